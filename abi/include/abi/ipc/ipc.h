@@ -35,6 +35,8 @@
 #ifndef ABI_IPC_IPC_H_
 #define ABI_IPC_IPC_H_
 
+#include <_bits/native.h>
+
 /** Length of data being transfered with IPC call
  *
  * The uspace may not be able to utilize the full length
@@ -45,6 +47,9 @@
 /** Maximum active async calls per phone */
 #define IPC_MAX_ASYNC_CALLS  64
 
+/** Maximum number of calls handled by one batched IPC syscall */
+#define IPC_BATCH_MAX  16
+
 /* Flags for calls */
 
 /** This is answer to a call */
@@ -104,6 +109,16 @@
 /** Restrict the transfer size if necessary. */
 #define IPC_XF_RESTRICT  (1 << 0)
 
+/** Request submitted by SYS_IPC_CALL_ASYNC_BATCH */
+typedef struct {
+	/** Phone capability handle */
+	sysarg_t phone;
+	/** User-defined label */
+	sysarg_t label;
+	/** Interface, method and payload arguments */
+	sysarg_t args[IPC_CALL_LEN];
+} ipc_batch_call_t;
+
 /** User-defined IPC methods */
 #define IPC_FIRST_USER_METHOD  1024
 
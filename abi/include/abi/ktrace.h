@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup generic
+ * @{
+ */
+/** @file
+ * Layout of the kernel trace ring buffers shared with user space.
+ */
+
+#ifndef ABI_KTRACE_H_
+#define ABI_KTRACE_H_
+
+#include <stdint.h>
+
+/** Number of pages of the records of each processor */
+#define KTRACE_RING_PAGES  16
+
+/** Kernel trace events
+ *
+ * The events come in pairs. The latency of an event pair is the time
+ * between the start event and the matching end event. The events of a
+ * pair are matched either by their argument or by the thread which
+ * recorded them (see KTRACE_EVENT_BY_THREAD()).
+ *
+ */
+typedef enum {
+	/** Thread made ready to run (arg: thread ID) */
+	KTRACE_SCHED_READY,
+	/** Thread starts running (arg: thread ID) */
+	KTRACE_SCHED_RUN,
+	/** IPC call sent (arg: call) */
+	KTRACE_IPC_CALL,
+	/** IPC call answered (arg: call) */
+	KTRACE_IPC_ANSWER,
+	/** Page fault entered (arg: faulting address) */
+	KTRACE_PF_ENTER,
+	/** Page fault handled (arg: result) */
+	KTRACE_PF_EXIT,
+	/** Thread going to sleep on a futex (arg: futex) */
+	KTRACE_FUTEX_SLEEP,
+	/** Thread woken up from a futex (arg: futex) */
+	KTRACE_FUTEX_WAKEUP,
+	KTRACE_EVENT_COUNT
+} ktrace_event_t;
+
+/** Check whether the events of a pair are matched by the thread */
+#define KTRACE_EVENT_BY_THREAD(event) \
+	(((event) == KTRACE_PF_ENTER) || ((event) == KTRACE_PF_EXIT) || \
+	    ((event) == KTRACE_FUTEX_SLEEP) || ((event) == KTRACE_FUTEX_WAKEUP))
+
+/** Single trace record
+ *
+ * The record is valid only if its sequence number is equal to the index
+ * of the record plus one, both before and after the record is read.
+ *
+ */
+typedef struct {
+	/** Index of the record plus one, zero while being written */
+	uint64_t seq;
+	/** Value of the cycle counter */
+	uint64_t timestamp;
+	/** Event argument */
+	uint64_t arg;
+	/** Event (ktrace_event_t) */
+	uint32_t event;
+	/** Lower bits of the ID of the thread recording the event */
+	uint32_t thread;
+} ktrace_record_t;
+
+/** Header of a trace ring
+ *
+ * The shared area starts with the headers of the rings of all processors,
+ * padded to whole pages, and continues with the records of the rings.
+ *
+ */
+typedef struct {
+	/** Number of records written so far */
+	uint64_t head;
+	/** Offset of the records from the start of the shared area */
+	uint64_t offset;
+	/** Number of record slots in the ring (a power of two) */
+	uint32_t capacity;
+	/** Processor the ring belongs to */
+	uint32_t cpu;
+	uint64_t reserved;
+} ktrace_ring_t;
+
+#endif
+
+/** @}
+ */
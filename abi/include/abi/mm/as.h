@@ -42,6 +42,7 @@
 #define AS_AREA_CACHEABLE    0x08
 #define AS_AREA_GUARD        0x10
 #define AS_AREA_LATE_RESERVE 0x20
+#define AS_AREA_LARGE_PAGES  0x40
 
 #define AS_AREA_ANY    ((void *) -1)
 #define AS_MAP_FAILED  ((void *) -1)
@@ -58,6 +59,9 @@ typedef struct {
 	
 	/** Area flags */
 	unsigned int flags;
+	
+	/** Size of the part mapped using large frames */
+	size_t large_size;
 } as_area_info_t;
 
 typedef struct {
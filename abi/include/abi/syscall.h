@@ -64,11 +64,13 @@ typedef enum {
 	
 	SYS_IPC_CALL_ASYNC_FAST,
 	SYS_IPC_CALL_ASYNC_SLOW,
+	SYS_IPC_CALL_ASYNC_BATCH,
 	SYS_IPC_ANSWER_FAST,
 	SYS_IPC_ANSWER_SLOW,
 	SYS_IPC_FORWARD_FAST,
 	SYS_IPC_FORWARD_SLOW,
 	SYS_IPC_WAIT,
+	SYS_IPC_WAIT_BATCH,
 	SYS_IPC_POKE,
 	SYS_IPC_HANGUP,
 	SYS_IPC_CONNECT_KBOX,
@@ -68,6 +68,10 @@ typedef struct {
 	uint16_t frequency_mhz;  /**< Frequency in MHz */
 	uint64_t idle_cycles;    /**< Number of idle cycles */
 	uint64_t busy_cycles;    /**< Number of busy cycles */
+	uint64_t steal_attempts;   /**< Idle work stealing attempts */
+	uint64_t steal_successes;  /**< Threads stolen while idle */
+	uint64_t tlb_ipis_sent;     /**< TLB shootdown IPIs sent */
+	uint64_t tlb_ipis_avoided;  /**< TLB shootdown IPIs not needed */
 } stats_cpu_t;
 
 /** Physical memory statistics
@@ -102,9 +106,12 @@ typedef struct {
 	char name[TASK_NAME_BUFLEN];  /**< Task name (in kernel) */
 	size_t virtmem;               /**< Size of VAS (bytes) */
 	size_t resmem;                /**< Size of resident (used) memory (bytes) */
+	size_t largemem;              /**< Memory mapped using large frames (bytes) */
 	size_t threads;               /**< Number of threads */
 	uint64_t ucycles;             /**< Number of CPU cycles in user space */
 	uint64_t kcycles;             /**< Number of CPU cycles in kernel */
+	uint64_t page_faults;         /**< Number of page faults */
+	uint64_t fault_around;        /**< Pages mapped by fault-around */
 	stats_ipc_t ipc_info;         /**< IPC statistics */
 } stats_task_t;
 
@@ -133,6 +140,16 @@ typedef struct {
 	uint64_t count;              /**< Number of handled exceptions */
 } stats_exc_t;
 
+/** Contention statistics of a single futex
+ *
+ */
+typedef struct {
+	task_id_t task_id;  /**< Task which created the futex */
+	uint64_t uaddr;     /**< Address of the futex in that task */
+	uint64_t sleeps;    /**< Number of sleeps on the futex */
+	uint64_t wakeups;   /**< Number of wakeups on the futex */
+} stats_futex_t;
+
 /** Load fixed-point value */
 typedef uint32_t load_t;
 
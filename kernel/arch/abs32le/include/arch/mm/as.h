@@ -36,6 +36,7 @@
 #define KERN_abs32le_AS_H_
 
 #define KERNEL_ADDRESS_SPACE_SHADOWED_ARCH  0
+#define AS_SWITCH_FLUSHES_TLB_ARCH          0
 
 #define KERNEL_ADDRESS_SPACE_START_ARCH  UINT32_C(0x80000000)
 #define KERNEL_ADDRESS_SPACE_END_ARCH    UINT32_C(0xffffffff)
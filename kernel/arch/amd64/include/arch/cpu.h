@@ -92,6 +92,8 @@ typedef struct {
 	unsigned int id; /** CPU's local, ie physical, APIC ID. */
 	
 	size_t iomapver_copy;  /** Copy of TASK's I/O Permission bitmap generation count. */
+	
+	uint32_t timer_quantum;  /** Local APIC timer count of one clock tick. */
 } cpu_arch_t;
 
 struct star_msr {
@@ -81,6 +81,8 @@ typedef struct {
 	tss_t *tss;
 	
 	size_t iomapver_copy;  /** Copy of TASK's I/O Permission bitmap generation count. */
+	
+	uint32_t timer_quantum;  /** Local APIC timer count of one clock tick. */
 } cpu_arch_t;
 
 #endif
@@ -46,6 +46,8 @@
 #include <arch/asm.h>
 #include <arch.h>
 #include <ddi/irq.h>
+#include <time/clock.h>
+#include <macros.h>
 
 #ifdef CONFIG_SMP
 
@@ -155,6 +157,55 @@ static void l_apic_timer_irq_handler(irq_t *irq)
 	irq_spinlock_lock(&irq->lock, false);
 }
 
+/** Switch the local timer to a one-shot interrupt for tickless idle.
+ *
+ * @param ticks Number of clock ticks to skip.
+ *
+ * @return Number of clock ticks actually programmed.
+ *
+ */
+static size_t l_apic_timer_oneshot(size_t ticks)
+{
+	uint32_t quantum = CPU->arch.timer_quantum;
+	if (quantum == 0)
+		return 0;
+	
+	ticks = min(ticks, UINT32_MAX / quantum);
+	
+	lvt_tm_t tm;
+	tm.value = l_apic[LVT_Tm];
+	tm.mode = TIMER_ONESHOT;
+	l_apic[LVT_Tm] = tm.value;
+	
+	l_apic[ICRT] = ticks * quantum;
+	return ticks;
+}
+
+/** Switch the local timer back to periodic clock ticks.
+ *
+ * @return Number of whole clock ticks elapsed in the one-shot mode.
+ *
+ */
+static size_t l_apic_timer_periodic(void)
+{
+	uint32_t quantum = CPU->arch.timer_quantum;
+	uint32_t remaining = l_apic[CCRT];
+	uint32_t elapsed = l_apic[ICRT] - remaining;
+	
+	lvt_tm_t tm;
+	tm.value = l_apic[LVT_Tm];
+	tm.mode = TIMER_PERIODIC;
+	l_apic[LVT_Tm] = tm.value;
+	
+	l_apic[ICRT] = quantum;
+	return elapsed / quantum;
+}
+
+static clock_tickless_ops_t l_apic_tickless_ops = {
+	.oneshot = l_apic_timer_oneshot,
+	.periodic = l_apic_timer_periodic
+};
+
 /** Get Local APIC ID.
  *
  * @return Local APIC ID.
@@ -193,6 +244,8 @@ void apic_init(void)
 	l_apic_timer_irq.handler = l_apic_timer_irq_handler;
 	irq_register(&l_apic_timer_irq);
 	
+	clock_tickless_ops = &l_apic_tickless_ops;
+	
 	uint8_t i;
 	for (i = 0; i < IRQ_COUNT; i++) {
 		int pin;
@@ -487,7 +540,8 @@ void l_apic_init(void)
 	delay(1000000 / HZ);
 	uint32_t t2 = l_apic[CCRT];
 	
-	l_apic[ICRT] = t1 - t2;
+	CPU->arch.timer_quantum = t1 - t2;
+	l_apic[ICRT] = CPU->arch.timer_quantum;
 	
 	/* Program Logical Destination Register. */
 	assert(CPU->id < 8);
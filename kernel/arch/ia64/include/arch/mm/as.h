@@ -36,6 +36,7 @@
 #define KERN_ia64_AS_H_
 
 #define KERNEL_ADDRESS_SPACE_SHADOWED_ARCH  0
+#define AS_SWITCH_FLUSHES_TLB_ARCH          0
 
 #define KERNEL_ADDRESS_SPACE_START_ARCH  UINT64_C(0xe000000000000000)
 #define KERNEL_ADDRESS_SPACE_END_ARCH    UINT64_C(0xffffffffffffffff)
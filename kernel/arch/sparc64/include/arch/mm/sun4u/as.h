@@ -38,6 +38,7 @@
 #include <arch/mm/tte.h>
 
 #define KERNEL_ADDRESS_SPACE_SHADOWED_ARCH  1
+#define AS_SWITCH_FLUSHES_TLB_ARCH          0
 
 #define KERNEL_ADDRESS_SPACE_START_ARCH  UINT64_C(0x0000000000000000)
 #define KERNEL_ADDRESS_SPACE_END_ARCH    UINT64_C(0xffffffffffffffff)
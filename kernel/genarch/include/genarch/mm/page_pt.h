@@ -128,6 +128,17 @@
 #define SET_PTL3_PRESENT(ptl2, i)   SET_PTL3_PRESENT_ARCH(ptl2, i)
 #define SET_FRAME_PRESENT(ptl3, i)  SET_FRAME_PRESENT_ARCH(ptl3, i)
 
+/*
+ * These macros are provided by architectures which can map the whole range
+ * of a PTL3 table by a single PTL2 entry pointing to a large frame.
+ *
+ */
+#ifdef PTL3_LARGE_ARCH
+#define PTL3_LARGE
+#define GET_PTL3_LARGE(ptl2, i)     GET_PTL3_LARGE_ARCH(ptl2, i)
+#define SET_PTL3_LARGE(ptl2, i, x)  SET_PTL3_LARGE_ARCH(ptl2, i, x)
+#endif
+
 /*
  * Macros for querying the last-level PTEs.
  *
@@ -96,7 +96,7 @@ void ht_destroy(pte_t *page_table)
 
 /** Lock page table.
  *
- * Lock address space.
+ * Lock the page table and optionally also the address space.
  * Interrupts must be disabled.
  *
  * @param as   Address space.
@@ -107,11 +107,13 @@ void ht_lock(as_t *as, bool lock)
 {
 	if (lock)
 		mutex_lock(&as->lock);
+	
+	mutex_lock(&as->page_table_mutex);
 }
 
 /** Unlock page table.
  *
- * Unlock address space.
+ * Unlock the page table and optionally also the address space.
  * Interrupts must be disabled.
  *
  * @param as     Address space.
@@ -120,6 +122,8 @@ void ht_lock(as_t *as, bool lock)
  */
 void ht_unlock(as_t *as, bool unlock)
 {
+	mutex_unlock(&as->page_table_mutex);
+	
 	if (unlock)
 		mutex_unlock(&as->lock);
 }
@@ -133,7 +137,7 @@ void ht_unlock(as_t *as, bool unlock)
  */
 bool ht_locked(as_t *as)
 {
-	return mutex_locked(&as->lock);
+	return mutex_locked(&as->page_table_mutex);
 }
 
 /** @}
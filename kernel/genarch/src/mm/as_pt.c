@@ -116,7 +116,7 @@ void ptl0_destroy(pte_t *page_table)
 
 /** Lock page tables.
  *
- * Lock only the address space.
+ * Lock the page tables and optionally also the address space.
  * Interrupts must be disabled.
  *
  * @param as   Address space.
@@ -127,11 +127,13 @@ void pt_lock(as_t *as, bool lock)
 {
 	if (lock)
 		mutex_lock(&as->lock);
+	
+	mutex_lock(&as->page_table_mutex);
 }
 
 /** Unlock page tables.
  *
- * Unlock the address space.
+ * Unlock the page tables and optionally also the address space.
  * Interrupts must be disabled.
  *
  * @param as     Address space.
@@ -140,6 +142,8 @@ void pt_lock(as_t *as, bool lock)
  */
 void pt_unlock(as_t *as, bool unlock)
 {
+	mutex_unlock(&as->page_table_mutex);
+	
 	if (unlock)
 		mutex_unlock(&as->lock);
 }
@@ -153,7 +157,7 @@ void pt_unlock(as_t *as, bool unlock)
  */
 bool pt_locked(as_t *as)
 {
-	return mutex_locked(&as->lock);
+	return mutex_locked(&as->page_table_mutex);
 }
 
 /** @}
@@ -57,31 +57,39 @@ static bool pt_mapping_find(as_t *, uintptr_t, bool, pte_t *pte);
 static void pt_mapping_update(as_t *, uintptr_t, bool, pte_t *pte);
 static void pt_mapping_make_global(uintptr_t, size_t);
 
+#ifdef PTL3_LARGE
+static bool pt_mapping_insert_large(as_t *, uintptr_t, uintptr_t,
+    unsigned int);
+static bool pt_mapping_remove_large(as_t *, uintptr_t);
+static bool pt_mapping_split_large(as_t *, uintptr_t);
+#endif
+
 page_mapping_operations_t pt_mapping_operations = {
 	.mapping_insert = pt_mapping_insert,
 	.mapping_remove = pt_mapping_remove,
 	.mapping_find = pt_mapping_find,
 	.mapping_update = pt_mapping_update,
-	.mapping_make_global = pt_mapping_make_global
+	.mapping_make_global = pt_mapping_make_global,
+#ifdef PTL3_LARGE
+	.mapping_insert_large = pt_mapping_insert_large,
+	.mapping_remove_large = pt_mapping_remove_large,
+	.mapping_split_large = pt_mapping_split_large
+#endif
 };
 
-/** Map page to frame using hierarchical page tables.
+/** Get the PTL2 table covering a page.
  *
- * Map virtual address page to physical address frame
- * using flags.
+ * The PTL1 and PTL2 tables are created if they do not exist yet.
  *
- * @param as    Address space to wich page belongs.
- * @param page  Virtual address of the page to be mapped.
- * @param frame Physical address of memory frame to which the mapping is done.
- * @param flags Flags to be used for mapping.
+ * @param as   Address space to which page belongs.
+ * @param page Virtual address of the page.
+ *
+ * @return Kernel address of the PTL2 table.
  *
  */
-void pt_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
-    unsigned int flags)
+static pte_t *pt_ptl2_get(as_t *as, uintptr_t page)
 {
 	pte_t *ptl0 = (pte_t *) PA2KA((uintptr_t) as->genarch.page_table);
-
-	assert(page_table_locked(as));
 	
 	if (GET_PTL1_FLAGS(ptl0, PTL0_INDEX(page)) & PAGE_NOT_PRESENT) {
 		pte_t *newpt = (pte_t *)
@@ -117,7 +125,30 @@ void pt_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
 		SET_PTL2_PRESENT(ptl1, PTL1_INDEX(page));
 	}
 	
-	pte_t *ptl2 = (pte_t *) PA2KA(GET_PTL2_ADDRESS(ptl1, PTL1_INDEX(page)));
+	return (pte_t *) PA2KA(GET_PTL2_ADDRESS(ptl1, PTL1_INDEX(page)));
+}
+
+/** Map page to frame using hierarchical page tables.
+ *
+ * Map virtual address page to physical address frame
+ * using flags.
+ *
+ * @param as    Address space to wich page belongs.
+ * @param page  Virtual address of the page to be mapped.
+ * @param frame Physical address of memory frame to which the mapping is done.
+ * @param flags Flags to be used for mapping.
+ *
+ */
+void pt_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
+    unsigned int flags)
+{
+	assert(page_table_locked(as));
+	
+	pte_t *ptl2 = pt_ptl2_get(as, page);
+	
+#ifdef PTL3_LARGE
+	assert(!GET_PTL3_LARGE(ptl2, PTL2_INDEX(page)));
+#endif
 	
 	if (GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT) {
 		pte_t *newpt = (pte_t *)
@@ -151,7 +182,8 @@ void pt_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
  * TLB shootdown should follow in order to make effects of
  * this call visible.
  *
- * Empty page tables except PTL0 are freed.
+ * Empty page tables except PTL0 are freed. If the page is mapped by a large
+ * mapping, the large mapping is split first, which may block.
  *
  * @param as   Address space to wich page belongs.
  * @param page Virtual address of the page to be demapped.
@@ -177,6 +209,14 @@ void pt_mapping_remove(as_t *as, uintptr_t page)
 	if (GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT)
 		return;
 	
+#ifdef PTL3_LARGE
+	/*
+	 * Removing a single page of a large mapping requires the rest of the
+	 * mapping to be entered into a PTL3 table first.
+	 */
+	(void) pt_mapping_split_large(as, page);
+#endif
+	
 	pte_t *ptl3 = (pte_t *) PA2KA(GET_PTL3_ADDRESS(ptl2, PTL2_INDEX(page)));
 	
 	/*
@@ -291,8 +331,22 @@ void pt_mapping_remove(as_t *as, uintptr_t page)
 #endif /* PTL1_ENTRIES != 0 */
 }
 
-static pte_t *pt_mapping_find_internal(as_t *as, uintptr_t page, bool nolock)
+/** Find the PTE of a virtual page.
+ *
+ * @param as         Address space to which page belongs.
+ * @param page       Virtual page.
+ * @param nolock     True if the page tables need not be locked.
+ * @param[out] large Set to true if the returned entry is a PTL2 entry
+ *                   mapping a large frame which contains the page.
+ *
+ * @return Pointer to the PTE or NULL if there is no mapping.
+ *
+ */
+static pte_t *pt_mapping_find_internal(as_t *as, uintptr_t page, bool nolock,
+    bool *large)
 {
+	*large = false;
+	
 	assert(nolock || page_table_locked(as));
 
 	pte_t *ptl0 = (pte_t *) PA2KA((uintptr_t) as->genarch.page_table);
@@ -316,6 +370,13 @@ static pte_t *pt_mapping_find_internal(as_t *as, uintptr_t page, bool nolock)
 	if (GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT)
 		return NULL;
 
+#ifdef PTL3_LARGE
+	if (GET_PTL3_LARGE(ptl2, PTL2_INDEX(page))) {
+		*large = true;
+		return &ptl2[PTL2_INDEX(page)];
+	}
+#endif
+
 #if (PTL2_ENTRIES != 0)
 	/*
 	 * Always read ptl3 only after we are sure it is present.
@@ -339,10 +400,26 @@ static pte_t *pt_mapping_find_internal(as_t *as, uintptr_t page, bool nolock)
  */
 bool pt_mapping_find(as_t *as, uintptr_t page, bool nolock, pte_t *pte)
 {
-	pte_t *t = pt_mapping_find_internal(as, page, nolock);
-	if (t)
-		*pte = *t;
-	return t != NULL;
+	bool large;
+	pte_t *t = pt_mapping_find_internal(as, page, nolock, &large);
+	if (!t)
+		return false;
+	
+	*pte = *t;
+	
+#ifdef PTL3_LARGE
+	if (large) {
+		/*
+		 * Make up the PTE which would map the page if the large
+		 * mapping was split.
+		 */
+		SET_PTL3_LARGE(pte, 0, false);
+		SET_FRAME_ADDRESS(pte, 0,
+		    PTE_GET_FRAME(t) + P2SZ(PTL3_INDEX(page)));
+	}
+#endif
+	
+	return true;
 }
 
 /** Update mapping for virtual page in hierarchical page tables.
@@ -354,19 +431,199 @@ bool pt_mapping_find(as_t *as, uintptr_t page, bool nolock, pte_t *pte)
  */
 void pt_mapping_update(as_t *as, uintptr_t page, bool nolock, pte_t *pte)
 {
-	pte_t *t = pt_mapping_find_internal(as, page, nolock);
+	bool large;
+	pte_t *t = pt_mapping_find_internal(as, page, nolock, &large);
 	if (!t)
 		panic("Updating non-existent PTE");	
 
 	assert(PTE_VALID(t) == PTE_VALID(pte));
 	assert(PTE_PRESENT(t) == PTE_PRESENT(pte));
-	assert(PTE_GET_FRAME(t) == PTE_GET_FRAME(pte));
 	assert(PTE_WRITABLE(t) == PTE_WRITABLE(pte));
 	assert(PTE_EXECUTABLE(t) == PTE_EXECUTABLE(pte));
 
+#ifdef PTL3_LARGE
+	if (large) {
+		assert(PTE_GET_FRAME(t) + P2SZ(PTL3_INDEX(page)) ==
+		    PTE_GET_FRAME(pte));
+		
+		/* Update the large mapping as a whole. */
+		pte_t entry = *pte;
+		SET_FRAME_ADDRESS(&entry, 0, PTE_GET_FRAME(t));
+		SET_PTL3_LARGE(&entry, 0, true);
+		*t = entry;
+		return;
+	}
+#endif
+
+	assert(PTE_GET_FRAME(t) == PTE_GET_FRAME(pte));
+
 	*t = *pte;
 }
 
+#ifdef PTL3_LARGE
+
+/** Check whether a page table contains no valid entries.
+ *
+ * @param pt      Page table.
+ * @param entries Number of entries in the page table.
+ *
+ * @return True if the page table is empty.
+ *
+ */
+static bool pt_empty(pte_t *pt, size_t entries)
+{
+	for (size_t i = 0; i < entries; i++) {
+		if (PTE_VALID(&pt[i]))
+			return false;
+	}
+	
+	return true;
+}
+
+/** Map a large page to a large frame using hierarchical page tables.
+ *
+ * The whole range covered by a single PTL3 table is mapped by one PTL2
+ * entry. Both page and frame must be aligned to the size of that range.
+ *
+ * @param as    Address space to which page belongs.
+ * @param page  Virtual address of the large page.
+ * @param frame Physical address of the large frame.
+ * @param flags Flags to be used for mapping.
+ *
+ * @return True if the large mapping was entered. False if some of the pages
+ *         are already mapped.
+ *
+ */
+bool pt_mapping_insert_large(as_t *as, uintptr_t page, uintptr_t frame,
+    unsigned int flags)
+{
+	static_assert(P2SZ(PTL3_ENTRIES) == AS_LARGE_SIZE, "");
+	
+	assert(page_table_locked(as));
+	assert(IS_ALIGNED(page, P2SZ(PTL3_ENTRIES)));
+	assert(IS_ALIGNED(frame, P2SZ(PTL3_ENTRIES)));
+	
+	pte_t *ptl2 = pt_ptl2_get(as, page);
+	size_t i = PTL2_INDEX(page);
+	
+	/*
+	 * Empty PTL3 tables are freed by pt_mapping_remove(), so an existing
+	 * one contains some mapped pages.
+	 */
+	if (!(GET_PTL3_FLAGS(ptl2, i) & PAGE_NOT_PRESENT))
+		return false;
+	
+	SET_PTL3_ADDRESS(ptl2, i, frame);
+	SET_PTL3_FLAGS(ptl2, i, flags | PAGE_NOT_PRESENT);
+	SET_PTL3_LARGE(ptl2, i, true);
+	/*
+	 * Make the new mapping visible only after it is fully initialized.
+	 */
+	write_barrier();
+	SET_PTL3_PRESENT(ptl2, i);
+	
+	return true;
+}
+
+/** Remove a large mapping from hierarchical page tables.
+ *
+ * The whole large mapping containing the page is removed. Empty PTL2 and
+ * PTL1 tables are freed. TLB shootdown should follow in order to make
+ * effects of this call visible.
+ *
+ * @param as   Address space to which page belongs.
+ * @param page Virtual address of a page within the large mapping.
+ *
+ * @return True if the page was mapped by a large mapping, which was
+ *         removed. False if the page is not mapped by a large mapping and
+ *         nothing was done.
+ *
+ */
+bool pt_mapping_remove_large(as_t *as, uintptr_t page)
+{
+	assert(page_table_locked(as));
+	
+	pte_t *ptl0 = (pte_t *) PA2KA((uintptr_t) as->genarch.page_table);
+	if (GET_PTL1_FLAGS(ptl0, PTL0_INDEX(page)) & PAGE_NOT_PRESENT)
+		return false;
+	
+	pte_t *ptl1 = (pte_t *) PA2KA(GET_PTL1_ADDRESS(ptl0, PTL0_INDEX(page)));
+	if (GET_PTL2_FLAGS(ptl1, PTL1_INDEX(page)) & PAGE_NOT_PRESENT)
+		return false;
+	
+	pte_t *ptl2 = (pte_t *) PA2KA(GET_PTL2_ADDRESS(ptl1, PTL1_INDEX(page)));
+	if ((GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT) ||
+	    (!GET_PTL3_LARGE(ptl2, PTL2_INDEX(page))))
+		return false;
+	
+	/* There is no PTL3 table to free, just drop the entry. */
+	memsetb(&ptl2[PTL2_INDEX(page)], sizeof(pte_t), 0);
+	
+	if (!pt_empty(ptl2, PTL2_ENTRIES))
+		return true;
+	
+	memsetb(&ptl1[PTL1_INDEX(page)], sizeof(pte_t), 0);
+	frame_free(KA2PA((uintptr_t) ptl2), PTL2_FRAMES);
+	
+	if ((km_is_non_identity(page)) || (!pt_empty(ptl1, PTL1_ENTRIES)))
+		return true;
+	
+	memsetb(&ptl0[PTL0_INDEX(page)], sizeof(pte_t), 0);
+	frame_free(KA2PA((uintptr_t) ptl1), PTL1_FRAMES);
+	
+	return true;
+}
+
+/** Replace a large mapping by a PTL3 table.
+ *
+ * The PTL3 table maps the pages of the large mapping to the same frames,
+ * using the same flags, so the translation of none of the pages changes
+ * and no TLB shootdown is needed. This function may block when allocating
+ * the PTL3 table.
+ *
+ * @param as   Address space to which page belongs.
+ * @param page Virtual address of a page within the large mapping.
+ *
+ * @return True if the page was mapped by a large mapping, which was split.
+ *         False if the page is not mapped by a large mapping.
+ *
+ */
+bool pt_mapping_split_large(as_t *as, uintptr_t page)
+{
+	bool large;
+	pte_t *t = pt_mapping_find_internal(as, page, false, &large);
+	if ((t == NULL) || (!large))
+		return false;
+	
+	pte_t *newpt = (pte_t *)
+	    PA2KA(frame_alloc(PTL3_FRAMES, FRAME_LOWMEM, PTL3_SIZE - 1));
+	uintptr_t frame = PTE_GET_FRAME(t);
+	
+	for (size_t i = 0; i < PTL3_ENTRIES; i++) {
+		newpt[i] = *t;
+		SET_PTL3_LARGE(newpt, i, false);
+		SET_FRAME_ADDRESS(newpt, i, frame + P2SZ(i));
+	}
+	
+	pte_t entry;
+	memsetb(&entry, sizeof(pte_t), 0);
+	SET_PTL3_ADDRESS(&entry, 0, KA2PA(newpt));
+	SET_PTL3_FLAGS(&entry, 0, PAGE_USER | PAGE_EXEC | PAGE_CACHEABLE |
+	    PAGE_WRITE);
+	
+	/*
+	 * Replace the large mapping in a single store, so that a concurrent
+	 * hardware page table walk sees either the large mapping or the fully
+	 * initialized PTL3 table.
+	 */
+	write_barrier();
+	*t = entry;
+	
+	return true;
+}
+
+#endif /* PTL3_LARGE */
+
 /** Return the size of the region mapped by a single PTL0 entry.
  *
  * @return Size of the region mapped by a single PTL0 entry.
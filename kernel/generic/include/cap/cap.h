@@ -38,12 +38,22 @@
 #include <abi/cap.h>
 #include <typedefs.h>
 #include <adt/list.h>
-#include <adt/hash.h>
-#include <adt/hash_table.h>
-#include <lib/ra.h>
 #include <synch/mutex.h>
+#include <synch/rcu_types.h>
 #include <atomic.h>
 
+/** Number of bits of a capability handle resolved by a table leaf. */
+#define CAPS_LEAF_BITS  9
+#define CAPS_LEAF_SIZE  (1 << CAPS_LEAF_BITS)
+#define CAPS_LEAF_MASK  (CAPS_LEAF_SIZE - 1)
+
+/**
+ * Number of leaves in the capability table of a task. Together with
+ * CAPS_LEAF_SIZE, this limits a task to 262143 capabilities at a time,
+ * cap_alloc() fails with ELIMIT beyond that.
+ */
+#define CAPS_DIR_SIZE  512
+
 typedef enum {
 	CAP_STATE_FREE,
 	CAP_STATE_ALLOCATED,
@@ -71,11 +81,15 @@ typedef struct kobject_ops {
 
 /*
  * Everything in kobject_t except for the atomic reference count is imutable.
+ * The kobject_t wrapper is freed only after an RCU grace period, so that it
+ * can be looked up without holding the cap_info_t lock.
  */
 typedef struct kobject {
 	kobject_type_t type;
 	atomic_t refcnt;
 
+	rcu_item_t rcu;
+
 	kobject_ops_t *ops;
 
 	union {
@@ -87,7 +101,9 @@ typedef struct kobject {
 } kobject_t;
 
 /*
- * A cap_t may only be accessed under the protection of the cap_info_t lock.
+ * A cap_t may only be modified under the protection of the cap_info_t lock.
+ * The kobject pointer may also be read in an RCU reader section. A cap_t
+ * lives in the capability table until its task is destroyed.
  */
 typedef struct cap {
 	cap_state_t state;
@@ -95,12 +111,13 @@ typedef struct cap {
 	struct task *task;
 	cap_handle_t handle;
 
-	/* Link to the task's capabilities of the same kobject type. */
+	/*
+	 * Link to the task's capabilities of the same kobject type or to the
+	 * task's free capabilities.
+	 */
 	link_t type_link;
 
-	ht_link_t caps_link;
-
-	/* The underlying kernel object. */
+	/* The underlying kernel object, NULL unless published. */
 	kobject_t *kobject;
 } cap_t;
 
@@ -109,8 +126,17 @@ typedef struct cap_info {
 
 	list_t type_list[KOBJECT_TYPE_MAX];
 
-	hash_table_t caps;
-	ra_arena_t *handles;
+	/* Free capabilities, most recently freed first. */
+	list_t free_list;
+
+	/* Lowest handle which has not been used yet. */
+	cap_handle_t next_handle;
+
+	/*
+	 * Two-level capability table indexed by handle. Leaves are allocated
+	 * on demand and published with rcu_assign().
+	 */
+	cap_t **table[CAPS_DIR_SIZE];
 } cap_info_t;
 
 extern void caps_init(void);
@@ -46,6 +46,13 @@
 
 #define CPU                  THE->cpu
 
+/** Number of levels of the per-CPU timeout wheel. */
+#define TIMEOUT_WHEEL_LEVELS  4
+
+/** Number of bits of the tick count resolved by one wheel level. */
+#define TIMEOUT_WHEEL_BITS    6
+#define TIMEOUT_WHEEL_SLOTS   (1 << TIMEOUT_WHEEL_BITS)
+
 
 /** CPU structure.
  *
@@ -57,14 +64,26 @@ typedef struct cpu {
 	tlb_shootdown_msg_t tlb_messages[TLB_MESSAGE_QUEUE_LEN];
 	size_t tlb_messages_count;
 	
+	/**
+	 * Set while this processor is a recipient of the
+	 * TLB shootdown in progress. Protected by tlblock.
+	 */
+	bool tlb_target;
+	
 	context_t saved_context;
 	
 	atomic_t nrdy;
 	runq_t rq[RQ_COUNT];
+	volatile rq_bitmap_t rq_bitmap;
 	volatile size_t needs_relink;
 	
 	IRQ_SPINLOCK_DECLARE(timeoutlock);
-	list_t timeout_active_list;
+	
+	/** Next clock() tick to be processed by the timeout wheel. */
+	uint64_t timeout_tick;
+	
+	/** Hierarchical wheel of active timeouts, see time/timeout.c. */
+	list_t timeout_wheel[TIMEOUT_WHEEL_LEVELS][TIMEOUT_WHEEL_SLOTS];
 	
 	/**
 	 * When system clock loses a tick, it is
@@ -75,6 +94,13 @@ typedef struct cpu {
 	 */
 	size_t missed_clock_ticks;
 	
+	/**
+	 * Number of ticks the clock of the idle processor
+	 * has been programmed to skip, zero while it ticks
+	 * periodically. Only modified by the CPU itself.
+	 */
+	volatile size_t tickless_ticks;
+	
 	/**
 	 * Processor cycle accounting.
 	 */
@@ -83,6 +109,28 @@ typedef struct cpu {
 	uint64_t idle_cycles;
 	uint64_t busy_cycles;
 	
+	/**
+	 * Idle-time work stealing statistics.
+	 * Only modified by the CPU itself.
+	 */
+	uint64_t steal_attempts;
+	uint64_t steal_successes;
+	
+	/**
+	 * TLB shootdown statistics: IPIs sent to processors
+	 * which had the address space loaded and IPIs saved
+	 * by skipping those which did not. Only modified by
+	 * the CPU itself.
+	 */
+	uint64_t tlb_ipis_sent;
+	uint64_t tlb_ipis_avoided;
+	
+	/**
+	 * Zone preferred for slab frames allocated on this CPU.
+	 * Only accessed by the CPU itself.
+	 */
+	size_t frame_zone;
+	
 	/**
 	 * Processor ID assigned by kernel.
 	 */
@@ -172,6 +172,16 @@ typedef struct call {
 
 	/** Buffer for IPC_M_DATA_WRITE and IPC_M_DATA_READ. */
 	uint8_t *buffer;
+	
+	/**
+	 * Pinned destination frames for IPC_M_DATA_READ transfers which
+	 * bypass the buffer.
+	 */
+	uintptr_t *frames;
+	/** Number of pinned destination frames. */
+	size_t frames_count;
+	/** Offset of the data in the first pinned frame. */
+	size_t frames_offset;
 } call_t;
 
 extern slab_cache_t *phone_cache;
@@ -185,6 +195,10 @@ extern void ipc_call_free(call_t *);
 extern void ipc_call_hold(call_t *);
 extern void ipc_call_release(call_t *);
 
+extern errno_t ipc_call_frames_pin(call_t *, uintptr_t, size_t);
+extern void ipc_call_frames_unpin(call_t *);
+extern errno_t ipc_call_frames_copy_from_uspace(call_t *, uintptr_t, size_t);
+
 extern errno_t ipc_call_sync(phone_t *, call_t *);
 extern errno_t ipc_call(phone_t *, call_t *);
 extern call_t *ipc_wait_for_call(answerbox_t *, uint32_t, unsigned int);
@@ -44,10 +44,14 @@ extern errno_t ipc_req_internal(int, ipc_data_t *, sysarg_t);
 extern sys_errno_t sys_ipc_call_async_fast(sysarg_t, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t, sysarg_t);
 extern sys_errno_t sys_ipc_call_async_slow(sysarg_t, ipc_data_t *, sysarg_t);
+extern sys_errno_t sys_ipc_call_async_batch(ipc_batch_call_t *, sysarg_t,
+    size_t *);
 extern sys_errno_t sys_ipc_answer_fast(sysarg_t, sysarg_t, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t);
 extern sys_errno_t sys_ipc_answer_slow(sysarg_t, ipc_data_t *);
 extern sys_errno_t sys_ipc_wait_for_call(ipc_data_t *, uint32_t, unsigned int);
+extern sys_errno_t sys_ipc_wait_for_call_batch(ipc_data_t *, sysarg_t,
+    uint32_t, unsigned int, size_t *);
 extern sys_errno_t sys_ipc_poke(void);
 extern sys_errno_t sys_ipc_forward_fast(sysarg_t, sysarg_t, sysarg_t, sysarg_t,
     sysarg_t, unsigned int);
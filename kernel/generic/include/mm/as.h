@@ -43,6 +43,7 @@
 #include <arch/istate.h>
 #include <synch/spinlock.h>
 #include <synch/mutex.h>
+#include <synch/rcu_types.h>
 #include <adt/list.h>
 #include <adt/btree.h>
 #include <lib/elf.h>
@@ -58,6 +59,35 @@
  */
 #define KERNEL_ADDRESS_SPACE_SHADOWED  KERNEL_ADDRESS_SPACE_SHADOWED_ARCH
 
+/**
+ * Defined to be true if switching to another address space drops all TLB
+ * entries of the previous (user) address space.
+ *
+ */
+#define AS_SWITCH_FLUSHES_TLB  AS_SWITCH_FLUSHES_TLB_ARCH
+
+/** Number of processors tracked by one word of as_t::cpu_mask. */
+#define AS_CPU_MASK_BITS  (sizeof(unsigned long) * 8)
+
+/**
+ * Default size (in pages) of the aligned window of pages mapped together
+ * with the faulting page, provided they can be mapped cheaply.
+ *
+ */
+#define AS_FAULT_AROUND  8
+
+/** Maximal size (in pages) of the fault-around window. */
+#define AS_FAULT_AROUND_MAX  64
+
+/**
+ * Width of the naturally aligned, physically contiguous chunks of frames
+ * backing the areas created with AS_AREA_LARGE_PAGES.
+ *
+ */
+#define AS_LARGE_WIDTH   (PAGE_WIDTH + 9)
+#define AS_LARGE_SIZE    ((size_t) 1 << AS_LARGE_WIDTH)
+#define AS_LARGE_FRAMES  (AS_LARGE_SIZE >> PAGE_WIDTH)
+
 #define KERNEL_ADDRESS_SPACE_START  KERNEL_ADDRESS_SPACE_START_ARCH
 #define KERNEL_ADDRESS_SPACE_END    KERNEL_ADDRESS_SPACE_END_ARCH
 #define USER_ADDRESS_SPACE_START    USER_ADDRESS_SPACE_START_ARCH
@@ -82,6 +112,11 @@
 /** The page fault was not resolved by as_page_fault(). Non-verbose version. */
 #define AS_PF_SILENT 3
 
+/** Number of levels of the skip list of address space areas. */
+#define AS_AREA_INDEX_LEVELS  8
+
+struct as_area;
+
 /** Address space structure.
  *
  * as_t contains the list of as_areas of userspace accessible
@@ -109,14 +144,36 @@ typedef struct as {
 	 */
 	asid_t asid;
 	
+	/**
+	 * Bitmap of processors which may hold TLB entries of this
+	 * address space, AS_CPU_MASK_BITS processors per word. Bits
+	 * are set in as_switch() with atomic operations. NULL for
+	 * the kernel address space, which is on all processors.
+	 *
+	 */
+	unsigned long *cpu_mask;
+	
 	/** Number of references (i.e. tasks that reference this as). */
 	atomic_t refcount;
 	
 	mutex_t lock;
 	
+	/**
+	 * Protects the page tables. Must be acquired after the address
+	 * space lock and the address space area locks.
+	 */
+	mutex_t page_table_mutex;
+	
 	/** B+tree of address space areas. */
 	btree_t as_area_btree;
 	
+	/**
+	 * Heads of the skip list of address space areas sorted by their
+	 * base addresses. It can be searched in RCU reader sections and
+	 * it is updated with the address space lock held.
+	 */
+	struct as_area *area_index[AS_AREA_INDEX_LEVELS];
+	
 	/** Non-generic content. */
 	as_genarch_t genarch;
 	
@@ -197,9 +254,25 @@ typedef union mem_backend_data {
  * Each as_area_t structure describes one contiguous area of virtual memory.
  *
  */
-typedef struct {
+typedef struct as_area {
 	mutex_t lock;
 	
+	/**
+	 * Number of references. The address space holds one as long as
+	 * the area exists. Page faults and the area caches of threads
+	 * hold the others.
+	 */
+	atomic_t refcount;
+	
+	/** Link for deferred freeing. */
+	rcu_item_t rcu;
+	
+	/** Links of the area index of the address space, one per level. */
+	struct as_area *index_next[AS_AREA_INDEX_LEVELS];
+	
+	/** Number of levels of the area index the area is linked in. */
+	unsigned int index_levels;
+	
 	/** Containing address space. */
 	as_t *as;
 	
@@ -215,6 +288,9 @@ typedef struct {
 	/** Number of resident pages in the area. */
 	size_t resident;
 	
+	/** Number of pages mapped by large mappings. */
+	size_t large_pages;
+	
 	/** Base address of this area. */
 	uintptr_t base;
 	
@@ -245,6 +321,7 @@ typedef struct mem_backend {
 	bool (* is_shareable)(as_area_t *);
 
 	int (* page_fault)(as_area_t *, uintptr_t, pf_access_t);
+	bool (* is_fault_cheap)(as_area_t *, uintptr_t);
 	void (* frame_free)(as_area_t *, uintptr_t, uintptr_t);
 
 	bool (* create_shared_data)(as_area_t *);
@@ -255,6 +332,7 @@ extern as_t *AS_KERNEL;
 
 extern as_operations_t *as_operations;
 extern list_t inactive_as_with_asid_list;
+extern size_t as_fault_around;
 
 extern void as_init(void);
 
@@ -263,6 +341,7 @@ extern void as_destroy(as_t *);
 extern void as_hold(as_t *);
 extern void as_release(as_t *);
 extern void as_switch(as_t *, as_t *);
+extern bool as_cpu_mask_test(as_t *, unsigned int);
 extern int as_page_fault(uintptr_t, pf_access_t, istate_t *);
 
 extern as_area_t *as_area_create(as_t *, unsigned int, size_t, unsigned int,
@@ -272,12 +351,14 @@ extern errno_t as_area_resize(as_t *, uintptr_t, size_t, unsigned int);
 extern errno_t as_area_share(as_t *, uintptr_t, size_t, as_t *, unsigned int,
     uintptr_t *, uintptr_t);
 extern errno_t as_area_change_flags(as_t *, unsigned int, uintptr_t);
+extern void as_area_release(as_area_t *);
 
 extern unsigned int as_area_get_flags(as_area_t *);
 extern bool as_area_check_access(as_area_t *, pf_access_t);
 extern size_t as_area_get_size(uintptr_t);
 extern bool used_space_insert(as_area_t *, uintptr_t, size_t);
 extern bool used_space_remove(as_area_t *, uintptr_t, size_t);
+extern bool as_area_large_chunk(as_area_t *, uintptr_t, uintptr_t *);
 
 /* Interface to be implemented by architectures. */
 
@@ -47,6 +47,15 @@
 /** Maximum number of zones in the system. */
 #define ZONES_MAX  32
 
+/** Number of buddy orders (largest free block has 2^(orders - 1) frames). */
+#define FRAME_BUDDY_ORDERS  11
+
+/** Value of frame_t.buddy_order for frames not heading a free block. */
+#define FRAME_BUDDY_NONE  0xff
+
+/** Terminator of the buddy free lists. */
+#define FRAME_BUDDY_NIL  UINT32_MAX
+
 typedef uint8_t frame_flags_t;
 
 #define FRAME_NONE        0x00
@@ -91,6 +100,15 @@ typedef uint8_t zone_flags_t;
 typedef struct {
 	size_t refcount;  /**< Tracking of shared frames */
 	void *parent;     /**< If allocated by slab, this points there */
+	
+	/** Order of the free buddy block headed by this frame */
+	uint8_t buddy_order;
+	
+	/** Zone-relative index of the previous free block of the same order */
+	uint32_t buddy_prev;
+	
+	/** Zone-relative index of the next free block of the same order */
+	uint32_t buddy_next;
 } frame_t;
 
 typedef struct {
@@ -112,6 +130,16 @@ typedef struct {
 	/** Frame bitmap */
 	bitmap_t bitmap;
 	
+	/**
+	 * Heads of the buddy free lists (zone-relative frame indices).
+	 * Only frames above FRAME_LOWPRIO are kept in the free lists,
+	 * the rest is allocated from the bitmap.
+	 */
+	uint32_t buddy_head[FRAME_BUDDY_ORDERS];
+	
+	/** Number of free buddy blocks of each order */
+	size_t buddy_blocks[FRAME_BUDDY_ORDERS];
+	
 	/** Array of frame_t structures in this zone */
 	frame_t *frames;
 } zone_t;
@@ -129,6 +157,7 @@ typedef struct {
 extern zones_t zones;
 
 extern void frame_init(void);
+extern void frame_enable_cpucache(void);
 extern bool frame_adjust_zone_bounds(bool, uintptr_t *, size_t *);
 extern uintptr_t frame_alloc_generic(size_t, frame_flags_t, uintptr_t,
     size_t *);
@@ -138,6 +167,7 @@ extern void frame_free(uintptr_t, size_t);
 extern void frame_free_noreserve(uintptr_t, size_t);
 extern void frame_reference_add(pfn_t);
 extern size_t frame_total_free_get(void);
+extern bool frame_low_memory(void);
 
 extern size_t find_zone(pfn_t, size_t, size_t);
 extern size_t zone_create(pfn_t, size_t, pfn_t, zone_flags_t);
@@ -149,7 +179,8 @@ extern pfn_t zone_external_conf_alloc(size_t);
 extern bool zone_merge(size_t, size_t);
 extern void zone_merge_all(void);
 extern uint64_t zones_total_size(void);
-extern void zones_stats(uint64_t *, uint64_t *, uint64_t *, uint64_t *);
+extern void zones_stats(uint64_t *, uint64_t *, uint64_t *, uint64_t *,
+    uint64_t *);
 
 /*
  * Console functions
@@ -50,6 +50,14 @@ typedef struct {
 	bool (* mapping_find)(as_t *, uintptr_t, bool, pte_t *);
 	void (* mapping_update)(as_t *, uintptr_t, bool, pte_t *);
 	void (* mapping_make_global)(uintptr_t, size_t);
+	
+	/*
+	 * Large mappings of AS_LARGE_SIZE bytes (optional, NULL if the page
+	 * tables cannot hold them).
+	 */
+	bool (* mapping_insert_large)(as_t *, uintptr_t, uintptr_t, unsigned int);
+	bool (* mapping_remove_large)(as_t *, uintptr_t);
+	bool (* mapping_split_large)(as_t *, uintptr_t);
 } page_mapping_operations_t;
 
 extern page_mapping_operations_t *page_mapping_operations;
@@ -63,6 +71,12 @@ extern void page_mapping_remove(as_t *, uintptr_t);
 extern bool page_mapping_find(as_t *, uintptr_t, bool, pte_t *);
 extern void page_mapping_update(as_t *, uintptr_t, bool, pte_t *);
 extern void page_mapping_make_global(uintptr_t, size_t);
+extern bool page_mapping_large_supported(void);
+extern bool page_mapping_insert_large(as_t *, uintptr_t, uintptr_t,
+    unsigned int);
+extern bool page_mapping_remove_large(as_t *, uintptr_t);
+extern bool page_mapping_split_large(as_t *, uintptr_t);
+extern errno_t page_mapping_pin(as_t *, uintptr_t, bool, uintptr_t *);
 extern pte_t *page_table_create(unsigned int);
 extern void page_table_destroy(pte_t *);
 
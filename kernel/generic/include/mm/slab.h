@@ -49,6 +49,9 @@
 /** Initial Magazine size (TODO: dynamically growing magazines) */
 #define SLAB_MAG_SIZE  4
 
+/** Number of full magazines the depot of a cache can hold */
+#define SLAB_DEPOT_SIZE  32
+
 /** If object size is less, store control structure inside SLAB */
 #define SLAB_INSIDE_SIZE  (PAGE_SIZE >> 3)
 
@@ -81,6 +84,10 @@ typedef struct {
 	slab_magazine_t *current;
 	slab_magazine_t *last;
 	IRQ_SPINLOCK_DECLARE(lock);
+	
+	/* Statistics */
+	uint64_t depot_hits;    /**< Full magazines taken from the depot */
+	uint64_t depot_misses;  /**< Depot found without full magazines */
 } slab_mag_cache_t;
 
 typedef struct {
@@ -107,16 +114,14 @@ typedef struct {
 	atomic_t allocated_slabs;
 	atomic_t allocated_objs;
 	atomic_t cached_objs;
-	/** How many magazines in magazines list */
-	atomic_t magazine_counter;
 	
 	/* Slabs */
 	list_t full_slabs;     /**< List of full slabs */
 	list_t partial_slabs;  /**< List of partial slabs */
 	IRQ_SPINLOCK_DECLARE(slablock);
-	/* Magazines */
-	list_t magazines;  /**< List o full magazines */
-	IRQ_SPINLOCK_DECLARE(maglock);
+	
+	/** Depot of full magazines, empty slots are NULL */
+	slab_magazine_t *depot[SLAB_DEPOT_SIZE];
 	
 	/** CPU cache */
 	slab_mag_cache_t *mag_cache;
@@ -130,10 +135,12 @@ extern void *slab_alloc(slab_cache_t *, unsigned int)
     __attribute__((malloc));
 extern void slab_free(slab_cache_t *, void *);
 extern size_t slab_reclaim(unsigned int);
+extern void slab_reclaim_request(void);
 
 /* slab subsytem initialization */
 extern void slab_cache_init(void);
 extern void slab_enable_cpucache(void);
+extern void kslab(void *);
 
 /* kconsole debug */
 extern void slab_print_list(void);
@@ -64,17 +64,24 @@ typedef struct {
 	size_t count;			/**< Number of pages to invalidate. */
 } tlb_shootdown_msg_t;
 
+struct as;
+
 extern void tlb_init(void);
 
 #ifdef CONFIG_SMP
 extern ipl_t tlb_shootdown_start(tlb_invalidate_type_t, asid_t, uintptr_t,
     size_t);
+extern ipl_t tlb_shootdown_start_as(struct as *, tlb_invalidate_type_t,
+    uintptr_t, size_t);
 extern void tlb_shootdown_finalize(ipl_t);
 extern void tlb_shootdown_ipi_recv(void);
+extern void tlb_shootdown_wait(void);
 #else
 #define tlb_shootdown_start(w, x, y, z)	interrupts_disable()	
+#define tlb_shootdown_start_as(w, x, y, z)	interrupts_disable()
 #define tlb_shootdown_finalize(i)	(interrupts_restore(i));
 #define tlb_shootdown_ipi_recv()
+#define tlb_shootdown_wait()
 #endif /* CONFIG_SMP */
 
 /* Export TLB interface that each architecture must implement. */
@@ -40,10 +40,20 @@
 #include <time/clock.h>
 #include <atomic.h>
 #include <adt/list.h>
+#include <bitops.h>
 
 #define RQ_COUNT          16
 #define NEEDS_RELINK_MAX  (HZ)
 
+/** Bitmap of non-empty run queues.
+ *
+ * Bit i is set if and only if rq[i] contains at least one
+ * ready thread. The bit of rq[i] is only ever changed while
+ * holding the lock of rq[i].
+ *
+ */
+typedef uint32_t rq_bitmap_t;
+
 /** Scheduler run queue structure. */
 typedef struct {
 	IRQ_SPINLOCK_DECLARE(lock);
@@ -51,6 +61,42 @@ typedef struct {
 	size_t n;			/**< Number of threads in rq_ready. */
 } runq_t;
 
+/** Mark run queue as non-empty in the run queue bitmap.
+ *
+ * @param bitmap Run queue bitmap of the respective CPU.
+ * @param i      Index of the run queue.
+ *
+ */
+NO_TRACE static inline void rq_bitmap_set(volatile rq_bitmap_t *bitmap,
+    unsigned int i)
+{
+	__atomic_fetch_or(bitmap, (rq_bitmap_t) 1 << i, __ATOMIC_RELAXED);
+}
+
+/** Mark run queue as empty in the run queue bitmap.
+ *
+ * @param bitmap Run queue bitmap of the respective CPU.
+ * @param i      Index of the run queue.
+ *
+ */
+NO_TRACE static inline void rq_bitmap_clear(volatile rq_bitmap_t *bitmap,
+    unsigned int i)
+{
+	__atomic_fetch_and(bitmap, ~((rq_bitmap_t) 1 << i), __ATOMIC_RELAXED);
+}
+
+/** Get the index of the highest-priority non-empty run queue.
+ *
+ * @param bitmap Snapshot of the run queue bitmap (must be non-zero).
+ *
+ * @return Index of the lowest set bit.
+ *
+ */
+NO_TRACE static inline unsigned int rq_bitmap_first(rq_bitmap_t bitmap)
+{
+	return fnzb32(bitmap & -bitmap);
+}
+
 extern atomic_t nrdy;
 extern void scheduler_init(void);
 
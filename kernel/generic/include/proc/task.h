@@ -43,7 +43,6 @@
 #include <synch/mutex.h>
 #include <synch/futex.h>
 #include <synch/workqueue.h>
-#include <adt/avl.h>
 #include <adt/btree.h>
 #include <adt/cht.h>
 #include <adt/list.h>
@@ -70,13 +69,15 @@ struct cap;
 
 /** Task structure. */
 typedef struct task {
-	/** Task's linkage for the tasks_tree AVL tree. */
-	avltree_node_t tasks_tree_node;
+	/** Task's linkage for the list of active tasks. */
+	link_t tasks_link;
+	/** Task's linkage for the tasks_cht concurrent hash table. */
+	cht_link_t tasks_cht_link;
 	
 	/** Task lock.
 	 *
-	 * Must be acquired before threads_lock and thread lock of any of its
-	 * threads.
+	 * Must be acquired after the lists of active tasks and before the
+	 * lists of threads and thread lock of any of its threads.
 	 */
 	IRQ_SPINLOCK_DECLARE(lock);
 	
@@ -94,6 +95,12 @@ typedef struct task {
 	atomic_t refcount;
 	/** Number of threads that haven't exited yet. */
 	atomic_t lifecount;
+	/**
+	 * Number of parties which still use the task structure after the task
+	 * has been destroyed (i.e. task_destroy() and RCU readers which found
+	 * the task in the tasks_cht).
+	 */
+	atomic_t free_refs;
 	
 	/** Task permissions. */
 	perm_t perms;
@@ -144,18 +151,23 @@ typedef struct task {
 	/** Accumulated accounting. */
 	uint64_t ucycles;
 	uint64_t kcycles;
+	
+	/** Page fault statistics. */
+	atomic_t page_faults;
+	atomic_t fault_around;
 } task_t;
 
-IRQ_SPINLOCK_EXTERN(tasks_lock);
-extern avltree_t tasks_tree;
-
 extern void task_init(void);
 extern void task_done(void);
+extern void task_list_lock(void);
+extern void task_list_unlock(void);
+extern void task_list_walk(bool (*)(task_t *, void *), void *);
 extern task_t *task_create(as_t *, const char *);
 extern void task_destroy(task_t *);
 extern void task_hold(task_t *);
 extern void task_release(task_t *);
 extern task_t *task_find_by_id(task_id_t);
+extern task_t *task_get_by_id(task_id_t);
 extern errno_t task_kill(task_id_t);
 extern void task_kill_self(bool) __attribute__((noreturn));
 extern void task_get_accounting(task_t *, uint64_t *, uint64_t *);
@@ -41,7 +41,7 @@
 #include <cpu.h>
 #include <synch/spinlock.h>
 #include <synch/rcu_types.h>
-#include <adt/avl.h>
+#include <adt/cht.h>
 #include <mm/slab.h>
 #include <arch/cpu.h>
 #include <mm/tlb.h>
@@ -75,8 +75,18 @@ typedef struct thread {
 	link_t wq_link;  /**< Wait queue link. */
 	link_t th_link;  /**< Links to threads within containing task. */
 	
-	/** Threads linkage to the threads_tree. */
-	avltree_node_t threads_tree_node;
+	/** Threads linkage to the lists of all threads. */
+	link_t threads_link;
+	/** Threads linkage to the threads_cht (keyed by address). */
+	cht_link_t threads_cht_link;
+	/** Threads linkage to the tids_cht (keyed by thread ID). */
+	cht_link_t tids_cht_link;
+	/**
+	 * Number of parties which still use the thread structure after the
+	 * thread has been destroyed (i.e. thread_destroy() and RCU readers
+	 * which found the thread in either of the hash tables).
+	 */
+	atomic_t free_refs;
 	
 	/** Lock protecting thread structure.
 	 *
@@ -130,6 +140,12 @@ typedef struct thread {
 	 */
 	bool in_copy_to_uspace;
 	
+	/**
+	 * Address space area of the last page fault of this thread.
+	 * Referenced by the thread and used only by the thread itself.
+	 */
+	as_area_t *fault_area;
+	
 	/**
 	 * If true, the thread will not go to sleep at all and will call
 	 * thread_exit() before returning to userspace.
@@ -216,18 +232,10 @@ typedef struct thread {
 #endif /* CONFIG_UDEBUG */
 } thread_t;
 
-/** Thread list lock.
- *
- * This lock protects the threads_tree.
- * Must be acquired before T.lock for each T of type thread_t.
- *
- */
-IRQ_SPINLOCK_EXTERN(threads_lock);
-
-/** AVL tree containing all threads. */
-extern avltree_t threads_tree;
-
 extern void thread_init(void);
+extern void thread_list_lock(void);
+extern void thread_list_unlock(void);
+extern void thread_list_walk(bool (*)(thread_t *, void *), void *);
 extern thread_t *thread_create(void (*)(void *), void *, task_t *,
     thread_flags_t, const char *);
 extern void thread_wire(thread_t *, cpu_t *);
@@ -36,8 +36,10 @@
 #define KERN_FUTEX_H_
 
 #include <typedefs.h>
+#include <atomic.h>
 #include <synch/waitq.h>
 #include <adt/hash_table.h>
+#include <abi/sysinfo.h>
 
 /** Kernel-side futex structure. */
 typedef struct {
@@ -49,11 +51,21 @@ typedef struct {
 	ht_link_t ht_link;
 	/** Number of tasks that reference this futex. */
 	size_t refcount;
+	/** Task which created the kernel futex object. */
+	task_id_t task_id;
+	/** Virtual address of the futex variable in that task. */
+	uintptr_t uaddr;
+	/** Number of times a thread went to sleep on the futex. */
+	atomic_t sleeps;
+	/** Number of wakeups requested on the futex. */
+	atomic_t wakeups;
 } futex_t;
 
 extern void futex_init(void);
 extern sys_errno_t sys_futex_sleep(uintptr_t);
 extern sys_errno_t sys_futex_wakeup(uintptr_t);
+extern size_t futex_stats_count(void);
+extern size_t futex_stats_get(stats_futex_t *, size_t);
 
 extern void futex_task_cleanup(void);
 extern void futex_task_init(struct task *);
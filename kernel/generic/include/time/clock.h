@@ -36,6 +36,7 @@
 #define KERN_CLOCK_H_
 
 #include <typedefs.h>
+#include <stdbool.h>
 
 #define HZ  100
 
@@ -46,10 +47,24 @@ typedef struct {
 	sysarg_t seconds2;
 } uptime_t;
 
+/** Operations of a processor-local clock capable of tickless idle */
+typedef struct {
+	/** Replace the periodic ticks of the current processor by a single
+	 * interrupt after the given number of ticks. Return the number of
+	 * ticks actually programmed. */
+	size_t (* oneshot)(size_t);
+	/** Resume periodic ticks on the current processor. Return the number
+	 * of whole ticks elapsed since oneshot(). */
+	size_t (* periodic)(void);
+} clock_tickless_ops_t;
+
 extern uptime_t *uptime;
+extern clock_tickless_ops_t *clock_tickless_ops;
 
 extern void clock(void);
 extern void clock_counter_init(void);
+extern bool clock_tickless_enter(void);
+extern void clock_tickless_exit(void);
 
 #endif
 
@@ -76,43 +76,20 @@
 #include <abi/cap.h>
 #include <proc/task.h>
 #include <synch/mutex.h>
+#include <synch/rcu.h>
 #include <abi/errno.h>
 #include <mm/slab.h>
 #include <adt/list.h>
+#include <mem.h>
+#include <macros.h>
 
 #include <stdint.h>
 
 #define CAPS_START	(CAP_NIL + 1)
-#define CAPS_SIZE	(INT_MAX - CAPS_START)
-#define CAPS_LAST	(CAPS_SIZE - 1)
+#define CAPS_LAST	(CAPS_DIR_SIZE * CAPS_LEAF_SIZE - 1)
 
 static slab_cache_t *cap_cache;
 
-static size_t caps_hash(const ht_link_t *item)
-{
-	cap_t *cap = hash_table_get_inst(item, cap_t, caps_link);
-	return hash_mix(cap->handle);
-}
-
-static size_t caps_key_hash(void *key)
-{
-	cap_handle_t *handle = (cap_handle_t *) key;
-	return hash_mix(*handle);
-}
-
-static bool caps_key_equal(void *key, const ht_link_t *item)
-{
-	cap_handle_t *handle = (cap_handle_t *) key;
-	cap_t *cap = hash_table_get_inst(item, cap_t, caps_link);
-	return *handle == cap->handle;
-}
-
-static hash_table_ops_t caps_ops = {
-	.hash = caps_hash,
-	.key_hash = caps_key_hash,
-	.key_equal = caps_key_equal
-};
-
 void caps_init(void)
 {
 	cap_cache = slab_cache_create("cap_t", sizeof(cap_t), 0, NULL,
@@ -129,20 +106,9 @@ errno_t caps_task_alloc(task_t *task)
 	    FRAME_ATOMIC);
 	if (!task->cap_info)
 		return ENOMEM;
-	task->cap_info->handles = ra_arena_create();
-	if (!task->cap_info->handles)
-		goto error_handles;
-	if (!ra_span_add(task->cap_info->handles, CAPS_START, CAPS_SIZE))
-		goto error_span;
-	if (!hash_table_create(&task->cap_info->caps, 0, 0, &caps_ops))
-		goto error_span;
+	task->cap_info->next_handle = CAPS_START;
+	memsetb(task->cap_info->table, sizeof(task->cap_info->table), 0);
 	return EOK;
-
-error_span:
-	ra_arena_destroy(task->cap_info->handles);
-error_handles:
-	free(task->cap_info);
-	return ENOMEM;
 }
 
 /** Initialize the capability info structure
@@ -155,6 +121,7 @@ void caps_task_init(task_t *task)
 
 	for (kobject_type_t t = 0; t < KOBJECT_TYPE_MAX; t++)
 		list_initialize(&task->cap_info->type_list[t]);
+	list_initialize(&task->cap_info->free_list);
 }
 
 /** Deallocate the capability info structure
@@ -163,8 +130,16 @@ void caps_task_init(task_t *task)
  */
 void caps_task_free(task_t *task)
 {
-	hash_table_destroy(&task->cap_info->caps);
-	ra_arena_destroy(task->cap_info->handles);
+	for (size_t i = 0; i < CAPS_DIR_SIZE; i++) {
+		cap_t **leaf = task->cap_info->table[i];
+		if (!leaf)
+			continue;
+		for (size_t j = 0; j < CAPS_LEAF_SIZE; j++) {
+			if (leaf[j])
+				slab_free(cap_cache, leaf[j]);
+		}
+		free(leaf);
+	}
 	free(task->cap_info);
 }
 
@@ -207,9 +182,32 @@ static void cap_initialize(cap_t *cap, task_t *task, cap_handle_t handle)
 	cap->state = CAP_STATE_FREE;
 	cap->task = task;
 	cap->handle = handle;
+	cap->kobject = NULL;
 	link_initialize(&cap->type_link);
 }
 
+/** Find capability in the capability table
+ *
+ * Must be called with the task's cap_info lock held or from within an RCU
+ * reader section.
+ *
+ * @param task    Task whose capability to find.
+ * @param handle  Capability handle.
+ *
+ * @return Address of the capability in any state or NULL if the handle has
+ *         never been allocated.
+ */
+static cap_t *cap_find(task_t *task, cap_handle_t handle)
+{
+	if ((handle < CAPS_START) || (handle > CAPS_LAST))
+		return NULL;
+	cap_t **leaf =
+	    rcu_access(task->cap_info->table[handle >> CAPS_LEAF_BITS]);
+	if (!leaf)
+		return NULL;
+	return rcu_access(leaf[handle & CAPS_LEAF_MASK]);
+}
+
 /** Get capability using capability handle
  *
  * @param task    Task whose capability to get.
@@ -223,33 +221,79 @@ static cap_t *cap_get(task_t *task, cap_handle_t handle, cap_state_t state)
 {
 	assert(mutex_locked(&task->cap_info->lock));
 
-	if ((handle < CAPS_START) || (handle > CAPS_LAST))
-		return NULL;
-	ht_link_t *link = hash_table_find(&task->cap_info->caps, &handle);
-	if (!link)
+	cap_t *cap = cap_find(task, handle);
+	if (!cap)
 		return NULL;
-	cap_t *cap = hash_table_get_inst(link, cap_t, caps_link);
 	if (cap->state != state)
 		return NULL;
 	return cap;
 }
 
-static bool cap_reclaimer(ht_link_t *link, void *arg)
+/** Try to reclaim one of the published capabilities of a task
+ *
+ * @param task  Task whose capabilities to examine.
+ *
+ * @return Reclaimed capability in the free state or NULL.
+ */
+static cap_t *cap_reclaim(task_t *task)
+{
+	assert(mutex_locked(&task->cap_info->lock));
+
+	for (kobject_type_t t = 0; t < KOBJECT_TYPE_MAX; t++) {
+		list_foreach(task->cap_info->type_list[t], type_link, cap_t,
+		    cap) {
+			if (!cap->kobject->ops->reclaim ||
+			    !cap->kobject->ops->reclaim(cap->kobject))
+				continue;
+
+			kobject_t *kobj = cap_unpublish(cap->task, cap->handle,
+			    cap->kobject->type);
+			kobject_put(kobj);
+			cap_initialize(cap, cap->task, cap->handle);
+			return cap;
+		}
+	}
+
+	return NULL;
+}
+
+/** Allocate a never used capability handle
+ *
+ * @param task  Task for which to allocate the new capability.
+ *
+ * @param[out] out  New capability in the free state.
+ *
+ * @return EOK on success.
+ * @return ELIMIT if all CAPS_LAST handles of the task have been used.
+ * @return ENOMEM if out of memory.
+ */
+static errno_t cap_create(task_t *task, cap_t **out)
 {
-	cap_t **result = (cap_t **) arg;
-	cap_t *cap = hash_table_get_inst(link, cap_t, caps_link);
-
-	if (cap->state == CAP_STATE_PUBLISHED && cap->kobject->ops->reclaim &&
-	    cap->kobject->ops->reclaim(cap->kobject)) {
-		kobject_t *kobj = cap_unpublish(cap->task, cap->handle,
-		    cap->kobject->type);
-		kobject_put(kobj);
-		cap_initialize(cap, cap->task, cap->handle);
-		*result = cap;
-		return false;
+	assert(mutex_locked(&task->cap_info->lock));
+
+	cap_handle_t handle = task->cap_info->next_handle;
+	if (handle > CAPS_LAST)
+		return ELIMIT;
+
+	cap_t **leaf = task->cap_info->table[handle >> CAPS_LEAF_BITS];
+	if (!leaf) {
+		leaf = malloc(CAPS_LEAF_SIZE * sizeof(cap_t *), FRAME_ATOMIC);
+		if (!leaf)
+			return ENOMEM;
+		memsetb(leaf, CAPS_LEAF_SIZE * sizeof(cap_t *), 0);
+		rcu_assign(task->cap_info->table[handle >> CAPS_LEAF_BITS],
+		    leaf);
 	}
 
-	return true;
+	cap_t *cap = slab_alloc(cap_cache, FRAME_ATOMIC);
+	if (!cap)
+		return ENOMEM;
+	cap_initialize(cap, task, handle);
+	rcu_assign(leaf[handle & CAPS_LEAF_MASK], cap);
+
+	task->cap_info->next_handle++;
+	*out = cap;
+	return EOK;
 }
 
 /** Allocate new capability
@@ -258,37 +302,36 @@ static bool cap_reclaimer(ht_link_t *link, void *arg)
  *
  * @param[out] handle  New capability handle on success.
  *
- * @return An error code in case of error.
+ * @return EOK on success.
+ * @return ELIMIT if the task already holds the maximum number of capabilities.
+ * @return ENOMEM if out of memory.
  */
 errno_t cap_alloc(task_t *task, cap_handle_t *handle)
 {
-	cap_t *cap = NULL;
-
 	/*
 	 * First of all, see if we can reclaim a capability. Note that this
 	 * feature is only temporary and capability reclamaition will eventually
 	 * be phased out.
 	 */
 	mutex_lock(&task->cap_info->lock);
-	hash_table_apply(&task->cap_info->caps, cap_reclaimer, &cap);
+	cap_t *cap = cap_reclaim(task);
 
 	/*
-	 * If we don't have a capability by now, try to allocate a new one.
+	 * If we don't have a capability by now, reuse a free one or allocate
+	 * a new one.
 	 */
 	if (!cap) {
-		cap = slab_alloc(cap_cache, FRAME_ATOMIC);
-		if (!cap) {
-			mutex_unlock(&task->cap_info->lock);
-			return ENOMEM;
-		}
-		uintptr_t hbase;
-		if (!ra_alloc(task->cap_info->handles, 1, 1, &hbase)) {
-			slab_free(cap_cache, cap);
-			mutex_unlock(&task->cap_info->lock);
-			return ENOMEM;
+		link_t *link = list_first(&task->cap_info->free_list);
+		if (link) {
+			cap = list_get_instance(link, cap_t, type_link);
+			list_remove(link);
+		} else {
+			errno_t rc = cap_create(task, &cap);
+			if (rc != EOK) {
+				mutex_unlock(&task->cap_info->lock);
+				return rc;
+			}
 		}
-		cap_initialize(cap, task, (cap_handle_t) hbase);
-		hash_table_insert(&task->cap_info->caps, &cap->caps_link);
 	}
 
 	cap->state = CAP_STATE_ALLOCATED;
@@ -316,7 +359,7 @@ cap_publish(task_t *task, cap_handle_t handle, kobject_t *kobj)
 	assert(cap);
 	cap->state = CAP_STATE_PUBLISHED;
 	/* Hand over kobj's reference to cap */
-	cap->kobject = kobj;
+	rcu_assign(cap->kobject, kobj);
 	list_append(&cap->type_link, &task->cap_info->type_list[kobj->type]);
 	mutex_unlock(&task->cap_info->lock);
 }
@@ -354,6 +397,9 @@ kobject_t *cap_unpublish(task_t *task, cap_handle_t handle, kobject_type_t type)
 }
 
 /** Free allocated capability
+ *
+ * The capability stays in the capability table and its handle is reused
+ * by a subsequent cap_alloc().
  *
  * @param task    Task in which to free the capability.
  * @param handle  Capability handle.
@@ -368,9 +414,8 @@ void cap_free(task_t *task, cap_handle_t handle)
 
 	assert(cap);
 
-	hash_table_remove_item(&task->cap_info->caps, &cap->caps_link);
-	ra_free(task->cap_info->handles, handle, 1);
-	slab_free(cap_cache, cap);
+	cap->state = CAP_STATE_FREE;
+	list_prepend(&cap->type_link, &task->cap_info->free_list);
 	mutex_unlock(&task->cap_info->lock);
 }
 
@@ -405,15 +450,29 @@ kobject_get(struct task *task, cap_handle_t handle, kobject_type_t type)
 {
 	kobject_t *kobj = NULL;
 
-	mutex_lock(&task->cap_info->lock);
-	cap_t *cap = cap_get(task, handle, CAP_STATE_PUBLISHED);
+	/*
+	 * No lock is needed here. The capability table only grows while the
+	 * task exists and kobject_t wrappers are freed after a grace period.
+	 * The reference count of a kernel object which is concurrently being
+	 * destroyed is zero and must not be resurrected.
+	 */
+	rcu_read_lock();
+	cap_t *cap = cap_find(task, handle);
 	if (cap) {
-		if (cap->kobject->type == type) {
-			kobj = cap->kobject;
-			atomic_inc(&kobj->refcnt);
+		kobject_t *cur = rcu_access(cap->kobject);
+		if ((cur) && (cur->type == type)) {
+			atomic_count_t refcnt = atomic_get(&cur->refcnt);
+			while (refcnt != 0) {
+				if (__atomic_compare_exchange_n(&cur->refcnt.count,
+				    &refcnt, refcnt + 1, false, __ATOMIC_ACQUIRE,
+				    __ATOMIC_RELAXED)) {
+					kobj = cur;
+					break;
+				}
+			}
 		}
 	}
-	mutex_unlock(&task->cap_info->lock);
+	rcu_read_unlock();
 
 	return kobj;
 }
@@ -427,6 +486,12 @@ void kobject_add_ref(kobject_t *kobj)
 	atomic_inc(&kobj->refcnt);
 }
 
+/** Free kernel object wrapper after a grace period */
+static void kobject_free(rcu_item_t *item)
+{
+	free(member_to_inst(item, kobject_t, rcu));
+}
+
 /** Drop reference to kernel object
  *
  * The encapsulated object and the kobject_t wrapper are both destroyed when the
@@ -438,7 +503,7 @@ void kobject_put(kobject_t *kobj)
 {
 	if (atomic_postdec(&kobj->refcnt) == 1) {
 		kobj->ops->destroy(kobj->raw);
-		free(kobj);
+		rcu_call(&kobj->rcu, kobject_free);
 	}
 }
 
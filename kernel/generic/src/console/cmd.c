@@ -57,6 +57,7 @@
 #include <cpu.h>
 #include <mm/tlb.h>
 #include <mm/km.h>
+#include <mm/as.h>
 #include <arch/mm/tlb.h>
 #include <mm/frame.h>
 #include <main/version.h>
@@ -535,6 +536,20 @@ static cmd_info_t zone_info = {
 	.argv = &zone_argv
 };
 
+/* Data and methods for 'faultaround' command */
+static int cmd_faultaround(cmd_arg_t *argv);
+static cmd_arg_t faultaround_argv = {
+	.type = ARG_TYPE_INT,
+};
+
+static cmd_info_t faultaround_info = {
+	.name = "faultaround",
+	.description = "<pages> Set the size of the page fault-around window.",
+	.func = cmd_faultaround,
+	.argc = 1,
+	.argv = &faultaround_argv
+};
+
 /* Data and methods for the 'workq' command */
 static int cmd_workq(cmd_arg_t *argv);
 static cmd_info_t workq_info = {
@@ -611,6 +626,7 @@ static cmd_info_t *basic_commands[] = {
 	&continue_info,
 	&cpus_info,
 	&desc_info,
+	&faultaround_info,
 	&halt_info,
 	&help_info,
 	&ipc_info,
@@ -1350,6 +1366,26 @@ int cmd_zone(cmd_arg_t *argv)
 	return 1;
 }
 
+/** Command for setting the size of the fault-around window
+ *
+ * @param argv Integer argument from cmdline expected
+ *
+ * return Always 1
+ */
+int cmd_faultaround(cmd_arg_t *argv)
+{
+	/* Negative values wrap around to huge ones as well */
+	if (argv[0].intval > AS_FAULT_AROUND_MAX) {
+		printf("Window size limited to %u pages.\n",
+		    AS_FAULT_AROUND_MAX);
+		as_fault_around = AS_FAULT_AROUND_MAX;
+	} else
+		as_fault_around = argv[0].intval;
+	
+	printf("Fault-around window set to %zu pages.\n", as_fault_around);
+	return 1;
+}
+
 /** Command for printing task IPC details
  *
  * @param argv Integer argument from cmdline expected
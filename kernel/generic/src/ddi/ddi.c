@@ -273,9 +273,7 @@ NO_TRACE static errno_t iospace_enable(task_id_t id, uintptr_t ioaddr, size_t si
 	if (!(perms & PERM_IO_MANAGER))
 		return EPERM;
 	
-	irq_spinlock_lock(&tasks_lock, true);
-	
-	task_t *task = task_find_by_id(id);
+	task_t *task = task_get_by_id(id);
 	
 	if ((!task) || (!container_check(CONTAINER, task->container))) {
 		/*
@@ -283,14 +281,15 @@ NO_TRACE static errno_t iospace_enable(task_id_t id, uintptr_t ioaddr, size_t si
 		 * or the task belongs to a different security
 		 * context.
 		 */
-		irq_spinlock_unlock(&tasks_lock, true);
+		if (task)
+			task_release(task);
 		return ENOENT;
 	}
 	
-	/* Lock the task and release the lock protecting tasks_btree. */
-	irq_spinlock_exchange(&tasks_lock, &task->lock);
+	irq_spinlock_lock(&task->lock, true);
 	errno_t rc = ddi_iospace_enable_arch(task, ioaddr, size);
 	irq_spinlock_unlock(&task->lock, true);
+	task_release(task);
 
 	return rc;
 }
@@ -314,9 +313,7 @@ NO_TRACE static errno_t iospace_disable(task_id_t id, uintptr_t ioaddr, size_t s
 	if (!(perms & PERM_IO_MANAGER))
 		return EPERM;
 	
-	irq_spinlock_lock(&tasks_lock, true);
-	
-	task_t *task = task_find_by_id(id);
+	task_t *task = task_get_by_id(id);
 	
 	if ((!task) || (!container_check(CONTAINER, task->container))) {
 		/*
@@ -324,14 +321,15 @@ NO_TRACE static errno_t iospace_disable(task_id_t id, uintptr_t ioaddr, size_t s
 		 * or the task belongs to a different security
 		 * context.
 		 */
-		irq_spinlock_unlock(&tasks_lock, true);
+		if (task)
+			task_release(task);
 		return ENOENT;
 	}
 	
-	/* Lock the task and release the lock protecting tasks_btree. */
-	irq_spinlock_exchange(&tasks_lock, &task->lock);
+	irq_spinlock_lock(&task->lock, true);
 	errno_t rc = ddi_iospace_disable_arch(task, ioaddr, size);
 	irq_spinlock_unlock(&task->lock, true);
+	task_release(task);
 	
 	return rc;
 }
@@ -384,6 +382,13 @@ NO_TRACE static errno_t dmamem_map_anonymous(size_t size, uintptr_t constraint,
 	if (frames == 0)
 		return EINVAL;
 
+	/*
+	 * Align larger buffers so that they can be mapped using large
+	 * frames.
+	 */
+	if ((map_flags & AS_AREA_LARGE_PAGES) && (frames >= AS_LARGE_FRAMES))
+		constraint |= AS_LARGE_SIZE - 1;
+	
 	*phys = frame_alloc(frames, FRAME_ATOMIC, constraint);
 	if (*phys == 0)
 		return ENOMEM;
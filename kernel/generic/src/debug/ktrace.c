@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup genericdebug
+ * @{
+ */
+
+/**
+ * @file
+ * @brief Per-processor kernel trace ring buffers.
+ *
+ * Each processor records the trace events into its own ring of binary
+ * records. The processor is the only writer of its ring and it writes with
+ * interrupts disabled, so no locking is needed. Older records are simply
+ * overwritten.
+ *
+ * The rings are exported as a physical memory area which user space can
+ * map read-only. A reader validates every record it copies out by checking
+ * the sequence number of the record before and after reading it.
+ *
+ */
+
+#include <ktrace.h>
+#include <arch.h>
+#include <arch/asm.h>
+#include <arch/barrier.h>
+#include <arch/cycle.h>
+#include <config.h>
+#include <cpu.h>
+#include <ddi/ddi.h>
+#include <mem.h>
+#include <mm/frame.h>
+#include <panic.h>
+#include <proc/thread.h>
+#include <sysinfo/sysinfo.h>
+#include <trace.h>
+
+/** Number of record slots in each ring */
+#define KTRACE_CAPACITY \
+	(FRAMES2SIZE(KTRACE_RING_PAGES) / sizeof(ktrace_record_t))
+
+/** Shared area with the ring headers followed by the records */
+static uint8_t *ktrace_area = NULL;
+
+/** Physical memory area descriptor of the rings */
+static parea_t ktrace_parea;
+
+/** Initialize the trace rings of all processors
+ *
+ * Must be called after the number of processors is known.
+ *
+ */
+void ktrace_init(void)
+{
+	size_t hdr_frames = SIZE2FRAMES(config.cpu_count * sizeof(ktrace_ring_t));
+	size_t frames = hdr_frames + config.cpu_count * KTRACE_RING_PAGES;
+	
+	uintptr_t faddr = frame_alloc(frames, FRAME_LOWMEM | FRAME_ATOMIC, 0);
+	if (faddr == 0)
+		panic("Cannot allocate trace rings.");
+	
+	uint8_t *area = (uint8_t *) PA2KA(faddr);
+	memsetb(area, FRAMES2SIZE(frames), 0);
+	
+	ktrace_ring_t *rings = (ktrace_ring_t *) area;
+	for (unsigned int i = 0; i < config.cpu_count; i++) {
+		rings[i].head = 0;
+		rings[i].offset = FRAMES2SIZE(hdr_frames + i * KTRACE_RING_PAGES);
+		rings[i].capacity = KTRACE_CAPACITY;
+		rings[i].cpu = i;
+	}
+	
+	ktrace_parea.pbase = faddr;
+	ktrace_parea.frames = frames;
+	ktrace_parea.unpriv = false;
+	ktrace_parea.mapped = false;
+	ddi_parea_register(&ktrace_parea);
+	
+	sysinfo_set_item_val("ktrace.faddr", NULL, (sysarg_t) faddr);
+	sysinfo_set_item_val("ktrace.pages", NULL, frames);
+	sysinfo_set_item_val("ktrace.cpus", NULL, config.cpu_count);
+	
+	write_barrier();
+	ktrace_area = area;
+}
+
+/** Record a trace event into the ring of the current processor
+ *
+ * @param event Event to record.
+ * @param arg   Event argument.
+ *
+ */
+NO_TRACE void ktrace_record(ktrace_event_t event, uint64_t arg)
+{
+	if ((ktrace_area == NULL) || (CPU == NULL))
+		return;
+	
+	ipl_t ipl = interrupts_disable();
+	
+	ktrace_ring_t *ring = &((ktrace_ring_t *) ktrace_area)[CPU->id];
+	ktrace_record_t *records =
+	    (ktrace_record_t *) (ktrace_area + ring->offset);
+	
+	uint64_t head = ring->head;
+	ktrace_record_t *record =
+	    &records[(size_t) (head & (KTRACE_CAPACITY - 1))];
+	
+	/* Invalidate the slot while it is being overwritten */
+	record->seq = 0;
+	write_barrier();
+	
+	record->timestamp = get_cycle();
+	record->arg = arg;
+	record->event = event;
+	record->thread = (THREAD != NULL) ? (uint32_t) THREAD->tid : 0;
+	
+	write_barrier();
+	record->seq = head + 1;
+	ring->head = head + 1;
+	
+	interrupts_restore(ipl);
+}
+
+/** @}
+ */
@@ -50,6 +50,13 @@
 #include <ipc/sysipc_priv.h>
 #include <errno.h>
 #include <mm/slab.h>
+#include <mm/frame.h>
+#include <mm/page.h>
+#include <mm/km.h>
+#include <syscall/copy.h>
+#include <align.h>
+#include <config.h>
+#include <macros.h>
 #include <arch.h>
 #include <proc/task.h>
 #include <mem.h>
@@ -59,6 +66,7 @@
 #include <arch/interrupt.h>
 #include <ipc/irq.h>
 #include <cap/cap.h>
+#include <ktrace.h>
 
 static void ipc_forget_call(call_t *);
 
@@ -70,6 +78,9 @@ static slab_cache_t *answerbox_cache;
 
 slab_cache_t *phone_cache = NULL; 
 
+/** Minimum size of a data transfer done straight into the destination frames */
+#define IPC_DIRECT_XFER_MIN  (2 * PAGE_SIZE)
+
 /** Initialize a call structure.
  *
  * @param call Call structure to be initialized.
@@ -92,6 +103,8 @@ static void call_destroy(void *arg)
 
 	if (call->buffer)
 		free(call->buffer);
+	if (call->frames)
+		ipc_call_frames_unpin(call);
 	if (call->caller_phone)
 		kobject_put(call->caller_phone->kobject);
 	slab_free(call_cache, call);
@@ -130,6 +143,132 @@ call_t *ipc_call_alloc(unsigned int flags)
 	return call;
 }
 
+/** Pin the destination frames of a data transfer.
+ *
+ * Large IPC_M_DATA_READ transfers are not copied into a kernel buffer.
+ * Instead, each frame backing the destination buffer in the current address
+ * space gets an extra reference, so that it cannot go away even if the
+ * destination task unmaps it or dies. When the recipient answers, the data
+ * is copied straight from its address space into the frames. This saves one
+ * copy of the data and the kernel heap allocation of the buffer, while the
+ * data is still taken at the time of the answer.
+ *
+ * @param call Call carrying the transfer.
+ * @param dst  Destination buffer address in the current address space.
+ * @param size Size of the destination buffer.
+ *
+ * @return EOK on success.
+ * @return ENOTSUP if the transfer is too small or if the destination buffer
+ *         is not backed by writable memory managed by the frame allocator.
+ *         The caller is expected to fall back to the kernel buffer in that
+ *         case.
+ *
+ */
+errno_t ipc_call_frames_pin(call_t *call, uintptr_t dst, size_t size)
+{
+	assert(call->frames == NULL);
+	
+	if ((size < IPC_DIRECT_XFER_MIN) || (dst + size < dst))
+		return ENOTSUP;
+	
+	uintptr_t base = ALIGN_DOWN(dst, PAGE_SIZE);
+	size_t count = (ALIGN_UP(dst + size, PAGE_SIZE) - base) >> PAGE_WIDTH;
+	
+	uintptr_t *frames = malloc(count * sizeof(uintptr_t), 0);
+	size_t pinned;
+	
+	for (pinned = 0; pinned < count; pinned++) {
+		uintptr_t page = base + (pinned << PAGE_WIDTH);
+		void *probe = (void *) max(page, dst);
+		
+		/*
+		 * Fault the page in for writing if it is not resident yet.
+		 * Its contents are left as they are.
+		 */
+		uint8_t byte;
+		if ((copy_from_uspace(&byte, probe, 1) != EOK) ||
+		    (copy_to_uspace(probe, &byte, 1) != EOK))
+			break;
+		
+		if (page_mapping_pin(AS, page, true, &frames[pinned]) != EOK)
+			break;
+	}
+	
+	if (pinned < count) {
+		while (pinned > 0)
+			frame_free_noreserve(frames[--pinned], 1);
+		
+		free(frames);
+		return ENOTSUP;
+	}
+	
+	call->frames = frames;
+	call->frames_count = count;
+	call->frames_offset = dst - base;
+	
+	return EOK;
+}
+
+/** Release the destination frames pinned by ipc_call_frames_pin().
+ *
+ * @param call Call carrying the transfer.
+ *
+ */
+void ipc_call_frames_unpin(call_t *call)
+{
+	for (size_t i = 0; i < call->frames_count; i++)
+		frame_free_noreserve(call->frames[i], 1);
+	
+	free(call->frames);
+	call->frames = NULL;
+	call->frames_count = 0;
+	call->frames_offset = 0;
+}
+
+/** Copy data from the current address space to the pinned frames.
+ *
+ * @param call Call carrying the transfer.
+ * @param src  Source address in the current address space.
+ * @param size Number of bytes to copy.
+ *
+ * @return EOK on success or an error code from copy_from_uspace().
+ *
+ */
+errno_t ipc_call_frames_copy_from_uspace(call_t *call, uintptr_t src,
+    size_t size)
+{
+	uintptr_t identity_lo = KA2PA(config.identity_base);
+	uintptr_t identity_hi = identity_lo + config.identity_size;
+	size_t offset = call->frames_offset;
+	size_t done = 0;
+	
+	for (size_t i = 0; (i < call->frames_count) && (done < size); i++) {
+		uintptr_t frame = call->frames[i];
+		size_t chunk = min(PAGE_SIZE - offset, size - done);
+		
+		/* Frames outside of the identity mapping need to be mapped. */
+		bool mapped = (frame < identity_lo) ||
+		    (frame + PAGE_SIZE > identity_hi);
+		uintptr_t page = mapped ?
+		    km_map(frame, PAGE_SIZE, PAGE_WRITE | PAGE_CACHEABLE) :
+		    PA2KA(frame);
+		
+		errno_t rc = copy_from_uspace((void *) (page + offset),
+		    (void *) (src + done), chunk);
+		
+		if (mapped)
+			km_unmap(page, PAGE_SIZE);
+		
+		if (rc != EOK)
+			return rc;
+		
+		done += chunk;
+		offset = 0;
+	}
+	
+	return EOK;
+}
+
 /** Initialize an answerbox structure.
  *
  * @param box  Answerbox structure to be initialized.
@@ -276,6 +415,8 @@ errno_t ipc_call_sync(phone_t *phone, call_t *request)
  */
 void _ipc_answer_free_call(call_t *call, bool selflocked)
 {
+	KTRACE(KTRACE_IPC_ANSWER, (uintptr_t) call);
+	
 	/* Count sent answer */
 	irq_spinlock_lock(&TASK->lock, true);
 	TASK->ipc_info.answer_sent++;
@@ -358,6 +499,8 @@ static void _ipc_call_actions_internal(phone_t *phone, call_t *call,
 
 	call->data.phone = phone;
 	call->data.task_id = caller->taskid;
+	
+	KTRACE(KTRACE_IPC_CALL, (uintptr_t) call);
 }
 
 /** Simulate sending back a message.
@@ -987,14 +1130,9 @@ static bool print_task_phone_cb(cap_t *cap, void *arg)
  */
 void ipc_print_task(task_id_t taskid)
 {
-	irq_spinlock_lock(&tasks_lock, true);
-	task_t *task = task_find_by_id(taskid);
-	if (!task) {
-		irq_spinlock_unlock(&tasks_lock, true);
+	task_t *task = task_get_by_id(taskid);
+	if (!task)
 		return;
-	}
-	task_hold(task);
-	irq_spinlock_unlock(&tasks_lock, true);
 	
 	printf("[phone cap] [calls] [state\n");
 	
@@ -211,17 +211,9 @@ static void kbox_thread_proc(void *arg)
  */
 errno_t ipc_connect_kbox(task_id_t taskid, cap_handle_t *out_phone)
 {
-	irq_spinlock_lock(&tasks_lock, true);
-	
-	task_t *task = task_find_by_id(taskid);
-	if (task == NULL) {
-		irq_spinlock_unlock(&tasks_lock, true);
+	task_t *task = task_get_by_id(taskid);
+	if (task == NULL)
 		return ENOENT;
-	}
-	
-	atomic_inc(&task->refcount);
-	
-	irq_spinlock_unlock(&tasks_lock, true);
 	
 	mutex_lock(&task->kb.cleanup_lock);
 	
@@ -53,6 +53,14 @@ static errno_t request_preprocess(call_t *call, phone_t *phone)
 			return ELIMIT;
 	}
 
+	/*
+	 * Large transfers are copied by the recipient straight into the
+	 * frames of the destination buffer when it answers. If the frames
+	 * cannot be pinned, the data goes through the kernel buffer.
+	 */
+	(void) ipc_call_frames_pin(call, IPC_GET_ARG1(call->data),
+	    IPC_GET_ARG2(call->data));
+
 	return EOK;
 }
 
@@ -73,6 +81,14 @@ static errno_t answer_preprocess(call_t *answer, ipc_data_t *olddata)
 			 * information is not lost.
 			 */
 			IPC_SET_ARG1(answer->data, dst);
+			
+			if (answer->frames) {
+				errno_t rc = ipc_call_frames_copy_from_uspace(
+				    answer, src, size);
+				if (rc)
+					IPC_SET_RETVAL(answer->data, rc);
+				return EOK;
+			}
 				
 			answer->buffer = malloc(size, 0);
 			errno_t rc = copy_from_uspace(answer->buffer,
@@ -96,7 +112,10 @@ static errno_t answer_preprocess(call_t *answer, ipc_data_t *olddata)
 
 static errno_t answer_process(call_t *answer)
 {
-	if (answer->buffer) {
+	if (answer->frames) {
+		/* The data is already in place. */
+		ipc_call_frames_unpin(answer);
+	} else if (answer->buffer) {
 		uintptr_t dst = IPC_GET_ARG1(answer->data);
 		size_t size = IPC_GET_ARG2(answer->data);
 		errno_t rc;
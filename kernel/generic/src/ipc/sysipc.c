@@ -443,6 +443,74 @@ sys_errno_t sys_ipc_call_async_slow(sysarg_t handle, ipc_data_t *data,
 	return EOK;
 }
 
+/** Make a batch of asynchronous IPC calls.
+ *
+ * The calls are submitted in order until all of them are submitted or until
+ * the first one that cannot be made. At most IPC_BATCH_MAX calls are
+ * submitted by one invocation.
+ *
+ * @param calls     Userspace address of the array of requests.
+ * @param count     Number of requests in the array.
+ * @param submitted Userspace address where to store the number of
+ *                  submitted calls.
+ *
+ * @return EOK if all calls (up to IPC_BATCH_MAX) were submitted.
+ * @return Error code of the first call which could not be submitted
+ *         (see sys_ipc_call_async_fast()).
+ *
+ */
+sys_errno_t sys_ipc_call_async_batch(ipc_batch_call_t *calls, sysarg_t count,
+    size_t *submitted)
+{
+	size_t done = 0;
+	errno_t rc = EOK;
+	
+	if (count > IPC_BATCH_MAX)
+		count = IPC_BATCH_MAX;
+	
+	while (done < count) {
+		ipc_batch_call_t req;
+		rc = copy_from_uspace(&req, &calls[done], sizeof(req));
+		if (rc != EOK)
+			break;
+		
+		kobject_t *kobj = kobject_get(TASK, req.phone,
+		    KOBJECT_TYPE_PHONE);
+		if (!kobj) {
+			rc = ENOENT;
+			break;
+		}
+		
+		if (check_call_limit(kobj->phone)) {
+			kobject_put(kobj);
+			rc = ELIMIT;
+			break;
+		}
+		
+		call_t *call = ipc_call_alloc(0);
+		memcpy(call->data.args, req.args, sizeof(call->data.args));
+		
+		/* Set the user-defined label */
+		call->data.label = req.label;
+		
+		errno_t res = request_preprocess(call, kobj->phone);
+		
+		if (!res)
+			ipc_call(kobj->phone, call);
+		else
+			ipc_backsend_err(kobj->phone, call, res);
+		
+		kobject_put(kobj);
+		done++;
+	}
+	
+	errno_t crc = copy_to_uspace(submitted, &done, sizeof(done));
+	if (crc != EOK)
+		return (sys_errno_t) crc;
+	
+	return (sys_errno_t) rc;
+}
+
 /** Forward a received call to another destination
  *
  * Common code for both the fast and the slow version.
@@ -732,20 +800,24 @@ sys_errno_t sys_ipc_hangup(sysarg_t handle)
 	return rc;
 }
 
-/** Wait for an incoming IPC call or an answer.
+/** Wait for an incoming IPC call or an answer and pass it to userspace.
  *
  * @param calldata Pointer to buffer where the call/answer data is stored.
  * @param usec     Timeout. See waitq_sleep_timeout() for explanation.
  * @param flags    Select mode of sleep operation. See waitq_sleep_timeout()
  *                 for explanation.
+ * @param received Set to true if a call, an answer or a notification was
+ *                 stored in @a calldata.
  *
  * @return An error code on error.
  */
-sys_errno_t sys_ipc_wait_for_call(ipc_data_t *calldata, uint32_t usec,
-    unsigned int flags)
+static errno_t wait_for_call_common(ipc_data_t *calldata, uint32_t usec,
+    unsigned int flags, bool *received)
 {
 	call_t *call;
 	
+	*received = false;
+	
 restart:
 	
 #ifdef CONFIG_UDEBUG
@@ -766,6 +838,8 @@ restart:
 		return EOK;
 	}
 	
+	*received = true;
+	
 	call->data.flags = call->flags;
 	if (call->flags & IPC_CALL_NOTIF) {
 		/* Set in_phone_hash to the interrupt counter */
@@ -784,6 +858,7 @@ restart:
 		
 		if (call->flags & IPC_CALL_DISCARD_ANSWER) {
 			kobject_put(call->kobject);
+			*received = false;
 			goto restart;
 		}
 
@@ -795,8 +870,10 @@ restart:
 		return EOK;
 	}
 	
-	if (process_request(&TASK->answerbox, call))
+	if (process_request(&TASK->answerbox, call)) {
+		*received = false;
 		goto restart;
+	}
 	
 	cap_handle_t handle;
 	errno_t rc = cap_alloc(TASK, &handle);
@@ -819,6 +896,8 @@ restart:
 	return EOK;
 
 error:
+	*received = false;
+
 	if (handle >= 0)
 		cap_free(TASK, handle);
 
@@ -844,6 +923,74 @@ error:
 	return rc;
 }
 
+/** Wait for an incoming IPC call or an answer.
+ *
+ * @param calldata Pointer to buffer where the call/answer data is stored.
+ * @param usec     Timeout. See waitq_sleep_timeout() for explanation.
+ * @param flags    Select mode of sleep operation. See waitq_sleep_timeout()
+ *                 for explanation.
+ *
+ * @return An error code on error.
+ */
+sys_errno_t sys_ipc_wait_for_call(ipc_data_t *calldata, uint32_t usec,
+    unsigned int flags)
+{
+	bool received;
+	return (sys_errno_t) wait_for_call_common(calldata, usec, flags,
+	    &received);
+}
+
+/** Wait for a batch of incoming IPC calls and answers.
+ *
+ * Only the wait for the first call or answer may block. After that, calls
+ * and answers which are already pending are collected until the buffer is
+ * full or there are no more of them. At most IPC_BATCH_MAX calls and answers
+ * are received by one invocation.
+ *
+ * @param calldata Pointer to the array where the call/answer data is stored.
+ * @param count    Number of elements in the array.
+ * @param usec     Timeout. See waitq_sleep_timeout() for explanation.
+ * @param flags    Select mode of sleep operation. See waitq_sleep_timeout()
+ *                 for explanation.
+ * @param received Userspace address where to store the number of received
+ *                 calls and answers.
+ *
+ * @return An error code on error.
+ */
+sys_errno_t sys_ipc_wait_for_call_batch(ipc_data_t *calldata, sysarg_t count,
+    uint32_t usec, unsigned int flags, size_t *received)
+{
+	size_t done = 0;
+	errno_t rc = EOK;
+	
+	if (count > IPC_BATCH_MAX)
+		count = IPC_BATCH_MAX;
+	
+	while (done < count) {
+		bool got;
+		rc = wait_for_call_common(&calldata[done], usec, flags, &got);
+		if ((rc != EOK) || (!got))
+			break;
+		
+		done++;
+		usec = SYNCH_NO_TIMEOUT;
+		flags = SYNCH_FLAGS_NON_BLOCKING;
+	}
+	
+	errno_t crc = copy_to_uspace(received, &done, sizeof(done));
+	if (crc != EOK)
+		return (sys_errno_t) crc;
+	
+	/*
+	 * The calls and answers received so far have already been passed
+	 * to userspace and must not be lost because of a later failure.
+	 */
+	if (done > 0)
+		return EOK;
+	
+	return (sys_errno_t) rc;
+}
+
 /** Interrupt one thread from sys_ipc_wait_for_call().
  *
  */
@@ -58,6 +58,8 @@
 #include <mm/as.h>
 #include <mm/frame.h>
 #include <mm/km.h>
+#include <mm/slab.h>
+#include <mm/zero.h>
 #include <print.h>
 #include <log.h>
 #include <mem.h>
@@ -161,6 +163,34 @@ void kinit(void *arg)
 	 */
 	ARCH_OP(post_smp_init);
 	
+	/* Start thread reclaiming slab memory under memory pressure */
+	thread = thread_create(kslab, NULL, TASK, THREAD_FLAG_NONE,
+	    "kslab");
+	if (thread != NULL)
+		thread_ready(thread);
+	else
+		log(LF_OTHER, LVL_ERROR, "Unable to create kslab thread");
+	
+	/*
+	 * For each active CPU, create the thread keeping its pool of
+	 * pre-zeroed frames filled.
+	 */
+	zero_init();
+	
+	for (unsigned int cpu = 0; cpu < config.cpu_count; cpu++) {
+		if (!cpus[cpu].active)
+			continue;
+		
+		thread = thread_create(kzero, NULL, TASK,
+		    THREAD_FLAG_UNCOUNTED, "kzero");
+		if (thread != NULL) {
+			thread_wire(thread, &cpus[cpu]);
+			thread_ready(thread);
+		} else
+			log(LF_OTHER, LVL_ERROR,
+			    "Unable to create kzero thread for cpu%u", cpu);
+	}
+	
 	/* Start thread computing system load */
 	thread = thread_create(kload, NULL, TASK, THREAD_FLAG_NONE,
 	    "kload");
@@ -93,6 +93,7 @@
 #include <sysinfo/stats.h>
 #include <lib/ra.h>
 #include <cap/cap.h>
+#include <ktrace.h>
 
 /* Ensure [u]int*_t types are of correct size.
  *
@@ -263,6 +264,9 @@ void main_bsp_separated_stack(void)
 	/* Slab must be initialized after we know the number of processors. */
 	slab_enable_cpucache();
 	
+	/* Per-CPU frame caches require the final zone layout. */
+	frame_enable_cpucache();
+	
 	uint64_t size;
 	const char *size_suffix;
 	bin_order_suffix(zones_total_size(), &size, &size_suffix, false);
@@ -276,6 +280,9 @@ void main_bsp_separated_stack(void)
 	smp_call_init();
 	workq_global_init();
 	clock_counter_init();
+#ifdef CONFIG_KTRACE
+	ktrace_init();
+#endif
 	timeout_init();
 	scheduler_init();
 	caps_init();
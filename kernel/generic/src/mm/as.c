@@ -60,8 +60,10 @@
 #include <preemption.h>
 #include <synch/spinlock.h>
 #include <synch/mutex.h>
+#include <synch/rcu.h>
 #include <adt/list.h>
 #include <adt/btree.h>
+#include <adt/hash.h>
 #include <proc/task.h>
 #include <proc/thread.h>
 #include <arch/asm.h>
@@ -79,6 +81,7 @@
 #include <syscall/copy.h>
 #include <arch/interrupt.h>
 #include <interrupt.h>
+#include <ktrace.h>
 
 /**
  * Each architecture decides what functions will be used to carry out
@@ -110,12 +113,19 @@ LIST_INITIALIZE(inactive_as_with_asid_list);
 /** Kernel address space. */
 as_t *AS_KERNEL = NULL;
 
+/**
+ * Size (in pages) of the fault-around window. Values smaller than 2
+ * disable fault-around.
+ */
+size_t as_fault_around = AS_FAULT_AROUND;
+
 NO_TRACE static errno_t as_constructor(void *obj, unsigned int flags)
 {
 	as_t *as = (as_t *) obj;
 	
 	link_initialize(&as->inactive_as_with_asid_link);
 	mutex_initialize(&as->lock, MUTEX_PASSIVE);
+	mutex_initialize(&as->page_table_mutex, MUTEX_PASSIVE);
 	
 	return as_constructor_arch(as, flags);
 }
@@ -156,6 +166,8 @@ as_t *as_create(unsigned int flags)
 	(void) as_create_arch(as, 0);
 	
 	btree_create(&as->as_area_btree);
+	for (unsigned int l = 0; l < AS_AREA_INDEX_LEVELS; l++)
+		as->area_index[l] = NULL;
 	
 	if (flags & FLAG_AS_KERNEL)
 		as->asid = ASID_KERNEL;
@@ -165,6 +177,16 @@ as_t *as_create(unsigned int flags)
 	atomic_set(&as->refcount, 0);
 	as->cpu_refcount = 0;
 	
+	if (flags & FLAG_AS_KERNEL) {
+		as->cpu_mask = NULL;
+	} else {
+		size_t size = sizeof(unsigned long) *
+		    ((config.cpu_count + AS_CPU_MASK_BITS - 1) / AS_CPU_MASK_BITS);
+		
+		as->cpu_mask = (unsigned long *) malloc(size, 0);
+		memsetb(as->cpu_mask, size, 0);
+	}
+	
 #ifdef AS_PAGE_TABLE
 	as->genarch.page_table = page_table_create(flags);
 #else
@@ -245,6 +267,7 @@ retry:
 			as_area_destroy(as, node->key[0]);
 	}
 	
+	assert(as->area_index[0] == NULL);
 	btree_destroy(&as->as_area_btree);
 	
 #ifdef AS_PAGE_TABLE
@@ -253,9 +276,51 @@ retry:
 	page_table_destroy(NULL);
 #endif
 	
+	if (as->cpu_mask != NULL)
+		free(as->cpu_mask);
+	
 	slab_free(as_cache, as);
 }
 
+/** Test whether a processor may hold TLB entries of an address space.
+ *
+ * @param as     Address space.
+ * @param cpu_id Processor ID.
+ *
+ * @return True if the processor has to take part in TLB shootdowns
+ *         of the address space.
+ *
+ */
+NO_TRACE bool as_cpu_mask_test(as_t *as, unsigned int cpu_id)
+{
+	if (as->cpu_mask == NULL)
+		return true;
+	
+	unsigned long word = __atomic_load_n(
+	    &as->cpu_mask[cpu_id / AS_CPU_MASK_BITS], __ATOMIC_RELAXED);
+	
+	return ((word & (1UL << (cpu_id % AS_CPU_MASK_BITS))) != 0);
+}
+
+/** Mark a processor as possibly holding TLB entries of an address space.
+ *
+ * The update is a full memory barrier. It is ordered before the check
+ * for a TLB shootdown in progress in as_switch().
+ *
+ */
+NO_TRACE static void as_cpu_mask_set(as_t *as, unsigned int cpu_id)
+{
+	(void) __atomic_fetch_or(&as->cpu_mask[cpu_id / AS_CPU_MASK_BITS],
+	    1UL << (cpu_id % AS_CPU_MASK_BITS), __ATOMIC_SEQ_CST);
+}
+
+/** Mark a processor as holding no TLB entries of an address space. */
+NO_TRACE static void as_cpu_mask_clear(as_t *as, unsigned int cpu_id)
+{
+	(void) __atomic_fetch_and(&as->cpu_mask[cpu_id / AS_CPU_MASK_BITS],
+	    ~(1UL << (cpu_id % AS_CPU_MASK_BITS)), __ATOMIC_SEQ_CST);
+}
+
 /** Hold a reference to an address space.
  *
  * Holding a reference to an address space prevents destruction
@@ -519,6 +584,180 @@ NO_TRACE static uintptr_t as_get_unmapped_area(as_t *as, uintptr_t bound,
 	return (uintptr_t) -1;
 }
 
+/** Free an address space area structure after a grace period.
+ *
+ * @param item RCU item of the area.
+ *
+ */
+NO_TRACE static void as_area_free(rcu_item_t *item)
+{
+	free(member_to_inst(item, as_area_t, rcu));
+}
+
+/** Remove reference to address space area structure.
+ *
+ * If the reference count drops to 0, the structure is deallocated
+ * after a grace period, since lock-free lookups of the area index
+ * may still be looking at it.
+ *
+ * @param area Pointer to address space area.
+ *
+ */
+void as_area_release(as_area_t *area)
+{
+	if (atomic_predec(&area->refcount) == 0)
+		rcu_call(&area->rcu, as_area_free);
+}
+
+/** Add reference to address space area found by a lock-free lookup.
+ *
+ * Must be called in an RCU reader section.
+ *
+ * @param area Pointer to address space area.
+ *
+ * @return False if the area is already being deallocated.
+ *
+ */
+NO_TRACE static bool as_area_try_hold(as_area_t *area)
+{
+	assert(rcu_read_locked());
+	
+	/* Do not resurrect an area whose last reference is gone. */
+	atomic_count_t refcount = atomic_get(&area->refcount);
+	while (refcount != 0) {
+		if (__atomic_compare_exchange_n(&area->refcount.count,
+		    &refcount, refcount + 1, false, __ATOMIC_ACQUIRE,
+		    __ATOMIC_RELAXED))
+			return true;
+	}
+	
+	return false;
+}
+
+/** Compute the number of area index levels of an area.
+ *
+ * The number is derived from a hash of the base address, so each level
+ * holds roughly a quarter of the areas of the level below it.
+ *
+ * @param base Base address of the area.
+ *
+ * @return Number of levels, at least one.
+ *
+ */
+NO_TRACE static unsigned int as_area_index_levels(uintptr_t base)
+{
+	size_t hash = hash_mix(base >> PAGE_WIDTH);
+	unsigned int levels = 1;
+	
+	while ((levels < AS_AREA_INDEX_LEVELS) && ((hash & 3) == 0)) {
+		levels++;
+		hash >>= 2;
+	}
+	
+	return levels;
+}
+
+/** Find the links of the area index preceding an address.
+ *
+ * @param as    Address space. Must be locked.
+ * @param base  Address to look for.
+ * @param links Place to store, for each level, the link which points
+ *              to the first area with base not below the address.
+ *
+ */
+NO_TRACE static void as_area_index_links(as_t *as, uintptr_t base,
+    as_area_t **links[])
+{
+	as_area_t **next = as->area_index;
+	
+	for (unsigned int l = AS_AREA_INDEX_LEVELS; l-- > 0; ) {
+		while ((next[l] != NULL) && (next[l]->base < base))
+			next = next[l]->index_next;
+		
+		links[l] = &next[l];
+	}
+}
+
+/** Insert area into the area index of address space.
+ *
+ * The index is a skip list of the areas sorted by their base addresses
+ * which can be searched without holding the address space mutex. The
+ * area is linked in from the lowest level up, so that readers always
+ * see sorted lists on all levels.
+ *
+ * @param as   Address space. Must be locked.
+ * @param area Area to be inserted.
+ *
+ */
+NO_TRACE static void as_area_index_insert(as_t *as, as_area_t *area)
+{
+	assert(mutex_locked(&as->lock));
+	
+	as_area_t **links[AS_AREA_INDEX_LEVELS];
+	as_area_index_links(as, area->base, links);
+	
+	area->index_levels = as_area_index_levels(area->base);
+	for (unsigned int l = 0; l < area->index_levels; l++)
+		area->index_next[l] = *links[l];
+	
+	for (unsigned int l = 0; l < area->index_levels; l++)
+		rcu_assign(*links[l], area);
+}
+
+/** Remove area from the area index of address space.
+ *
+ * The links of the removed area are left intact for the readers which
+ * might still be passing through it. The area itself is freed only after
+ * a grace period.
+ *
+ * @param as   Address space. Must be locked.
+ * @param area Area to be removed.
+ *
+ */
+NO_TRACE static void as_area_index_remove(as_t *as, as_area_t *area)
+{
+	assert(mutex_locked(&as->lock));
+	
+	as_area_t **links[AS_AREA_INDEX_LEVELS];
+	as_area_index_links(as, area->base, links);
+	
+	for (unsigned int l = area->index_levels; l-- > 0; ) {
+		assert(*links[l] == area);
+		rcu_assign(*links[l], area->index_next[l]);
+	}
+}
+
+/** Find address space area in the area index.
+ *
+ * Must be called in an RCU reader section. The area is neither
+ * locked nor referenced and the caller must validate it.
+ *
+ * @param as Address space.
+ * @param va Virtual address.
+ *
+ * @return Area with the highest base not above va or NULL.
+ *
+ */
+NO_TRACE static as_area_t *as_area_index_find(as_t *as, uintptr_t va)
+{
+	assert(rcu_read_locked());
+	
+	as_area_t **next = as->area_index;
+	as_area_t *area = NULL;
+	
+	for (unsigned int l = AS_AREA_INDEX_LEVELS; l-- > 0; ) {
+		as_area_t *cur;
+		
+		while (((cur = rcu_access(next[l])) != NULL) &&
+		    (cur->base <= va)) {
+			area = cur;
+			next = cur->index_next;
+		}
+	}
+	
+	return area;
+}
+
 /** Remove reference to address space area share info.
  *
  * If the reference count drops to 0, the sh_info is deallocated.
@@ -602,11 +841,21 @@ as_area_t *as_area_create(as_t *as, unsigned int flags, size_t size,
 	mutex_lock(&as->lock);
 	
 	if (*base == (uintptr_t) AS_AREA_ANY) {
-		*base = as_get_unmapped_area(as, bound, size, guarded);
+		/*
+		 * Areas backed by large frames need their chunks to be
+		 * aligned also in the virtual address space.
+		 */
+		size_t slack = (flags & AS_AREA_LARGE_PAGES) ?
+		    AS_LARGE_SIZE - PAGE_SIZE : 0;
+		
+		*base = as_get_unmapped_area(as, bound, size + slack, guarded);
 		if (*base == (uintptr_t) -1) {
 			mutex_unlock(&as->lock);
 			return NULL;
 		}
+		
+		if (flags & AS_AREA_LARGE_PAGES)
+			*base = ALIGN_UP(*base, AS_LARGE_SIZE);
 	}
 
 	if (overflows_into_positive(*base, size)) {
@@ -622,12 +871,14 @@ as_area_t *as_area_create(as_t *as, unsigned int flags, size_t size,
 	as_area_t *area = (as_area_t *) malloc(sizeof(as_area_t), 0);
 	
 	mutex_initialize(&area->lock, MUTEX_PASSIVE);
+	atomic_set(&area->refcount, 1);
 	
 	area->as = as;
 	area->flags = flags;
 	area->attributes = attrs;
 	area->pages = pages;
 	area->resident = 0;
+	area->large_pages = 0;
 	area->base = *base;
 	area->backend = backend;
 	area->sh_info = NULL;
@@ -678,6 +929,7 @@ as_area_t *as_area_create(as_t *as, unsigned int flags, size_t size,
 	btree_create(&area->used_space);
 	btree_insert(&as->as_area_btree, *base, (void *) area,
 	    NULL);
+	as_area_index_insert(as, area);
 	
 	mutex_unlock(&as->lock);
 	
@@ -747,6 +999,55 @@ NO_TRACE static as_area_t *find_area_and_lock(as_t *as, uintptr_t va)
 	return NULL;
 }
 
+/** Unmap a used page of an address space area.
+ *
+ * If the page starts a chunk mapped by a large mapping, the whole chunk is
+ * unmapped at once. A large mapping must not be entered in the middle, so
+ * that it is not split while a TLB shootdown sequence is in progress.
+ *
+ * The address space area and page tables must be already locked.
+ *
+ * @param area   Address space area.
+ * @param page   Used page of the area.
+ * @param frames If not NULL, the frames of the unmapped pages are stored
+ *               there instead of being freed by the backend.
+ *
+ * @return Number of unmapped pages.
+ *
+ */
+NO_TRACE static size_t as_area_unmap(as_area_t *area, uintptr_t page,
+    uintptr_t *frames)
+{
+	assert(page_table_locked(area->as));
+	assert(mutex_locked(&area->lock));
+	
+	pte_t pte;
+	bool found = page_mapping_find(area->as, page, false, &pte);
+	
+	assert(found);
+	assert(PTE_VALID(&pte));
+	assert(PTE_PRESENT(&pte));
+	
+	size_t count = 1;
+	if ((area->large_pages > 0) && (IS_ALIGNED(page, AS_LARGE_SIZE)) &&
+	    (page_mapping_remove_large(area->as, page))) {
+		count = AS_LARGE_FRAMES;
+		area->large_pages -= AS_LARGE_FRAMES;
+	} else
+		page_mapping_remove(area->as, page);
+	
+	for (size_t i = 0; i < count; i++) {
+		uintptr_t frame = PTE_GET_FRAME(&pte) + P2SZ(i);
+		
+		if (frames != NULL)
+			frames[i] = frame;
+		else if ((area->backend) && (area->backend->frame_free))
+			area->backend->frame_free(area, page + P2SZ(i), frame);
+	}
+	
+	return count;
+}
+
 /** Find address space area and change it.
  *
  * @param as      Address space.
@@ -818,13 +1119,87 @@ errno_t as_area_resize(as_t *as, uintptr_t address, size_t size, unsigned int fl
 		page_table_lock(as, false);
 		
 		/*
-		 * Remove frames belonging to used space starting from
-		 * the highest addresses downwards until an overlap with
-		 * the resized address space area is found. Note that this
-		 * is also the right way to remove part of the used_space
-		 * B+tree leaf list.
+		 * A large mapping crossing the new end of the area has to be
+		 * split before its tail can be unmapped. The split allocates
+		 * memory, so it is done before the TLB shootdown sequence.
+		 */
+		if ((area->large_pages > 0) &&
+		    (!IS_ALIGNED(start_free, AS_LARGE_SIZE)) &&
+		    (page_mapping_split_large(as, start_free)))
+			area->large_pages -= AS_LARGE_FRAMES;
+		
+		/*
+		 * Start TLB shootdown sequence.
+		 *
+		 * All pages beyond the new end of the area are unmapped in
+		 * one sequence, so that the other processors are interrupted
+		 * only once. The used_space B+tree is only read inside the
+		 * sequence and it is trimmed afterwards, because
+		 * used_space_remove() may use a blocking memory allocation
+		 * for its B+tree. Blocking while holding the tlblock spinlock
+		 * is forbidden and would hit a kernel assertion.
 		 */
+		
+		ipl_t ipl = tlb_shootdown_start_as(as, TLB_INVL_PAGES,
+		    area->base + P2SZ(pages), area->pages - pages);
+		
 		bool cond = true;
+		list_foreach_rev(area->used_space.leaf_list, leaf_link,
+		    btree_node_t, node) {
+			for (size_t j = node->keys; (cond) && (j > 0); j--) {
+				uintptr_t ptr = node->key[j - 1];
+				size_t node_size = (size_t) node->value[j - 1];
+				size_t i = 0;
+				
+				if (ptr + P2SZ(node_size) <= start_free) {
+					/*
+					 * The whole interval fits completely
+					 * in the resized address space area.
+					 */
+					cond = false;
+					break;
+				}
+				
+				if (ptr < start_free) {
+					/*
+					 * Part of the interval overlaps with
+					 * the resized address space area.
+					 */
+					i = (start_free - ptr) >> PAGE_WIDTH;
+					cond = false;
+				}
+				
+				while (i < node_size)
+					i += as_area_unmap(area, ptr + P2SZ(i),
+					    NULL);
+			}
+			
+			if (!cond)
+				break;
+		}
+		
+		/*
+		 * Finish TLB shootdown sequence.
+		 */
+		
+		tlb_invalidate_pages(as->asid, area->base + P2SZ(pages),
+		    area->pages - pages);
+		
+		/*
+		 * Invalidate software translation caches
+		 * (e.g. TSB on sparc64, PHT on ppc32).
+		 */
+		as_invalidate_translation_cache(as, area->base + P2SZ(pages),
+		    area->pages - pages);
+		tlb_shootdown_finalize(ipl);
+		
+		/*
+		 * Remove used space starting from the highest addresses
+		 * downwards until an overlap with the resized address space
+		 * area is found. Note that this is also the right way to
+		 * remove part of the used_space B+tree leaf list.
+		 */
+		cond = true;
 		while (cond) {
 			assert(!list_empty(&area->used_space.leaf_list));
 			
@@ -836,29 +1211,25 @@ errno_t as_area_resize(as_t *as, uintptr_t address, size_t size, unsigned int fl
 				uintptr_t ptr = node->key[node->keys - 1];
 				size_t node_size =
 				    (size_t) node->value[node->keys - 1];
-				size_t i = 0;
 				
-				if (overlaps(ptr, P2SZ(node_size), area->base,
-				    P2SZ(pages))) {
-					
-					if (ptr + P2SZ(node_size) <= start_free) {
-						/*
-						 * The whole interval fits
-						 * completely in the resized
-						 * address space area.
-						 */
-						break;
-					}
-					
+				if (ptr + P2SZ(node_size) <= start_free) {
 					/*
-					 * Part of the interval corresponding
-					 * to b and c overlaps with the resized
+					 * The whole interval fits
+					 * completely in the resized
 					 * address space area.
 					 */
+					break;
+				}
+				
+				if (ptr < start_free) {
+					/*
+					 * Part of the interval overlaps with
+					 * the resized address space area.
+					 */
 					
 					/* We are almost done */
 					cond = false;
-					i = (start_free - ptr) >> PAGE_WIDTH;
+					size_t i = (start_free - ptr) >> PAGE_WIDTH;
 					if (!used_space_remove(area, start_free,
 					    node_size - i))
 						panic("Cannot remove used space.");
@@ -870,58 +1241,6 @@ errno_t as_area_resize(as_t *as, uintptr_t address, size_t size, unsigned int fl
 					if (!used_space_remove(area, ptr, node_size))
 						panic("Cannot remove used space.");
 				}
-				
-				/*
-				 * Start TLB shootdown sequence.
-				 *
-				 * The sequence is rather short and can be
-				 * repeated multiple times. The reason is that
-				 * we don't want to have used_space_remove()
-				 * inside the sequence as it may use a blocking
-				 * memory allocation for its B+tree. Blocking
-				 * while holding the tlblock spinlock is
-				 * forbidden and would hit a kernel assertion.
-				 */
-
-				ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES,
-				    as->asid, area->base + P2SZ(pages),
-				    area->pages - pages);
-		
-				for (; i < node_size; i++) {
-					pte_t pte;
-					bool found = page_mapping_find(as,
-					    ptr + P2SZ(i), false, &pte);
-					
-					assert(found);
-					assert(PTE_VALID(&pte));
-					assert(PTE_PRESENT(&pte));
-					
-					if ((area->backend) &&
-					    (area->backend->frame_free)) {
-						area->backend->frame_free(area,
-						    ptr + P2SZ(i),
-						    PTE_GET_FRAME(&pte));
-					}
-					
-					page_mapping_remove(as, ptr + P2SZ(i));
-				}
-		
-				/*
-				 * Finish TLB shootdown sequence.
-				 */
-		
-				tlb_invalidate_pages(as->asid,
-				    area->base + P2SZ(pages),
-				    area->pages - pages);
-		
-				/*
-				 * Invalidate software translation caches
-				 * (e.g. TSB on sparc64, PHT on ppc32).
-				 */
-				as_invalidate_translation_cache(as,
-				    area->base + P2SZ(pages),
-				    area->pages - pages);
-				tlb_shootdown_finalize(ipl);
 			}
 		}
 		page_table_unlock(as, false);
@@ -988,7 +1307,7 @@ errno_t as_area_destroy(as_t *as, uintptr_t address)
 	/*
 	 * Start TLB shootdown sequence.
 	 */
-	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as->asid, area->base,
+	ipl_t ipl = tlb_shootdown_start_as(as, TLB_INVL_PAGES, area->base,
 	    area->pages);
 	
 	/*
@@ -1002,24 +1321,9 @@ errno_t as_area_destroy(as_t *as, uintptr_t address)
 			uintptr_t ptr = node->key[i];
 			size_t size;
 			
-			for (size = 0; size < (size_t) node->value[i]; size++) {
-				pte_t pte;
-				bool found = page_mapping_find(as,
-				     ptr + P2SZ(size), false, &pte);
-				
-				assert(found);
-				assert(PTE_VALID(&pte));
-				assert(PTE_PRESENT(&pte));
-				
-				if ((area->backend) &&
-				    (area->backend->frame_free)) {
-					area->backend->frame_free(area,
-					    ptr + P2SZ(size),
-					    PTE_GET_FRAME(&pte));
-				}
-				
-				page_mapping_remove(as, ptr + P2SZ(size));
-			}
+			for (size = 0; size < (size_t) node->value[i]; )
+				size += as_area_unmap(area, ptr + P2SZ(size),
+				    NULL);
 		}
 	}
 	
@@ -1050,8 +1354,13 @@ errno_t as_area_destroy(as_t *as, uintptr_t address)
 	 * Remove the empty area from address space.
 	 */
 	btree_remove(&as->as_area_btree, base, NULL);
+	as_area_index_remove(as, area);
 	
-	free(area);
+	/*
+	 * Lock-free page fault lookups and the per-thread area caches may
+	 * still reference the area, which is marked as partial now.
+	 */
+	as_area_release(area);
 	
 	mutex_unlock(&as->lock);
 	return 0;
@@ -1207,6 +1516,57 @@ NO_TRACE bool as_area_check_access(as_area_t *area, pf_access_t access)
 	return true;
 }
 
+/** Find the unused large chunk of an address space area containing a page.
+ *
+ * The chunk is the naturally aligned block of AS_LARGE_FRAMES pages
+ * containing the page. It can be mapped using a large mapping only if the
+ * page tables support them, it lies within the area and none of its pages
+ * is mapped yet.
+ *
+ * The address space area must be already locked, which keeps the answer
+ * valid until the area is unlocked. The page tables are locked only while
+ * the chunk is being checked.
+ *
+ * @param area  Address space area.
+ * @param page  Page within the area.
+ * @param chunk Place to store the base of the chunk.
+ *
+ * @return True if the chunk can be mapped using a large frame.
+ *
+ */
+bool as_area_large_chunk(as_area_t *area, uintptr_t page, uintptr_t *chunk)
+{
+	assert(mutex_locked(&area->lock));
+	
+	if (!page_mapping_large_supported())
+		return false;
+	
+	uintptr_t base = ALIGN_DOWN(page, AS_LARGE_SIZE);
+	
+	if ((base < area->base) ||
+	    (base + AS_LARGE_SIZE > area->base + P2SZ(area->pages)))
+		return false;
+	
+	bool unused = true;
+	
+	page_table_lock(area->as, false);
+	
+	for (size_t i = 0; i < AS_LARGE_FRAMES; i++) {
+		pte_t pte;
+		
+		if ((page_mapping_find(area->as, base + P2SZ(i), false, &pte)) &&
+		    (PTE_VALID(&pte))) {
+			unused = false;
+			break;
+		}
+	}
+	
+	page_table_unlock(area->as, false);
+	
+	*chunk = base;
+	return unused;
+}
+
 /** Convert address space area flags to page flags.
  *
  * @param aflags Flags of some address space area.
@@ -1298,7 +1658,7 @@ errno_t as_area_change_flags(as_t *as, unsigned int flags, uintptr_t address)
 	/*
 	 * Start TLB shootdown sequence.
 	 */
-	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as->asid, area->base,
+	ipl_t ipl = tlb_shootdown_start_as(as, TLB_INVL_PAGES, area->base,
 	    area->pages);
 	
 	/*
@@ -1315,19 +1675,13 @@ errno_t as_area_change_flags(as_t *as, unsigned int flags, uintptr_t address)
 			uintptr_t ptr = node->key[i];
 			size_t size;
 			
-			for (size = 0; size < (size_t) node->value[i]; size++) {
-				pte_t pte;
-				bool found = page_mapping_find(as,
-				    ptr + P2SZ(size), false, &pte);
-				
-				assert(found);
-				assert(PTE_VALID(&pte));
-				assert(PTE_PRESENT(&pte));
-				
-				old_frame[frame_idx++] = PTE_GET_FRAME(&pte);
-				
+			for (size = 0; size < (size_t) node->value[i]; ) {
 				/* Remove old mapping */
-				page_mapping_remove(as, ptr + P2SZ(size));
+				size_t count = as_area_unmap(area,
+				    ptr + P2SZ(size), &old_frame[frame_idx]);
+				
+				size += count;
+				frame_idx += count;
 			}
 		}
 	}
@@ -1387,6 +1741,127 @@ errno_t as_area_change_flags(as_t *as, unsigned int flags, uintptr_t address)
 	return 0;
 }
 
+/** Map the cheap pages around a resolved page fault.
+ *
+ * Try to map the pages of the aligned fault-around window which contains
+ * the faulting page. Only pages which are not mapped yet and which the
+ * backend can map cheaply (i.e. without copying data or clearing a frame
+ * on the spot) are considered.
+ *
+ * The address space area must be already locked. The page tables are
+ * locked only while each page is being checked, the backend locks them
+ * again to insert the mapping.
+ * Each page mapped in addition to the faulting page is accounted in
+ * the fault-around statistics of the current task.
+ *
+ * @param area Address space area containing the faulting page.
+ * @param page Faulting page.
+ *
+ */
+NO_TRACE static void as_fault_around_area(as_area_t *area, uintptr_t page)
+{
+	size_t window = min(as_fault_around, AS_FAULT_AROUND_MAX);
+	if ((window < 2) || (!area->backend->is_fault_cheap))
+		return;
+	
+	uintptr_t start = page - P2SZ((page >> PAGE_WIDTH) % window);
+	uintptr_t area_end = area->base + P2SZ(area->pages);
+	
+	for (size_t i = 0; i < window; i++) {
+		uintptr_t cur = start + P2SZ(i);
+		
+		if ((cur == page) || (cur < area->base))
+			continue;
+		
+		if (cur >= area_end)
+			break;
+		
+		pte_t pte;
+		page_table_lock(AS, false);
+		bool present = (page_mapping_find(AS, cur, false, &pte)) &&
+		    (PTE_PRESENT(&pte));
+		page_table_unlock(AS, false);
+		
+		if (present)
+			continue;
+		
+		if (!area->backend->is_fault_cheap(area, cur))
+			continue;
+		
+		/*
+		 * The neighbouring pages are mapped as if they were read,
+		 * the backends map them with the flags of the area anyway.
+		 */
+		if (area->backend->page_fault(area, cur, PF_ACCESS_READ) !=
+		    AS_PF_OK)
+			break;
+		
+		atomic_inc(&TASK->fault_around);
+	}
+}
+
+/** Find and lock address space area of a page fault without the address space lock.
+ *
+ * The area cached by the current thread is tried first, the area index
+ * of the current address space is searched on a miss. The page table
+ * and the area mutexes are enough to resolve the fault, so parallel
+ * page faults in different areas of the address space do not serialize
+ * on the address space mutex.
+ *
+ * @param page Faulting page.
+ *
+ * @return Locked address space area containing the page. The area stays
+ *         referenced by the area cache of the current thread.
+ * @return NULL if the fault has to be resolved with the address space
+ *         mutex held.
+ *
+ */
+NO_TRACE static as_area_t *as_fault_area_lock(uintptr_t page)
+{
+	as_area_t *area = THREAD->fault_area;
+	
+	if ((area == NULL) || (area->as != AS) || (page < area->base) ||
+	    (page - area->base >= P2SZ(area->pages))) {
+		rcu_read_lock();
+		
+		as_area_t *found = as_area_index_find(AS, page);
+		if ((found != NULL) && (!as_area_try_hold(found)))
+			found = NULL;
+		
+		rcu_read_unlock();
+		
+		if (found == NULL)
+			return NULL;
+		
+		if (area != NULL)
+			as_area_release(area);
+		
+		THREAD->fault_area = found;
+		area = found;
+	}
+	
+	mutex_lock(&area->lock);
+	
+	if (area->attributes & AS_AREA_ATTR_PARTIAL) {
+		/*
+		 * The area is being destroyed or it is not fully
+		 * initialized. Do not keep it cached.
+		 */
+		mutex_unlock(&area->lock);
+		THREAD->fault_area = NULL;
+		as_area_release(area);
+		return NULL;
+	}
+	
+	/* The area might have been shrunk before it got locked. */
+	if (page - area->base >= P2SZ(area->pages)) {
+		mutex_unlock(&area->lock);
+		return NULL;
+	}
+	
+	return area;
+}
+
 /** Handle page fault within the current address space.
  *
  * This is the high-level page fault handler. It decides whether the page fault
@@ -1410,6 +1885,8 @@ int as_page_fault(uintptr_t address, pf_access_t access, istate_t *istate)
 {
 	uintptr_t page = ALIGN_DOWN(address, PAGE_SIZE);
 	int rc = AS_PF_FAULT;
+	
+	KTRACE(KTRACE_PF_ENTER, address);
 
 	if (!THREAD)
 		goto page_fault;
@@ -1417,15 +1894,27 @@ int as_page_fault(uintptr_t address, pf_access_t access, istate_t *istate)
 	if (!AS)
 		goto page_fault;
 	
-	mutex_lock(&AS->lock);
-	as_area_t *area = find_area_and_lock(AS, page);
+	atomic_inc(&TASK->page_faults);
+	
+	/*
+	 * The address space mutex is taken only if the lock-free lookup
+	 * fails, e.g. when the address space areas are being changed.
+	 */
+	bool as_locked = false;
+	as_area_t *area = as_fault_area_lock(page);
 	if (!area) {
-		/*
-		 * No area contained mapping for 'page'.
-		 * Signal page fault to low-level handler.
-		 */
-		mutex_unlock(&AS->lock);
-		goto page_fault;
+		mutex_lock(&AS->lock);
+		as_locked = true;
+		
+		area = find_area_and_lock(AS, page);
+		if (!area) {
+			/*
+			 * No area contained mapping for 'page'.
+			 * Signal page fault to low-level handler.
+			 */
+			mutex_unlock(&AS->lock);
+			goto page_fault;
+		}
 	}
 	
 	if (area->attributes & AS_AREA_ATTR_PARTIAL) {
@@ -1434,7 +1923,8 @@ int as_page_fault(uintptr_t address, pf_access_t access, istate_t *istate)
 		 * Avoid possible race by returning error.
 		 */
 		mutex_unlock(&area->lock);
-		mutex_unlock(&AS->lock);
+		if (as_locked)
+			mutex_unlock(&AS->lock);
 		goto page_fault;
 	}
 	
@@ -1444,25 +1934,32 @@ int as_page_fault(uintptr_t address, pf_access_t access, istate_t *istate)
 		 * or the backend cannot handle page faults.
 		 */
 		mutex_unlock(&area->lock);
-		mutex_unlock(&AS->lock);
+		if (as_locked)
+			mutex_unlock(&AS->lock);
 		goto page_fault;
 	}
 	
-	page_table_lock(AS, false);
-	
 	/*
 	 * To avoid race condition between two page faults on the same address,
 	 * we need to make sure the mapping has not been already inserted.
+	 * The mappings of the area change only with the area locked, so the
+	 * page tables need to be locked just for the lookup. The backend
+	 * locks them again only to insert the new mapping, so faults in
+	 * other areas do not wait for the frame to be prepared.
 	 */
 	pte_t pte;
+	page_table_lock(AS, false);
 	bool found = page_mapping_find(AS, page, false, &pte);
+	page_table_unlock(AS, false);
+	
 	if (found && PTE_PRESENT(&pte)) {
 		if (((access == PF_ACCESS_READ) && PTE_READABLE(&pte)) ||
 		    (access == PF_ACCESS_WRITE && PTE_WRITABLE(&pte)) ||
 		    (access == PF_ACCESS_EXEC && PTE_EXECUTABLE(&pte))) {
-			page_table_unlock(AS, false);
 			mutex_unlock(&area->lock);
-			mutex_unlock(&AS->lock);
+			if (as_locked)
+				mutex_unlock(&AS->lock);
+			KTRACE(KTRACE_PF_EXIT, AS_PF_OK);
 			return AS_PF_OK;
 		}
 	}
@@ -1472,15 +1969,18 @@ int as_page_fault(uintptr_t address, pf_access_t access, istate_t *istate)
 	 */
 	rc = area->backend->page_fault(area, page, access);
 	if (rc != AS_PF_OK) {
-		page_table_unlock(AS, false);
 		mutex_unlock(&area->lock);
-		mutex_unlock(&AS->lock);
+		if (as_locked)
+			mutex_unlock(&AS->lock);
 		goto page_fault;
 	}
 	
-	page_table_unlock(AS, false);
+	as_fault_around_area(area, page);
+	
 	mutex_unlock(&area->lock);
-	mutex_unlock(&AS->lock);
+	if (as_locked)
+		mutex_unlock(&AS->lock);
+	KTRACE(KTRACE_PF_EXIT, AS_PF_OK);
 	return AS_PF_OK;
 	
 page_fault:
@@ -1501,6 +2001,7 @@ page_fault:
 		panic_memtrap(istate, access, address, NULL);
 	}
 	
+	KTRACE(KTRACE_PF_EXIT, AS_PF_DEFER);
 	return AS_PF_DEFER;
 }
 
@@ -1521,6 +2022,18 @@ void as_switch(as_t *old_as, as_t *new_as)
 	DEADLOCK_PROBE_INIT(p_asidlock);
 	preemption_disable();
 	
+	if ((new_as->cpu_mask != NULL) && (!as_cpu_mask_test(new_as, CPU->id))) {
+		/*
+		 * Announce this processor in the CPU mask of the new address
+		 * space before installing it, so that TLB shootdowns started
+		 * from now on are delivered here. A shootdown which has read
+		 * the mask before the bit was set may have missed us and must
+		 * finish before we start using the page tables.
+		 */
+		as_cpu_mask_set(new_as, CPU->id);
+		tlb_shootdown_wait();
+	}
+	
 retry:
 	(void) interrupts_disable();
 	if (!spinlock_trylock(&asidlock)) {
@@ -1584,6 +2097,13 @@ retry:
 	
 	spinlock_unlock(&asidlock);
 	
+	/*
+	 * If the switch has dropped all TLB entries of the old address
+	 * space, this processor no longer needs its TLB shootdowns.
+	 */
+	if ((AS_SWITCH_FLUSHES_TLB) && (old_as) && (old_as->cpu_mask != NULL))
+		as_cpu_mask_clear(old_as, CPU->id);
+	
 	AS = new_as;
 }
 
@@ -1697,7 +2217,7 @@ size_t as_area_get_size(uintptr_t base)
 {
 	size_t size;
 	
-	page_table_lock(AS, true);
+	mutex_lock(&AS->lock);
 	as_area_t *src_area = find_area_and_lock(AS, base);
 	
 	if (src_area) {
@@ -1706,7 +2226,7 @@ size_t as_area_get_size(uintptr_t base)
 	} else
 		size = 0;
 	
-	page_table_unlock(AS, true);
+	mutex_unlock(&AS->lock);
 	return size;
 }
 
@@ -2262,6 +2782,7 @@ void as_get_area_info(as_t *as, as_area_info_t **obuf, size_t *osize)
 			info[area_idx].start_addr = area->base;
 			info[area_idx].size = P2SZ(area->pages);
 			info[area_idx].flags = area->flags;
+			info[area_idx].large_size = P2SZ(area->large_pages);
 			++area_idx;
 			
 			mutex_unlock(&area->lock);
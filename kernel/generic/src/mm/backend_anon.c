@@ -45,6 +45,7 @@
 #include <mm/frame.h>
 #include <mm/slab.h>
 #include <mm/km.h>
+#include <mm/zero.h>
 #include <synch/mutex.h>
 #include <adt/list.h>
 #include <adt/btree.h>
@@ -63,6 +64,7 @@ static bool anon_is_resizable(as_area_t *);
 static bool anon_is_shareable(as_area_t *);
 
 static int anon_page_fault(as_area_t *, uintptr_t, pf_access_t);
+static bool anon_is_fault_cheap(as_area_t *, uintptr_t);
 static void anon_frame_free(as_area_t *, uintptr_t, uintptr_t);
 
 mem_backend_t anon_backend = {
@@ -75,6 +77,7 @@ mem_backend_t anon_backend = {
 	.is_shareable = anon_is_shareable,
 
 	.page_fault = anon_page_fault,
+	.is_fault_cheap = anon_is_fault_cheap,
 	.frame_free = anon_frame_free,
 
 	.create_shared_data = NULL,
@@ -174,9 +177,60 @@ bool anon_is_shareable(as_area_t *area)
 	return !(area->flags & AS_AREA_LATE_RESERVE);
 }
 
+/** Map a whole chunk of the area using a large frame.
+ *
+ * The chunk containing the faulting page is backed by a naturally aligned
+ * block of contiguous frames and entered into the page tables as a single
+ * large mapping. If the chunk does not fit into the area, some of its pages
+ * are already mapped, there is no such block of frames available or the
+ * page tables cannot hold large mappings, the caller falls back to mapping
+ * ordinary pages.
+ *
+ * The address space area must be already locked.
+ *
+ * @param area  Pointer to the address space area.
+ * @param upage Faulting virtual page.
+ *
+ * @return True if the chunk containing upage has been mapped.
+ */
+static bool anon_large_fault(as_area_t *area, uintptr_t upage)
+{
+	uintptr_t chunk;
+
+	if (!as_area_large_chunk(area, upage, &chunk))
+		return false;
+
+	/* The frames are covered by the reservation of the whole area. */
+	uintptr_t frame = frame_alloc(AS_LARGE_FRAMES,
+	    FRAME_LOWMEM | FRAME_ATOMIC | FRAME_NO_RESERVE, AS_LARGE_SIZE - 1);
+	if (!frame)
+		return false;
+
+	memsetb((void *) PA2KA(frame), AS_LARGE_SIZE, 0);
+
+	page_table_lock(AS, false);
+	bool mapped = page_mapping_insert_large(AS, chunk, frame,
+	    as_area_get_flags(area));
+	page_table_unlock(AS, false);
+
+	if (!mapped) {
+		frame_free_noreserve(frame, AS_LARGE_FRAMES);
+		return false;
+	}
+
+	if (!used_space_insert(area, chunk, AS_LARGE_FRAMES))
+		panic("Cannot insert used space.");
+
+	area->large_pages += AS_LARGE_FRAMES;
+
+	return true;
+}
+
 /** Service a page fault in the anonymous memory address space area.
  *
- * The address space area and page tables must be already locked.
+ * The address space area must be already locked. The page tables are
+ * locked only while the new mapping is being inserted so that faults in
+ * other areas are not held up by clearing the frame.
  *
  * @param area Pointer to the address space area.
  * @param upage Faulting virtual page.
@@ -187,10 +241,8 @@ bool anon_is_shareable(as_area_t *area)
  */
 int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 {
-	uintptr_t kpage;
 	uintptr_t frame;
 
-	assert(page_table_locked(AS));
 	assert(mutex_locked(&area->lock));
 	assert(IS_ALIGNED(upage, PAGE_SIZE));
 
@@ -225,10 +277,7 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 				}
 			}
 			if (allocate) {
-				kpage = km_temporary_page_get(&frame,
-				    FRAME_NO_RESERVE);
-				memsetb((void *) kpage, PAGE_SIZE, 0);
-				km_temporary_page_put(kpage);
+				frame = zero_frame_alloc();
 				
 				/*
 				 * Insert the address of the newly allocated
@@ -256,6 +305,13 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		 *   the different causes
 		 */
 
+		if ((area->flags & AS_AREA_LARGE_PAGES) &&
+		    (!(area->flags & AS_AREA_LATE_RESERVE)) &&
+		    (anon_large_fault(area, upage))) {
+			mutex_unlock(&area->sh_info->lock);
+			return AS_PF_OK;
+		}
+
 		if (area->flags & AS_AREA_LATE_RESERVE) {
 			/*
 			 * Reserve the memory for this page now.
@@ -266,9 +322,7 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 			}
 		}
 
-		kpage = km_temporary_page_get(&frame, FRAME_NO_RESERVE);
-		memsetb((void *) kpage, PAGE_SIZE, 0);
-		km_temporary_page_put(kpage);
+		frame = zero_frame_alloc();
 	}
 	mutex_unlock(&area->sh_info->lock);
 	
@@ -277,13 +331,64 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 	 * Note that TLB shootdown is not attempted as only new information is
 	 * being inserted into page tables.
 	 */
+	page_table_lock(AS, false);
 	page_mapping_insert(AS, upage, frame, as_area_get_flags(area));
+	page_table_unlock(AS, false);
 	if (!used_space_insert(area, upage, 1))
 		panic("Cannot insert used space.");
 		
 	return AS_PF_OK;
 }
 
+/** Check whether a page fault in the anonymous memory area would be cheap.
+ *
+ * The fault is cheap if the page is already present in the pagemap of a
+ * shared area or if a pre-zeroed frame is available for it. Faults in late
+ * reserve areas are never considered cheap.
+ *
+ * The address space area must be already locked.
+ *
+ * @param area Pointer to the address space area.
+ * @param upage Virtual page.
+ *
+ * @return True if the page can be mapped without clearing a frame.
+ */
+bool anon_is_fault_cheap(as_area_t *area, uintptr_t upage)
+{
+	bool cheap = false;
+
+	assert(mutex_locked(&area->lock));
+
+	/*
+	 * Do not map pages of late reserve areas in advance, they would
+	 * consume reservations the task might never need.
+	 */
+	if (area->flags & AS_AREA_LATE_RESERVE)
+		return false;
+
+	mutex_lock(&area->sh_info->lock);
+	if (area->sh_info->shared) {
+		btree_node_t *leaf;
+		unsigned int i;
+
+		if (btree_search(&area->sh_info->pagemap, upage - area->base,
+		    &leaf)) {
+			cheap = true;
+		} else {
+			/* Zero can be a valid frame address. */
+			for (i = 0; i < leaf->keys; i++) {
+				if (leaf->key[i] == upage - area->base) {
+					cheap = true;
+					break;
+				}
+			}
+		}
+	}
+	mutex_unlock(&area->sh_info->lock);
+
+	return cheap || zero_frame_available();
+}
+
 /** Free a frame that is backed by the anonymous memory backend.
  *
  * The address space area and page tables must be already locked.
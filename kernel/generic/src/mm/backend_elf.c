@@ -44,6 +44,7 @@
 #include <mm/page.h>
 #include <mm/reserve.h>
 #include <mm/km.h>
+#include <mm/zero.h>
 #include <genarch/mm/page_pt.h>
 #include <genarch/mm/page_ht.h>
 #include <align.h>
@@ -61,6 +62,7 @@ static bool elf_is_resizable(as_area_t *);
 static bool elf_is_shareable(as_area_t *);
 
 static int elf_page_fault(as_area_t *, uintptr_t, pf_access_t);
+static bool elf_is_fault_cheap(as_area_t *, uintptr_t);
 static void elf_frame_free(as_area_t *, uintptr_t, uintptr_t);
 
 mem_backend_t elf_backend = {
@@ -73,6 +75,7 @@ mem_backend_t elf_backend = {
 	.is_shareable = elf_is_shareable,
 
 	.page_fault = elf_page_fault,
+	.is_fault_cheap = elf_is_fault_cheap,
 	.frame_free = elf_frame_free,
 
 	.create_shared_data = NULL,
@@ -238,7 +241,8 @@ bool elf_is_shareable(as_area_t *area)
 
 /** Service a page fault in the ELF backend address space area.
  *
- * The address space area and page tables must be already locked.
+ * The address space area must be already locked. The page tables are
+ * locked only while the new mapping is being inserted.
  *
  * @param area		Pointer to the address space area.
  * @param upage		Faulting virtual page.
@@ -260,7 +264,6 @@ int elf_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 	size_t i;
 	bool dirty = false;
 
-	assert(page_table_locked(AS));
 	assert(mutex_locked(&area->lock));
 	assert(IS_ALIGNED(upage, PAGE_SIZE));
 
@@ -306,8 +309,10 @@ int elf_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		}
 		if (frame || found) {
 			frame_reference_add(ADDR2PFN(frame));
+			page_table_lock(AS, false);
 			page_mapping_insert(AS, upage, frame,
 			    as_area_get_flags(area));
+			page_table_unlock(AS, false);
 			if (!used_space_insert(area, upage, 1))
 				panic("Cannot insert used space.");
 			mutex_unlock(&area->sh_info->lock);
@@ -356,9 +361,7 @@ int elf_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		 * To resolve the situation, a frame must be allocated
 		 * and cleared.
 		 */
-		kpage = km_temporary_page_get(&frame, FRAME_NO_RESERVE);
-		memsetb((void *) kpage, PAGE_SIZE, 0);
-		km_temporary_page_put(kpage);
+		frame = zero_frame_alloc();
 		dirty = true;
 	} else {
 		size_t pad_lo, pad_hi;
@@ -401,13 +404,77 @@ int elf_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 
 	mutex_unlock(&area->sh_info->lock);
 
+	page_table_lock(AS, false);
 	page_mapping_insert(AS, upage, frame, as_area_get_flags(area));
+	page_table_unlock(AS, false);
 	if (!used_space_insert(area, upage, 1))
 		panic("Cannot insert used space.");
 
 	return AS_PF_OK;
 }
 
+/** Check whether a page fault in the ELF backend area would be cheap.
+ *
+ * The fault is cheap if the page is already present in the pagemap of a
+ * shared area, if it is mapped directly from the read-only ELF image or
+ * if it belongs to the uninitialized portion of the segment and a
+ * pre-zeroed frame is available for it. Pages that need to be copied
+ * are never cheap.
+ *
+ * The address space area must be already locked.
+ *
+ * @param area		Pointer to the address space area.
+ * @param upage		Virtual page.
+ *
+ * @return		True if the page can be mapped without copying or
+ * 			clearing a frame.
+ */
+bool elf_is_fault_cheap(as_area_t *area, uintptr_t upage)
+{
+	elf_segment_header_t *entry = area->backend_data.segment;
+	uintptr_t start_anon = entry->p_vaddr + entry->p_filesz;
+	bool cheap = false;
+
+	assert(mutex_locked(&area->lock));
+
+	if (upage < ALIGN_DOWN(entry->p_vaddr, PAGE_SIZE))
+		return false;
+
+	if (upage >= entry->p_vaddr + entry->p_memsz)
+		return false;
+
+	mutex_lock(&area->sh_info->lock);
+	if (area->sh_info->shared) {
+		btree_node_t *leaf;
+		unsigned int i;
+
+		if (btree_search(&area->sh_info->pagemap, upage - area->base,
+		    &leaf)) {
+			cheap = true;
+		} else {
+			/* Workaround for valid NULL address. */
+			for (i = 0; i < leaf->keys; i++) {
+				if (leaf->key[i] == upage - area->base) {
+					cheap = true;
+					break;
+				}
+			}
+		}
+	}
+	mutex_unlock(&area->sh_info->lock);
+
+	if (cheap)
+		return true;
+
+	if (upage >= entry->p_vaddr && upage + PAGE_SIZE <= start_anon)
+		return !(entry->p_flags & PF_W);
+
+	if (upage >= start_anon)
+		return zero_frame_available();
+
+	return false;
+}
+
 /** Free a frame that is backed by the ELF backend.
  *
  * The address space area and page tables must be already locked.
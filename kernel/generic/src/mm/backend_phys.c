@@ -73,6 +73,7 @@ mem_backend_t phys_backend = {
 	.is_shareable = phys_is_shareable,
 
 	.page_fault = phys_page_fault,
+	.is_fault_cheap = NULL,
 	.frame_free = NULL,
 	
 	.create_shared_data = phys_create_shared_data,
@@ -121,7 +122,7 @@ bool phys_is_shareable(as_area_t *area)
 
 /** Service a page fault in the address space area backed by physical memory.
  *
- * The address space area and page tables must be already locked.
+ * The address space area must be already locked.
  *
  * @param area Pointer to the address space area.
  * @param upage Faulting virtual page.
@@ -133,8 +134,8 @@ bool phys_is_shareable(as_area_t *area)
 int phys_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 {
 	uintptr_t base = area->backend_data.base;
+	bool mapped = false;
 
-	assert(page_table_locked(AS));
 	assert(mutex_locked(&area->lock));
 	assert(IS_ALIGNED(upage, PAGE_SIZE));
 
@@ -142,8 +143,33 @@ int phys_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		return AS_PF_FAULT;
 
 	assert(upage - area->base < area->backend_data.frames * FRAME_SIZE);
+
+	/*
+	 * Map the whole chunk containing the page at once if the physical
+	 * memory behind it is aligned in the same way as the chunk.
+	 */
+	uintptr_t chunk;
+	if ((area->flags & AS_AREA_LARGE_PAGES) &&
+	    (as_area_large_chunk(area, upage, &chunk)) &&
+	    (IS_ALIGNED(base + (chunk - area->base), AS_LARGE_SIZE))) {
+		page_table_lock(AS, false);
+		mapped = page_mapping_insert_large(AS, chunk,
+		    base + (chunk - area->base), as_area_get_flags(area));
+		page_table_unlock(AS, false);
+	}
+
+	if (mapped) {
+		if (!used_space_insert(area, chunk, AS_LARGE_FRAMES))
+			panic("Cannot insert used space.");
+
+		area->large_pages += AS_LARGE_FRAMES;
+		return AS_PF_OK;
+	}
+
+	page_table_lock(AS, false);
 	page_mapping_insert(AS, upage, base + (upage - area->base),
 	    as_area_get_flags(area));
+	page_table_unlock(AS, false);
 	
 	if (!used_space_insert(area, upage, 1))
 		panic("Cannot insert used space.");
@@ -39,6 +39,7 @@
 #include <mm/as.h>
 #include <mm/page.h>
 #include <mm/frame.h>
+#include <mm/km.h>
 #include <abi/mm/as.h>
 #include <abi/ipc/methods.h>
 #include <ipc/sysipc.h>
@@ -48,6 +49,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <log.h>
+#include <mem.h>
 #include <str.h>
 
 static bool user_create(as_area_t *);
@@ -69,6 +71,7 @@ mem_backend_t user_backend = {
 	.is_shareable = user_is_shareable,
 
 	.page_fault = user_page_fault,
+	.is_fault_cheap = NULL,
 	.frame_free = user_frame_free,
 
 	.create_shared_data = NULL,
@@ -97,7 +100,8 @@ bool user_is_shareable(as_area_t *area)
 
 /** Service a page fault in the user-paged address space area.
  *
- * The address space area and page tables must be already locked.
+ * The address space area must be already locked. The page tables are not
+ * held while the pager is being asked for the frame.
  *
  * @param area Pointer to the address space area.
  * @param upage Faulting virtual page.
@@ -108,7 +112,6 @@ bool user_is_shareable(as_area_t *area)
  */
 int user_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 {
-	assert(page_table_locked(AS));
 	assert(mutex_locked(&area->lock));
 	assert(IS_ALIGNED(upage, PAGE_SIZE));
 
@@ -145,7 +148,43 @@ int user_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 	 */
 
 	uintptr_t frame = IPC_GET_ARG1(data);
+	
+	/*
+	 * The pager may hand out the same frame to all clients that fault on
+	 * the same page (e.g. from its page cache). Such a frame can be mapped
+	 * directly only into read-only areas. Writable areas get a private copy
+	 * so that their modifications cannot leak to other clients or into the
+	 * pager's cache.
+	 */
+	if ((area->flags & AS_AREA_WRITE) &&
+	    (find_zone(ADDR2PFN(frame), 1, 0) != (size_t) -1)) {
+		uintptr_t copy;
+		uintptr_t kpage = km_temporary_page_get(&copy, FRAME_NONE);
+		if (!kpage) {
+			frame_free(frame, 1);
+			return AS_PF_FAULT;
+		}
+		
+		uintptr_t src = km_map(frame, PAGE_SIZE,
+		    PAGE_READ | PAGE_CACHEABLE);
+		if (!src) {
+			km_temporary_page_put(kpage);
+			frame_free(copy, 1);
+			frame_free(frame, 1);
+			return AS_PF_FAULT;
+		}
+		
+		memcpy((void *) kpage, (void *) src, PAGE_SIZE);
+		km_unmap(src, PAGE_SIZE);
+		km_temporary_page_put(kpage);
+		
+		frame_free(frame, 1);
+		frame = copy;
+	}
+	
+	page_table_lock(AS, false);
 	page_mapping_insert(AS, upage, frame, as_area_get_flags(area));
+	page_table_unlock(AS, false);
 	if (!used_space_insert(area, upage, 1))
 		panic("Cannot insert used space.");
 
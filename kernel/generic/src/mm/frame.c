@@ -39,6 +39,17 @@
  * This file contains the physical frame allocator and memory zone management.
  * The frame allocator is built on top of the two-level bitmap structure.
  *
+ * The bitmap is authoritative for the state of each frame. On top of it,
+ * every zone maintains buddy free lists of its low-priority memory so that
+ * common allocations do not need to scan the bitmap. Allocations with
+ * irregular constraints and allocations of high-priority memory fall back
+ * to the bitmap search.
+ *
+ * Single frames are further cached in per-CPU frame caches, so most
+ * single-frame allocations and deallocations do not need to take the
+ * global zones lock at all. Frames in the per-CPU caches are busy from
+ * the zones' point of view, but they are reported as free.
+ *
  */
 
 #include <typedefs.h>
@@ -61,9 +72,43 @@
 #include <config.h>
 #include <str.h>
 #include <proc/thread.h> /* THREAD */
+#include <cpu.h>
+
+/** Number of frames in one class of a per-CPU frame cache. */
+#define FRAME_CACHE_SIZE  64
+
+/** Number of frames moved between a frame cache and the zones at once. */
+#define FRAME_CACHE_BATCH  (FRAME_CACHE_SIZE / 2)
+
+/** Free memory is low below 1 / 2^FRAME_LOW_SHIFT of available memory. */
+#define FRAME_LOW_SHIFT  5
+
+/** Frame cache classes. */
+#define FRAME_CACHE_LOWMEM   0
+#define FRAME_CACHE_HIGHMEM  1
+#define FRAME_CACHE_CLASSES  2
+
+/** Per-CPU cache of free single frames.
+ *
+ * The cache is normally accessed only by its CPU, the lock is
+ * taken by other CPUs only when draining all caches.
+ *
+ */
+typedef struct {
+	IRQ_SPINLOCK_DECLARE(lock);
+	
+	/** Number of cached frames in each class */
+	size_t count[FRAME_CACHE_CLASSES];
+	
+	/** Cached frames */
+	pfn_t pfn[FRAME_CACHE_CLASSES][FRAME_CACHE_SIZE];
+} frame_cache_t;
 
 zones_t zones;
 
+/** Per-CPU frame caches (NULL until frame_enable_cpucache() is called). */
+static frame_cache_t *frame_caches = NULL;
+
 /*
  * Synchronization primitives used to sleep when there is no memory
  * available.
@@ -82,6 +127,7 @@ NO_TRACE static void frame_initialize(frame_t *frame)
 {
 	frame->refcount = 0;
 	frame->parent = NULL;
+	frame->buddy_order = FRAME_BUDDY_NONE;
 }
 
 /*******************/
@@ -147,6 +193,28 @@ NO_TRACE static size_t zones_insert_zone(pfn_t base, size_t count,
 	return i;
 }
 
+/** Get number of frames held in the per-CPU frame caches.
+ *
+ * The caches are not locked, so the result is only
+ * a snapshot suitable for statistics.
+ *
+ */
+NO_TRACE static size_t frame_cache_count(void)
+{
+	size_t total = 0;
+	
+	if (frame_caches == NULL)
+		return 0;
+	
+	for (size_t i = 0; i < config.cpu_count; i++) {
+		for (unsigned int class = 0; class < FRAME_CACHE_CLASSES;
+		    class++)
+			total += frame_caches[i].count[class];
+	}
+	
+	return total;
+}
+
 /** Get total available frames.
  *
  * Assume interrupts are disabled and zones lock is
@@ -163,7 +231,7 @@ NO_TRACE static size_t frame_total_free_get_internal(void)
 	for (i = 0; i < zones.count; i++)
 		total += zones.info[i].free_count;
 	
-	return total;
+	return total + frame_cache_count();
 }
 
 NO_TRACE size_t frame_total_free_get(void)
@@ -177,6 +245,47 @@ NO_TRACE size_t frame_total_free_get(void)
 	return total;
 }
 
+/** Check whether free memory is low.
+ *
+ * Assume interrupts are disabled and zones lock is
+ * locked.
+ *
+ * @return True if less than 1 / 2^FRAME_LOW_SHIFT of
+ *         the available memory is free.
+ *
+ */
+NO_TRACE static bool frame_low_memory_internal(void)
+{
+	size_t total = 0;
+	size_t free = 0;
+	
+	for (size_t i = 0; i < zones.count; i++) {
+		if (zones.info[i].flags & ZONE_AVAILABLE) {
+			total += zones.info[i].count;
+			free += zones.info[i].free_count;
+		}
+	}
+	
+	free += frame_cache_count();
+	
+	return (free < (total >> FRAME_LOW_SHIFT));
+}
+
+/** Check whether free memory is low.
+ *
+ * @return True if less than 1 / 2^FRAME_LOW_SHIFT of
+ *         the available memory is free.
+ *
+ */
+bool frame_low_memory(void)
+{
+	irq_spinlock_lock(&zones.lock, true);
+	bool low = frame_low_memory_internal();
+	irq_spinlock_unlock(&zones.lock, true);
+	
+	return low;
+}
+
 
 /** Find a zone with a given frames.
  *
@@ -210,18 +319,301 @@ NO_TRACE size_t find_zone(pfn_t frame, size_t count, size_t hint)
 	return (size_t) -1;
 }
 
+/** Check if frame range  priority memory
+ *
+ * @param pfn   Starting frame.
+ * @param count Number of frames.
+ *
+ * @return True if the range contains only priority memory.
+ *
+ */
+NO_TRACE static bool is_high_priority(pfn_t base, size_t count)
+{
+	return (base + count <= FRAME_LOWPRIO);
+}
+
+/*******************/
+/* Buddy functions */
+/*******************/
+
+/** Return the smallest buddy order whose blocks have at least count frames. */
+NO_TRACE static uint8_t buddy_order_fit(size_t count)
+{
+	if (count <= 1)
+		return 0;
+	
+	return fnzb(count - 1) + 1;
+}
+
+/** Return the buddy order needed to satisfy an allocation.
+ *
+ * Buddy blocks are naturally aligned, so constraints which only
+ * prescribe the alignment of the first frame can be satisfied by
+ * choosing a large enough block. Other constraints are left to the
+ * bitmap search.
+ *
+ * @param count      Number of frames to allocate.
+ * @param constraint Frame number constraint.
+ *
+ * @return Buddy order or FRAME_BUDDY_ORDERS if the request cannot be
+ *         handled by the buddy free lists.
+ *
+ */
+NO_TRACE static uint8_t buddy_order_needed(size_t count, pfn_t constraint)
+{
+	if ((constraint & (constraint + 1)) != 0)
+		return FRAME_BUDDY_ORDERS;
+	
+	uint8_t order = max(buddy_order_fit(count),
+	    buddy_order_fit(constraint + 1));
+	
+	return min(order, FRAME_BUDDY_ORDERS);
+}
+
+/** Link a free block to the buddy free list of its order. */
+NO_TRACE static void buddy_link(zone_t *zone, size_t index, uint8_t order)
+{
+	frame_t *frame = &zone->frames[index];
+	
+	assert(frame->buddy_order == FRAME_BUDDY_NONE);
+	
+	frame->buddy_order = order;
+	frame->buddy_prev = FRAME_BUDDY_NIL;
+	frame->buddy_next = zone->buddy_head[order];
+	
+	if (zone->buddy_head[order] != FRAME_BUDDY_NIL)
+		zone->frames[zone->buddy_head[order]].buddy_prev = index;
+	
+	zone->buddy_head[order] = index;
+	zone->buddy_blocks[order]++;
+}
+
+/** Unlink a free block from the buddy free list of its order. */
+NO_TRACE static void buddy_unlink(zone_t *zone, size_t index)
+{
+	frame_t *frame = &zone->frames[index];
+	uint8_t order = frame->buddy_order;
+	
+	assert(order < FRAME_BUDDY_ORDERS);
+	
+	if (frame->buddy_prev != FRAME_BUDDY_NIL)
+		zone->frames[frame->buddy_prev].buddy_next = frame->buddy_next;
+	else
+		zone->buddy_head[order] = frame->buddy_next;
+	
+	if (frame->buddy_next != FRAME_BUDDY_NIL)
+		zone->frames[frame->buddy_next].buddy_prev = frame->buddy_prev;
+	
+	frame->buddy_order = FRAME_BUDDY_NONE;
+	zone->buddy_blocks[order]--;
+}
+
+/** Return a free block to the buddy free lists.
+ *
+ * The block is coalesced with its free buddies as far as possible.
+ *
+ * @param zone  Zone the block belongs to.
+ * @param index Zone-relative index of the first frame of the block.
+ * @param order Order of the block.
+ *
+ */
+NO_TRACE static void buddy_free_block(zone_t *zone, size_t index,
+    uint8_t order)
+{
+	while (order < FRAME_BUDDY_ORDERS - 1) {
+		pfn_t buddy = (zone->base + index) ^ ((pfn_t) 1 << order);
+		
+		if ((buddy < zone->base) ||
+		    (buddy + ((pfn_t) 1 << order) > zone->base + zone->count))
+			break;
+		
+		size_t buddy_index = buddy - zone->base;
+		if (zone->frames[buddy_index].buddy_order != order)
+			break;
+		
+		buddy_unlink(zone, buddy_index);
+		index = min(index, buddy_index);
+		order++;
+	}
+	
+	buddy_link(zone, index, order);
+}
+
+/** Return a range of free frames to the buddy free lists.
+ *
+ * High-priority frames are skipped as they are not managed
+ * by the buddy free lists.
+ *
+ * @param zone  Zone the frames belong to.
+ * @param index Zone-relative index of the first frame.
+ * @param count Number of frames.
+ *
+ */
+NO_TRACE static void buddy_free_range(zone_t *zone, size_t index,
+    size_t count)
+{
+	pfn_t lowprio = FRAME_LOWPRIO;
+	if (zone->base + index < lowprio) {
+		size_t skip = min(count, lowprio - (zone->base + index));
+		index += skip;
+		count -= skip;
+	}
+	
+	while (count > 0) {
+		pfn_t pfn = zone->base + index;
+		uint8_t order = min(fnzb(count), FRAME_BUDDY_ORDERS - 1);
+		
+		if (pfn != 0)
+			order = min(order, fnzb(pfn & -pfn));
+		
+		buddy_free_block(zone, index, order);
+		
+		index += (size_t) 1 << order;
+		count -= (size_t) 1 << order;
+	}
+}
+
+/** Take a single free frame out of the buddy free lists.
+ *
+ * Find the free block containing the frame and split it so
+ * that the frame is no longer contained in any free block.
+ *
+ * @param zone  Zone the frame belongs to.
+ * @param index Zone-relative index of the frame.
+ *
+ */
+NO_TRACE static void buddy_take(zone_t *zone, size_t index)
+{
+	pfn_t pfn = zone->base + index;
+	
+	if (is_high_priority(pfn, 1))
+		return;
+	
+	for (uint8_t order = 0; order < FRAME_BUDDY_ORDERS; order++) {
+		pfn_t head = pfn & ~(((pfn_t) 1 << order) - 1);
+		if (head < zone->base)
+			break;
+		
+		size_t head_index = head - zone->base;
+		if (zone->frames[head_index].buddy_order != order)
+			continue;
+		
+		buddy_unlink(zone, head_index);
+		buddy_free_range(zone, head_index, index - head_index);
+		buddy_free_range(zone, index + 1,
+		    head_index + ((size_t) 1 << order) - index - 1);
+		return;
+	}
+}
+
+/** Rebuild the buddy free lists of a zone from its bitmap. */
+NO_TRACE static void buddy_rebuild(zone_t *zone)
+{
+	for (uint8_t order = 0; order < FRAME_BUDDY_ORDERS; order++) {
+		zone->buddy_head[order] = FRAME_BUDDY_NIL;
+		zone->buddy_blocks[order] = 0;
+	}
+	
+	if (!(zone->flags & ZONE_AVAILABLE))
+		return;
+	
+	assert(zone->count < FRAME_BUDDY_NIL);
+	
+	for (size_t i = 0; i < zone->count; i++)
+		zone->frames[i].buddy_order = FRAME_BUDDY_NONE;
+	
+	size_t i = 0;
+	while (i < zone->count) {
+		if (bitmap_get(&zone->bitmap, i)) {
+			i++;
+			continue;
+		}
+		
+		size_t run = 1;
+		while ((i + run < zone->count) &&
+		    (!bitmap_get(&zone->bitmap, i + run)))
+			run++;
+		
+		buddy_free_range(zone, i, run);
+		i += run;
+	}
+}
+
+/** Check if the buddy free lists can satisfy an allocation. */
+NO_TRACE static bool buddy_can_alloc(zone_t *zone, size_t count,
+    pfn_t constraint)
+{
+	for (uint8_t order = buddy_order_needed(count, constraint);
+	    order < FRAME_BUDDY_ORDERS; order++) {
+		if (zone->buddy_head[order] != FRAME_BUDDY_NIL)
+			return true;
+	}
+	
+	return false;
+}
+
+/** Allocate frames from the buddy free lists.
+ *
+ * The frames beyond count in the allocated block are
+ * returned to the free lists.
+ *
+ * @param zone       Zone to allocate from.
+ * @param count      Number of frames to allocate.
+ * @param constraint Frame number constraint.
+ * @param index      Place to store the zone-relative index of the
+ *                   first allocated frame.
+ *
+ * @return True on success, false if the buddy free lists cannot
+ *         satisfy the request.
+ *
+ */
+NO_TRACE static bool buddy_alloc(zone_t *zone, size_t count,
+    pfn_t constraint, size_t *index)
+{
+	uint8_t needed = buddy_order_needed(count, constraint);
+	
+	for (uint8_t order = needed; order < FRAME_BUDDY_ORDERS; order++) {
+		size_t head = zone->buddy_head[order];
+		if (head == FRAME_BUDDY_NIL)
+			continue;
+		
+		buddy_unlink(zone, head);
+		
+		/* Return the unused tail of the block */
+		buddy_free_range(zone, head + count,
+		    ((size_t) 1 << order) - count);
+		
+		*index = head;
+		return true;
+	}
+	
+	return false;
+}
+
+/******************/
+/* Zone functions */
+/******************/
+
 /** @return True if zone can allocate specified number of frames */
 NO_TRACE static bool zone_can_alloc(zone_t *zone, size_t count,
     pfn_t constraint)
 {
+	if (!(zone->flags & ZONE_AVAILABLE))
+		return false;
+	
+	if (zone->free_count < count)
+		return false;
+	
+	if (buddy_can_alloc(zone, count, constraint))
+		return true;
+	
 	/*
 	 * The function bitmap_allocate_range() does not modify
 	 * the bitmap if the last argument is NULL.
 	 */
 	
-	return ((zone->flags & ZONE_AVAILABLE) &&
-	    bitmap_allocate_range(&zone->bitmap, count, zone->base,
-	    FRAME_LOWPRIO, constraint, NULL));
+	return bitmap_allocate_range(&zone->bitmap, count, zone->base,
+	    FRAME_LOWPRIO, constraint, NULL);
 }
 
 /** Find a zone that can allocate specified number of frames
@@ -257,19 +649,6 @@ NO_TRACE static size_t find_free_zone_all(size_t count, zone_flags_t flags,
 	return (size_t) -1;
 }
 
-/** Check if frame range  priority memory
- *
- * @param pfn   Starting frame.
- * @param count Number of frames.
- *
- * @return True if the range contains only priority memory.
- *
- */
-NO_TRACE static bool is_high_priority(pfn_t base, size_t count)
-{
-	return (base + count <= FRAME_LOWPRIO);
-}
-
 /** Find a zone that can allocate specified number of frames
  *
  * This function ignores zones that contain only high-priority
@@ -341,10 +720,6 @@ NO_TRACE static size_t find_free_zone(size_t count, zone_flags_t flags,
 	return find_free_zone_all(count, flags, constraint, hint);
 }
 
-/******************/
-/* Zone functions */
-/******************/
-
 /** Return frame from zone. */
 NO_TRACE static frame_t *zone_get_frame(zone_t *zone, size_t index)
 {
@@ -373,10 +748,19 @@ NO_TRACE static size_t zone_frame_alloc(zone_t *zone, size_t count,
 	
 	/* Allocate frames from zone */
 	size_t index = (size_t) -1;
-	int avail = bitmap_allocate_range(&zone->bitmap, count, zone->base,
-	    FRAME_LOWPRIO, constraint, &index);
 	
-	assert(avail);
+	if (buddy_alloc(zone, count, constraint, &index)) {
+		bitmap_set_range(&zone->bitmap, index, count);
+	} else {
+		int avail = bitmap_allocate_range(&zone->bitmap, count,
+		    zone->base, FRAME_LOWPRIO, constraint, &index);
+		
+		assert(avail);
+		
+		for (size_t i = 0; i < count; i++)
+			buddy_take(zone, index + i);
+	}
+	
 	assert(index != (size_t) -1);
 	
 	/* Update frame reference count */
@@ -414,6 +798,7 @@ NO_TRACE static size_t zone_frame_free(zone_t *zone, size_t index)
 	
 	if (!--frame->refcount) {
 		bitmap_set(&zone->bitmap, index, 0);
+		buddy_free_range(zone, index, 1);
 		
 		/* Update zone information. */
 		zone->free_count++;
@@ -436,6 +821,7 @@ NO_TRACE static void zone_mark_unavailable(zone_t *zone, size_t index)
 	
 	frame->refcount = 1;
 	bitmap_set_range(&zone->bitmap, index, 1);
+	buddy_take(zone, index);
 	
 	zone->free_count--;
 	reserve_force_alloc(1);
@@ -491,6 +877,8 @@ NO_TRACE static void zone_merge_internal(size_t z1, size_t z2, zone_t *old_z1,
 		zones.info[z1].frames[base_diff + i] =
 		    zones.info[z2].frames[i];
 	}
+	
+	buddy_rebuild(&zones.info[z1]);
 }
 
 /** Return old configuration frames into the zone.
@@ -653,6 +1041,8 @@ NO_TRACE static void zone_construct(zone_t *zone, pfn_t start, size_t count,
 		bitmap_initialize(&zone->bitmap, 0, NULL);
 		zone->frames = NULL;
 	}
+	
+	buddy_rebuild(zone);
 }
 
 /** Compute configuration data size for zone.
@@ -815,6 +1205,256 @@ void *frame_get_parent(pfn_t pfn, size_t hint)
 	return res;
 }
 
+/************************/
+/* Frame cache functions */
+/************************/
+
+/** Return the frame cache class for allocation flags. */
+NO_TRACE static unsigned int frame_cache_class(frame_flags_t flags)
+{
+	return (flags & FRAME_HIGHMEM) ? FRAME_CACHE_HIGHMEM :
+	    FRAME_CACHE_LOWMEM;
+}
+
+/** Find the zone of a frame without taking the zones lock.
+ *
+ * This is safe only after frame_enable_cpucache() has been called,
+ * because the zones do not move or merge from then on.
+ *
+ */
+NO_TRACE static zone_t *frame_cache_zone(pfn_t pfn)
+{
+	size_t znum = find_zone(pfn, 1, 0);
+	
+	assert(znum != (size_t) -1);
+	
+	return &zones.info[znum];
+}
+
+/** Return frames from a frame cache back to the zones.
+ *
+ * Assume the frame cache is locked and interrupts are disabled.
+ *
+ * @param cache Frame cache.
+ * @param class Frame cache class.
+ * @param count Number of frames to return.
+ *
+ */
+NO_TRACE static void frame_cache_flush(frame_cache_t *cache,
+    unsigned int class, size_t count)
+{
+	assert(count <= cache->count[class]);
+	
+	irq_spinlock_lock(&zones.lock, false);
+	
+	for (size_t i = 0; i < count; i++) {
+		pfn_t pfn = cache->pfn[class][--cache->count[class]];
+		size_t znum = find_zone(pfn, 1, 0);
+		
+		assert(znum != (size_t) -1);
+		
+		zone_t *zone = &zones.info[znum];
+		size_t index = pfn - zone->base;
+		
+		assert(zone->frames[index].refcount == 0);
+		
+		bitmap_set(&zone->bitmap, index, 0);
+		buddy_free_range(zone, index, 1);
+		
+		zone->free_count++;
+		zone->busy_count--;
+	}
+	
+	irq_spinlock_unlock(&zones.lock, false);
+}
+
+/** Refill a frame cache from the buddy free lists of the zones.
+ *
+ * Assume the frame cache is locked and interrupts are disabled.
+ *
+ * @param cache Frame cache.
+ * @param class Frame cache class.
+ * @param low   Set to true if free memory is low after the refill.
+ *
+ * @return True if at least one frame was added to the cache.
+ *
+ */
+NO_TRACE static bool frame_cache_refill(frame_cache_t *cache,
+    unsigned int class, bool *low)
+{
+	zone_flags_t flags = ZONE_AVAILABLE |
+	    ((class == FRAME_CACHE_HIGHMEM) ? ZONE_HIGHMEM : ZONE_LOWMEM);
+	size_t refilled = 0;
+	
+	irq_spinlock_lock(&zones.lock, false);
+	
+	for (size_t i = 0; (i < zones.count) &&
+	    (refilled < FRAME_CACHE_BATCH); i++) {
+		zone_t *zone = &zones.info[i];
+		
+		if (!ZONE_FLAGS_MATCH(zone->flags, flags))
+			continue;
+		
+		while (refilled < FRAME_CACHE_BATCH) {
+			size_t index;
+			
+			if (!buddy_alloc(zone, 1, 0, &index))
+				break;
+			
+			bitmap_set(&zone->bitmap, index, 1);
+			zone->free_count--;
+			zone->busy_count++;
+			
+			cache->pfn[class][cache->count[class]++] =
+			    zone->base + index;
+			refilled++;
+		}
+	}
+	
+	*low = frame_low_memory_internal();
+	
+	irq_spinlock_unlock(&zones.lock, false);
+	
+	return (refilled > 0);
+}
+
+/** Allocate a single frame from the frame cache of the current CPU.
+ *
+ * @param flags Frame allocation flags.
+ * @param pzone Preferred zone, updated on success.
+ *
+ * @return Frame number or 0 if the frame cache cannot satisfy
+ *         the request.
+ *
+ */
+NO_TRACE static pfn_t frame_cache_alloc(frame_flags_t flags, size_t *pzone)
+{
+	pfn_t pfn = 0;
+	unsigned int class = frame_cache_class(flags);
+	bool low = false;
+	
+	ipl_t ipl = interrupts_disable();
+	
+	if ((frame_caches == NULL) || (CPU == NULL)) {
+		interrupts_restore(ipl);
+		return 0;
+	}
+	
+	frame_cache_t *cache = &frame_caches[CPU->id];
+	irq_spinlock_lock(&cache->lock, false);
+	
+	if ((cache->count[class] > 0) ||
+	    (frame_cache_refill(cache, class, &low))) {
+		pfn = cache->pfn[class][--cache->count[class]];
+	}
+	
+	irq_spinlock_unlock(&cache->lock, false);
+	interrupts_restore(ipl);
+	
+	if (low)
+		slab_reclaim_request();
+	
+	if (pfn != 0) {
+		zone_t *zone = frame_cache_zone(pfn);
+		frame_t *frame = &zone->frames[pfn - zone->base];
+		
+		/* The frame is exclusively ours, no need for the zones lock */
+		assert(frame->refcount == 0);
+		frame->refcount = 1;
+		
+		if (pzone)
+			*pzone = zone - zones.info;
+	}
+	
+	return pfn;
+}
+
+/** Free a single frame to the frame cache of the current CPU.
+ *
+ * Only frames with the last reference being dropped are cached.
+ *
+ * @param pfn Frame number.
+ *
+ * @return True if the frame was freed to the cache, false if it
+ *         needs to be freed the usual way.
+ *
+ */
+NO_TRACE static bool frame_cache_free(pfn_t pfn)
+{
+	if (frame_caches == NULL)
+		return false;
+	
+	zone_t *zone = frame_cache_zone(pfn);
+	frame_t *frame = &zone->frames[pfn - zone->base];
+	
+	/*
+	 * If the caller holds the only reference, nobody else may
+	 * add a new reference to the frame. Shared frames are
+	 * handled under the zones lock.
+	 */
+	if (frame->refcount != 1)
+		return false;
+	
+	unsigned int class = (zone->flags & ZONE_LOWMEM) ?
+	    FRAME_CACHE_LOWMEM : FRAME_CACHE_HIGHMEM;
+	
+	ipl_t ipl = interrupts_disable();
+	
+	if (CPU == NULL) {
+		interrupts_restore(ipl);
+		return false;
+	}
+	
+	frame->refcount = 0;
+	
+	frame_cache_t *cache = &frame_caches[CPU->id];
+	irq_spinlock_lock(&cache->lock, false);
+	
+	if (cache->count[class] == FRAME_CACHE_SIZE)
+		frame_cache_flush(cache, class, FRAME_CACHE_BATCH);
+	
+	cache->pfn[class][cache->count[class]++] = pfn;
+	
+	irq_spinlock_unlock(&cache->lock, false);
+	interrupts_restore(ipl);
+	
+	return true;
+}
+
+/** Return all frames in all frame caches back to the zones.
+ *
+ * The zones lock must not be held by the caller.
+ *
+ * @return Number of frames returned to the zones.
+ *
+ */
+static size_t frame_cache_drain(void)
+{
+	if (frame_caches == NULL)
+		return 0;
+	
+	size_t drained = 0;
+	
+	for (size_t i = 0; i < config.cpu_count; i++) {
+		frame_cache_t *cache = &frame_caches[i];
+		
+		irq_spinlock_lock(&cache->lock, true);
+		
+		for (unsigned int class = 0; class < FRAME_CACHE_CLASSES;
+		    class++) {
+			size_t count = cache->count[class];
+			if (count > 0) {
+				frame_cache_flush(cache, class, count);
+				drained += count;
+			}
+		}
+		
+		irq_spinlock_unlock(&cache->lock, true);
+	}
+	
+	return drained;
+}
+
 /** Allocate frames of physical memory.
  *
  * @param count      Number of continuous frames to allocate.
@@ -840,6 +1480,16 @@ uintptr_t frame_alloc_generic(size_t count, frame_flags_t flags,
 	if (!(flags & FRAME_NO_RESERVE))
 		reserve_force_alloc(count);
 	
+	/*
+	 * Single unconstrained frames are served from
+	 * the frame cache of the current CPU if possible.
+	 */
+	if ((count == 1) && (frame_constraint == 0)) {
+		pfn_t pfn = frame_cache_alloc(flags, pzone);
+		if (pfn != 0)
+			return PFN2ADDR(pfn);
+	}
+	
 loop:
 	irq_spinlock_lock(&zones.lock, true);
 	
@@ -849,6 +1499,20 @@ loop:
 	size_t znum = find_free_zone(count, FRAME_TO_ZONE_FLAGS(flags),
 	    frame_constraint, hint);
 	
+	/*
+	 * If no memory, return the frames cached by the CPUs
+	 * to the zones first.
+	 */
+	if ((znum == (size_t) -1) && (frame_caches != NULL)) {
+		irq_spinlock_unlock(&zones.lock, true);
+		size_t drained = frame_cache_drain();
+		irq_spinlock_lock(&zones.lock, true);
+		
+		if (drained > 0)
+			znum = find_free_zone(count, FRAME_TO_ZONE_FLAGS(flags),
+			    frame_constraint, hint);
+	}
+	
 	/*
 	 * If no memory, reclaim some slab memory,
 	 * if it does not help, reclaim all.
@@ -932,8 +1596,14 @@ loop:
 	pfn_t pfn = zone_frame_alloc(&zones.info[znum], count,
 	    frame_constraint) + zones.info[znum].base;
 	
+	bool low = frame_low_memory_internal();
+	
 	irq_spinlock_unlock(&zones.lock, true);
 	
+	/* Let the slab allocator return some memory in the background */
+	if (low)
+		slab_reclaim_request();
+	
 	if (pzone)
 		*pzone = znum;
 	
@@ -945,6 +1615,34 @@ uintptr_t frame_alloc(size_t count, frame_flags_t flags, uintptr_t constraint)
 	return frame_alloc_generic(count, flags, constraint, NULL);
 }
 
+/** Signal that some memory has been freed.
+ *
+ * @param freed Number of freed frames.
+ *
+ */
+static void mem_avail_signal(size_t freed)
+{
+	/*
+	 * Since the mem_avail_mtx is an active mutex,
+	 * we need to disable interruptsto prevent deadlock
+	 * with TLB shootdown.
+	 */
+	
+	ipl_t ipl = interrupts_disable();
+	mutex_lock(&mem_avail_mtx);
+	
+	if (mem_avail_req > 0)
+		mem_avail_req -= min(mem_avail_req, freed);
+	
+	if (mem_avail_req == 0) {
+		mem_avail_gen++;
+		condvar_broadcast(&mem_avail_cv);
+	}
+	
+	mutex_unlock(&mem_avail_mtx);
+	interrupts_restore(ipl);
+}
+
 /** Free frames of physical memory.
  *
  * Find respective frame structures for supplied physical frames.
@@ -960,6 +1658,20 @@ void frame_free_generic(uintptr_t start, size_t count, frame_flags_t flags)
 {
 	size_t freed = 0;
 	
+	if ((count == 1) && (frame_cache_free(ADDR2PFN(start)))) {
+		/*
+		 * Only bother taking the mutex if somebody
+		 * waits for memory to become available.
+		 */
+		if (mem_avail_req > 0)
+			mem_avail_signal(1);
+		
+		if (!(flags & FRAME_NO_RESERVE))
+			reserve_free(1);
+		
+		return;
+	}
+	
 	irq_spinlock_lock(&zones.lock, true);
 	
 	for (size_t i = 0; i < count; i++) {
@@ -977,26 +1689,7 @@ void frame_free_generic(uintptr_t start, size_t count, frame_flags_t flags)
 	
 	irq_spinlock_unlock(&zones.lock, true);
 	
-	/*
-	 * Signal that some memory has been freed.
-	 * Since the mem_avail_mtx is an active mutex,
-	 * we need to disable interruptsto prevent deadlock
-	 * with TLB shootdown.
-	 */
-	
-	ipl_t ipl = interrupts_disable();
-	mutex_lock(&mem_avail_mtx);
-	
-	if (mem_avail_req > 0)
-		mem_avail_req -= min(mem_avail_req, freed);
-	
-	if (mem_avail_req == 0) {
-		mem_avail_gen++;
-		condvar_broadcast(&mem_avail_cv);
-	}
-	
-	mutex_unlock(&mem_avail_mtx);
-	interrupts_restore(ipl);
+	mem_avail_signal(freed);
 	
 	if (!(flags & FRAME_NO_RESERVE))
 		reserve_free(freed);
@@ -1095,6 +1788,32 @@ void frame_init(void)
 	frame_high_arch_init();
 }
 
+/** Enable the per-CPU frame caches.
+ *
+ * Must be called after the number of processors is known and
+ * after the zones have been created and merged.
+ *
+ */
+void frame_enable_cpucache(void)
+{
+	frame_cache_t *caches = (frame_cache_t *)
+	    malloc(sizeof(frame_cache_t) * config.cpu_count, FRAME_ATOMIC);
+	if (caches == NULL) {
+		log(LF_OTHER, LVL_WARN, "Cannot allocate frame caches.");
+		return;
+	}
+	
+	for (size_t i = 0; i < config.cpu_count; i++) {
+		irq_spinlock_initialize(&caches[i].lock, "frame_cache.lock");
+		
+		for (unsigned int class = 0; class < FRAME_CACHE_CLASSES;
+		    class++)
+			caches[i].count[class] = 0;
+	}
+	
+	frame_caches = caches;
+}
+
 /** Adjust bounds of physical memory region according to low/high memory split.
  *
  * @param low[in]      If true, the adjustment is performed to make the region
@@ -1149,14 +1868,32 @@ uint64_t zones_total_size(void)
 	return total;
 }
 
+/** Get physical memory statistics.
+ *
+ * Frames held in the per-CPU frame caches are reported as free.
+ *
+ * @param total       Total size of all zones (bytes).
+ * @param unavail     Size of unavailable zones (bytes).
+ * @param busy        Size of allocated memory (bytes).
+ * @param free        Size of free memory (bytes).
+ * @param free_blocks If not NULL, an array of FRAME_BUDDY_ORDERS
+ *                    elements which receives the number of free
+ *                    blocks of each buddy order in all zones.
+ *
+ */
 void zones_stats(uint64_t *total, uint64_t *unavail, uint64_t *busy,
-    uint64_t *free)
+    uint64_t *free, uint64_t *free_blocks)
 {
 	assert(total != NULL);
 	assert(unavail != NULL);
 	assert(busy != NULL);
 	assert(free != NULL);
 	
+	if (free_blocks != NULL) {
+		for (unsigned int order = 0; order < FRAME_BUDDY_ORDERS; order++)
+			free_blocks[order] = 0;
+	}
+	
 	irq_spinlock_lock(&zones.lock, true);
 	
 	*total = 0;
@@ -1170,11 +1907,38 @@ void zones_stats(uint64_t *total, uint64_t *unavail, uint64_t *busy,
 		if (zones.info[i].flags & ZONE_AVAILABLE) {
 			*busy += (uint64_t) FRAMES2SIZE(zones.info[i].busy_count);
 			*free += (uint64_t) FRAMES2SIZE(zones.info[i].free_count);
+			
+			if (free_blocks != NULL) {
+				for (unsigned int order = 0;
+				    order < FRAME_BUDDY_ORDERS; order++)
+					free_blocks[order] +=
+					    zones.info[i].buddy_blocks[order];
+			}
 		} else
 			*unavail += (uint64_t) FRAMES2SIZE(zones.info[i].count);
 	}
 	
 	irq_spinlock_unlock(&zones.lock, true);
+	
+	uint64_t cached = (uint64_t) FRAMES2SIZE(frame_cache_count());
+	
+	*busy -= min(*busy, cached);
+	*free += cached;
+}
+
+/** Print the number of free blocks of each buddy order.
+ *
+ * @param free_blocks Array of FRAME_BUDDY_ORDERS elements.
+ *
+ */
+static void buddy_print_blocks(uint64_t *free_blocks)
+{
+	printf("Free blocks per order:  ");
+	
+	for (unsigned int order = 0; order < FRAME_BUDDY_ORDERS; order++)
+		printf(" %u:%" PRIu64, order, free_blocks[order]);
+	
+	printf("\n");
 }
 
 /** Prints list of zones.
@@ -1296,6 +2060,20 @@ void zones_print_list(void)
 	    false);
 	printf("Available high priority: %zu frames (%" PRIu64 " %s)\n",
 	    free_highprio, size, size_suffix);
+	
+	size_t cached = frame_cache_count();
+	bin_order_suffix(FRAMES2SIZE(cached), &size, &size_suffix, false);
+	printf("Cached by processors:    %zu frames (%" PRIu64 " %s)\n",
+	    cached, size, size_suffix);
+	
+	uint64_t total;
+	uint64_t unavail;
+	uint64_t busy;
+	uint64_t free;
+	uint64_t free_blocks[FRAME_BUDDY_ORDERS];
+	
+	zones_stats(&total, &unavail, &busy, &free, free_blocks);
+	buddy_print_blocks(free_blocks);
 }
 
 /** Prints zone details.
@@ -1332,6 +2110,10 @@ void zone_print_one(size_t num)
 	size_t free_count = zones.info[znum].free_count;
 	size_t busy_count = zones.info[znum].busy_count;
 	
+	uint64_t free_blocks[FRAME_BUDDY_ORDERS];
+	for (unsigned int order = 0; order < FRAME_BUDDY_ORDERS; order++)
+		free_blocks[order] = zones.info[znum].buddy_blocks[order];
+	
 	bool available = ((flags & ZONE_AVAILABLE) != 0);
 	bool lowmem = ((flags & ZONE_LOWMEM) != 0);
 	bool highmem = ((flags & ZONE_HIGHMEM) != 0);
@@ -1406,6 +2188,8 @@ void zone_print_one(size_t num)
 		    false);
 		printf("Available high priority: %zu frames (%" PRIu64 " %s)\n",
 		    free_highprio, size, size_suffix);
+		
+		buddy_print_blocks(free_blocks);
 	}
 }
 
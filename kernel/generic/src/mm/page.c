@@ -189,6 +189,151 @@ void page_mapping_make_global(uintptr_t base, size_t size)
 	return page_mapping_operations->mapping_make_global(base, size);
 }
 
+/** Check whether the page tables can hold large mappings.
+ *
+ * @return True if page_mapping_insert_large() may succeed.
+ *
+ */
+bool page_mapping_large_supported(void)
+{
+	assert(page_mapping_operations);
+	
+	return page_mapping_operations->mapping_insert_large != NULL;
+}
+
+/** Insert a large mapping.
+ *
+ * Map the AS_LARGE_SIZE bytes large virtual chunk to the physically
+ * contiguous block of frames of the same size. Both must be naturally
+ * aligned. Pages of the chunk are then seen by page_mapping_find() as if
+ * they were mapped one by one.
+ *
+ * @param as    Address space to which the chunk belongs.
+ * @param page  Virtual address of the chunk.
+ * @param frame Physical address of the block of frames.
+ * @param flags Flags to be used for mapping.
+ *
+ * @return True if the large mapping was inserted. False if the page tables
+ *         cannot hold large mappings or some page of the chunk is already
+ *         mapped.
+ *
+ */
+NO_TRACE bool page_mapping_insert_large(as_t *as, uintptr_t page,
+    uintptr_t frame, unsigned int flags)
+{
+	assert(page_table_locked(as));
+	assert(IS_ALIGNED(page, AS_LARGE_SIZE));
+	assert(IS_ALIGNED(frame, AS_LARGE_SIZE));
+	
+	assert(page_mapping_operations);
+	
+	if (page_mapping_operations->mapping_insert_large == NULL)
+		return false;
+	
+	bool inserted = page_mapping_operations->mapping_insert_large(as,
+	    page, frame, flags);
+	
+	/* Repel prefetched accesses to the old mapping. */
+	memory_barrier();
+	
+	return inserted;
+}
+
+/** Remove a large mapping.
+ *
+ * Remove the large mapping containing the page. TLB shootdown of the whole
+ * chunk should follow in order to make effects of this call visible.
+ *
+ * @param as   Address space to which page belongs.
+ * @param page Virtual address of a page within the chunk.
+ *
+ * @return True if the page was mapped by a large mapping, which was removed.
+ *
+ */
+NO_TRACE bool page_mapping_remove_large(as_t *as, uintptr_t page)
+{
+	assert(page_table_locked(as));
+	
+	assert(page_mapping_operations);
+	
+	if (page_mapping_operations->mapping_remove_large == NULL)
+		return false;
+	
+	bool removed = page_mapping_operations->mapping_remove_large(as,
+	    ALIGN_DOWN(page, PAGE_SIZE));
+	
+	/* Repel prefetched accesses to the old mapping. */
+	memory_barrier();
+	
+	return removed;
+}
+
+/** Split a large mapping.
+ *
+ * Replace the large mapping containing the page by ordinary mappings of
+ * its pages to the same frames, so that the pages can be removed one by
+ * one. The translation of the pages does not change. This function may
+ * block and so it must not be called with spinlocks held.
+ *
+ * @param as   Address space to which page belongs.
+ * @param page Virtual address of a page within the chunk.
+ *
+ * @return True if the page was mapped by a large mapping, which was split.
+ *
+ */
+NO_TRACE bool page_mapping_split_large(as_t *as, uintptr_t page)
+{
+	assert(page_table_locked(as));
+	
+	assert(page_mapping_operations);
+	
+	if (page_mapping_operations->mapping_split_large == NULL)
+		return false;
+	
+	return page_mapping_operations->mapping_split_large(as,
+	    ALIGN_DOWN(page, PAGE_SIZE));
+}
+
+/** Take a reference to the frame mapped at a virtual page.
+ *
+ * The frame stays allocated until the reference is dropped with
+ * frame_free_noreserve(), even if the page gets unmapped in the meantime.
+ *
+ * @param as    Address space.
+ * @param page  Virtual address within the page.
+ * @param write Require the mapping to be writable.
+ * @param frame Place to store the physical address of the frame.
+ *
+ * @return EOK on success.
+ * @return ENOENT if the page is not mapped with the requested access or if
+ *         the frame is not managed by the frame allocator.
+ *
+ */
+errno_t page_mapping_pin(as_t *as, uintptr_t page, bool write,
+    uintptr_t *frame)
+{
+	errno_t rc = ENOENT;
+	
+	page_table_lock(as, true);
+	
+	pte_t pte;
+	bool found = page_mapping_find(as, page, false, &pte);
+	if ((found) && (PTE_VALID(&pte)) && (PTE_PRESENT(&pte)) &&
+	    ((!write) || (PTE_WRITABLE(&pte)))) {
+		uintptr_t pa = PTE_GET_FRAME(&pte);
+		
+		if (find_zone(ADDR2PFN(pa), 1, 0) != (size_t) -1) {
+			frame_reference_add(ADDR2PFN(pa));
+			*frame = pa;
+			rc = EOK;
+		}
+	}
+	
+	page_table_unlock(as, true);
+	
+	return rc;
+}
+
 errno_t page_find_mapping(uintptr_t virt, uintptr_t *phys)
 {
 	page_table_lock(AS, true);
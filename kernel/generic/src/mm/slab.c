@@ -59,7 +59,12 @@
  * When an object is being deallocated, it is put to a CPU-bound magazine.
  * If there is no such magazine, a new one is allocated (if this fails, 
  * the object is deallocated into slab). If the magazine is full, it is
- * put into cpu-shared list of magazines and a new one is allocated.
+ * put into the cpu-shared depot of magazines and a new one is allocated.
+ * If the depot is full as well, the magazine is destroyed.
+ *
+ * The depot is an array of slots which are exchanged with compare-and-swap
+ * instead of a list under a spinlock, so CPUs trading magazines do not
+ * serialize on the cache.
  *
  * The CPU-bound magazine is actually a pair of magazines in order to avoid
  * thrashing when somebody is allocating/deallocating 1 item at the magazine
@@ -78,11 +83,15 @@
  * The slab allocator allocates a lot of space and does not free it. When
  * the frame allocator fails to allocate a frame, it calls slab_reclaim().
  * It tries 'light reclaim' first, then brutal reclaim. The light reclaim
- * releases slabs from cpu-shared magazine-list, until at least 1 slab 
+ * releases slabs from cpu-shared magazine depot, until at least 1 slab 
  * is deallocated in each cache (this algorithm should probably change).
  * The brutal reclaim removes all cached objects, even from CPU-bound
  * magazines.
  *
+ * Before it comes to that, the frame allocator signals memory pressure
+ * by slab_reclaim_request(). The kslab thread then does the light reclaim
+ * one cache at a time, until there is enough free memory again.
+ *
  * @todo
  * For better CPU-scaling the magazine allocation strategy should
  * be extended. Currently, if the cache does not have magazine, it asks
@@ -115,10 +124,21 @@
 #include <bitops.h>
 #include <macros.h>
 #include <cpu.h>
+#include <synch/semaphore.h>
+#include <proc/thread.h>
 
 IRQ_SPINLOCK_STATIC_INITIALIZE(slab_cache_lock);
 static LIST_INITIALIZE(slab_cache_list);
 
+/** Semaphore kslab waits on for reclaim requests */
+static semaphore_t kslab_sem;
+
+/** Set while a reclaim request is being processed by kslab */
+static atomic_t kslab_pending;
+
+/** The kslab semaphore is initialized */
+static bool kslab_ready = false;
+
 /** Magazine cache */
 static slab_cache_t mag_cache;
 
@@ -181,13 +201,20 @@ static unsigned int _slab_initialized = 0;
 NO_TRACE static slab_t *slab_space_alloc(slab_cache_t *cache,
     unsigned int flags)
 {
-	size_t zone = 0;
+	/*
+	 * Keep the slabs of each CPU together in the zone
+	 * it got its last slab from.
+	 */
+	size_t zone = (CPU != NULL) ? CPU->frame_zone : 0;
 	
 	uintptr_t data_phys =
 	    frame_alloc_generic(cache->frames, flags, 0, &zone);
 	if (!data_phys)
 		return NULL;
 	
+	if (CPU != NULL)
+		CPU->frame_zone = zone;
+	
 	void *data = (void *) PA2KA(data_phys);
 	
 	slab_t *slab;
@@ -347,45 +374,57 @@ NO_TRACE static void *slab_obj_create(slab_cache_t *cache, unsigned int flags)
 /* CPU-Cache slab functions */
 /****************************/
 
-/** Find a full magazine in cache, take it from list and return it
+/** Take a full magazine from the depot
+ *
+ * A magazine belongs to whoever swaps it out of its depot slot,
+ * therefore the exchange needs no lock and does not suffer from
+ * the ABA problem of lock-free linked stacks.
+ *
+ * @param cache Slab cache.
+ * @param start Depot slot to start the search at.
  *
- * @param first If true, return first, else last mag.
+ * @return Full magazine or NULL if the depot is empty.
  *
  */
-NO_TRACE static slab_magazine_t *get_mag_from_cache(slab_cache_t *cache,
-    bool first)
-{
-	slab_magazine_t *mag = NULL;
-	link_t *cur;
-	
-	irq_spinlock_lock(&cache->maglock, true);
-	if (!list_empty(&cache->magazines)) {
-		if (first)
-			cur = list_first(&cache->magazines);
-		else
-			cur = list_last(&cache->magazines);
+NO_TRACE static slab_magazine_t *depot_get(slab_cache_t *cache, size_t start)
+{
+	for (size_t i = 0; i < SLAB_DEPOT_SIZE; i++) {
+		slab_magazine_t **slot =
+		    &cache->depot[(start + i) % SLAB_DEPOT_SIZE];
+		slab_magazine_t *mag = __atomic_load_n(slot, __ATOMIC_RELAXED);
 		
-		mag = list_get_instance(cur, slab_magazine_t, link);
-		list_remove(&mag->link);
-		atomic_dec(&cache->magazine_counter);
+		if ((mag != NULL) && (__atomic_compare_exchange_n(slot, &mag,
+		    NULL, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)))
+			return mag;
 	}
-	irq_spinlock_unlock(&cache->maglock, true);
-
-	return mag;
+	
+	return NULL;
 }
 
-/** Prepend magazine to magazine list in cache
+/** Put a full magazine to the depot
+ *
+ * @param cache Slab cache.
+ * @param mag   Full magazine.
+ * @param start Depot slot to start the search at.
+ *
+ * @return True on success, false if the depot is full.
  *
  */
-NO_TRACE static void put_mag_to_cache(slab_cache_t *cache,
-    slab_magazine_t *mag)
+NO_TRACE static bool depot_put(slab_cache_t *cache, slab_magazine_t *mag,
+    size_t start)
 {
-	irq_spinlock_lock(&cache->maglock, true);
-	
-	list_prepend(&mag->link, &cache->magazines);
-	atomic_inc(&cache->magazine_counter);
+	for (size_t i = 0; i < SLAB_DEPOT_SIZE; i++) {
+		slab_magazine_t **slot =
+		    &cache->depot[(start + i) % SLAB_DEPOT_SIZE];
+		slab_magazine_t *empty = NULL;
+		
+		if ((__atomic_load_n(slot, __ATOMIC_RELAXED) == NULL) &&
+		    (__atomic_compare_exchange_n(slot, &empty, mag, false,
+		    __ATOMIC_RELEASE, __ATOMIC_RELAXED)))
+			return true;
+	}
 	
-	irq_spinlock_unlock(&cache->maglock, true);
+	return false;
 }
 
 /** Free all objects in magazine and free memory associated with magazine
@@ -430,10 +469,14 @@ NO_TRACE static slab_magazine_t *get_full_current_mag(slab_cache_t *cache)
 		}
 	}
 	
-	/* Local magazines are empty, import one from magazine list */
-	slab_magazine_t *newmag = get_mag_from_cache(cache, 1);
-	if (!newmag)
+	/* Local magazines are empty, import one from the depot */
+	slab_magazine_t *newmag = depot_get(cache, CPU->id);
+	if (!newmag) {
+		cache->mag_cache[CPU->id].depot_misses++;
 		return NULL;
+	}
+	
+	cache->mag_cache[CPU->id].depot_hits++;
 	
 	if (lastmag)
 		magazine_destroy(cache, lastmag);
@@ -513,9 +556,9 @@ NO_TRACE static slab_magazine_t *make_empty_current_mag(slab_cache_t *cache)
 	newmag->size = SLAB_MAG_SIZE;
 	newmag->busy = 0;
 	
-	/* Flush last to magazine list */
-	if (lastmag)
-		put_mag_to_cache(cache, lastmag);
+	/* Flush last to the depot */
+	if ((lastmag) && (!depot_put(cache, lastmag, CPU->id)))
+		magazine_destroy(cache, lastmag);
 	
 	/* Move current as last, save new as current */
 	cache->mag_cache[CPU->id].last = cmag;
@@ -627,10 +670,8 @@ NO_TRACE static void _slab_cache_create(slab_cache_t *cache, const char *name,
 	
 	list_initialize(&cache->full_slabs);
 	list_initialize(&cache->partial_slabs);
-	list_initialize(&cache->magazines);
 	
 	irq_spinlock_initialize(&cache->slablock, "slab.cache.slablock");
-	irq_spinlock_initialize(&cache->maglock, "slab.cache.maglock");
 	
 	if (!(cache->flags & SLAB_CACHE_NOMAGAZINE))
 		(void) make_magcache(cache);
@@ -684,15 +725,15 @@ NO_TRACE static size_t _slab_reclaim(slab_cache_t *cache, unsigned int flags)
 		return 0; /* Nothing to do */
 	
 	/*
-	 * We count up to original magazine count to avoid
-	 * endless loop
+	 * We count up to the depot size to avoid endless
+	 * loop
 	 */
-	atomic_count_t magcount = atomic_get(&cache->magazine_counter);
+	size_t magcount = SLAB_DEPOT_SIZE;
 	
 	slab_magazine_t *mag;
 	size_t frames = 0;
 	
-	while ((magcount--) && (mag = get_mag_from_cache(cache, 0))) {
+	while ((magcount--) && (mag = depot_get(cache, 0))) {
 		frames += magazine_destroy(cache, mag);
 		if ((!(flags & SLAB_RECLAIM_ALL)) && (frames))
 			break;
@@ -803,26 +844,110 @@ void slab_free(slab_cache_t *cache, void *obj)
 	_slab_free(cache, obj, NULL);
 }
 
-/** Go through all caches and reclaim what is possible */
-size_t slab_reclaim(unsigned int flags)
+/** Reclaim memory from the cache at the head of the cache list
+ *
+ * The cache is moved to the tail of the list, so that repeated
+ * calls visit all caches in a round-robin fashion without holding
+ * the cache list lock for more than one cache at a time.
+ *
+ * @param flags If contains SLAB_RECLAIM_ALL, do aggressive freeing
+ *
+ * @return Number of freed pages
+ *
+ */
+static size_t slab_reclaim_step(unsigned int flags)
 {
 	irq_spinlock_lock(&slab_cache_lock, true);
 	
-	size_t frames = 0;
-	list_foreach(slab_cache_list, link, slab_cache_t, cache) {
-		frames += _slab_reclaim(cache, flags);
+	if (list_empty(&slab_cache_list)) {
+		irq_spinlock_unlock(&slab_cache_lock, true);
+		return 0;
 	}
 	
+	slab_cache_t *cache = list_get_instance(list_first(&slab_cache_list),
+	    slab_cache_t, link);
+	list_remove(&cache->link);
+	list_append(&cache->link, &slab_cache_list);
+	
+	size_t frames = _slab_reclaim(cache, flags);
+	
+	irq_spinlock_unlock(&slab_cache_lock, true);
+	
+	return frames;
+}
+
+/** Return the number of slab caches */
+static size_t slab_cache_count(void)
+{
+	irq_spinlock_lock(&slab_cache_lock, true);
+	size_t count = list_count(&slab_cache_list);
 	irq_spinlock_unlock(&slab_cache_lock, true);
 	
+	return count;
+}
+
+/** Go through all caches and reclaim what is possible */
+size_t slab_reclaim(unsigned int flags)
+{
+	size_t count = slab_cache_count();
+	size_t frames = 0;
+	
+	for (size_t i = 0; i < count; i++)
+		frames += slab_reclaim_step(flags);
+	
 	return frames;
 }
 
+/** Ask kslab to reclaim memory in the background
+ *
+ * Called by the frame allocator when free memory runs low.
+ * Can be called from any context.
+ *
+ */
+void slab_reclaim_request(void)
+{
+	if (!kslab_ready)
+		return;
+	
+	if (!test_and_set(&kslab_pending))
+		semaphore_up(&kslab_sem);
+}
+
+/** Kernel thread reclaiming slab memory in the background
+ *
+ * The reclaim is incremental. Each step frees the depot magazines of a
+ * single cache and the thread stops as soon as there is enough free
+ * memory again or a round over all caches does not free anything.
+ *
+ * @param arg Not used.
+ *
+ */
+void kslab(void *arg)
+{
+	thread_detach(THREAD);
+	
+	while (true) {
+		semaphore_down(&kslab_sem);
+		
+		size_t count = slab_cache_count();
+		size_t idle = 0;
+		
+		while ((idle < count) && (frame_low_memory())) {
+			if (slab_reclaim_step(0) > 0)
+				idle = 0;
+			else
+				idle++;
+		}
+		
+		atomic_set(&kslab_pending, 0);
+	}
+}
+
 /* Print list of caches */
 void slab_print_list(void)
 {
 	printf("[cache name      ] [size  ] [pages ] [obj/pg] [slabs ]"
-	    " [cached] [alloc ] [ctl]\n");
+	    " [cached] [alloc ] [dhits ] [dmiss ] [ctl]\n");
 	
 	size_t skip = 0;
 	while (true) {
@@ -875,11 +1000,22 @@ void slab_print_list(void)
 		long allocated_objs = atomic_get(&cache->allocated_objs);
 		unsigned int flags = cache->flags;
 		
+		uint64_t depot_hits = 0;
+		uint64_t depot_misses = 0;
+		
+		if (!(flags & SLAB_CACHE_NOMAGAZINE)) {
+			for (i = 0; i < config.cpu_count; i++) {
+				depot_hits += cache->mag_cache[i].depot_hits;
+				depot_misses += cache->mag_cache[i].depot_misses;
+			}
+		}
+		
 		irq_spinlock_unlock(&slab_cache_lock, true);
 		
-		printf("%-18s %8zu %8zu %8zu %8ld %8ld %8ld %-5s\n",
+		printf("%-18s %8zu %8zu %8zu %8ld %8ld %8ld %8" PRIu64
+		    " %8" PRIu64 " %-5s\n",
 		    name, size, frames, objects, allocated_slabs,
-		    cached_objs, allocated_objs,
+		    cached_objs, allocated_objs, depot_hits, depot_misses,
 		    flags & SLAB_CACHE_SLINSIDE ? "in" : "out");
 	}
 }
@@ -912,6 +1048,10 @@ void slab_cache_init(void)
 		    NULL, NULL, SLAB_CACHE_MAGDEFERRED);
 	}
 	
+	semaphore_initialize(&kslab_sem, 0);
+	atomic_set(&kslab_pending, 0);
+	kslab_ready = true;
+	
 #ifdef CONFIG_DEBUG
 	_slab_initialized = 1;
 #endif
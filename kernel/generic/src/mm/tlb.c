@@ -35,11 +35,16 @@
  * @brief Generic TLB shootdown algorithm.
  *
  * The algorithm implemented here is based on the CMU TLB shootdown
- * algorithm and is further simplified (e.g. all CPUs receive all TLB
- * shootdown messages).
+ * algorithm and is further simplified (e.g. shootdowns of the kernel
+ * address space and of ASIDs are delivered to all CPUs).
+ *
+ * Shootdowns of pages of a user address space are only delivered to
+ * the CPUs recorded in the CPU mask of the address space, i.e. those
+ * which have had it installed since their TLB was last flushed.
  */
 
 #include <mm/tlb.h>
+#include <mm/as.h>
 #include <mm/asid.h>
 #include <arch/mm/tlb.h>
 #include <assert.h>
@@ -51,6 +56,7 @@
 #include <arch.h>
 #include <panic.h>
 #include <cpu.h>
+#include <arch/barrier.h>
 
 void tlb_init(void)
 {
@@ -70,8 +76,11 @@ IRQ_SPINLOCK_STATIC_INITIALIZE(tlblock);
 /** Send TLB shootdown message.
  *
  * This function attempts to deliver TLB shootdown message
- * to all other processors.
+ * to all other processors which may hold TLB entries of the
+ * given address space.
  *
+ * @param as    Address space or NULL if all processors are
+ *              to be reached.
  * @param type  Type describing scope of shootdown.
  * @param asid  Address space, if required by type.
  * @param page  Virtual page address, if required by type.
@@ -80,19 +89,31 @@ IRQ_SPINLOCK_STATIC_INITIALIZE(tlblock);
  * @return The interrupt priority level as it existed prior to this call.
  *
  */
-ipl_t tlb_shootdown_start(tlb_invalidate_type_t type, asid_t asid,
-    uintptr_t page, size_t count)
+static ipl_t tlb_shootdown_send(as_t *as, tlb_invalidate_type_t type,
+    asid_t asid, uintptr_t page, size_t count)
 {
 	ipl_t ipl = interrupts_disable();
 	CPU->tlb_active = false;
 	irq_spinlock_lock(&tlblock, false);
 	
+	/*
+	 * Pairs with the update of the CPU mask in as_switch(). Either we
+	 * see the bit of a processor joining the address space, or it sees
+	 * tlblock locked and waits for us in tlb_shootdown_wait().
+	 */
+	memory_barrier();
+	
+	size_t targets = 0;
 	size_t i;
 	for (i = 0; i < config.cpu_count; i++) {
-		if (i == CPU->id)
+		cpu_t *cpu = &cpus[i];
+		
+		cpu->tlb_target = ((i != CPU->id) &&
+		    ((as == NULL) || (as_cpu_mask_test(as, i))));
+		if (!cpu->tlb_target)
 			continue;
 		
-		cpu_t *cpu = &cpus[i];
+		targets++;
 		
 		irq_spinlock_lock(&cpu->lock, false);
 		if (cpu->tlb_messages_count == TLB_MESSAGE_QUEUE_LEN) {
@@ -118,17 +139,62 @@ ipl_t tlb_shootdown_start(tlb_invalidate_type_t type, asid_t asid,
 		irq_spinlock_unlock(&cpu->lock, false);
 	}
 	
-	tlb_shootdown_ipi_send();
+	if (targets == config.cpu_count - 1) {
+		tlb_shootdown_ipi_send();
+	} else {
+		for (i = 0; i < config.cpu_count; i++) {
+			if (cpus[i].tlb_target)
+				ipi_unicast(i, VECTOR_TLB_SHOOTDOWN_IPI);
+		}
+	}
+	
+	CPU->tlb_ipis_sent += targets;
+	CPU->tlb_ipis_avoided += config.cpu_count - 1 - targets;
 	
 busy_wait:
 	for (i = 0; i < config.cpu_count; i++) {
-		if (cpus[i].tlb_active)
+		if ((cpus[i].tlb_target) && (cpus[i].tlb_active))
 			goto busy_wait;
 	}
 	
 	return ipl;
 }
 
+/** Send TLB shootdown message to all processors.
+ *
+ * @param type  Type describing scope of shootdown.
+ * @param asid  Address space, if required by type.
+ * @param page  Virtual page address, if required by type.
+ * @param count Number of pages, if required by type.
+ *
+ * @return The interrupt priority level as it existed prior to this call.
+ *
+ */
+ipl_t tlb_shootdown_start(tlb_invalidate_type_t type, asid_t asid,
+    uintptr_t page, size_t count)
+{
+	return tlb_shootdown_send(NULL, type, asid, page, count);
+}
+
+/** Send TLB shootdown message concerning one address space.
+ *
+ * Only processors which may hold TLB entries of the address
+ * space are interrupted.
+ *
+ * @param as    Address space.
+ * @param type  Type describing scope of shootdown.
+ * @param page  Virtual page address, if required by type.
+ * @param count Number of pages, if required by type.
+ *
+ * @return The interrupt priority level as it existed prior to this call.
+ *
+ */
+ipl_t tlb_shootdown_start_as(as_t *as, tlb_invalidate_type_t type,
+    uintptr_t page, size_t count)
+{
+	return tlb_shootdown_send(as, type, as->asid, page, count);
+}
+
 /** Finish TLB shootdown sequence.
  *
  * @param ipl Previous interrupt priority level.
@@ -146,6 +212,26 @@ void tlb_shootdown_ipi_send(void)
 	ipi_broadcast(VECTOR_TLB_SHOOTDOWN_IPI);
 }
 
+/** Wait for a TLB shootdown in progress to finish.
+ *
+ * Used by a processor which has just announced itself in the CPU mask
+ * of an address space and which might have been missed by a shootdown
+ * in progress. Interrupts are enabled while waiting so that shootdown
+ * messages can still be received. Preemption must be disabled.
+ *
+ */
+void tlb_shootdown_wait(void)
+{
+	memory_barrier();
+	
+	if (!irq_spinlock_locked(&tlblock))
+		return;
+	
+	ipl_t ipl = interrupts_enable();
+	while (irq_spinlock_locked(&tlblock));
+	interrupts_restore(ipl);
+}
+
 /** Receive TLB shootdown message.
  *
  */
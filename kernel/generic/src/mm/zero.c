@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup genericmm
+ * @{
+ */
+
+/**
+ * @file
+ * @brief Pool of pre-zeroed frames.
+ *
+ * Page faults on anonymous memory and on the uninitialized parts of ELF
+ * segments need a zero-filled frame. Instead of clearing the frame while
+ * the faulting thread waits, each processor keeps a small pool of frames
+ * that were cleared in advance by its kzero thread.
+ *
+ * The kzero thread is woken up whenever its pool drops below half of its
+ * capacity and it refills the pool only as long as there is nothing else
+ * ready to run on its processor. Pooled frames are fully reserved, so they
+ * never make a memory reservation fail. Under memory pressure, kzero gives
+ * all pooled frames back to the frame allocator instead.
+ *
+ */
+
+#include <mm/zero.h>
+#include <mm/frame.h>
+#include <mm/km.h>
+#include <mm/reserve.h>
+#include <mm/slab.h>
+#include <synch/spinlock.h>
+#include <synch/semaphore.h>
+#include <proc/thread.h>
+#include <atomic.h>
+#include <config.h>
+#include <cpu.h>
+#include <arch.h>
+#include <mem.h>
+
+/** Per-processor pool of pre-zeroed frames */
+typedef struct {
+	IRQ_SPINLOCK_DECLARE(lock);
+	
+	/** Number of frames in the pool */
+	size_t count;
+	/** Physical addresses of the pooled frames */
+	uintptr_t frames[ZERO_POOL_SIZE];
+	
+	/** Semaphore the kzero thread waits on for refill requests */
+	semaphore_t sem;
+	/** Set while a refill request is pending */
+	atomic_t pending;
+} zero_pool_t;
+
+/** Array of config.cpu_count pools, NULL until zero_init() */
+static zero_pool_t *zero_pools = NULL;
+
+/** Initialize the pre-zeroed frame pools
+ *
+ * Must be called before the kzero threads are started.
+ *
+ */
+void zero_init(void)
+{
+	zero_pool_t *pools =
+	    (zero_pool_t *) malloc(sizeof(zero_pool_t) * config.cpu_count, 0);
+	
+	for (unsigned int i = 0; i < config.cpu_count; i++) {
+		irq_spinlock_initialize(&pools[i].lock, "zero_pool.lock");
+		pools[i].count = 0;
+		
+		/* Fill the pools as soon as the kzero threads start */
+		semaphore_initialize(&pools[i].sem, 1);
+		atomic_set(&pools[i].pending, 1);
+	}
+	
+	write_barrier();
+	zero_pools = pools;
+}
+
+/** Ask the kzero thread of a pool to refill it
+ *
+ * @param pool Pool to be refilled.
+ *
+ */
+NO_TRACE static void zero_pool_request(zero_pool_t *pool)
+{
+	if (!test_and_set(&pool->pending))
+		semaphore_up(&pool->sem);
+}
+
+/** Give all pooled frames back to the frame allocator
+ *
+ * @param pool Pool to be drained.
+ *
+ */
+NO_TRACE static void zero_pool_drain(zero_pool_t *pool)
+{
+	while (true) {
+		uintptr_t frame = 0;
+		
+		irq_spinlock_lock(&pool->lock, true);
+		if (pool->count > 0)
+			frame = pool->frames[--pool->count];
+		irq_spinlock_unlock(&pool->lock, true);
+		
+		if (!frame)
+			break;
+		
+		/* Releases the reservation together with the frame */
+		frame_free(frame, 1);
+	}
+}
+
+/** Clear one frame and add it to a pool
+ *
+ * @param pool Pool to be refilled.
+ *
+ * @return True if the pool can take more frames.
+ *
+ */
+NO_TRACE static bool zero_pool_refill_one(zero_pool_t *pool)
+{
+	/*
+	 * Do not let the pool take memory that would otherwise make
+	 * somebody's reservation fail.
+	 */
+	if (!reserve_try_alloc(1))
+		return false;
+	
+	uintptr_t frame;
+	uintptr_t kpage = km_temporary_page_get(&frame,
+	    FRAME_ATOMIC | FRAME_NO_RESERVE);
+	if (!kpage) {
+		reserve_free(1);
+		return false;
+	}
+	
+	memsetb((void *) kpage, PAGE_SIZE, 0);
+	km_temporary_page_put(kpage);
+	
+	irq_spinlock_lock(&pool->lock, true);
+	
+	bool added = (pool->count < ZERO_POOL_SIZE);
+	if (added)
+		pool->frames[pool->count++] = frame;
+	
+	bool more = (pool->count < ZERO_POOL_SIZE);
+	
+	irq_spinlock_unlock(&pool->lock, true);
+	
+	if (!added)
+		frame_free(frame, 1);
+	
+	return more;
+}
+
+/** Kernel thread keeping the pool of its processor filled
+ *
+ * The thread is wired to the processor whose pool it maintains.
+ *
+ * @param arg Not used.
+ *
+ */
+void kzero(void *arg)
+{
+	zero_pool_t *pool = &zero_pools[CPU->id];
+	
+	thread_detach(THREAD);
+	
+	while (true) {
+		semaphore_down(&pool->sem);
+		
+		while (true) {
+			if (frame_low_memory()) {
+				zero_pool_drain(pool);
+				break;
+			}
+			
+			/*
+			 * Refill only while the processor would otherwise be
+			 * idle. Whoever takes the next frame from the pool
+			 * issues a new request.
+			 */
+			if (atomic_get(&CPU->nrdy) > 0)
+				break;
+			
+			if (!zero_pool_refill_one(pool))
+				break;
+		}
+		
+		atomic_set(&pool->pending, 0);
+	}
+}
+
+/** Check whether a pre-zeroed frame is available on this processor
+ *
+ * The answer is only a hint, the pool can be drained by the time
+ * zero_frame_alloc() is called.
+ *
+ * @return True if the pool of the current processor is not empty.
+ *
+ */
+bool zero_frame_available(void)
+{
+	if (!zero_pools)
+		return false;
+	
+	return (zero_pools[CPU->id].count > 0);
+}
+
+/** Allocate a zero-filled frame
+ *
+ * Take a frame from the pool of the current processor or clear a newly
+ * allocated frame if the pool is empty. The frame is not reserved, the
+ * caller must have already reserved the memory for it (as if it was
+ * allocated with FRAME_NO_RESERVE).
+ *
+ * @return Physical address of the zero-filled frame.
+ *
+ */
+uintptr_t zero_frame_alloc(void)
+{
+	uintptr_t frame = 0;
+	
+	if (zero_pools) {
+		zero_pool_t *pool = &zero_pools[CPU->id];
+		
+		irq_spinlock_lock(&pool->lock, true);
+		if (pool->count > 0)
+			frame = pool->frames[--pool->count];
+		size_t count = pool->count;
+		irq_spinlock_unlock(&pool->lock, true);
+		
+		if (count < ZERO_POOL_SIZE / 2)
+			zero_pool_request(pool);
+		
+		if (frame) {
+			/* The caller's reservation takes over */
+			reserve_free(1);
+			return frame;
+		}
+	}
+	
+	uintptr_t kpage = km_temporary_page_get(&frame, FRAME_NO_RESERVE);
+	memsetb((void *) kpage, PAGE_SIZE, 0);
+	km_temporary_page_put(kpage);
+	
+	return frame;
+}
+
+/** @}
+ */
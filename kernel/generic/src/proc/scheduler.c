@@ -45,9 +45,11 @@
 #include <mm/frame.h>
 #include <mm/page.h>
 #include <mm/as.h>
+#include <time/clock.h>
 #include <time/timeout.h>
 #include <time/delay.h>
 #include <arch/asm.h>
+#include <arch/barrier.h>
 #include <arch/faddr.h>
 #include <arch/cycle.h>
 #include <atomic.h>
@@ -62,9 +64,11 @@
 #include <adt/list.h>
 #include <panic.h>
 #include <cpu.h>
+#include <cpu/cpu_mask.h>
 #include <print.h>
 #include <log.h>
 #include <stacktrace.h>
+#include <ktrace.h>
 
 static void scheduler_separated_stack(void);
 
@@ -188,6 +192,150 @@ void scheduler_init(void)
 {
 }
 
+#ifdef CONFIG_SMP
+/** Steal a ready thread from a run queue of another CPU
+ *
+ * Search the run queue from the back for a thread which
+ * can be migrated and ready it on the current CPU.
+ *
+ * @param cpu CPU to steal from.
+ * @param i   Index of the run queue to steal from.
+ *
+ * @return True if a thread was stolen, false otherwise.
+ *
+ */
+static bool steal_thread(cpu_t *cpu, unsigned int i)
+{
+	irq_spinlock_lock(&(cpu->rq[i].lock), true);
+	if (cpu->rq[i].n == 0) {
+		irq_spinlock_unlock(&(cpu->rq[i].lock), true);
+		return false;
+	}
+	
+	thread_t *thread = NULL;
+	
+	/* Search rq from the back */
+	link_t *link = cpu->rq[i].rq.head.prev;
+	
+	while (link != &(cpu->rq[i].rq.head)) {
+		thread = (thread_t *) list_get_instance(link,
+		    thread_t, rq_link);
+		
+		/*
+		 * Do not steal CPU-wired threads, threads
+		 * already stolen, threads for which migration
+		 * was temporarily disabled or threads whose
+		 * FPU context is still in the CPU.
+		 */
+		irq_spinlock_lock(&thread->lock, false);
+		
+		if ((!thread->wired) && (!thread->stolen) &&
+		    (!thread->nomigrate) &&
+		    (!thread->fpu_context_engaged)) {
+			/*
+			 * Remove thread from ready queue.
+			 */
+			irq_spinlock_unlock(&thread->lock, false);
+			
+			atomic_dec(&cpu->nrdy);
+			atomic_dec(&nrdy);
+			
+			if (--cpu->rq[i].n == 0)
+				rq_bitmap_clear(&cpu->rq_bitmap, i);
+			list_remove(&thread->rq_link);
+			
+			break;
+		}
+		
+		irq_spinlock_unlock(&thread->lock, false);
+		
+		link = link->prev;
+		thread = NULL;
+	}
+	
+	if (thread == NULL) {
+		irq_spinlock_unlock(&(cpu->rq[i].lock), true);
+		return false;
+	}
+	
+	/*
+	 * Ready thread on local CPU
+	 */
+	
+	irq_spinlock_pass(&(cpu->rq[i].lock), &thread->lock);
+	
+#ifdef KCPULB_VERBOSE
+	log(LF_OTHER, LVL_DEBUG,
+	    "cpu%u: TID %" PRIu64 " cpu%u -> cpu%u, "
+	    "nrdy=%ld, avg=%ld", CPU->id, thread->tid, cpu->id,
+	    CPU->id, atomic_get(&CPU->nrdy),
+	    atomic_get(&nrdy) / config.cpu_active);
+#endif
+	
+	thread->stolen = true;
+	thread->state = Entering;
+	
+	irq_spinlock_unlock(&thread->lock, true);
+	thread_ready(thread);
+	
+	return true;
+}
+
+/** Steal work for an idle CPU
+ *
+ * Find the active CPU with the most ready threads and
+ * steal one of its ready threads, trying higher-priority
+ * run queues first. This lets an idle CPU pick up work
+ * immediately instead of waiting for kcpulb.
+ *
+ * @return True if a thread was stolen, false otherwise.
+ *
+ */
+static bool idle_steal(void)
+{
+	if (config.cpu_active <= 1)
+		return false;
+	
+	DEFINE_CPU_MASK(neighbours);
+	cpu_mask_active(neighbours);
+	
+	cpu_t *victim = NULL;
+	atomic_count_t victim_nrdy = 0;
+	
+	cpu_mask_for_each(*neighbours, cpu_id) {
+		cpu_t *cpu = &cpus[cpu_id];
+		
+		if (cpu == CPU)
+			continue;
+		
+		atomic_count_t rdy = atomic_get(&cpu->nrdy);
+		if (rdy > victim_nrdy) {
+			victim = cpu;
+			victim_nrdy = rdy;
+		}
+	}
+	
+	if (victim == NULL)
+		return false;
+	
+	CPU->steal_attempts++;
+	
+	rq_bitmap_t bitmap = victim->rq_bitmap;
+	while (bitmap != 0) {
+		unsigned int i = rq_bitmap_first(bitmap);
+		
+		if (steal_thread(victim, i)) {
+			CPU->steal_successes++;
+			return true;
+		}
+		
+		bitmap &= bitmap - 1;
+	}
+	
+	return false;
+}
+#endif /* CONFIG_SMP */
+
 /** Get thread to be scheduled
  *
  * Get the optimal thread to be scheduled
@@ -204,6 +352,15 @@ static thread_t *find_best_thread(void)
 loop:
 	
 	if (atomic_get(&CPU->nrdy) == 0) {
+#ifdef CONFIG_SMP
+		/*
+		 * Try to find some work on other CPUs
+		 * before going to sleep.
+		 */
+		if (idle_steal())
+			goto loop;
+#endif
+		
 		/*
 		 * For there was nothing to run, the CPU goes to sleep
 		 * until a hardware interrupt or an IPI comes.
@@ -212,6 +369,19 @@ loop:
 		irq_spinlock_lock(&CPU->lock, false);
 		CPU->idle = true;
 		irq_spinlock_unlock(&CPU->lock, false);
+		
+		/*
+		 * Let the clock skip the ticks which have no timeouts
+		 * to run. A thread readied on this CPU in the meantime
+		 * is either noticed here, or thread_ready() notices
+		 * that we are tickless and sends us an IPI.
+		 */
+		if (clock_tickless_enter()) {
+			memory_barrier();
+			if (atomic_get(&CPU->nrdy) != 0)
+				clock_tickless_exit();
+		}
+		
 		interrupts_enable();
 		
 		/*
@@ -221,50 +391,58 @@ loop:
 		 */
 		cpu_sleep();
 		interrupts_disable();
+		clock_tickless_exit();
 		goto loop;
 	}
 
 	assert(!CPU->idle);
 	
-	unsigned int i;
-	for (i = 0; i < RQ_COUNT; i++) {
-		irq_spinlock_lock(&(CPU->rq[i].lock), false);
-		if (CPU->rq[i].n == 0) {
-			/*
-			 * If this queue is empty, try a lower-priority queue.
-			 */
-			irq_spinlock_unlock(&(CPU->rq[i].lock), false);
-			continue;
-		}
-		
-		atomic_dec(&CPU->nrdy);
-		atomic_dec(&nrdy);
-		CPU->rq[i].n--;
-		
-		/*
-		 * Take the first thread from the queue.
-		 */
-		thread_t *thread = list_get_instance(
-		    list_first(&CPU->rq[i].rq), thread_t, rq_link);
-		list_remove(&thread->rq_link);
-		
-		irq_spinlock_pass(&(CPU->rq[i].lock), &thread->lock);
-		
-		thread->cpu = CPU;
-		thread->ticks = us2ticks((i + 1) * 10000);
-		thread->priority = i;  /* Correct rq index */
-		
+	/*
+	 * Pick the highest-priority non-empty queue in one go.
+	 * The bitmap might be momentarily out of date with respect
+	 * to nrdy while other CPUs are stealing from us.
+	 */
+	rq_bitmap_t bitmap = CPU->rq_bitmap;
+	if (bitmap == 0)
+		goto loop;
+	
+	unsigned int i = rq_bitmap_first(bitmap);
+	
+	irq_spinlock_lock(&(CPU->rq[i].lock), false);
+	if (CPU->rq[i].n == 0) {
 		/*
-		 * Clear the stolen flag so that it can be migrated
-		 * when load balancing needs emerge.
+		 * The queue was emptied after we looked at the bitmap.
 		 */
-		thread->stolen = false;
-		irq_spinlock_unlock(&thread->lock, false);
-		
-		return thread;
+		irq_spinlock_unlock(&(CPU->rq[i].lock), false);
+		goto loop;
 	}
 	
-	goto loop;
+	atomic_dec(&CPU->nrdy);
+	atomic_dec(&nrdy);
+	if (--CPU->rq[i].n == 0)
+		rq_bitmap_clear(&CPU->rq_bitmap, i);
+	
+	/*
+	 * Take the first thread from the queue.
+	 */
+	thread_t *thread = list_get_instance(
+	    list_first(&CPU->rq[i].rq), thread_t, rq_link);
+	list_remove(&thread->rq_link);
+	
+	irq_spinlock_pass(&(CPU->rq[i].lock), &thread->lock);
+	
+	thread->cpu = CPU;
+	thread->ticks = us2ticks((i + 1) * 10000);
+	thread->priority = i;  /* Correct rq index */
+	
+	/*
+	 * Clear the stolen flag so that it can be migrated
+	 * when load balancing needs emerge.
+	 */
+	thread->stolen = false;
+	irq_spinlock_unlock(&thread->lock, false);
+	
+	return thread;
 }
 
 /** Prevent rq starvation
@@ -294,6 +472,7 @@ static void relink_rq(int start)
 			list_concat(&list, &CPU->rq[i + 1].rq);
 			size_t n = CPU->rq[i + 1].n;
 			CPU->rq[i + 1].n = 0;
+			rq_bitmap_clear(&CPU->rq_bitmap, i + 1);
 			irq_spinlock_unlock(&CPU->rq[i + 1].lock, false);
 			
 			/* Append rq[i + 1] to rq[i] */
@@ -301,6 +480,8 @@ static void relink_rq(int start)
 			irq_spinlock_lock(&CPU->rq[i].lock, false);
 			list_concat(&CPU->rq[i].rq, &list);
 			CPU->rq[i].n += n;
+			if (CPU->rq[i].n > 0)
+				rq_bitmap_set(&CPU->rq_bitmap, i);
 			irq_spinlock_unlock(&CPU->rq[i].lock, false);
 		}
 		
@@ -524,6 +705,7 @@ repeat:
 	
 	irq_spinlock_lock(&THREAD->lock, false);
 	THREAD->state = Running;
+	KTRACE(KTRACE_SCHED_RUN, THREAD->tid);
 	
 #ifdef SCHEDULER_VERBOSE
 	log(LF_OTHER, LVL_DEBUG,
@@ -617,75 +799,10 @@ not_satisfied:
 			if (atomic_get(&cpu->nrdy) <= average)
 				continue;
 			
-			irq_spinlock_lock(&(cpu->rq[rq].lock), true);
-			if (cpu->rq[rq].n == 0) {
-				irq_spinlock_unlock(&(cpu->rq[rq].lock), true);
+			if (!(cpu->rq_bitmap & ((rq_bitmap_t) 1 << rq)))
 				continue;
-			}
-			
-			thread_t *thread = NULL;
-			
-			/* Search rq from the back */
-			link_t *link = cpu->rq[rq].rq.head.prev;
-			
-			while (link != &(cpu->rq[rq].rq.head)) {
-				thread = (thread_t *) list_get_instance(link,
-				    thread_t, rq_link);
-				
-				/*
-				 * Do not steal CPU-wired threads, threads
-				 * already stolen, threads for which migration
-				 * was temporarily disabled or threads whose
-				 * FPU context is still in the CPU.
-				 */
-				irq_spinlock_lock(&thread->lock, false);
-				
-				if ((!thread->wired) && (!thread->stolen) &&
-				    (!thread->nomigrate) &&
-				    (!thread->fpu_context_engaged)) {
-					/*
-					 * Remove thread from ready queue.
-					 */
-					irq_spinlock_unlock(&thread->lock,
-					    false);
-					
-					atomic_dec(&cpu->nrdy);
-					atomic_dec(&nrdy);
-					
-					cpu->rq[rq].n--;
-					list_remove(&thread->rq_link);
-					
-					break;
-				}
-				
-				irq_spinlock_unlock(&thread->lock, false);
-				
-				link = link->prev;
-				thread = NULL;
-			}
 			
-			if (thread) {
-				/*
-				 * Ready thread on local CPU
-				 */
-				
-				irq_spinlock_pass(&(cpu->rq[rq].lock),
-				    &thread->lock);
-				
-#ifdef KCPULB_VERBOSE
-				log(LF_OTHER, LVL_DEBUG,
-				    "kcpulb%u: TID %" PRIu64 " -> cpu%u, "
-				    "nrdy=%ld, avg=%ld", CPU->id, t->tid,
-				    CPU->id, atomic_get(&CPU->nrdy),
-				    atomic_get(&nrdy) / config.cpu_active);
-#endif
-				
-				thread->stolen = true;
-				thread->state = Entering;
-				
-				irq_spinlock_unlock(&thread->lock, true);
-				thread_ready(thread);
-				
+			if (steal_thread(cpu, rq)) {
 				if (--count == 0)
 					goto satisfied;
 				
@@ -695,11 +812,7 @@ not_satisfied:
 				 *
 				 */
 				acpu_bias++;
-				
-				continue;
-			} else
-				irq_spinlock_unlock(&(cpu->rq[rq].lock), true);
-			
+			}
 		}
 	}
 	
@@ -737,9 +850,11 @@ void sched_print_list(void)
 		
 		irq_spinlock_lock(&cpus[cpu].lock, true);
 		
-		printf("cpu%u: address=%p, nrdy=%" PRIua ", needs_relink=%zu\n",
+		printf("cpu%u: address=%p, nrdy=%" PRIua ", needs_relink=%zu, "
+		    "steals=%" PRIu64 "/%" PRIu64 "\n",
 		    cpus[cpu].id, &cpus[cpu], atomic_get(&cpus[cpu].nrdy),
-		    cpus[cpu].needs_relink);
+		    cpus[cpu].needs_relink, cpus[cpu].steal_successes,
+		    cpus[cpu].steal_attempts);
 		
 		unsigned int i;
 		for (i = 0; i < RQ_COUNT; i++) {
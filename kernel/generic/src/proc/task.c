@@ -46,8 +46,8 @@
 #include <synch/waitq.h>
 #include <arch.h>
 #include <arch/barrier.h>
-#include <adt/avl.h>
 #include <adt/btree.h>
+#include <adt/cht.h>
 #include <adt/list.h>
 #include <cap/cap.h>
 #include <ipc/ipc.h>
@@ -58,24 +58,40 @@
 #include <func.h>
 #include <str.h>
 #include <syscall/copy.h>
+#include <synch/rcu.h>
 #include <macros.h>
 
-/** Spinlock protecting the tasks_tree AVL tree. */
-IRQ_SPINLOCK_INITIALIZE(tasks_lock);
+/** Number of lists the active tasks are spread over (power of two). */
+#define TASKS_LISTS  16
 
-/** AVL tree of active tasks.
+/** List of active tasks together with its lock. */
+typedef struct {
+	IRQ_SPINLOCK_DECLARE(lock);
+	list_t list;
+} tasks_list_t;
+
+/** Lists of active tasks.
+ *
+ * Each task is linked to the list selected by its ID and the lists are kept
+ * sorted by task ID. Tasks created or destroyed in parallel land in
+ * different lists, so they do not contend for a single lock. The lists are
+ * only used when all the tasks need to be traversed, see task_list_lock()
+ * and task_list_walk(). A task found in the lists is guaranteed to exist as
+ * long as the lists are locked.
  *
- * The task is guaranteed to exist after it was found in the tasks_tree as
- * long as:
+ */
+static tasks_list_t tasks_lists[TASKS_LISTS];
+
+/** Concurrent hash table of active tasks indexed by task ID.
  *
- * @li the tasks_lock is held,
- * @li the task's lock is held when task's lock is acquired before releasing
- *     tasks_lock or
- * @li the task's refcount is greater than 0
+ * The table contains the same tasks as tasks_lists, but it can be searched
+ * without holding any lock. A task found in the table is guaranteed to stay
+ * allocated until the end of the RCU reader section in which it was found.
  *
  */
-avltree_t tasks_tree;
+static cht_t tasks_cht;
 
+IRQ_SPINLOCK_STATIC_INITIALIZE(task_counter_lock);
 static task_id_t task_counter = 0;
 
 static slab_cache_t *task_cache;
@@ -85,26 +101,178 @@ static void task_kill_internal(task_t *);
 static errno_t tsk_constructor(void *, unsigned int);
 static size_t tsk_destructor(void *obj);
 
+static size_t tasks_cht_hash(const cht_link_t *);
+static size_t tasks_cht_key_hash(void *);
+static bool tasks_cht_equal(const cht_link_t *, const cht_link_t *);
+static bool tasks_cht_key_equal(void *, const cht_link_t *);
+static void tasks_cht_remove_callback(cht_link_t *);
+
+static cht_ops_t tasks_cht_ops = {
+	.hash = tasks_cht_hash,
+	.key_hash = tasks_cht_key_hash,
+	.equal = tasks_cht_equal,
+	.key_equal = tasks_cht_key_equal,
+	.remove_callback = tasks_cht_remove_callback
+};
+
 /** Initialize kernel tasks support.
  *
  */
 void task_init(void)
 {
 	TASK = NULL;
-	avltree_create(&tasks_tree);
+	
+	for (unsigned int i = 0; i < TASKS_LISTS; i++) {
+		irq_spinlock_initialize(&tasks_lists[i].lock, "tasks_list_lock");
+		list_initialize(&tasks_lists[i].list);
+	}
+	
+	if (!cht_create(&tasks_cht, 0, 0, 0, true, &tasks_cht_ops))
+		panic("Cannot create the task hash table.");
+	
 	task_cache = slab_cache_create("task_t", sizeof(task_t), 0,
 	    tsk_constructor, tsk_destructor, 0);
 }
 
+static size_t tasks_cht_hash(const cht_link_t *item)
+{
+	task_t *task = member_to_inst(item, task_t, tasks_cht_link);
+	return (size_t) task->taskid;
+}
+
+static size_t tasks_cht_key_hash(void *key)
+{
+	return (size_t) *((task_id_t *) key);
+}
+
+static bool tasks_cht_equal(const cht_link_t *item1, const cht_link_t *item2)
+{
+	task_t *task1 = member_to_inst(item1, task_t, tasks_cht_link);
+	task_t *task2 = member_to_inst(item2, task_t, tasks_cht_link);
+	
+	return task1->taskid == task2->taskid;
+}
+
+static bool tasks_cht_key_equal(void *key, const cht_link_t *item)
+{
+	task_t *task = member_to_inst(item, task_t, tasks_cht_link);
+	return task->taskid == *((task_id_t *) key);
+}
+
+/** Drop one reference to the memory of a destroyed task.
+ *
+ * The task structure is freed once both task_destroy() has finished and
+ * the grace period following the removal of the task from tasks_cht has
+ * elapsed.
+ *
+ * @param task Task to be freed.
+ *
+ */
+static void task_free(task_t *task)
+{
+	if (atomic_predec(&task->free_refs) == 0)
+		slab_free(task_cache, task);
+}
+
+/** Called by tasks_cht after the grace period of a removed task. */
+static void tasks_cht_remove_callback(cht_link_t *item)
+{
+	task_free(member_to_inst(item, task_t, tasks_cht_link));
+}
+
+/** Get the list of active tasks a task belongs to.
+ *
+ * @param id Task ID.
+ *
+ * @return List of active tasks.
+ *
+ */
+static tasks_list_t *tasks_list_get(task_id_t id)
+{
+	return &tasks_lists[id & (TASKS_LISTS - 1)];
+}
+
+/** Lock the lists of all active tasks.
+ *
+ * Interrupts are disabled until the matching task_list_unlock(). The task
+ * lock of any of the tasks may be acquired while the lists are locked, but
+ * not vice versa.
+ *
+ */
+void task_list_lock(void)
+{
+	irq_spinlock_lock(&tasks_lists[0].lock, true);
+	for (unsigned int i = 1; i < TASKS_LISTS; i++)
+		irq_spinlock_lock(&tasks_lists[i].lock, false);
+}
+
+/** Unlock the lists of all active tasks.
+ *
+ */
+void task_list_unlock(void)
+{
+	for (unsigned int i = TASKS_LISTS - 1; i > 0; i--)
+		irq_spinlock_unlock(&tasks_lists[i].lock, false);
+	irq_spinlock_unlock(&tasks_lists[0].lock, true);
+}
+
+/** Walk all active tasks in the order of their IDs.
+ *
+ * The lists of active tasks must be locked by task_list_lock(). The walker
+ * must not remove tasks from the lists.
+ *
+ * @param walker Function called for every task. The walk is stopped when
+ *               it returns false.
+ * @param arg    Argument passed to the walker.
+ *
+ */
+void task_list_walk(bool (*walker)(task_t *, void *), void *arg)
+{
+	link_t *cur[TASKS_LISTS];
+	
+	assert(interrupts_disabled());
+	
+	for (unsigned int i = 0; i < TASKS_LISTS; i++) {
+		assert(irq_spinlock_locked(&tasks_lists[i].lock));
+		cur[i] = list_first(&tasks_lists[i].list);
+	}
+	
+	/* Merge the sorted lists */
+	while (true) {
+		task_t *next = NULL;
+		unsigned int next_list = 0;
+		
+		for (unsigned int i = 0; i < TASKS_LISTS; i++) {
+			if (cur[i] == NULL)
+				continue;
+			
+			task_t *task = list_get_instance(cur[i], task_t,
+			    tasks_link);
+			if ((next == NULL) || (task->taskid < next->taskid)) {
+				next = task;
+				next_list = i;
+			}
+		}
+		
+		if (next == NULL)
+			break;
+		
+		cur[next_list] = list_next(cur[next_list],
+		    &tasks_lists[next_list].list);
+		
+		if (!walker(next, arg))
+			break;
+	}
+}
+
 /** Task finish walker.
  *
  * The idea behind this walker is to kill and count all tasks different from
  * TASK.
  *
  */
-static bool task_done_walker(avltree_node_t *node, void *arg)
+static bool task_done_walker(task_t *task, void *arg)
 {
-	task_t *task = avltree_get_instance(node, task_t, tasks_tree_node);
 	size_t *cnt = (size_t *) arg;
 	
 	if (task != TASK) {
@@ -144,10 +312,10 @@ void task_done(void)
 		printf("Killing tasks... ");
 #endif
 		
-		irq_spinlock_lock(&tasks_lock, true);
+		task_list_lock();
 		tasks_left = 0;
-		avltree_walk(&tasks_tree, task_done_walker, &tasks_left);
-		irq_spinlock_unlock(&tasks_lock, true);
+		task_list_walk(task_done_walker, &tasks_left);
+		task_list_unlock();
 		
 		thread_sleep(1);
 		
@@ -219,6 +387,8 @@ task_t *task_create(as_t *as, const char *name)
 	task->perms = 0;
 	task->ucycles = 0;
 	task->kcycles = 0;
+	atomic_set(&task->page_faults, 0);
+	atomic_set(&task->fault_around, 0);
 
 	caps_task_init(task);
 
@@ -265,14 +435,32 @@ task_t *task_create(as_t *as, const char *name)
 	 */
 	as_hold(task->as);
 	
-	irq_spinlock_lock(&tasks_lock, true);
-	
+	irq_spinlock_lock(&task_counter_lock, true);
 	task->taskid = ++task_counter;
-	avltree_node_initialize(&task->tasks_tree_node);
-	task->tasks_tree_node.key = task->taskid;
-	avltree_insert(&tasks_tree, &task->tasks_tree_node);
+	irq_spinlock_unlock(&task_counter_lock, true);
 	
-	irq_spinlock_unlock(&tasks_lock, true);
+	atomic_set(&task->free_refs, 2);
+	
+	/*
+	 * Keep the list sorted. Tasks created in parallel may be inserted out
+	 * of the order of their IDs, but only by a few positions.
+	 */
+	tasks_list_t *tasks_list = tasks_list_get(task->taskid);
+	irq_spinlock_lock(&tasks_list->lock, true);
+	
+	link_t *prev = list_last(&tasks_list->list);
+	while ((prev != NULL) && (list_get_instance(prev, task_t,
+	    tasks_link)->taskid > task->taskid))
+		prev = list_prev(prev, &tasks_list->list);
+	
+	if (prev != NULL)
+		list_insert_after(&task->tasks_link, prev);
+	else
+		list_prepend(&task->tasks_link, &tasks_list->list);
+	
+	irq_spinlock_unlock(&tasks_list->lock, true);
+	
+	cht_insert(&tasks_cht, &task->tasks_cht_link);
 	
 	return task;
 }
@@ -285,11 +473,18 @@ task_t *task_create(as_t *as, const char *name)
 void task_destroy(task_t *task)
 {
 	/*
-	 * Remove the task from the task B+tree.
+	 * Remove the task from the list of active tasks and from the task hash
+	 * table. Lock-less readers may still be using the task, so it is not
+	 * freed until the next grace period.
 	 */
-	irq_spinlock_lock(&tasks_lock, true);
-	avltree_delete(&tasks_tree, &task->tasks_tree_node);
-	irq_spinlock_unlock(&tasks_lock, true);
+	tasks_list_t *tasks_list = tasks_list_get(task->taskid);
+	irq_spinlock_lock(&tasks_list->lock, true);
+	list_remove(&task->tasks_link);
+	irq_spinlock_unlock(&tasks_list->lock, true);
+	
+	rcu_read_lock();
+	cht_remove_item(&tasks_cht, &task->tasks_cht_link);
+	rcu_read_unlock();
 	
 	/*
 	 * Perform architecture specific task destruction.
@@ -306,7 +501,7 @@ void task_destroy(task_t *task)
 	 */
 	as_release(task->as);
 	
-	slab_free(task_cache, task);
+	task_free(task);
 }
 
 /** Hold a reference to a task.
@@ -404,16 +599,14 @@ sys_errno_t sys_task_set_name(const char *uspace_name, size_t name_len)
 	 * of the update.
 	 */
 	
-	irq_spinlock_lock(&tasks_lock, true);
-	irq_spinlock_lock(&TASK->lock, false);
-	irq_spinlock_lock(&threads_lock, false);
+	irq_spinlock_lock(&TASK->lock, true);
+	thread_list_lock();
 	
 	/* Set task name */
 	str_cpy(TASK->name, TASK_NAME_BUFLEN, namebuf);
 	
-	irq_spinlock_unlock(&threads_lock, false);
-	irq_spinlock_unlock(&TASK->lock, false);
-	irq_spinlock_unlock(&tasks_lock, true);
+	thread_list_unlock();
+	irq_spinlock_unlock(&TASK->lock, true);
 	
 	return EOK;
 }
@@ -437,8 +630,10 @@ sys_errno_t sys_task_kill(task_id_t *uspace_taskid)
 
 /** Find task structure corresponding to task ID.
  *
- * The tasks_lock must be already held by the caller of this function and
- * interrupts must be disabled.
+ * The caller of this function must be in an RCU reader section. The returned
+ * task structure remains allocated until the end of that section, but the
+ * task may already be in the middle of being destroyed. Use task_get_by_id()
+ * to obtain a task which is guaranteed to be alive.
  *
  * @param id Task ID.
  *
@@ -447,18 +642,52 @@ sys_errno_t sys_task_kill(task_id_t *uspace_taskid)
  */
 task_t *task_find_by_id(task_id_t id)
 {
-	assert(interrupts_disabled());
-	assert(irq_spinlock_locked(&tasks_lock));
-
-	avltree_node_t *node =
-	    avltree_search(&tasks_tree, (avltree_key_t) id);
+	assert(rcu_read_locked());
 	
-	if (node)
-		return avltree_get_instance(node, task_t, tasks_tree_node);
+	cht_link_t *item = cht_find(&tasks_cht, &id);
+	if (item)
+		return member_to_inst(item, task_t, tasks_cht_link);
 	
 	return NULL;
 }
 
+/** Find task structure corresponding to task ID and hold a reference to it.
+ *
+ * No lock needs to be held by the caller of this function. The reference
+ * must be dropped by task_release().
+ *
+ * @param id Task ID.
+ *
+ * @return Task structure address or NULL if there is no such task ID or
+ *         if the task is being destroyed.
+ *
+ */
+task_t *task_get_by_id(task_id_t id)
+{
+	task_t *held = NULL;
+	
+	rcu_read_lock();
+	task_t *task = task_find_by_id(id);
+	if (task) {
+		/*
+		 * The reference count of a task which is being destroyed is
+		 * zero and must not be resurrected.
+		 */
+		atomic_count_t refcount = atomic_get(&task->refcount);
+		while (refcount != 0) {
+			if (__atomic_compare_exchange_n(&task->refcount.count,
+			    &refcount, refcount + 1, false, __ATOMIC_ACQUIRE,
+			    __ATOMIC_RELAXED)) {
+				held = task;
+				break;
+			}
+		}
+	}
+	rcu_read_unlock();
+	
+	return held;
+}
+
 /** Get accounting data of given task.
  *
  * Note that task lock of 'task' must be already held and interrupts must be
@@ -502,8 +731,11 @@ void task_get_accounting(task_t *task, uint64_t *ucycles, uint64_t *kcycles)
 
 static void task_kill_internal(task_t *task)
 {
-	irq_spinlock_lock(&task->lock, false);
-	irq_spinlock_lock(&threads_lock, false);
+	/*
+	 * The threads cannot be destroyed while they are linked to the task,
+	 * i.e. until the task lock is released.
+	 */
+	irq_spinlock_lock(&task->lock, true);
 	
 	/*
 	 * Interrupt all threads.
@@ -524,8 +756,7 @@ static void task_kill_internal(task_t *task)
 			waitq_interrupt_sleep(thread);
 	}
 	
-	irq_spinlock_unlock(&threads_lock, false);
-	irq_spinlock_unlock(&task->lock, false);
+	irq_spinlock_unlock(&task->lock, true);
 }
 
 /** Kill task.
@@ -543,16 +774,12 @@ errno_t task_kill(task_id_t id)
 	if (id == 1)
 		return EPERM;
 	
-	irq_spinlock_lock(&tasks_lock, true);
-	
-	task_t *task = task_find_by_id(id);
-	if (!task) {
-		irq_spinlock_unlock(&tasks_lock, true);
+	task_t *task = task_get_by_id(id);
+	if (!task)
 		return ENOENT;
-	}
 	
 	task_kill_internal(task);
-	irq_spinlock_unlock(&tasks_lock, true);
+	task_release(task);
 	
 	return EOK;
 }
@@ -583,10 +810,7 @@ void task_kill_self(bool notify)
 		}
 	}
 	
-	irq_spinlock_lock(&tasks_lock, true);
 	task_kill_internal(TASK);
-	irq_spinlock_unlock(&tasks_lock, true);
-	
 	thread_exit();
 }
 
@@ -603,10 +827,9 @@ sys_errno_t sys_task_exit(sysarg_t notify)
 	return EOK;
 }
 
-static bool task_print_walker(avltree_node_t *node, void *arg)
+static bool task_print_walker(task_t *task, void *arg)
 {
 	bool *additional = (bool *) arg;
-	task_t *task = avltree_get_instance(node, task_t, tasks_tree_node);
 	irq_spinlock_lock(&task->lock, false);
 	
 	uint64_t ucycles;
@@ -649,7 +872,7 @@ static bool task_print_walker(avltree_node_t *node, void *arg)
 void task_print_list(bool additional)
 {
 	/* Messing with task structures, avoid deadlock */
-	irq_spinlock_lock(&tasks_lock, true);
+	task_list_lock();
 	
 #ifdef __32_BITS__
 	if (additional)
@@ -668,9 +891,9 @@ void task_print_list(bool additional)
 		    " [as              ]\n");
 #endif
 	
-	avltree_walk(&tasks_tree, task_print_walker, &additional);
+	task_list_walk(task_print_walker, &additional);
 	
-	irq_spinlock_unlock(&tasks_lock, true);
+	task_list_unlock();
 }
 
 /** @}
@@ -51,7 +51,7 @@
 #include <cpu.h>
 #include <str.h>
 #include <context.h>
-#include <adt/avl.h>
+#include <adt/cht.h>
 #include <adt/list.h>
 #include <time/clock.h>
 #include <time/timeout.h>
@@ -59,10 +59,13 @@
 #include <config.h>
 #include <arch/interrupt.h>
 #include <smp/ipi.h>
+#include <smp/smp_call.h>
 #include <arch/faddr.h>
+#include <arch/barrier.h>
 #include <atomic.h>
 #include <mem.h>
 #include <print.h>
+#include <ktrace.h>
 #include <mm/slab.h>
 #include <main/uinit.h>
 #include <syscall/copy.h>
@@ -79,25 +82,37 @@ const char *thread_states[] = {
 	"Lingering"
 };
 
+/** Number of lists the threads are spread over (power of two). */
+#define THREADS_LISTS  16
+
+/** List of threads together with its lock. */
 typedef struct {
-	thread_id_t thread_id;
-	thread_t *thread;
-} thread_iterator_t;
+	IRQ_SPINLOCK_DECLARE(lock);
+	list_t list;
+} threads_list_t;
 
-/** Lock protecting the threads_tree AVL tree.
+/** Lists of all threads.
  *
- * For locking rules, see declaration thereof.
+ * Each attached thread is linked to the list selected by its ID and the
+ * lists are kept sorted by thread ID, so that threads attached and destroyed
+ * in parallel do not contend for a single lock. For locking rules, see
+ * thread_list_lock(). When a thread is found in the lists, it is guaranteed
+ * to exist as long as the lists are locked.
  *
  */
-IRQ_SPINLOCK_INITIALIZE(threads_lock);
+static threads_list_t threads_lists[THREADS_LISTS];
 
-/** AVL tree of all threads.
+/** Concurrent hash tables of all threads.
  *
- * When a thread is found in the threads_tree AVL tree, it is guaranteed to
- * exist as long as the threads_lock is held.
+ * The tables contain the same threads as threads_lists, indexed by the address
+ * of the thread structure and by the thread ID, respectively. They can be
+ * searched without holding any lock. A thread found in either of them is
+ * guaranteed to stay allocated until the end of the RCU reader section in
+ * which it was found.
  *
  */
-avltree_t threads_tree;
+static cht_t threads_cht;
+static cht_t tids_cht;
 
 IRQ_SPINLOCK_STATIC_INITIALIZE(tidlock);
 static thread_id_t last_tid = 0;
@@ -108,6 +123,34 @@ static slab_cache_t *thread_cache;
 slab_cache_t *fpu_context_cache;
 #endif
 
+static size_t threads_cht_hash(const cht_link_t *);
+static size_t threads_cht_key_hash(void *);
+static bool threads_cht_equal(const cht_link_t *, const cht_link_t *);
+static bool threads_cht_key_equal(void *, const cht_link_t *);
+static void threads_cht_remove_callback(cht_link_t *);
+
+static size_t tids_cht_hash(const cht_link_t *);
+static size_t tids_cht_key_hash(void *);
+static bool tids_cht_equal(const cht_link_t *, const cht_link_t *);
+static bool tids_cht_key_equal(void *, const cht_link_t *);
+static void tids_cht_remove_callback(cht_link_t *);
+
+static cht_ops_t threads_cht_ops = {
+	.hash = threads_cht_hash,
+	.key_hash = threads_cht_key_hash,
+	.equal = threads_cht_equal,
+	.key_equal = threads_cht_key_equal,
+	.remove_callback = threads_cht_remove_callback
+};
+
+static cht_ops_t tids_cht_ops = {
+	.hash = tids_cht_hash,
+	.key_hash = tids_cht_key_hash,
+	.equal = tids_cht_equal,
+	.key_equal = tids_cht_key_equal,
+	.remove_callback = tids_cht_remove_callback
+};
+
 /** Thread wrapper.
  *
  * This wrapper is provided to ensure that every thread makes a call to
@@ -248,7 +291,173 @@ void thread_init(void)
 	    sizeof(fpu_context_t), FPU_CONTEXT_ALIGN, NULL, NULL, 0);
 #endif
 	
-	avltree_create(&threads_tree);
+	for (unsigned int i = 0; i < THREADS_LISTS; i++) {
+		irq_spinlock_initialize(&threads_lists[i].lock,
+		    "threads_list_lock");
+		list_initialize(&threads_lists[i].list);
+	}
+	
+	if ((!cht_create(&threads_cht, 0, 0, 0, true, &threads_cht_ops)) ||
+	    (!cht_create(&tids_cht, 0, 0, 0, true, &tids_cht_ops)))
+		panic("Cannot create the thread hash tables.");
+}
+
+static size_t threads_cht_hash(const cht_link_t *item)
+{
+	return (uintptr_t) member_to_inst(item, thread_t, threads_cht_link);
+}
+
+static size_t threads_cht_key_hash(void *key)
+{
+	return (uintptr_t) key;
+}
+
+static bool threads_cht_equal(const cht_link_t *item1,
+    const cht_link_t *item2)
+{
+	return item1 == item2;
+}
+
+static bool threads_cht_key_equal(void *key, const cht_link_t *item)
+{
+	return key == member_to_inst(item, thread_t, threads_cht_link);
+}
+
+static size_t tids_cht_hash(const cht_link_t *item)
+{
+	thread_t *thread = member_to_inst(item, thread_t, tids_cht_link);
+	return (size_t) thread->tid;
+}
+
+static size_t tids_cht_key_hash(void *key)
+{
+	return (size_t) *((thread_id_t *) key);
+}
+
+static bool tids_cht_equal(const cht_link_t *item1, const cht_link_t *item2)
+{
+	thread_t *thread1 = member_to_inst(item1, thread_t, tids_cht_link);
+	thread_t *thread2 = member_to_inst(item2, thread_t, tids_cht_link);
+	
+	return thread1->tid == thread2->tid;
+}
+
+static bool tids_cht_key_equal(void *key, const cht_link_t *item)
+{
+	thread_t *thread = member_to_inst(item, thread_t, tids_cht_link);
+	return thread->tid == *((thread_id_t *) key);
+}
+
+/** Drop one reference to the memory of a destroyed thread.
+ *
+ * The thread structure is freed once thread_destroy() has finished and the
+ * grace periods following the removal of the thread from both thread hash
+ * tables have elapsed.
+ *
+ * @param thread Thread to be freed.
+ *
+ */
+static void thread_free(thread_t *thread)
+{
+	if (atomic_predec(&thread->free_refs) == 0)
+		slab_free(thread_cache, thread);
+}
+
+/** Called by threads_cht after the grace period of a removed thread. */
+static void threads_cht_remove_callback(cht_link_t *item)
+{
+	thread_free(member_to_inst(item, thread_t, threads_cht_link));
+}
+
+/** Called by tids_cht after the grace period of a removed thread. */
+static void tids_cht_remove_callback(cht_link_t *item)
+{
+	thread_free(member_to_inst(item, thread_t, tids_cht_link));
+}
+
+/** Get the list of threads a thread belongs to.
+ *
+ * @param id Thread ID.
+ *
+ * @return List of threads.
+ *
+ */
+static threads_list_t *threads_list_get(thread_id_t id)
+{
+	return &threads_lists[id & (THREADS_LISTS - 1)];
+}
+
+/** Lock the lists of all threads.
+ *
+ * Interrupts are disabled until the matching thread_list_unlock(). The lists
+ * must be locked after the task lock and before the thread lock of any of
+ * the threads.
+ *
+ */
+void thread_list_lock(void)
+{
+	irq_spinlock_lock(&threads_lists[0].lock, true);
+	for (unsigned int i = 1; i < THREADS_LISTS; i++)
+		irq_spinlock_lock(&threads_lists[i].lock, false);
+}
+
+/** Unlock the lists of all threads.
+ *
+ */
+void thread_list_unlock(void)
+{
+	for (unsigned int i = THREADS_LISTS - 1; i > 0; i--)
+		irq_spinlock_unlock(&threads_lists[i].lock, false);
+	irq_spinlock_unlock(&threads_lists[0].lock, true);
+}
+
+/** Walk all threads in the order of their IDs.
+ *
+ * The lists of threads must be locked by thread_list_lock(). The walker
+ * must not remove threads from the lists.
+ *
+ * @param walker Function called for every thread. The walk is stopped
+ *               when it returns false.
+ * @param arg    Argument passed to the walker.
+ *
+ */
+void thread_list_walk(bool (*walker)(thread_t *, void *), void *arg)
+{
+	link_t *cur[THREADS_LISTS];
+	
+	assert(interrupts_disabled());
+	
+	for (unsigned int i = 0; i < THREADS_LISTS; i++) {
+		assert(irq_spinlock_locked(&threads_lists[i].lock));
+		cur[i] = list_first(&threads_lists[i].list);
+	}
+	
+	/* Merge the sorted lists */
+	while (true) {
+		thread_t *next = NULL;
+		unsigned int next_list = 0;
+		
+		for (unsigned int i = 0; i < THREADS_LISTS; i++) {
+			if (cur[i] == NULL)
+				continue;
+			
+			thread_t *thread = list_get_instance(cur[i], thread_t,
+			    threads_link);
+			if ((next == NULL) || (thread->tid < next->tid)) {
+				next = thread;
+				next_list = i;
+			}
+		}
+		
+		if (next == NULL)
+			break;
+		
+		cur[next_list] = list_next(cur[next_list],
+		    &threads_lists[next_list].list);
+		
+		if (!walker(next, arg))
+			break;
+	}
 }
 
 /** Wire thread to the given CPU
@@ -306,6 +515,7 @@ void thread_ready(thread_t *thread)
 	}
 	
 	thread->state = Ready;
+	KTRACE(KTRACE_SCHED_READY, thread->tid);
 	
 	irq_spinlock_pass(&thread->lock, &(cpu->rq[i].lock));
 	
@@ -315,11 +525,22 @@ void thread_ready(thread_t *thread)
 	 */
 	
 	list_append(&thread->rq_link, &cpu->rq[i].rq);
-	cpu->rq[i].n++;
+	if (cpu->rq[i].n++ == 0)
+		rq_bitmap_set(&cpu->rq_bitmap, i);
 	irq_spinlock_unlock(&(cpu->rq[i].lock), true);
 	
 	atomic_inc(&nrdy);
 	atomic_inc(&cpu->nrdy);
+	
+#ifdef CONFIG_SMP
+	/*
+	 * A CPU in tickless idle would not notice the thread
+	 * until its next timeout is due. Wake it up.
+	 */
+	memory_barrier();
+	if ((cpu != CPU) && (cpu->tickless_ticks != 0))
+		arch_smp_call_ipi(cpu->id);
+#endif
 }
 
 /** Create new thread
@@ -387,6 +608,7 @@ thread_t *thread_create(void (* func)(void *), void *arg, task_t *task,
 	
 	thread->in_copy_from_uspace = false;
 	thread->in_copy_to_uspace = false;
+	thread->fault_area = NULL;
 	
 	thread->interrupted = false;
 	thread->detached = false;
@@ -399,8 +621,7 @@ thread_t *thread_create(void (* func)(void *), void *arg, task_t *task,
 	thread->fpu_context_exists = false;
 	thread->fpu_context_engaged = false;
 	
-	avltree_node_initialize(&thread->threads_tree_node);
-	thread->threads_tree_node.key = (uintptr_t) thread;
+	link_initialize(&thread->threads_link);
 	
 #ifdef CONFIG_UDEBUG
 	/* Initialize debugging stuff */
@@ -440,11 +661,20 @@ void thread_destroy(thread_t *thread, bool irq_res)
 		thread->cpu->fpu_owner = NULL;
 	irq_spinlock_unlock(&thread->cpu->lock, false);
 	
-	irq_spinlock_pass(&thread->lock, &threads_lock);
-	
-	avltree_delete(&threads_tree, &thread->threads_tree_node);
+	threads_list_t *threads_list = threads_list_get(thread->tid);
+	irq_spinlock_pass(&thread->lock, &threads_list->lock);
+	list_remove(&thread->threads_link);
+	irq_spinlock_pass(&threads_list->lock, &thread->task->lock);
 	
-	irq_spinlock_pass(&threads_lock, &thread->task->lock);
+	/*
+	 * Lock-less readers may still be using the thread after it has been
+	 * removed from the hash tables, so it is not freed until the next grace
+	 * period.
+	 */
+	rcu_read_lock();
+	cht_remove_item(&threads_cht, &thread->threads_cht_link);
+	cht_remove_item(&tids_cht, &thread->tids_cht_link);
+	rcu_read_unlock();
 	
 	/*
 	 * Detach from the containing task.
@@ -453,16 +683,20 @@ void thread_destroy(thread_t *thread, bool irq_res)
 	irq_spinlock_unlock(&thread->task->lock, irq_res);
 	
 	/*
-	 * Drop the reference to the containing task.
+	 * Drop the cached page fault area and the reference
+	 * to the containing task.
 	 */
+	if (thread->fault_area != NULL)
+		as_area_release(thread->fault_area);
+	
 	task_release(thread->task);
-	slab_free(thread_cache, thread);
+	thread_free(thread);
 }
 
 /** Make the thread visible to the system.
  *
  * Attach the thread structure to the current task and make it visible in the
- * threads_tree.
+ * lists and hash tables of all threads.
  *
  * @param t    Thread to be attached to the task.
  * @param task Task to which the thread is to be attached.
@@ -484,13 +718,28 @@ void thread_attach(thread_t *thread, task_t *task)
 	
 	list_append(&thread->th_link, &task->threads);
 	
-	irq_spinlock_pass(&task->lock, &threads_lock);
-	
 	/*
-	 * Register this thread in the system-wide list.
+	 * Register this thread in the system-wide list. Keep the list sorted,
+	 * threads attached in parallel may arrive slightly out of order.
 	 */
-	avltree_insert(&threads_tree, &thread->threads_tree_node);
-	irq_spinlock_unlock(&threads_lock, true);
+	threads_list_t *threads_list = threads_list_get(thread->tid);
+	irq_spinlock_pass(&task->lock, &threads_list->lock);
+	
+	link_t *prev = list_last(&threads_list->list);
+	while ((prev != NULL) && (list_get_instance(prev, thread_t,
+	    threads_link)->tid > thread->tid))
+		prev = list_prev(prev, &threads_list->list);
+	
+	if (prev != NULL)
+		list_insert_after(&thread->threads_link, prev);
+	else
+		list_prepend(&thread->threads_link, &threads_list->list);
+	
+	irq_spinlock_unlock(&threads_list->lock, true);
+	
+	atomic_set(&thread->free_refs, 3);
+	cht_insert(&threads_cht, &thread->threads_cht_link);
+	cht_insert(&tids_cht, &thread->tids_cht_link);
 }
 
 /** Terminate thread.
@@ -551,7 +800,8 @@ restart:
  * blocking call was interruptable. See waitq_sleep_timeout().
  * 
  * The caller must guarantee the thread object is valid during the entire
- * function, eg by holding the threads_lock lock.
+ * function, eg by being in an RCU reader section after finding the thread
+ * with thread_exists() or thread_find_by_id().
  * 
  * Interrupted threads automatically exit when returning back to user space.
  * 
@@ -702,10 +952,9 @@ void thread_usleep(uint32_t usec)
 	(void) waitq_sleep_timeout(&wq, usec, SYNCH_FLAGS_NON_BLOCKING, NULL);
 }
 
-static bool thread_walker(avltree_node_t *node, void *arg)
+static bool thread_walker(thread_t *thread, void *arg)
 {
 	bool *additional = (bool *) arg;
-	thread_t *thread = avltree_get_instance(node, thread_t, threads_tree_node);
 	
 	uint64_t ucycles, kcycles;
 	char usuffix, ksuffix;
@@ -771,7 +1020,7 @@ static bool thread_walker(avltree_node_t *node, void *arg)
 void thread_print_list(bool additional)
 {
 	/* Messing with thread structures, avoid deadlock */
-	irq_spinlock_lock(&threads_lock, true);
+	thread_list_lock();
 	
 #ifdef __32_BITS__
 	if (additional)
@@ -791,15 +1040,16 @@ void thread_print_list(bool additional)
 		    " [task            ] [ctn]\n");
 #endif
 	
-	avltree_walk(&threads_tree, thread_walker, &additional);
+	thread_list_walk(thread_walker, &additional);
 	
-	irq_spinlock_unlock(&threads_lock, true);
+	thread_list_unlock();
 }
 
 /** Check whether thread exists.
  *
- * Note that threads_lock must be already held and
- * interrupts must be already disabled.
+ * The caller must be in an RCU reader section. If the thread is found, its
+ * structure remains allocated until the end of that section, but the thread
+ * may already be in the middle of being destroyed.
  *
  * @param thread Pointer to thread.
  *
@@ -808,13 +1058,9 @@ void thread_print_list(bool additional)
  */
 bool thread_exists(thread_t *thread)
 {
-	assert(interrupts_disabled());
-	assert(irq_spinlock_locked(&threads_lock));
-
-	avltree_node_t *node =
-	    avltree_search(&threads_tree, (avltree_key_t) ((uintptr_t) thread));
+	assert(rcu_read_locked());
 	
-	return node != NULL;
+	return cht_find(&threads_cht, thread) != NULL;
 }
 
 /** Update accounting of current thread.
@@ -840,24 +1086,11 @@ void thread_update_accounting(bool user)
 	THREAD->last_cycle = time;
 }
 
-static bool thread_search_walker(avltree_node_t *node, void *arg)
-{
-	thread_t *thread =
-	    (thread_t *) avltree_get_instance(node, thread_t, threads_tree_node);
-	thread_iterator_t *iterator = (thread_iterator_t *) arg;
-	
-	if (thread->tid == iterator->thread_id) {
-		iterator->thread = thread;
-		return false;
-	}
-	
-	return true;
-}
-
 /** Find thread structure corresponding to thread ID.
  *
- * The threads_lock must be already held by the caller of this function and
- * interrupts must be disabled.
+ * The caller of this function must be in an RCU reader section. The returned
+ * thread structure remains allocated until the end of that section, but the
+ * thread may already be in the middle of being destroyed.
  *
  * @param id Thread ID.
  *
@@ -866,29 +1099,27 @@ static bool thread_search_walker(avltree_node_t *node, void *arg)
  */
 thread_t *thread_find_by_id(thread_id_t thread_id)
 {
-	assert(interrupts_disabled());
-	assert(irq_spinlock_locked(&threads_lock));
-	
-	thread_iterator_t iterator;
+	assert(rcu_read_locked());
 	
-	iterator.thread_id = thread_id;
-	iterator.thread = NULL;
+	cht_link_t *item = cht_find(&tids_cht, &thread_id);
+	if (item)
+		return member_to_inst(item, thread_t, tids_cht_link);
 	
-	avltree_walk(&threads_tree, thread_search_walker, (void *) &iterator);
-	
-	return iterator.thread;
+	return NULL;
 }
 
 #ifdef CONFIG_UDEBUG
 
 void thread_stack_trace(thread_id_t thread_id)
 {
-	irq_spinlock_lock(&threads_lock, true);
+	rcu_read_lock();
+	ipl_t ipl = interrupts_disable();
 	
 	thread_t *thread = thread_find_by_id(thread_id);
 	if (thread == NULL) {
 		printf("No such thread.\n");
-		irq_spinlock_unlock(&threads_lock, true);
+		interrupts_restore(ipl);
+		rcu_read_unlock();
 		return;
 	}
 	
@@ -921,7 +1152,8 @@ void thread_stack_trace(thread_id_t thread_id)
 	if (sleeping)
 		waitq_interrupt_sleep(thread);
 	
-	irq_spinlock_unlock(&threads_lock, true);
+	interrupts_restore(ipl);
+	rcu_read_unlock();
 }
 
 #endif /* CONFIG_UDEBUG */
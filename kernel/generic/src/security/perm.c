@@ -40,6 +40,7 @@
 #include <security/perm.h>
 #include <proc/task.h>
 #include <synch/spinlock.h>
+#include <synch/rcu.h>
 #include <syscall/copy.h>
 #include <arch.h>
 #include <errno.h>
@@ -88,19 +89,19 @@ static errno_t perm_grant(task_id_t taskid, perm_t perms)
 	if (!(perm_get(TASK) & PERM_PERM))
 		return EPERM;
 	
-	irq_spinlock_lock(&tasks_lock, true);
+	rcu_read_lock();
 	task_t *task = task_find_by_id(taskid);
 	
 	if ((!task) || (!container_check(CONTAINER, task->container))) {
-		irq_spinlock_unlock(&tasks_lock, true);
+		rcu_read_unlock();
 		return ENOENT;
 	}
 	
-	irq_spinlock_lock(&task->lock, false);
+	irq_spinlock_lock(&task->lock, true);
 	task->perms |= perms;
-	irq_spinlock_unlock(&task->lock, false);
+	irq_spinlock_unlock(&task->lock, true);
 	
-	irq_spinlock_unlock(&tasks_lock, true);
+	rcu_read_unlock();
 	return EOK;
 }
 
@@ -117,11 +118,11 @@ static errno_t perm_grant(task_id_t taskid, perm_t perms)
  */
 static errno_t perm_revoke(task_id_t taskid, perm_t perms)
 {
-	irq_spinlock_lock(&tasks_lock, true);
+	rcu_read_lock();
 	
 	task_t *task = task_find_by_id(taskid);
 	if ((!task) || (!container_check(CONTAINER, task->container))) {
-		irq_spinlock_unlock(&tasks_lock, true);
+		rcu_read_unlock();
 		return ENOENT;
 	}
 	
@@ -130,18 +131,18 @@ static errno_t perm_revoke(task_id_t taskid, perm_t perms)
 	 * a task can revoke permissions from itself even if it
 	 * doesn't have PERM_PERM.
 	 */
-	irq_spinlock_unlock(&TASK->lock, false);
+	irq_spinlock_lock(&TASK->lock, true);
 	
 	if ((!(TASK->perms & PERM_PERM)) || (task != TASK)) {
-		irq_spinlock_unlock(&TASK->lock, false);
-		irq_spinlock_unlock(&tasks_lock, true);
+		irq_spinlock_unlock(&TASK->lock, true);
+		rcu_read_unlock();
 		return EPERM;
 	}
 	
 	task->perms &= ~perms;
-	irq_spinlock_unlock(&TASK->lock, false);
+	irq_spinlock_unlock(&TASK->lock, true);
 	
-	irq_spinlock_unlock(&tasks_lock, true);
+	rcu_read_unlock();
 	return EOK;
 }
 
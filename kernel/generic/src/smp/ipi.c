@@ -59,6 +59,19 @@ void ipi_broadcast(int ipi)
 		ipi_broadcast_arch(ipi);
 }
 
+/** Send IPI message to a single CPU
+ *
+ * @param cpu_id Destination CPU (index into the cpus array). Must not
+ *               be the current CPU.
+ * @param ipi    Message to send.
+ *
+ */
+void ipi_unicast(unsigned int cpu_id, int ipi)
+{
+	if (config.cpu_count > 1)
+		ipi_unicast_arch(cpu_id, ipi);
+}
+
 #endif /* CONFIG_SMP */
 
 /** @}
@@ -80,6 +80,7 @@
 #include <align.h>
 #include <panic.h>
 #include <errno.h>
+#include <ktrace.h>
 
 /** Task specific pointer to a global kernel futex object. */
 typedef struct futex_ptr {
@@ -96,7 +97,7 @@ typedef struct futex_ptr {
 
 static void destroy_task_cache(work_t *work);
 
-static void futex_initialize(futex_t *futex, uintptr_t paddr);
+static void futex_initialize(futex_t *futex, uintptr_t paddr, uintptr_t uaddr);
 static void futex_add_ref(futex_t *futex);
 static void futex_release_ref(futex_t *futex);
 static void futex_release_ref_locked(futex_t *futex);
@@ -230,12 +231,17 @@ void futex_task_cleanup(void)
  *
  * @param futex	Kernel futex structure.
  * @param paddr Physical address of the futex variable.
+ * @param uaddr Virtual address of the futex variable in the current task.
  */
-static void futex_initialize(futex_t *futex, uintptr_t paddr)
+static void futex_initialize(futex_t *futex, uintptr_t paddr, uintptr_t uaddr)
 {
 	waitq_initialize(&futex->wq);
 	futex->paddr = paddr;
 	futex->refcount = 1;
+	futex->task_id = TASK->taskid;
+	futex->uaddr = uaddr;
+	atomic_set(&futex->sleeps, 0);
+	atomic_set(&futex->wakeups, 0);
 }
 
 /** Increments the counter of tasks referencing the futex. */
@@ -353,7 +359,7 @@ static futex_t *get_and_cache_futex(uintptr_t phys_addr, uintptr_t uaddr)
 		futex = member_to_inst(fut_link, futex_t, ht_link);
 		futex_add_ref(futex);
 	} else {
-		futex_initialize(futex, phys_addr);
+		futex_initialize(futex, phys_addr, uaddr);
 		hash_table_insert(&futex_ht, &futex->ht_link);
 	}
 	
@@ -404,12 +410,16 @@ sys_errno_t sys_futex_sleep(uintptr_t uaddr)
 	if (!futex) 
 		return (sys_errno_t) ENOENT;
 
+	atomic_inc(&futex->sleeps);
+
 #ifdef CONFIG_UDEBUG
 	udebug_stoppable_begin();
 #endif
 
+	KTRACE(KTRACE_FUTEX_SLEEP, uaddr);
 	errno_t rc = waitq_sleep_timeout(
 	    &futex->wq, 0, SYNCH_FLAGS_INTERRUPTIBLE, NULL);
+	KTRACE(KTRACE_FUTEX_WAKEUP, uaddr);
 
 #ifdef CONFIG_UDEBUG
 	udebug_stoppable_end();
@@ -429,6 +439,7 @@ sys_errno_t sys_futex_wakeup(uintptr_t uaddr)
 	futex_t *futex = get_futex(uaddr);
 	
 	if (futex) {
+		atomic_inc(&futex->wakeups);
 		waitq_wakeup(&futex->wq, WAKEUP_FIRST);
 		return EOK;
 	} else {
@@ -436,6 +447,64 @@ sys_errno_t sys_futex_wakeup(uintptr_t uaddr)
 	}
 }
 
+/** Count kernel futex objects.
+ *
+ * @return Number of kernel futex objects.
+ */
+size_t futex_stats_count(void)
+{
+	spinlock_lock(&futex_ht_lock);
+	size_t count = hash_table_size(&futex_ht);
+	spinlock_unlock(&futex_ht_lock);
+	
+	return count;
+}
+
+/** Iterator state of futex_stats_get(). */
+typedef struct {
+	stats_futex_t *stats;
+	size_t count;
+	size_t max;
+} futex_stats_iter_t;
+
+static bool futex_stats_walker(ht_link_t *item, void *arg)
+{
+	futex_stats_iter_t *iter = (futex_stats_iter_t *) arg;
+	futex_t *futex = member_to_inst(item, futex_t, ht_link);
+	
+	if (iter->count == iter->max)
+		return false;
+	
+	stats_futex_t *stats = &iter->stats[iter->count++];
+	stats->task_id = futex->task_id;
+	stats->uaddr = futex->uaddr;
+	stats->sleeps = atomic_get(&futex->sleeps);
+	stats->wakeups = atomic_get(&futex->wakeups);
+	
+	return true;
+}
+
+/** Gather contention statistics of kernel futex objects.
+ *
+ * @param stats Array to fill in.
+ * @param max   Number of entries in @a stats.
+ *
+ * @return Number of entries filled in.
+ */
+size_t futex_stats_get(stats_futex_t *stats, size_t max)
+{
+	futex_stats_iter_t iter = {
+		.stats = stats,
+		.count = 0,
+		.max = max
+	};
+	
+	spinlock_lock(&futex_ht_lock);
+	hash_table_apply(&futex_ht, futex_stats_walker, &iter);
+	spinlock_unlock(&futex_ht_lock);
+	
+	return iter.count;
+}
 
 /** Return the hash of the key stored in the item */
 size_t futex_ht_hash(const ht_link_t *item)
@@ -47,6 +47,7 @@
 #include <errno.h>
 #include <synch/waitq.h>
 #include <synch/spinlock.h>
+#include <synch/rcu.h>
 #include <proc/thread.h>
 #include <proc/scheduler.h>
 #include <arch/asm.h>
@@ -94,7 +95,7 @@ void waitq_sleep_timed_out(void *data)
 	bool do_wakeup = false;
 	DEADLOCK_PROBE_INIT(p_wqlock);
 	
-	irq_spinlock_lock(&threads_lock, false);
+	rcu_read_lock();
 	if (!thread_exists(thread))
 		goto out;
 	
@@ -124,7 +125,7 @@ grab_locks:
 		thread_ready(thread);
 	
 out:
-	irq_spinlock_unlock(&threads_lock, false);
+	rcu_read_unlock();
 }
 
 /** Interrupt sleeping thread.
@@ -133,8 +134,9 @@ out:
  * a waitqueue. If the thread is not found sleeping, no action
  * is taken.
  *
- * The threads_lock must be already held and interrupts must be
- * disabled upon calling this function.
+ * The caller must guarantee that the thread exists, e.g. by holding the lock
+ * of its task or by being in an RCU reader section in which the thread was
+ * found. Interrupts must be disabled upon calling this function.
  *
  * @param thread Thread to be interrupted.
  *
@@ -144,11 +146,6 @@ void waitq_interrupt_sleep(thread_t *thread)
 	bool do_wakeup = false;
 	DEADLOCK_PROBE_INIT(p_wqlock);
 	
-	/*
-	 * The thread is quaranteed to exist because
-	 * threads_lock is held.
-	 */
-	
 grab_locks:
 	irq_spinlock_lock(&thread->lock, false);
 	
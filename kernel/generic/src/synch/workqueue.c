@@ -34,6 +34,12 @@
  * @file
  * @brief Work queue/thread pool that automatically adjusts its size
  *        depending on the current load. Queued work functions may sleep..
+ *
+ * Work items are queued in per-cpu queues. A work item is appended to the
+ * queue of the cpu that enqueued it and workers first look for work in the
+ * queue of the cpu they are running on. Only if it is empty do they steal
+ * work from the queues of the neighbouring cpus. Neither takes the work
+ * queue lock unless a worker has to be woken up, added or put to sleep.
  */
 
 #include <assert.h>
@@ -51,10 +57,27 @@
 #define WORKQ_MAGIC      0xf00c1333U
 #define WORK_ITEM_MAGIC  0xfeec1777U
 
+/** Per-cpu part of a work queue. */
+typedef struct {
+	/* Protects the fields below. Must be acquired after workq->lock. */
+	IRQ_SPINLOCK_DECLARE(lock);
+	
+	/* Work items enqueued on this cpu that are ready to be dispatched. */
+	list_t queue;
+	
+	/* 
+	 * Number of work items in queue. May be read without the lock
+	 * as a hint.
+	 */
+	size_t depth;
+	
+	/* Number of work items workers on this cpu stole from other cpus. */
+	size_t steals;
+} workq_cpu_t;
 
 struct work_queue {
 	/* 
-	 * Protects everything except activate_worker. 
+	 * Protects everything except activate_worker and the per-cpu queues.
 	 * Must be acquired after any thread->locks.
 	 */
 	IRQ_SPINLOCK_DECLARE(lock);
@@ -62,14 +85,17 @@ struct work_queue {
 	/* Activates a worker if new work arrives or if shutting down the queue. */
 	condvar_t activate_worker;
 	
-	/* Queue of work_items ready to be dispatched. */
-	list_t queue;
+	/* Per-cpu queues of work_items ready to be dispatched. Immutable. */
+	workq_cpu_t *cpu_queues;
 	
 	/* List of worker threads. */
 	list_t workers;
 	
-	/* Number of work items queued. */
-	size_t item_cnt;
+	/* 
+	 * Copy of active_workers() for enqueuers which do not hold the lock.
+	 * Written with the lock held whenever the worker counts change.
+	 */
+	size_t active_hint;
 	
 	/* Indicates the work queue is shutting down. */
 	bool stopping;
@@ -127,18 +153,23 @@ typedef void (*signal_op_t)(struct work_queue *workq);
 
 
 /* Fwd decl. */
-static void workq_preinit(struct work_queue *workq, const char *name);
+static bool workq_preinit(struct work_queue *workq, const char *name);
 static bool add_worker(struct work_queue *workq);
 static void interrupt_workers(struct work_queue *workq);
 static void wait_for_workers(struct work_queue *workq);
 static int _workq_enqueue(struct work_queue *workq, work_t *work_item, 
 	work_func_t func, bool can_block);
 static void init_work_item(work_t *work_item, work_func_t func);
+static work_t *take_work_item(struct work_queue *workq);
+static size_t queued_items(struct work_queue *workq);
+static size_t active_workers(struct work_queue *workq);
+static void update_active_hint(struct work_queue *workq);
+static unsigned int worker_home_cpu(struct work_queue *workq);
 static signal_op_t signal_worker_logic(struct work_queue *workq, bool can_block);
 static void worker_thread(void *arg);
 static bool dequeue_work(struct work_queue *workq, work_t **pwork_item);
 static bool worker_unnecessary(struct work_queue *workq);
-static void cv_wait(struct work_queue *workq);
+static bool cv_wait(struct work_queue *workq);
 static void nonblock_init(void);
 
 #ifdef CONFIG_DEBUG
@@ -174,7 +205,8 @@ void workq_global_init(void)
 	/* Maximum concurrency without slowing down the system. */
 	max_concurrent_workers = max(2, config.cpu_count);
 	
-	workq_preinit(&g_work_queue, "kworkq");
+	if (!workq_preinit(&g_work_queue, "kworkq"))
+		panic("Could not allocate the global work queue!\n");
 }
 
 /** Stops the system global work queue and waits for all work items to complete.*/
@@ -222,12 +254,30 @@ void workq_destroy(struct work_queue *workq)
 	workq->cookie = 0;
 #endif 
 	
+	free(workq->cpu_queues);
 	free(workq);
 }
 
-/** Initializes workq structure without creating any workers. */
-static void workq_preinit(struct work_queue *workq, const char *name)
+/** Initializes workq structure without creating any workers. 
+ * 
+ * @return false if the per-cpu queues could not be allocated.
+ */
+static bool workq_preinit(struct work_queue *workq, const char *name)
 {
+	workq->cpu_queues = malloc(config.cpu_count * sizeof(workq_cpu_t), 0);
+	
+	if (!workq->cpu_queues)
+		return false;
+	
+	for (unsigned int i = 0; i < config.cpu_count; ++i) {
+		workq_cpu_t *cpu_queue = &workq->cpu_queues[i];
+		
+		irq_spinlock_initialize(&cpu_queue->lock, name);
+		list_initialize(&cpu_queue->queue);
+		cpu_queue->depth = 0;
+		cpu_queue->steals = 0;
+	}
+	
 #ifdef CONFIG_DEBUG
 	workq->cookie = WORKQ_MAGIC;
 #endif 
@@ -235,20 +285,21 @@ static void workq_preinit(struct work_queue *workq, const char *name)
 	irq_spinlock_initialize(&workq->lock, name);
 	condvar_initialize(&workq->activate_worker);
 	
-	list_initialize(&workq->queue);
 	list_initialize(&workq->workers);
 	
-	workq->item_cnt = 0;
 	workq->stopping = false;
 	workq->name = name;
 	
 	workq->cur_worker_cnt = 1;
+	workq->active_hint = 1;
 	workq->idle_worker_cnt = 0;
 	workq->activate_pending = 0;
 	workq->blocked_worker_cnt = 0;
 	
 	workq->pending_op_cnt = 0;
 	link_initialize(&workq->nb_link);
+	
+	return true;
 }
 
 /** Initializes a work queue. Returns true if successful.  
@@ -258,8 +309,15 @@ static void workq_preinit(struct work_queue *workq, const char *name)
  */
 bool workq_init(struct work_queue *workq, const char *name)
 {
-	workq_preinit(workq, name);
-	return add_worker(workq);
+	if (!workq_preinit(workq, name))
+		return false;
+	
+	if (!add_worker(workq)) {
+		free(workq->cpu_queues);
+		return false;
+	}
+	
+	return true;
 }
 
 /** Add a new worker thread. Returns false if the thread could not be created. */
@@ -276,6 +334,7 @@ static bool add_worker(struct work_queue *workq)
 		/* cur_worker_cnt proactively increased in signal_worker_logic() .*/
 		assert(0 < workq->cur_worker_cnt);
 		--workq->cur_worker_cnt;
+		update_active_hint(workq);
 		
 		irq_spinlock_unlock(&workq->lock, true);
 		return false;
@@ -290,11 +349,8 @@ static bool add_worker(struct work_queue *workq)
 	if (!workq->stopping) {
 		success = true;
 		
-		/* Try to distribute workers among cpus right away. */
-		unsigned int cpu_id = (workq->cur_worker_cnt) % config.cpu_active;
-		
-		if (!cpus[cpu_id].active)
-			cpu_id = CPU->id;
+		/* Place the worker where it is most likely to find local work. */
+		unsigned int cpu_id = worker_home_cpu(workq);
 
 		thread->workq = workq;	
 		thread->cpu = &cpus[cpu_id];
@@ -315,6 +371,7 @@ static bool add_worker(struct work_queue *workq)
 		/* cur_worker_cnt proactively increased in signal_worker() .*/
 		assert(0 < workq->cur_worker_cnt);
 		--workq->cur_worker_cnt;
+		update_active_hint(workq);
 	}
 	
 	irq_spinlock_unlock(&workq->lock, false);
@@ -329,6 +386,38 @@ static bool add_worker(struct work_queue *workq)
 	return success;
 }
 
+/** Picks the cpu a new worker should run on.
+ * 
+ * Prefers the active cpu with the most work queued in its per-cpu queue
+ * so that the worker can process it without stealing. If no work is 
+ * queued, workers are distributed among the active cpus round-robin.
+ */
+static unsigned int worker_home_cpu(struct work_queue *workq)
+{
+	assert(irq_spinlock_locked(&workq->lock));
+	
+	unsigned int cpu_id = workq->cur_worker_cnt % config.cpu_active;
+	size_t max_depth = 0;
+	
+	for (unsigned int i = 0; i < config.cpu_count; ++i) {
+		if (!cpus[i].active)
+			continue;
+		
+		/* Reading the depth without the lock is good enough for a hint. */
+		size_t depth = workq->cpu_queues[i].depth;
+		
+		if (max_depth < depth) {
+			max_depth = depth;
+			cpu_id = i;
+		}
+	}
+	
+	if (!cpus[cpu_id].active)
+		cpu_id = CPU->id;
+	
+	return cpu_id;
+}
+
 /** Shuts down the work queue. Waits for all pending work items to complete.  
  *
  * workq_stop() may only be run once. 
@@ -350,6 +439,16 @@ static void interrupt_workers(struct work_queue *workq)
 	assert(!workq->stopping);
 	workq->stopping = true;
 	
+	/* 
+	 * Enqueuers check stopping with only their cpu queue locked. Pass 
+	 * through all the cpu queue locks so that any item queued before 
+	 * the flag became visible is already on a queue.
+	 */
+	for (unsigned int i = 0; i < config.cpu_count; ++i) {
+		irq_spinlock_lock(&workq->cpu_queues[i].lock, false);
+		irq_spinlock_unlock(&workq->cpu_queues[i].lock, false);
+	}
+	
 	/* Respect lock ordering - do not hold workq->lock during broadcast. */
 	irq_spinlock_unlock(&workq->lock, true);
 	
@@ -476,36 +575,56 @@ static int _workq_enqueue(struct work_queue *workq, work_t *work_item,
 {
 	assert(!workq_corrupted(workq));
 	
-	bool success = true;
 	signal_op_t signal_op = NULL;
 	
-	irq_spinlock_lock(&workq->lock, true);
+	/* 
+	 * Queue the item on the current cpu so that a worker running 
+	 * there picks it up. Interrupts are disabled, so CPU is stable.
+	 */
+	ipl_t ipl = interrupts_disable();
+	workq_cpu_t *cpu_queue = &workq->cpu_queues[CPU->id];
+	
+	irq_spinlock_lock(&cpu_queue->lock, false);
 	
+	/* See interrupt_workers(). */
 	if (workq->stopping) {
-		success = false;
-	} else {
-		init_work_item(work_item, func);
-		list_append(&work_item->queue_link, &workq->queue);
-		++workq->item_cnt;
-		success = true;
-		
-		if (!booting) {
-			signal_op = signal_worker_logic(workq, can_block);
-		} else {
-			/* 
-			 * During boot there are no workers to signal. Just queue 
-			 * the work and let future workers take care of it.
-			 */
-		}
+		irq_spinlock_unlock(&cpu_queue->lock, false);
+		interrupts_restore(ipl);
+		return false;
 	}
 	
-	irq_spinlock_unlock(&workq->lock, true);
+	init_work_item(work_item, func);
+	list_append(&work_item->queue_link, &cpu_queue->queue);
+	++cpu_queue->depth;
+	
+	irq_spinlock_unlock(&cpu_queue->lock, false);
+	
+	/* 
+	 * Pairs with the barrier in update_active_hint(). Either a worker
+	 * about to go idle or to block sees the new item or we see it is
+	 * no longer active and signal another one.
+	 */
+	memory_barrier();
+	
+	/* 
+	 * During boot there are no workers to signal. Just queue the work 
+	 * and let future workers take care of it. Otherwise take the work 
+	 * queue lock only if the active workers may not keep up.
+	 */
+	if (!booting && 
+		workq->active_hint * max_items_per_worker < queued_items(workq)) {
+		irq_spinlock_lock(&workq->lock, false);
+		signal_op = signal_worker_logic(workq, can_block);
+		irq_spinlock_unlock(&workq->lock, false);
+	}
+	
+	interrupts_restore(ipl);
 
 	if (signal_op) {
 		signal_op(workq);
 	}
 	
-	return success;
+	return true;
 }
 
 /** Prepare an item to be added to the work item queue. */
@@ -545,6 +664,39 @@ static size_t active_workers_now(struct work_queue *workq)
 	return workq->cur_worker_cnt - sleeping_workers;
 }
 
+/** Returns the number of queued work items not yet taken by a worker.
+ * 
+ * The per-cpu depths are read without their locks, so the result is
+ * only a snapshot.
+ */
+static size_t queued_items(struct work_queue *workq)
+{
+	size_t items = 0;
+	
+	for (unsigned int i = 0; i < config.cpu_count; ++i)
+		items += ((volatile workq_cpu_t *) &workq->cpu_queues[i])->depth;
+	
+	return items;
+}
+
+/** Publishes the current number of active workers to enqueuers. 
+ * 
+ * Must be called with workq->lock held after any change of the worker
+ * counts that active_workers() depends on.
+ */
+static void update_active_hint(struct work_queue *workq)
+{
+	assert(irq_spinlock_locked(&workq->lock));
+	
+	workq->active_hint = active_workers(workq);
+	
+	/* 
+	 * Pairs with the barrier in _workq_enqueue(). Make the new count 
+	 * visible before the caller looks at the queues.
+	 */
+	memory_barrier();
+}
+
 /** 
  * Returns the number of workers that are running or are about to run work 
  * func() and that are not blocked. 
@@ -610,7 +762,7 @@ static signal_op_t signal_worker_logic(struct work_queue *workq, bool can_block)
 	size_t max_load = active * max_items_per_worker;
 
 	/* Active workers are getting overwhelmed - activate another. */
-	if (max_load < workq->item_cnt) {
+	if (max_load < queued_items(workq)) {
 
 		size_t remaining_idle = 
 			workq->idle_worker_cnt - workq->activate_pending;
@@ -667,6 +819,9 @@ static signal_op_t signal_worker_logic(struct work_queue *workq, bool can_block)
 		signal_op = NULL;
 	}
 	
+	if (signal_op)
+		update_active_hint(workq);
+	
 	return signal_op;
 }
 
@@ -700,6 +855,14 @@ static bool dequeue_work(struct work_queue *workq, work_t **pwork_item)
 {
 	assert(!workq_corrupted(workq));
 	
+	/* Fast path - there is work queued, most likely on this cpu. */
+	work_t *work_item = take_work_item(workq);
+	
+	if (work_item) {
+		*pwork_item = work_item;
+		return true;
+	}
+	
 	irq_spinlock_lock(&workq->lock, true);
 	
 	/* Check if we should exit if load is low. */
@@ -707,6 +870,7 @@ static bool dequeue_work(struct work_queue *workq, work_t **pwork_item)
 		/* There are too many workers for this load. Exit. */
 		assert(0 < workq->cur_worker_cnt);
 		--workq->cur_worker_cnt;
+		update_active_hint(workq);
 		list_remove(&THREAD->workq_link);
 		irq_spinlock_unlock(&workq->lock, true);
 		
@@ -714,39 +878,84 @@ static bool dequeue_work(struct work_queue *workq, work_t **pwork_item)
 		return false;
 	}
 	
-	bool stop = false;
-	
-	/* Wait for work to arrive. */
-	while (list_empty(&workq->queue) && !workq->stopping) {
-		cv_wait(workq);
+	/* Wait for work to arrive. Process remaining work even if stopping. */
+	while (!(work_item = take_work_item(workq))) {
+		if (workq->stopping) {
+			/* Requested to stop and no more work queued. */
+			--workq->cur_worker_cnt;
+			update_active_hint(workq);
+			irq_spinlock_unlock(&workq->lock, true);
+			return false;
+		}
 		
-		if (0 < workq->activate_pending)
-			--workq->activate_pending;
+		if (cv_wait(workq)) {
+			if (0 < workq->activate_pending)
+				--workq->activate_pending;
+			
+			update_active_hint(workq);
+		}
 	}
+	
+	irq_spinlock_unlock(&workq->lock, true);
+	
+	*pwork_item = work_item;
+	return true;
+}
 
-	/* Process remaining work even if requested to stop. */
-	if (!list_empty(&workq->queue)) {
-		link_t *work_link = list_first(&workq->queue);
-		*pwork_item = list_get_instance(work_link, work_t, queue_link);
+/** Removes a work item from the per-cpu queues.
+ * 
+ * Looks into the queue of the current cpu first and then steals from
+ * the queues of the neighbouring cpus. 
+ * 
+ * @return The work item or NULL if all the queues were found empty.
+ */
+static work_t *take_work_item(struct work_queue *workq)
+{
+	ipl_t ipl = interrupts_disable();
+	unsigned int local_id = CPU->id;
+	
+	for (unsigned int i = 0; i < config.cpu_count; ++i) {
+		unsigned int cpu_id = (local_id + i) % config.cpu_count;
+		workq_cpu_t *cpu_queue = &workq->cpu_queues[cpu_id];
+		
+		/* Skip empty queues without taking their lock. */
+		if (0 == ((volatile workq_cpu_t *) cpu_queue)->depth)
+			continue;
+		
+		irq_spinlock_lock(&cpu_queue->lock, false);
+		
+		if (list_empty(&cpu_queue->queue)) {
+			irq_spinlock_unlock(&cpu_queue->lock, false);
+			continue;
+		}
+		
+		link_t *work_link = list_first(&cpu_queue->queue);
+		work_t *work_item = list_get_instance(work_link, work_t, 
+			queue_link);
 		
-#ifdef CONFIG_DEBUG
-		assert(!work_item_corrupted(*pwork_item));
-		(*pwork_item)->cookie = 0;
-#endif
 		list_remove(work_link);
-		--workq->item_cnt;
+		--cpu_queue->depth;
+		irq_spinlock_unlock(&cpu_queue->lock, false);
 		
-		stop = false;
-	} else {
-		/* Requested to stop and no more work queued. */
-		assert(workq->stopping);
-		--workq->cur_worker_cnt;
-		stop = true;
+		if (cpu_id != local_id) {
+			workq_cpu_t *local_queue = &workq->cpu_queues[local_id];
+			
+			irq_spinlock_lock(&local_queue->lock, false);
+			++local_queue->steals;
+			irq_spinlock_unlock(&local_queue->lock, false);
+		}
+		
+		interrupts_restore(ipl);
+		
+#ifdef CONFIG_DEBUG
+		assert(!work_item_corrupted(work_item));
+		work_item->cookie = 0;
+#endif
+		return work_item;
 	}
 	
-	irq_spinlock_unlock(&workq->lock, true);
-	
-	return !stop;
+	interrupts_restore(ipl);
+	return NULL;
 }
 
 /** Returns true if for the given load there are too many workers. */
@@ -755,7 +964,7 @@ static bool worker_unnecessary(struct work_queue *workq)
 	assert(irq_spinlock_locked(&workq->lock));
 	
 	/* No work is pending. We don't need too many idle threads. */
-	if (list_empty(&workq->queue)) {
+	if (0 == queued_items(workq)) {
 		/* There are too many idle workers. Exit. */
 		return (min_worker_cnt <= workq->idle_worker_cnt);
 	} else {
@@ -769,10 +978,26 @@ static bool worker_unnecessary(struct work_queue *workq)
 	}
 }
 
-/** Waits for a signal to activate_worker. Thread marked idle while waiting. */
-static void cv_wait(struct work_queue *workq)
+/** Waits for a signal to activate_worker. Thread marked idle while waiting. 
+ * 
+ * @return false if work arrived in the meantime and the thread did not 
+ *         wait at all.
+ */
+static bool cv_wait(struct work_queue *workq)
 {
 	++workq->idle_worker_cnt;
+	update_active_hint(workq);
+	
+	/* 
+	 * Enqueuers that have not seen us go idle will not signal us. Look
+	 * for their work once more now that they do.
+	 */
+	if (0 < queued_items(workq) || workq->stopping) {
+		--workq->idle_worker_cnt;
+		update_active_hint(workq);
+		return false;
+	}
+	
 	THREAD->workq_idling = true;
 	
 	/* Ignore lock ordering just here. */
@@ -786,6 +1011,9 @@ static void cv_wait(struct work_queue *workq)
 	
 	THREAD->workq_idling = false;
 	--workq->idle_worker_cnt;
+	
+	/* The caller updates the active hint once it settles activate_pending. */
+	return true;
 }
 
 
@@ -808,6 +1036,7 @@ void workq_before_thread_is_ready(thread_t *thread)
 		
 		irq_spinlock_lock(&thread->workq->lock, true);
 		--thread->workq->blocked_worker_cnt;
+		update_active_hint(thread->workq);
 		irq_spinlock_unlock(&thread->workq->lock, true);
 	}
 }
@@ -828,6 +1057,7 @@ void workq_after_thread_ran(void)
 		irq_spinlock_lock(&THREAD->workq->lock, false);
 
 		++THREAD->workq->blocked_worker_cnt;
+		update_active_hint(THREAD->workq);
 		
 		bool can_block = false;
 		signal_op_t op = signal_worker_logic(THREAD->workq, can_block);
@@ -850,7 +1080,7 @@ void workq_print_info(struct work_queue *workq)
 	size_t blocked = workq->blocked_worker_cnt;
 	size_t idle = workq->idle_worker_cnt;
 	size_t active = active_workers(workq);
-	size_t items = workq->item_cnt;
+	size_t items = queued_items(workq);
 	bool stopping = workq->stopping;
 	bool worker_surplus = worker_unnecessary(workq);
 	const char *load_str = worker_surplus ? "decreasing" : 
@@ -878,6 +1108,19 @@ void workq_print_info(struct work_queue *workq)
 		stopping,
 		load_str
 	);
+	
+	printf("[cpu] [depth   ] [steals  ]\n");
+	
+	for (unsigned int i = 0; i < config.cpu_count; ++i) {
+		workq_cpu_t *cpu_queue = &workq->cpu_queues[i];
+		
+		irq_spinlock_lock(&cpu_queue->lock, true);
+		size_t depth = cpu_queue->depth;
+		size_t steals = cpu_queue->steals;
+		irq_spinlock_unlock(&cpu_queue->lock, true);
+		
+		printf("%5u %10zu %10zu\n", i, depth, steals);
+	}
 }
 
 /** Prints stats of the global work queue. */
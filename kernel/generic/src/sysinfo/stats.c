@@ -40,6 +40,8 @@
 #include <sysinfo/sysinfo.h>
 #include <synch/spinlock.h>
 #include <synch/mutex.h>
+#include <synch/futex.h>
+#include <synch/rcu.h>
 #include <time/clock.h>
 #include <mm/frame.h>
 #include <proc/task.h>
@@ -115,6 +117,10 @@ static void *get_stats_cpus(struct sysinfo_item *item, size_t *size,
 		stats_cpus[i].frequency_mhz = cpus[i].frequency_mhz;
 		stats_cpus[i].busy_cycles = cpus[i].busy_cycles;
 		stats_cpus[i].idle_cycles = cpus[i].idle_cycles;
+		stats_cpus[i].steal_attempts = cpus[i].steal_attempts;
+		stats_cpus[i].steal_successes = cpus[i].steal_successes;
+		stats_cpus[i].tlb_ipis_sent = cpus[i].tlb_ipis_sent;
+		stats_cpus[i].tlb_ipis_avoided = cpus[i].tlb_ipis_avoided;
 		
 		irq_spinlock_unlock(&cpus[i].lock, true);
 	}
@@ -122,17 +128,69 @@ static void *get_stats_cpus(struct sysinfo_item *item, size_t *size,
 	return ((void *) stats_cpus);
 }
 
-/** Count number of nodes in an AVL tree
+/** Get contention statistics of all futexes
  *
- * AVL tree walker for counting nodes.
+ * @param item    Sysinfo item (unused).
+ * @param size    Size of the returned data.
+ * @param dry_run Do not get the data, just calculate the size.
+ * @param data    Unused.
+ *
+ * @return Data containing several stats_futex_t structures.
+ *         If the return value is not NULL, it should be freed
+ *         in the context of the sysinfo request.
+ */
+static void *get_stats_futexes(struct sysinfo_item *item, size_t *size,
+    bool dry_run, void *data)
+{
+	size_t count = futex_stats_count();
+	
+	*size = sizeof(stats_futex_t) * count;
+	if ((dry_run) || (count == 0))
+		return NULL;
+	
+	stats_futex_t *stats_futexes =
+	    (stats_futex_t *) malloc(*size, FRAME_ATOMIC);
+	if (stats_futexes == NULL) {
+		*size = 0;
+		return NULL;
+	}
+	
+	/* Futexes might have been destroyed in the meantime */
+	count = futex_stats_get(stats_futexes, count);
+	*size = sizeof(stats_futex_t) * count;
+	
+	return ((void *) stats_futexes);
+}
+
+/** Count tasks
  *
- * @param node AVL tree node (unused).
+ * Task walker for counting tasks.
+ *
+ * @param task Task (unused).
  * @param arg  Pointer to the counter (size_t).
  *
  * @param Always true (continue the walk).
  *
  */
-static bool avl_count_walker(avltree_node_t *node, void *arg)
+static bool task_count_walker(task_t *task, void *arg)
+{
+	size_t *count = (size_t *) arg;
+	(*count)++;
+	
+	return true;
+}
+
+/** Count threads
+ *
+ * Thread walker for counting threads.
+ *
+ * @param thread Thread (unused).
+ * @param arg    Pointer to the counter (size_t).
+ *
+ * @param Always true (continue the walk).
+ *
+ */
+static bool thread_count_walker(thread_t *thread, void *arg)
 {
 	size_t *count = (size_t *) arg;
 	(*count)++;
@@ -221,6 +279,46 @@ static size_t get_task_resmem(as_t *as)
 	return (pages << PAGE_WIDTH);
 }
 
+/** Get the size of a virtual address space mapped using large frames
+ *
+ * @param as Address space.
+ *
+ * @return Size of the memory mapped using large frames (bytes).
+ *
+ */
+static size_t get_task_largemem(as_t *as)
+{
+	/*
+	 * We are holding spinlocks here and therefore are not allowed to
+	 * block. Only attempt to lock the address space and address space
+	 * area mutexes conditionally. If it is not possible to lock either
+	 * object, return inexact statistics by skipping the respective object.
+	 */
+	
+	if (mutex_trylock(&as->lock) != EOK)
+		return 0;
+	
+	size_t pages = 0;
+	
+	/* Walk the B+ tree and count pages */
+	list_foreach(as->as_area_btree.leaf_list, leaf_link, btree_node_t, node) {
+		unsigned int i;
+		for (i = 0; i < node->keys; i++) {
+			as_area_t *area = node->value[i];
+			
+			if (mutex_trylock(&area->lock) != EOK)
+				continue;
+			
+			pages += area->large_pages;
+			mutex_unlock(&area->lock);
+		}
+	}
+	
+	mutex_unlock(&as->lock);
+	
+	return (pages << PAGE_WIDTH);
+}
+
 /* Produce task statistics
  *
  * Summarize task information into task statistics.
@@ -238,27 +336,29 @@ static void produce_stats_task(task_t *task, stats_task_t *stats_task)
 	str_cpy(stats_task->name, TASK_NAME_BUFLEN, task->name);
 	stats_task->virtmem = get_task_virtmem(task->as);
 	stats_task->resmem = get_task_resmem(task->as);
+	stats_task->largemem = get_task_largemem(task->as);
 	stats_task->threads = atomic_get(&task->refcount);
 	task_get_accounting(task, &(stats_task->ucycles),
 	    &(stats_task->kcycles));
+	stats_task->page_faults = atomic_get(&task->page_faults);
+	stats_task->fault_around = atomic_get(&task->fault_around);
 	stats_task->ipc_info = task->ipc_info;
 }
 
 /** Gather statistics of all tasks
  *
- * AVL task tree walker for gathering task statistics. Interrupts should
- * be already disabled while walking the tree.
+ * Task walker for gathering task statistics. Interrupts should
+ * be already disabled while walking the tasks.
  *
- * @param node AVL task tree node.
+ * @param task Task.
  * @param arg  Pointer to the iterator into the array of stats_task_t.
  *
  * @param Always true (continue the walk).
  *
  */
-static bool task_serialize_walker(avltree_node_t *node, void *arg)
+static bool task_serialize_walker(task_t *task, void *arg)
 {
 	stats_task_t **iterator = (stats_task_t **) arg;
-	task_t *task = avltree_get_instance(node, task_t, tasks_tree_node);
 	
 	/* Interrupts are already disabled */
 	irq_spinlock_lock(&(task->lock), false);
@@ -287,38 +387,38 @@ static void *get_stats_tasks(struct sysinfo_item *item, size_t *size,
     bool dry_run, void *data)
 {
 	/* Messing with task structures, avoid deadlock */
-	irq_spinlock_lock(&tasks_lock, true);
+	task_list_lock();
 	
-	/* First walk the task tree to count the tasks */
+	/* First walk the tasks to count them */
 	size_t count = 0;
-	avltree_walk(&tasks_tree, avl_count_walker, (void *) &count);
+	task_list_walk(task_count_walker, (void *) &count);
 	
 	if (count == 0) {
 		/* No tasks found (strange) */
-		irq_spinlock_unlock(&tasks_lock, true);
+		task_list_unlock();
 		*size = 0;
 		return NULL;
 	}
 	
 	*size = sizeof(stats_task_t) * count;
 	if (dry_run) {
-		irq_spinlock_unlock(&tasks_lock, true);
+		task_list_unlock();
 		return NULL;
 	}
 	
 	stats_task_t *stats_tasks = (stats_task_t *) malloc(*size, FRAME_ATOMIC);
 	if (stats_tasks == NULL) {
 		/* No free space for allocation */
-		irq_spinlock_unlock(&tasks_lock, true);
+		task_list_unlock();
 		*size = 0;
 		return NULL;
 	}
 	
-	/* Walk tha task tree again to gather the statistics */
+	/* Walk the tasks again to gather the statistics */
 	stats_task_t *iterator = stats_tasks;
-	avltree_walk(&tasks_tree, task_serialize_walker, (void *) &iterator);
+	task_list_walk(task_serialize_walker, (void *) &iterator);
 	
-	irq_spinlock_unlock(&tasks_lock, true);
+	task_list_unlock();
 	
 	return ((void *) stats_tasks);
 }
@@ -352,19 +452,18 @@ static void produce_stats_thread(thread_t *thread, stats_thread_t *stats_thread)
 
 /** Gather statistics of all threads
  *
- * AVL three tree walker for gathering thread statistics. Interrupts should
- * be already disabled while walking the tree.
+ * Thread walker for gathering thread statistics. Interrupts should
+ * be already disabled while walking the threads.
  *
- * @param node AVL thread tree node.
- * @param arg  Pointer to the iterator into the array of thread statistics.
+ * @param thread Thread.
+ * @param arg    Pointer to the iterator into the array of thread statistics.
  *
  * @param Always true (continue the walk).
  *
  */
-static bool thread_serialize_walker(avltree_node_t *node, void *arg)
+static bool thread_serialize_walker(thread_t *thread, void *arg)
 {
 	stats_thread_t **iterator = (stats_thread_t **) arg;
-	thread_t *thread = avltree_get_instance(node, thread_t, threads_tree_node);
 	
 	/* Interrupts are already disabled */
 	irq_spinlock_lock(&thread->lock, false);
@@ -393,38 +492,38 @@ static void *get_stats_threads(struct sysinfo_item *item, size_t *size,
     bool dry_run, void *data)
 {
 	/* Messing with threads structures, avoid deadlock */
-	irq_spinlock_lock(&threads_lock, true);
+	thread_list_lock();
 	
-	/* First walk the thread tree to count the threads */
+	/* First walk the threads to count them */
 	size_t count = 0;
-	avltree_walk(&threads_tree, avl_count_walker, (void *) &count);
+	thread_list_walk(thread_count_walker, (void *) &count);
 	
 	if (count == 0) {
 		/* No threads found (strange) */
-		irq_spinlock_unlock(&threads_lock, true);
+		thread_list_unlock();
 		*size = 0;
 		return NULL;
 	}
 	
 	*size = sizeof(stats_thread_t) * count;
 	if (dry_run) {
-		irq_spinlock_unlock(&threads_lock, true);
+		thread_list_unlock();
 		return NULL;
 	}
 	
 	stats_thread_t *stats_threads = (stats_thread_t *) malloc(*size, FRAME_ATOMIC);
 	if (stats_threads == NULL) {
 		/* No free space for allocation */
-		irq_spinlock_unlock(&threads_lock, true);
+		thread_list_unlock();
 		*size = 0;
 		return NULL;
 	}
 	
-	/* Walk tha thread tree again to gather the statistics */
+	/* Walk the threads again to gather the statistics */
 	stats_thread_t *iterator = stats_threads;
-	avltree_walk(&threads_tree, thread_serialize_walker, (void *) &iterator);
+	thread_list_walk(thread_serialize_walker, (void *) &iterator);
 	
-	irq_spinlock_unlock(&threads_lock, true);
+	thread_list_unlock();
 	
 	return ((void *) stats_threads);
 }
@@ -459,13 +558,10 @@ static sysinfo_return_t get_stats_task(const char *name, bool dry_run,
 	if (str_uint64_t(name, NULL, 0, true, &task_id) != EOK)
 		return ret;
 	
-	/* Messing with task structures, avoid deadlock */
-	irq_spinlock_lock(&tasks_lock, true);
-	
-	task_t *task = task_find_by_id(task_id);
+	/* The reference keeps the task from being destroyed */
+	task_t *task = task_get_by_id(task_id);
 	if (task == NULL) {
 		/* No task with this ID */
-		irq_spinlock_unlock(&tasks_lock, true);
 		return ret;
 	}
 	
@@ -473,14 +569,12 @@ static sysinfo_return_t get_stats_task(const char *name, bool dry_run,
 		ret.tag = SYSINFO_VAL_FUNCTION_DATA;
 		ret.data.data = NULL;
 		ret.data.size = sizeof(stats_task_t);
-		
-		irq_spinlock_unlock(&tasks_lock, true);
 	} else {
 		/* Allocate stats_task_t structure */
 		stats_task_t *stats_task =
 		    (stats_task_t *) malloc(sizeof(stats_task_t), FRAME_ATOMIC);
 		if (stats_task == NULL) {
-			irq_spinlock_unlock(&tasks_lock, true);
+			task_release(task);
 			return ret;
 		}
 		
@@ -489,14 +583,12 @@ static sysinfo_return_t get_stats_task(const char *name, bool dry_run,
 		ret.data.data = (void *) stats_task;
 		ret.data.size = sizeof(stats_task_t);
 		
-		/* Hand-over-hand locking */
-		irq_spinlock_exchange(&tasks_lock, &task->lock);
-		
+		irq_spinlock_lock(&task->lock, true);
 		produce_stats_task(task, stats_task);
-		
 		irq_spinlock_unlock(&task->lock, true);
 	}
 	
+	task_release(task);
 	return ret;
 }
 
@@ -530,13 +622,13 @@ static sysinfo_return_t get_stats_thread(const char *name, bool dry_run,
 	if (str_uint64_t(name, NULL, 0, true, &thread_id) != EOK)
 		return ret;
 	
-	/* Messing with threads structures, avoid deadlock */
-	irq_spinlock_lock(&threads_lock, true);
+	/* The thread structure stays allocated until rcu_read_unlock() */
+	rcu_read_lock();
 	
 	thread_t *thread = thread_find_by_id(thread_id);
 	if (thread == NULL) {
 		/* No thread with this ID */
-		irq_spinlock_unlock(&threads_lock, true);
+		rcu_read_unlock();
 		return ret;
 	}
 	
@@ -544,14 +636,12 @@ static sysinfo_return_t get_stats_thread(const char *name, bool dry_run,
 		ret.tag = SYSINFO_VAL_FUNCTION_DATA;
 		ret.data.data = NULL;
 		ret.data.size = sizeof(stats_thread_t);
-		
-		irq_spinlock_unlock(&threads_lock, true);
 	} else {
 		/* Allocate stats_thread_t structure */
 		stats_thread_t *stats_thread =
 		    (stats_thread_t *) malloc(sizeof(stats_thread_t), FRAME_ATOMIC);
 		if (stats_thread == NULL) {
-			irq_spinlock_unlock(&threads_lock, true);
+			rcu_read_unlock();
 			return ret;
 		}
 		
@@ -560,14 +650,12 @@ static sysinfo_return_t get_stats_thread(const char *name, bool dry_run,
 		ret.data.data = (void *) stats_thread;
 		ret.data.size = sizeof(stats_thread_t);
 		
-		/* Hand-over-hand locking */
-		irq_spinlock_exchange(&threads_lock, &thread->lock);
-		
+		irq_spinlock_lock(&thread->lock, true);
 		produce_stats_thread(thread, stats_thread);
-		
 		irq_spinlock_unlock(&thread->lock, true);
 	}
 	
+	rcu_read_unlock();
 	return ret;
 }
 
@@ -719,7 +807,7 @@ static void *get_stats_physmem(struct sysinfo_item *item, size_t *size,
 	}
 	
 	zones_stats(&(stats_physmem->total), &(stats_physmem->unavail),
-	    &(stats_physmem->used), &(stats_physmem->free));
+	    &(stats_physmem->used), &(stats_physmem->free), NULL);
 	
 	return ((void *) stats_physmem);
 }
@@ -811,6 +899,7 @@ void stats_init(void)
 	sysinfo_set_item_gen_data("system.tasks", NULL, get_stats_tasks, NULL);
 	sysinfo_set_item_gen_data("system.threads", NULL, get_stats_threads, NULL);
 	sysinfo_set_item_gen_data("system.exceptions", NULL, get_stats_exceptions, NULL);
+	sysinfo_set_item_gen_data("system.futexes", NULL, get_stats_futexes, NULL);
 	sysinfo_set_subtree_fn("system.tasks", NULL, get_stats_task, NULL);
 	sysinfo_set_subtree_fn("system.threads", NULL, get_stats_thread, NULL);
 	sysinfo_set_subtree_fn("system.exceptions", NULL, get_stats_exception, NULL);
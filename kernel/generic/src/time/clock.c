@@ -61,6 +61,9 @@
 /* Pointer to variable with uptime */
 uptime_t *uptime;
 
+/** Tickless idle support of the processor-local clocks or NULL */
+clock_tickless_ops_t *clock_tickless_ops = NULL;
+
 /** Physical memory area of the real time clock */
 static parea_t clock_parea;
 
@@ -135,6 +138,59 @@ static void cpu_update_accounting(void)
 	irq_spinlock_unlock(&CPU->lock, false);
 }
 
+/** Stop periodic ticks on an idle processor
+ *
+ * Program the clock of the current processor to interrupt only
+ * when the next timeout is due. The bootstrap processor keeps
+ * ticking as it maintains the uptime counters.
+ *
+ * Interrupts must be disabled.
+ *
+ * @return True if periodic ticks have been stopped.
+ *
+ */
+bool clock_tickless_enter(void)
+{
+	if ((clock_tickless_ops == NULL) || (CPU->id == 0))
+		return false;
+	
+	size_t ticks = timeout_idle_ticks();
+	if (ticks <= 1)
+		return false;
+	
+	ticks = clock_tickless_ops->oneshot(ticks);
+	if (ticks == 0)
+		return false;
+	
+	CPU->tickless_ticks = ticks;
+	return true;
+}
+
+/** Resume periodic ticks on a processor leaving tickless idle
+ *
+ * The ticks skipped so far are accounted in missed_clock_ticks.
+ * Once the one-shot interrupt has been raised, it stands for
+ * the last of the skipped ticks. Does nothing if the processor
+ * is ticking periodically.
+ *
+ * Interrupts must be disabled.
+ *
+ */
+void clock_tickless_exit(void)
+{
+	size_t ticks = CPU->tickless_ticks;
+	if (ticks == 0)
+		return;
+	
+	CPU->tickless_ticks = 0;
+	
+	size_t elapsed = clock_tickless_ops->periodic();
+	if (elapsed >= ticks)
+		elapsed = ticks - 1;
+	
+	CPU->missed_clock_ticks += elapsed;
+}
+
 /** Clock routine
  *
  * Clock routine executed from clock interrupt handler
@@ -144,49 +200,25 @@ static void cpu_update_accounting(void)
  */
 void clock(void)
 {
+	clock_tickless_exit();
+	
 	size_t missed_clock_ticks = CPU->missed_clock_ticks;
 	
 	/* Account CPU usage */
 	cpu_update_accounting();
 	
-	/*
-	 * To avoid lock ordering problems,
-	 * run all expired timeouts as you visit them.
-	 *
-	 */
 	size_t i;
 	for (i = 0; i <= missed_clock_ticks; i++) {
 		/* Update counters and accounting */
 		clock_update_counters();
 		cpu_update_accounting();
 		
-		irq_spinlock_lock(&CPU->timeoutlock, false);
-		
-		link_t *cur;
-		while ((cur = list_first(&CPU->timeout_active_list)) != NULL) {
-			timeout_t *timeout = list_get_instance(cur, timeout_t,
-			    link);
-			
-			irq_spinlock_lock(&timeout->lock, false);
-			if (timeout->ticks-- != 0) {
-				irq_spinlock_unlock(&timeout->lock, false);
-				break;
-			}
-			
-			list_remove(cur);
-			timeout_handler_t handler = timeout->handler;
-			void *arg = timeout->arg;
-			timeout_reinitialize(timeout);
-			
-			irq_spinlock_unlock(&timeout->lock, false);
-			irq_spinlock_unlock(&CPU->timeoutlock, false);
-			
-			handler(arg);
-			
-			irq_spinlock_lock(&CPU->timeoutlock, false);
-		}
-		
-		irq_spinlock_unlock(&CPU->timeoutlock, false);
+		/*
+		 * Timeouts registered by the handlers count only the ticks
+		 * which are still to be processed as missed.
+		 */
+		CPU->missed_clock_ticks = missed_clock_ticks - i;
+		timeout_tick();
 	}
 	CPU->missed_clock_ticks = 0;
 	
@@ -33,6 +33,14 @@
 /**
  * @file
  * @brief Timeout management functions.
+ *
+ * Active timeouts of each processor are kept in a hierarchical timing
+ * wheel. Level 0 has one slot for each of the next TIMEOUT_WHEEL_SLOTS
+ * ticks, each further level has slots which are TIMEOUT_WHEEL_SLOTS times
+ * coarser. A timeout is hashed into a slot according to its deadline, so
+ * that registering and unregistering it is O(1). Whenever the level 0
+ * index wraps around, the current slot of the next level is cascaded,
+ * i.e. its timeouts are redistributed into the finer levels.
  */
 
 #include <time/timeout.h>
@@ -44,6 +52,13 @@
 #include <cpu.h>
 #include <arch/asm.h>
 #include <arch.h>
+#include <macros.h>
+
+#define TIMEOUT_WHEEL_MASK  (TIMEOUT_WHEEL_SLOTS - 1)
+
+/** Number of ticks covered by the whole timeout wheel. */
+#define TIMEOUT_WHEEL_SPAN \
+	(UINT64_C(1) << (TIMEOUT_WHEEL_BITS * TIMEOUT_WHEEL_LEVELS))
 
 /** Initialize timeouts
  *
@@ -53,7 +68,14 @@
 void timeout_init(void)
 {
 	irq_spinlock_initialize(&CPU->timeoutlock, "cpu.timeoutlock");
-	list_initialize(&CPU->timeout_active_list);
+	CPU->timeout_tick = 0;
+	
+	unsigned int level;
+	for (level = 0; level < TIMEOUT_WHEEL_LEVELS; level++) {
+		size_t slot;
+		for (slot = 0; slot < TIMEOUT_WHEEL_SLOTS; slot++)
+			list_initialize(&CPU->timeout_wheel[level][slot]);
+	}
 }
 
 /** Reinitialize timeout
@@ -66,7 +88,7 @@ void timeout_init(void)
 void timeout_reinitialize(timeout_t *timeout)
 {
 	timeout->cpu = NULL;
-	timeout->ticks = 0;
+	timeout->deadline = 0;
 	timeout->handler = NULL;
 	timeout->arg = NULL;
 	link_initialize(&timeout->link);
@@ -85,10 +107,47 @@ void timeout_initialize(timeout_t *timeout)
 	timeout_reinitialize(timeout);
 }
 
+/** Get wheel slot index of a tick on a given level. */
+NO_TRACE static size_t timeout_wheel_index(uint64_t tick, unsigned int level)
+{
+	return (tick >> (TIMEOUT_WHEEL_BITS * level)) & TIMEOUT_WHEEL_MASK;
+}
+
+/** Insert timeout into the timeout wheel of its processor
+ *
+ * The processor's timeoutlock and the timeout's lock must be held.
+ *
+ * @param timeout Timeout with the deadline and processor set.
+ *
+ */
+NO_TRACE static void timeout_wheel_insert(timeout_t *timeout)
+{
+	cpu_t *cpu = timeout->cpu;
+	uint64_t now = cpu->timeout_tick;
+	uint64_t when = max(timeout->deadline, now);
+	uint64_t delta = when - now;
+	
+	unsigned int level = 0;
+	while ((level < TIMEOUT_WHEEL_LEVELS - 1) &&
+	    (delta >= (UINT64_C(1) << (TIMEOUT_WHEEL_BITS * (level + 1)))))
+		level++;
+	
+	/*
+	 * Timeouts beyond the reach of the wheel are parked in the
+	 * farthest slot. They are hashed again according to their real
+	 * deadline when the slot is cascaded.
+	 */
+	if (delta >= TIMEOUT_WHEEL_SPAN)
+		when = now + TIMEOUT_WHEEL_SPAN - 1;
+	
+	list_append(&timeout->link,
+	    &cpu->timeout_wheel[level][timeout_wheel_index(when, level)]);
+}
+
 /** Register timeout
  *
  * Insert timeout handler f (with argument arg)
- * to timeout list and make it execute in
+ * to timeout wheel and make it execute in
  * time microseconds (or slightly more).
  *
  * @param timeout Timeout structure.
@@ -106,50 +165,19 @@ void timeout_register(timeout_t *timeout, uint64_t time,
 	if (timeout->cpu)
 		panic("Unexpected: timeout->cpu != 0.");
 	
+	/*
+	 * Ticks missed by the processor, e.g. skipped in tickless idle,
+	 * have already elapsed even though timeout_tick() has not yet
+	 * caught up with them.
+	 */
 	timeout->cpu = CPU;
-	timeout->ticks = us2ticks(time);
+	timeout->deadline = CPU->timeout_tick + CPU->missed_clock_ticks +
+	    us2ticks(time);
 	
 	timeout->handler = handler;
 	timeout->arg = arg;
 	
-	/*
-	 * Insert timeout into the active timeouts list according to timeout->ticks.
-	 */
-	uint64_t sum = 0;
-	timeout_t *target = NULL;
-	link_t *cur;
-	for (cur = CPU->timeout_active_list.head.next;
-	    cur != &CPU->timeout_active_list.head; cur = cur->next) {
-		target = list_get_instance(cur, timeout_t, link);
-		irq_spinlock_lock(&target->lock, false);
-		
-		if (timeout->ticks < sum + target->ticks) {
-			irq_spinlock_unlock(&target->lock, false);
-			break;
-		}
-		
-		sum += target->ticks;
-		irq_spinlock_unlock(&target->lock, false);
-	}
-	
-	/* Avoid using cur->prev directly */
-	link_t *prev = cur->prev;
-	list_insert_after(&timeout->link, prev);
-	
-	/*
-	 * Adjust timeout->ticks according to ticks
-	 * accumulated in target's predecessors.
-	 */
-	timeout->ticks -= sum;
-	
-	/*
-	 * Decrease ticks of timeout's immediate succesor by timeout->ticks.
-	 */
-	if (cur != &CPU->timeout_active_list.head) {
-		irq_spinlock_lock(&target->lock, false);
-		target->ticks -= timeout->ticks;
-		irq_spinlock_unlock(&target->lock, false);
-	}
+	timeout_wheel_insert(timeout);
 	
 	irq_spinlock_unlock(&timeout->lock, false);
 	irq_spinlock_unlock(&CPU->timeoutlock, true);
@@ -157,7 +185,7 @@ void timeout_register(timeout_t *timeout, uint64_t time,
 
 /** Unregister timeout
  *
- * Remove timeout from timeout list.
+ * Remove timeout from timeout wheel.
  *
  * @param timeout Timeout to unregister.
  *
@@ -183,17 +211,9 @@ grab_locks:
 	
 	/*
 	 * Now we know for sure that timeout hasn't been activated yet
-	 * and is lurking in timeout->cpu->timeout_active_list.
+	 * and is lurking in timeout->cpu->timeout_wheel.
 	 */
 	
-	link_t *cur = timeout->link.next;
-	if (cur != &timeout->cpu->timeout_active_list.head) {
-		timeout_t *tmp = list_get_instance(cur, timeout_t, link);
-		irq_spinlock_lock(&tmp->lock, false);
-		tmp->ticks += timeout->ticks;
-		irq_spinlock_unlock(&tmp->lock, false);
-	}
-	
 	list_remove(&timeout->link);
 	irq_spinlock_unlock(&timeout->cpu->timeoutlock, false);
 	
@@ -203,5 +223,108 @@ grab_locks:
 	return true;
 }
 
+/** Move timeouts of one wheel slot to the finer levels
+ *
+ * The timeoutlock of the current processor must be held.
+ *
+ * @param level Wheel level.
+ * @param slot  Slot index on the level.
+ *
+ */
+NO_TRACE static void timeout_cascade(unsigned int level, size_t slot)
+{
+	list_t *list = &CPU->timeout_wheel[level][slot];
+	
+	while (!list_empty(list)) {
+		timeout_t *timeout = list_get_instance(list_first(list),
+		    timeout_t, link);
+		
+		irq_spinlock_lock(&timeout->lock, false);
+		list_remove(&timeout->link);
+		timeout_wheel_insert(timeout);
+		irq_spinlock_unlock(&timeout->lock, false);
+	}
+}
+
+/** Process one clock tick
+ *
+ * Run all timeouts of the current processor which expire
+ * on this tick. Called from clock() with interrupts disabled.
+ *
+ */
+void timeout_tick(void)
+{
+	irq_spinlock_lock(&CPU->timeoutlock, false);
+	
+	uint64_t tick = CPU->timeout_tick;
+	size_t slot = timeout_wheel_index(tick, 0);
+	
+	if (slot == 0) {
+		unsigned int level;
+		for (level = 1; level < TIMEOUT_WHEEL_LEVELS; level++) {
+			size_t index = timeout_wheel_index(tick, level);
+			timeout_cascade(level, index);
+			
+			if (index != 0)
+				break;
+		}
+	}
+	
+	CPU->timeout_tick++;
+	
+	/*
+	 * To avoid lock ordering problems,
+	 * run all expired timeouts as you visit them.
+	 */
+	list_t *list = &CPU->timeout_wheel[0][slot];
+	while (!list_empty(list)) {
+		timeout_t *timeout = list_get_instance(list_first(list),
+		    timeout_t, link);
+		
+		irq_spinlock_lock(&timeout->lock, false);
+		
+		list_remove(&timeout->link);
+		timeout_handler_t handler = timeout->handler;
+		void *arg = timeout->arg;
+		timeout_reinitialize(timeout);
+		
+		irq_spinlock_unlock(&timeout->lock, false);
+		irq_spinlock_unlock(&CPU->timeoutlock, false);
+		
+		handler(arg);
+		
+		irq_spinlock_lock(&CPU->timeoutlock, false);
+	}
+	
+	irq_spinlock_unlock(&CPU->timeoutlock, false);
+}
+
+/** Find out how many ticks an idle processor can sleep through
+ *
+ * The processor must be woken up for the first tick which has
+ * timeouts to run or which cascades a coarser wheel level.
+ *
+ * @return Number of clock() ticks until the next one which has
+ *         work to do, at least 1 and at most TIMEOUT_WHEEL_SLOTS.
+ *
+ */
+size_t timeout_idle_ticks(void)
+{
+	irq_spinlock_lock(&CPU->timeoutlock, false);
+	
+	uint64_t now = CPU->timeout_tick;
+	size_t ticks;
+	for (ticks = 0; ticks < TIMEOUT_WHEEL_SLOTS - 1; ticks++) {
+		size_t slot = timeout_wheel_index(now + ticks, 0);
+		
+		if ((slot == 0) || (!list_empty(&CPU->timeout_wheel[0][slot])))
+			break;
+	}
+	
+	irq_spinlock_unlock(&CPU->timeoutlock, false);
+	
+	return ticks + 1;
+}
+
 /** @}
  */
@@ -42,6 +42,7 @@
 #include <debug.h>
 #include <proc/task.h>
 #include <proc/thread.h>
+#include <synch/rcu.h>
 #include <arch.h>
 #include <errno.h>
 #include <print.h>
@@ -82,22 +83,25 @@ static errno_t _thread_op_begin(thread_t *thread, bool being_go)
 {
 	mutex_lock(&TASK->udebug.lock);
 	
-	/* thread_exists() must be called with threads_lock held */
-	irq_spinlock_lock(&threads_lock, true);
+	/*
+	 * thread_exists() must be called in an RCU reader section, which also
+	 * keeps the thread structure allocated until it is unlocked.
+	 */
+	rcu_read_lock();
 	
 	if (!thread_exists(thread)) {
-		irq_spinlock_unlock(&threads_lock, true);
+		rcu_read_unlock();
 		mutex_unlock(&TASK->udebug.lock);
 		return ENOENT;
 	}
 	
-	/* thread->lock is enough to ensure the thread's existence */
-	irq_spinlock_exchange(&threads_lock, &thread->lock);
+	irq_spinlock_lock(&thread->lock, true);
 	
 	/* Verify that 'thread' is a userspace thread. */
 	if (!thread->uspace) {
 		/* It's not, deny its existence */
 		irq_spinlock_unlock(&thread->lock, true);
+		rcu_read_unlock();
 		mutex_unlock(&TASK->udebug.lock);
 		return ENOENT;
 	}
@@ -106,6 +110,7 @@ static errno_t _thread_op_begin(thread_t *thread, bool being_go)
 	if (thread->udebug.active != true) {
 		/* Not in debugging session or undesired GO state */
 		irq_spinlock_unlock(&thread->lock, true);
+		rcu_read_unlock();
 		mutex_unlock(&TASK->udebug.lock);
 		return ENOENT;
 	}
@@ -117,6 +122,7 @@ static errno_t _thread_op_begin(thread_t *thread, bool being_go)
 	 *
 	 */
 	irq_spinlock_unlock(&thread->lock, true);
+	rcu_read_unlock();
 	
 	/* Only mutex TASK->udebug.lock left. */
 	
@@ -277,7 +283,7 @@ errno_t udebug_go(thread_t *thread, call_t *call)
 	thread->udebug.cur_event = 0;  /* none */
 	
 	/*
-	 * Neither thread's lock nor threads_lock may be held during wakeup.
+	 * Thread's lock may not be held during wakeup.
 	 *
 	 */
 	waitq_wakeup(&thread->udebug.go_wq, WAKEUP_FIRST);
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <test.h>
+#include <print.h>
+#include <cap/cap.h>
+#include <adt/hash.h>
+#include <adt/hash_table.h>
+#include <synch/mutex.h>
+#include <proc/thread.h>
+#include <proc/task.h>
+#include <mm/slab.h>
+#include <arch/cycle.h>
+#include <atomic.h>
+#include <config.h>
+#include <cpu.h>
+#include <macros.h>
+
+#define MAX_CPUS    16
+#define CAPS        64
+#define ITERATIONS  100000
+
+/*
+ * The baseline is a copy of the previous capability lookup: a hash table
+ * keyed by handle, searched under a mutex.
+ */
+typedef struct {
+	ht_link_t link;
+	cap_handle_t handle;
+	kobject_t *kobject;
+} ht_cap_t;
+
+typedef struct {
+	bool baseline;
+	unsigned int seed;
+	uint64_t cycles;
+	size_t failures;
+} bench_arg_t;
+
+static hash_table_t ht_caps;
+static mutex_t ht_lock;
+static cap_handle_t handles[CAPS];
+
+static size_t ht_cap_hash(const ht_link_t *item)
+{
+	ht_cap_t *cap = hash_table_get_inst(item, ht_cap_t, link);
+	return hash_mix(cap->handle);
+}
+
+static size_t ht_cap_key_hash(void *key)
+{
+	return hash_mix(*(cap_handle_t *) key);
+}
+
+static bool ht_cap_key_equal(void *key, const ht_link_t *item)
+{
+	ht_cap_t *cap = hash_table_get_inst(item, ht_cap_t, link);
+	return *(cap_handle_t *) key == cap->handle;
+}
+
+static hash_table_ops_t ht_cap_ops = {
+	.hash = ht_cap_hash,
+	.key_hash = ht_cap_key_hash,
+	.key_equal = ht_cap_key_equal
+};
+
+static void dummy_destroy(void *arg)
+{
+}
+
+static kobject_ops_t dummy_ops = {
+	.destroy = dummy_destroy
+};
+
+static kobject_t *ht_kobject_get(cap_handle_t handle)
+{
+	kobject_t *kobj = NULL;
+
+	mutex_lock(&ht_lock);
+	ht_link_t *link = hash_table_find(&ht_caps, &handle);
+	if (link) {
+		kobj = hash_table_get_inst(link, ht_cap_t, link)->kobject;
+		kobject_add_ref(kobj);
+	}
+	mutex_unlock(&ht_lock);
+
+	return kobj;
+}
+
+static void bench_thread(void *data)
+{
+	bench_arg_t *arg = (bench_arg_t *) data;
+	unsigned int seed = arg->seed;
+
+	uint64_t start = get_cycle();
+
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		seed = seed * 1103515245 + 12345;
+		cap_handle_t handle = handles[(seed >> 16) % CAPS];
+
+		kobject_t *kobj;
+		if (arg->baseline)
+			kobj = ht_kobject_get(handle);
+		else
+			kobj = kobject_get(TASK, handle, KOBJECT_TYPE_CALL);
+
+		if (kobj)
+			kobject_put(kobj);
+		else
+			arg->failures++;
+	}
+
+	arg->cycles = get_cycle() - start;
+}
+
+/** Run lookups on all CPUs and print the average cost of one lookup
+ *
+ * @return Number of failed lookups.
+ */
+static size_t bench_run(unsigned int cpu_count, bool baseline)
+{
+	bench_arg_t args[MAX_CPUS];
+	thread_t *threads[MAX_CPUS];
+
+	for (unsigned int i = 0; i < cpu_count; i++) {
+		args[i].baseline = baseline;
+		args[i].seed = i;
+		args[i].cycles = 0;
+		args[i].failures = 0;
+
+		threads[i] = thread_create(bench_thread, &args[i], TASK,
+		    THREAD_FLAG_NONE, "cap-bench");
+		if (threads[i]) {
+			thread_wire(threads[i], &cpus[i]);
+			thread_ready(threads[i]);
+		}
+	}
+
+	uint64_t cycles = 0;
+	size_t failures = 0;
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < cpu_count; i++) {
+		if (!threads[i])
+			continue;
+
+		thread_join(threads[i]);
+		thread_detach(threads[i]);
+
+		cycles += args[i].cycles;
+		failures += args[i].failures;
+		count++;
+	}
+
+	if (count > 0) {
+		TPRINTF("%s: %u CPUs, %" PRIu64 " cycles per lookup\n",
+		    baseline ? "hash table" : "cap table", count,
+		    cycles / (count * ITERATIONS));
+	}
+
+	return failures;
+}
+
+const char *test_cap1(void)
+{
+	ht_cap_t ht_items[CAPS];
+	const char *err = NULL;
+	size_t allocated = 0;
+
+	if (!hash_table_create(&ht_caps, 0, 0, &ht_cap_ops))
+		return "Unable to create hash table";
+	mutex_initialize(&ht_lock, MUTEX_PASSIVE);
+
+	for (; allocated < CAPS; allocated++) {
+		kobject_t *kobj = malloc(sizeof(kobject_t), 0);
+		if (cap_alloc(TASK, &handles[allocated]) != EOK) {
+			free(kobj);
+			err = "Unable to allocate capability";
+			break;
+		}
+
+		kobject_initialize(kobj, KOBJECT_TYPE_CALL, NULL, &dummy_ops);
+		cap_publish(TASK, handles[allocated], kobj);
+
+		ht_items[allocated].handle = handles[allocated];
+		ht_items[allocated].kobject = kobj;
+		hash_table_insert(&ht_caps, &ht_items[allocated].link);
+	}
+
+	if (!err) {
+		unsigned int cpu_count = min(config.cpu_active, MAX_CPUS);
+
+		for (unsigned int n = 1; n <= cpu_count; n *= 2) {
+			if ((bench_run(n, true) != 0) ||
+			    (bench_run(n, false) != 0)) {
+				err = "Capability lookup failed";
+				break;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < allocated; i++) {
+		hash_table_remove_item(&ht_caps, &ht_items[i].link);
+
+		kobject_t *kobj = cap_unpublish(TASK, handles[i],
+		    KOBJECT_TYPE_CALL);
+		if (!kobj) {
+			err = "Capability disappeared";
+			continue;
+		}
+
+		kobject_put(kobj);
+		cap_free(TASK, handles[i]);
+	}
+
+	hash_table_destroy(&ht_caps);
+	return err;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <test.h>
+#include <print.h>
+#include <mm/as.h>
+#include <mm/page.h>
+#include <genarch/mm/page_pt.h>
+#include <genarch/mm/page_ht.h>
+#include <proc/thread.h>
+#include <proc/task.h>
+#include <arch/cycle.h>
+#include <atomic.h>
+#include <config.h>
+#include <cpu.h>
+#include <macros.h>
+#include <arch.h>
+#include <mem.h>
+
+#define MAX_CPUS  16
+#define PAGES     1024
+
+typedef struct {
+	uintptr_t base;
+	uint64_t cycles;
+	size_t failures;
+} fault_arg_t;
+
+/** Resolve page faults on all pages of the thread's own area
+ *
+ * The faults are raised by calling the page fault handler directly,
+ * the pages are never accessed. Each fault is handled as if it happened
+ * in copy_from_uspace(), so that a fault which cannot be resolved is
+ * only counted instead of bringing the kernel down. The handler then
+ * redirects the dummy interrupted state to the failover address.
+ *
+ */
+static void fault_thread(void *data)
+{
+	fault_arg_t *arg = (fault_arg_t *) data;
+	istate_t istate;
+	
+	memsetb(&istate, sizeof(istate), 0);
+	
+	uint64_t start = get_cycle();
+	
+	for (size_t i = 0; i < PAGES; i++) {
+		THREAD->in_copy_from_uspace = true;
+		
+		if (as_page_fault(arg->base + P2SZ(i), PF_ACCESS_WRITE,
+		    &istate) != AS_PF_OK)
+			arg->failures++;
+		
+		THREAD->in_copy_from_uspace = false;
+	}
+	
+	arg->cycles = get_cycle() - start;
+	
+	page_table_lock(AS, true);
+	
+	for (size_t i = 0; i < PAGES; i++) {
+		pte_t pte;
+		if ((!page_mapping_find(AS, arg->base + P2SZ(i), false, &pte)) ||
+		    (!PTE_PRESENT(&pte)))
+			arg->failures++;
+	}
+	
+	page_table_unlock(AS, true);
+}
+
+/** Fault in one area per thread and print the average cost of one fault
+ *
+ * Each thread resolves the faults of a separate anonymous area in the
+ * current address space, so the threads contend only for the address
+ * space itself.
+ *
+ * @param cpu_count Number of threads, one per active CPU.
+ *
+ * @return Error message or NULL on success.
+ *
+ */
+static const char *fault_run(unsigned int cpu_count)
+{
+	fault_arg_t args[MAX_CPUS];
+	thread_t *threads[MAX_CPUS];
+	const char *err = NULL;
+	unsigned int created = 0;
+	
+	for (; created < cpu_count; created++) {
+		args[created].base = (uintptr_t) AS_AREA_ANY;
+		args[created].cycles = 0;
+		args[created].failures = 0;
+		
+		as_area_t *area = as_area_create(AS,
+		    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE,
+		    P2SZ(PAGES), AS_AREA_ATTR_NONE,
+		    &anon_backend, NULL, &args[created].base,
+		    USER_ADDRESS_SPACE_START + P2SZ(PAGES));
+		if (!area) {
+			err = "Unable to create address space area";
+			break;
+		}
+	}
+	
+	unsigned int cpu = 0;
+	
+	for (unsigned int i = 0; i < created; i++) {
+		threads[i] = NULL;
+		if (err)
+			continue;
+		
+		/* Skip the processors which never came up. */
+		while ((cpu < config.cpu_count) && (!cpus[cpu].active))
+			cpu++;
+		
+		if (cpu == config.cpu_count) {
+			err = "Not enough active processors";
+			continue;
+		}
+		
+		threads[i] = thread_create(fault_thread, &args[i], TASK,
+		    THREAD_FLAG_NONE, "as1");
+		if (!threads[i]) {
+			err = "Unable to create thread";
+			continue;
+		}
+		
+		thread_wire(threads[i], &cpus[cpu++]);
+		thread_ready(threads[i]);
+	}
+	
+	uint64_t cycles = 0;
+	size_t failures = 0;
+	unsigned int count = 0;
+	
+	for (unsigned int i = 0; i < created; i++) {
+		if (threads[i]) {
+			thread_join(threads[i]);
+			thread_detach(threads[i]);
+			
+			cycles += args[i].cycles;
+			failures += args[i].failures;
+			count++;
+		}
+		
+		as_area_destroy(AS, args[i].base);
+	}
+	
+	if (count > 0) {
+		TPRINTF("%u threads: %" PRIu64 " cycles per fault\n",
+		    count, cycles / (count * PAGES));
+	}
+	
+	if ((!err) && (failures > 0))
+		err = "Page not mapped after page fault";
+	
+	return err;
+}
+
+const char *test_as1(void)
+{
+	unsigned int cpu_count = min(config.cpu_active, MAX_CPUS);
+	
+	for (unsigned int n = 1; n <= cpu_count; n++) {
+		const char *err = fault_run(n);
+		if (err)
+			return err;
+	}
+	
+	return NULL;
+}
@@ -42,9 +42,11 @@ test_t tests[] = {
 #include <atomic/atomic1.def>
 #include <avltree/avltree1.def>
 #include <btree/btree1.def>
+#include <cap/cap1.def>
 #include <cht/cht1.def>
 #include <debug/mips1.def>
 #include <fault/fault1.def>
+#include <mm/as1.def>
 #include <mm/falloc1.def>
 #include <mm/falloc2.def>
 #include <mm/mapping1.def>
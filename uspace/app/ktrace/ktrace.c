@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup ktrace
+ * @brief Decode the kernel trace rings.
+ * @{
+ */
+/**
+ * @file
+ */
+
+#include <abi/ktrace.h>
+#include <as.h>
+#include <ddi.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <libarch/barrier.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <str.h>
+#include <str_error.h>
+#include <sysinfo.h>
+
+#define NAME  "ktrace"
+
+/** Number of latency histogram buckets (powers of two) */
+#define BUCKETS  64
+
+/** Record copied out of a ring */
+typedef struct {
+	ktrace_record_t record;
+	unsigned int cpu;
+} trace_event_t;
+
+/** Start or end of an event pair */
+typedef struct {
+	uint64_t key;
+	uint64_t timestamp;
+	bool end;
+} pair_point_t;
+
+/** Pair of events whose latency is measured */
+typedef struct {
+	const char *name;
+	ktrace_event_t start;
+	ktrace_event_t end;
+} pair_desc_t;
+
+static const pair_desc_t pairs[] = {
+	{ "Scheduler wakeup latency", KTRACE_SCHED_READY, KTRACE_SCHED_RUN },
+	{ "IPC round trip", KTRACE_IPC_CALL, KTRACE_IPC_ANSWER },
+	{ "Page fault", KTRACE_PF_ENTER, KTRACE_PF_EXIT },
+	{ "Futex sleep", KTRACE_FUTEX_SLEEP, KTRACE_FUTEX_WAKEUP }
+};
+
+static const char *event_names[KTRACE_EVENT_COUNT] = {
+	[KTRACE_SCHED_READY] = "sched_ready",
+	[KTRACE_SCHED_RUN] = "sched_run",
+	[KTRACE_IPC_CALL] = "ipc_call",
+	[KTRACE_IPC_ANSWER] = "ipc_answer",
+	[KTRACE_PF_ENTER] = "pf_enter",
+	[KTRACE_PF_EXIT] = "pf_exit",
+	[KTRACE_FUTEX_SLEEP] = "futex_sleep",
+	[KTRACE_FUTEX_WAKEUP] = "futex_wakeup"
+};
+
+/** Copy the valid records of a ring
+ *
+ * Records which are being overwritten by the kernel while they are
+ * copied are skipped.
+ *
+ * @param area   Mapped trace area.
+ * @param ring   Ring to copy.
+ * @param events Output array.
+ *
+ * @return Number of records copied.
+ *
+ */
+static size_t ring_snapshot(uint8_t *area, volatile ktrace_ring_t *ring,
+    trace_event_t *events)
+{
+	volatile ktrace_record_t *records =
+	    (volatile ktrace_record_t *) (area + ring->offset);
+	uint64_t capacity = ring->capacity;
+	
+	uint64_t head = ring->head;
+	read_barrier();
+	
+	uint64_t first = (head > capacity) ? head - capacity : 0;
+	size_t count = 0;
+	
+	for (uint64_t idx = first; idx < head; idx++) {
+		volatile ktrace_record_t *rec = &records[idx & (capacity - 1)];
+		
+		if (rec->seq != idx + 1)
+			continue;
+		
+		read_barrier();
+		events[count].record.timestamp = rec->timestamp;
+		events[count].record.arg = rec->arg;
+		events[count].record.event = rec->event;
+		events[count].record.thread = rec->thread;
+		read_barrier();
+		
+		if (rec->seq != idx + 1)
+			continue;
+		
+		events[count].record.seq = idx + 1;
+		events[count].cpu = ring->cpu;
+		count++;
+	}
+	
+	return count;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+	const trace_event_t *ea = (const trace_event_t *) a;
+	const trace_event_t *eb = (const trace_event_t *) b;
+	
+	if (ea->record.timestamp < eb->record.timestamp)
+		return -1;
+	
+	if (ea->record.timestamp > eb->record.timestamp)
+		return 1;
+	
+	return 0;
+}
+
+static int point_cmp(const void *a, const void *b)
+{
+	const pair_point_t *pa = (const pair_point_t *) a;
+	const pair_point_t *pb = (const pair_point_t *) b;
+	
+	if (pa->key != pb->key)
+		return (pa->key < pb->key) ? -1 : 1;
+	
+	if (pa->timestamp != pb->timestamp)
+		return (pa->timestamp < pb->timestamp) ? -1 : 1;
+	
+	/* Start before end */
+	return (int) pa->end - (int) pb->end;
+}
+
+/** Return the index of the highest bit set */
+static unsigned int log2_u64(uint64_t val)
+{
+	unsigned int order = 0;
+	
+	while (val >>= 1)
+		order++;
+	
+	return order;
+}
+
+/** Print the latency histogram of an event pair
+ *
+ * The start and end events are matched by their key (the thread or the
+ * argument of the event). Each start is paired with the first end which
+ * follows it.
+ *
+ * @param desc   Event pair.
+ * @param events Chronologically sorted events.
+ * @param count  Number of events.
+ * @param points Scratch array with space for count points.
+ *
+ */
+static void print_histogram(const pair_desc_t *desc, trace_event_t *events,
+    size_t count, pair_point_t *points)
+{
+	size_t npoints = 0;
+	
+	for (size_t i = 0; i < count; i++) {
+		ktrace_event_t event = events[i].record.event;
+		if ((event != desc->start) && (event != desc->end))
+			continue;
+		
+		points[npoints].key = KTRACE_EVENT_BY_THREAD(event) ?
+		    events[i].record.thread : events[i].record.arg;
+		points[npoints].timestamp = events[i].record.timestamp;
+		points[npoints].end = (event == desc->end);
+		npoints++;
+	}
+	
+	qsort(points, npoints, sizeof(pair_point_t), point_cmp);
+	
+	uint64_t buckets[BUCKETS] = { 0 };
+	uint64_t samples = 0;
+	uint64_t total = 0;
+	uint64_t min = UINT64_MAX;
+	uint64_t max = 0;
+	
+	for (size_t i = 0; i + 1 < npoints; i++) {
+		if ((points[i].end) || (!points[i + 1].end) ||
+		    (points[i].key != points[i + 1].key))
+			continue;
+		
+		uint64_t latency = points[i + 1].timestamp - points[i].timestamp;
+		
+		buckets[log2_u64(latency)]++;
+		samples++;
+		total += latency;
+		
+		if (latency < min)
+			min = latency;
+		
+		if (latency > max)
+			max = latency;
+	}
+	
+	printf("%s: ", desc->name);
+	
+	if (samples == 0) {
+		printf("no samples\n\n");
+		return;
+	}
+	
+	printf("%" PRIu64 " samples, min %" PRIu64 ", avg %" PRIu64
+	    ", max %" PRIu64 " cycles\n", samples, min, total / samples, max);
+	
+	uint64_t peak = 0;
+	for (unsigned int i = 0; i < BUCKETS; i++) {
+		if (buckets[i] > peak)
+			peak = buckets[i];
+	}
+	
+	for (unsigned int i = log2_u64(min); i <= log2_u64(max); i++) {
+		printf("  < 2^%-2u %10" PRIu64 " ", i + 1, buckets[i]);
+		
+		size_t bar = (size_t) ((buckets[i] * 40 + peak - 1) / peak);
+		for (size_t j = 0; j < bar; j++)
+			putchar('#');
+		
+		putchar('\n');
+	}
+	
+	putchar('\n');
+}
+
+static void dump_events(trace_event_t *events, size_t count)
+{
+	printf("[timestamp         ] [cpu] [thread    ] [event       ] [arg]\n");
+	
+	for (size_t i = 0; i < count; i++) {
+		ktrace_record_t *rec = &events[i].record;
+		const char *name = (rec->event < KTRACE_EVENT_COUNT) ?
+		    event_names[rec->event] : "?";
+		
+		printf("%20" PRIu64 " %5u %12" PRIu32 " %-14s %#" PRIx64 "\n",
+		    rec->timestamp, events[i].cpu, rec->thread, name, rec->arg);
+	}
+}
+
+static void usage(const char *name)
+{
+	printf(
+	    "Usage: %s [-d]\n" \
+	    "\n" \
+	    "Options:\n" \
+	    "\t-d\n" \
+	    "\t--dump\n" \
+	    "\t\tDump the trace records\n" \
+	    "\n" \
+	    "\t-h\n" \
+	    "\t--help\n" \
+	    "\t\tPrint this usage information\n"
+	    "\n" \
+	    "Without any options latency histograms are printed\n",
+	    name
+	);
+}
+
+int main(int argc, char *argv[])
+{
+	bool dump = false;
+	
+	for (int i = 1; i < argc; i++) {
+		if ((str_cmp(argv[i], "-d") == 0) ||
+		    (str_cmp(argv[i], "--dump") == 0)) {
+			dump = true;
+			continue;
+		}
+		
+		usage(NAME);
+		return (str_cmp(argv[i], "-h") == 0) ||
+		    (str_cmp(argv[i], "--help") == 0) ? 0 : 1;
+	}
+	
+	sysarg_t faddr;
+	sysarg_t pages;
+	sysarg_t cpus;
+	
+	if ((sysinfo_get_value("ktrace.faddr", &faddr) != EOK) ||
+	    (sysinfo_get_value("ktrace.pages", &pages) != EOK) ||
+	    (sysinfo_get_value("ktrace.cpus", &cpus) != EOK)) {
+		fprintf(stderr, "%s: Kernel tracing is not available "
+		    "(CONFIG_KTRACE)\n", NAME);
+		return 1;
+	}
+	
+	uint8_t *area;
+	errno_t rc = physmem_map(faddr, pages,
+	    AS_AREA_READ | AS_AREA_CACHEABLE, (void *) &area);
+	if (rc != EOK) {
+		fprintf(stderr, "%s: Unable to map trace rings: %s\n", NAME,
+		    str_error(rc));
+		return 1;
+	}
+	
+	volatile ktrace_ring_t *rings = (volatile ktrace_ring_t *) area;
+	
+	size_t capacity = 0;
+	for (sysarg_t i = 0; i < cpus; i++)
+		capacity += rings[i].capacity;
+	
+	trace_event_t *events = calloc(capacity, sizeof(trace_event_t));
+	pair_point_t *points = calloc(capacity, sizeof(pair_point_t));
+	if ((events == NULL) || (points == NULL)) {
+		fprintf(stderr, "%s: Out of memory\n", NAME);
+		return 1;
+	}
+	
+	size_t count = 0;
+	for (sysarg_t i = 0; i < cpus; i++)
+		count += ring_snapshot(area, &rings[i], events + count);
+	
+	physmem_unmap(area);
+	
+	qsort(events, count, sizeof(trace_event_t), event_cmp);
+	
+	if (dump) {
+		dump_events(events, count);
+	} else {
+		printf("%s: %zu records from %" PRIun " CPUs\n\n", NAME, count,
+		    cpus);
+		
+		for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++)
+			print_histogram(&pairs[i], events, count, points);
+	}
+	
+	free(points);
+	free(events);
+	return 0;
+}
+
+/** @}
+ */
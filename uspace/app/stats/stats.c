@@ -63,30 +63,41 @@ static void list_tasks(void)
 		return;
 	}
 	
-	printf("[taskid] [thrds] [resident] [virtual] [ucycles]"
-	    " [kcycles] [name\n");
+	printf("[taskid] [thrds] [resident] [virtual] [large] [ucycles]"
+	    " [kcycles] [faults] [around] [name\n");
 	
 	size_t i;
 	for (i = 0; i < count; i++) {
 		uint64_t resmem;
 		uint64_t virtmem;
+		uint64_t largemem;
 		uint64_t ucycles;
 		uint64_t kcycles;
+		uint64_t faults;
+		uint64_t around;
 		const char *resmem_suffix;
 		const char *virtmem_suffix;
+		const char *largemem_suffix;
 		char usuffix;
 		char ksuffix;
+		char fsuffix;
+		char asuffix;
 		
 		bin_order_suffix(stats_tasks[i].resmem, &resmem, &resmem_suffix, true);
 		bin_order_suffix(stats_tasks[i].virtmem, &virtmem, &virtmem_suffix, true);
+		bin_order_suffix(stats_tasks[i].largemem, &largemem, &largemem_suffix, true);
 		order_suffix(stats_tasks[i].ucycles, &ucycles, &usuffix);
 		order_suffix(stats_tasks[i].kcycles, &kcycles, &ksuffix);
+		order_suffix(stats_tasks[i].page_faults, &faults, &fsuffix);
+		order_suffix(stats_tasks[i].fault_around, &around, &asuffix);
 		
 		printf("%-8" PRIu64 " %7zu %7" PRIu64 "%s %6" PRIu64 "%s"
-		    " %8" PRIu64 "%c %8" PRIu64 "%c %s\n",
-		    stats_tasks[i].task_id, stats_tasks[i].threads,
-		    resmem, resmem_suffix, virtmem, virtmem_suffix,
-		    ucycles, usuffix, kcycles, ksuffix, stats_tasks[i].name);
+		    " %4" PRIu64 "%s %8" PRIu64 "%c %8" PRIu64 "%c %7" PRIu64
+		    "%c %7" PRIu64 "%c %s\n", stats_tasks[i].task_id,
+		    stats_tasks[i].threads, resmem, resmem_suffix, virtmem,
+		    virtmem_suffix, largemem, largemem_suffix, ucycles, usuffix,
+		    kcycles, ksuffix, faults, fsuffix, around, asuffix,
+		    stats_tasks[i].name);
 	}
 	
 	free(stats_tasks);
@@ -141,7 +152,8 @@ static void list_cpus(void)
 		return;
 	}
 	
-	printf("[id] [MHz     ] [busy cycles] [idle cycles]\n");
+	printf("[id] [MHz     ] [busy cycles] [idle cycles] [steals      ] "
+	    "[TLB IPIs sent/avoided]\n");
 	
 	size_t i;
 	for (i = 0; i < count; i++) {
@@ -153,9 +165,12 @@ static void list_cpus(void)
 			order_suffix(cpus[i].busy_cycles, &bcycles, &bsuffix);
 			order_suffix(cpus[i].idle_cycles, &icycles, &isuffix);
 			
-			printf("%10" PRIu16 " %12" PRIu64 "%c %12" PRIu64 "%c\n",
-			    cpus[i].frequency_mhz, bcycles, bsuffix,
-			    icycles, isuffix);
+			printf("%10" PRIu16 " %12" PRIu64 "%c %12" PRIu64 "%c "
+			    "%6" PRIu64 "/%-6" PRIu64 " %10" PRIu64 "/%-10" PRIu64
+			    "\n", cpus[i].frequency_mhz, bcycles, bsuffix,
+			    icycles, isuffix, cpus[i].steal_successes,
+			    cpus[i].steal_attempts, cpus[i].tlb_ipis_sent,
+			    cpus[i].tlb_ipis_avoided);
 		} else
 			printf("inactive\n");
 	}
@@ -163,6 +178,54 @@ static void list_cpus(void)
 	free(cpus);
 }
 
+static int futex_sleeps_cmp(const void *a, const void *b)
+{
+	const stats_futex_t *fa = (const stats_futex_t *) a;
+	const stats_futex_t *fb = (const stats_futex_t *) b;
+	
+	if (fa->sleeps > fb->sleeps)
+		return -1;
+	
+	if (fa->sleeps < fb->sleeps)
+		return 1;
+	
+	return 0;
+}
+
+static void list_futexes(void)
+{
+	size_t count;
+	stats_futex_t *futexes = stats_get_futexes(&count);
+	
+	if (futexes == NULL) {
+		fprintf(stderr, "%s: Unable to get futex statistics\n", NAME);
+		return;
+	}
+	
+	/* Most contended futexes first */
+	qsort(futexes, count, sizeof(stats_futex_t), futex_sleeps_cmp);
+	
+	printf("[taskid] [address         ] [sleeps  ] [wakeups ]\n");
+	
+	size_t i;
+	for (i = 0; i < count; i++) {
+		if (futexes[i].sleeps == 0)
+			break;
+		
+		uint64_t sleeps, wakeups;
+		char ssuffix, wsuffix;
+		
+		order_suffix(futexes[i].sleeps, &sleeps, &ssuffix);
+		order_suffix(futexes[i].wakeups, &wakeups, &wsuffix);
+		
+		printf("%-8" PRIu64 " %#018" PRIx64 " %9" PRIu64 "%c"
+		    " %9" PRIu64 "%c\n", futexes[i].task_id, futexes[i].uaddr,
+		    sleeps, ssuffix, wakeups, wsuffix);
+	}
+	
+	free(futexes);
+}
+
 static void print_load(void)
 {
 	size_t count;
@@ -201,7 +264,7 @@ static void print_uptime(void)
 static void usage(const char *name)
 {
 	printf(
-	    "Usage: %s [-t task_id] [-a] [-c] [-l] [-u]\n" \
+	    "Usage: %s [-t task_id] [-a] [-c] [-f] [-l] [-u]\n" \
 	    "\n" \
 	    "Options:\n" \
 	    "\t-t task_id\n" \
@@ -216,6 +279,10 @@ static void usage(const char *name)
 	    "\t--cpus\n" \
 	    "\t\tList CPUs\n" \
 	    "\n" \
+	    "\t-f\n" \
+	    "\t--futexes\n" \
+	    "\t\tList contended futexes\n" \
+	    "\n" \
 	    "\t-l\n" \
 	    "\t--load\n" \
 	    "\t\tPrint system load\n" \
@@ -239,6 +306,7 @@ int main(int argc, char *argv[])
 	bool toggle_threads = false;
 	bool toggle_all = false;
 	bool toggle_cpus = false;
+	bool toggle_futexes = false;
 	bool toggle_load = false;
 	bool toggle_uptime = false;
 	
@@ -269,6 +337,13 @@ int main(int argc, char *argv[])
 			continue;
 		}
 		
+		/* Futexes */
+		if ((off = arg_parse_short_long(argv[i], "-f", "--futexes")) != -1) {
+			toggle_tasks = false;
+			toggle_futexes = true;
+			continue;
+		}
+		
 		/* Threads */
 		if ((off = arg_parse_short_long(argv[i], "-t", "--task=")) != -1) {
 			// TODO: Support for 64b range
@@ -310,6 +385,9 @@ int main(int argc, char *argv[])
 	if (toggle_cpus)
 		list_cpus();
 	
+	if (toggle_futexes)
+		list_futexes();
+	
 	if (toggle_load)
 		print_load();
 	
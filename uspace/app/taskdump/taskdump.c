@@ -293,12 +293,15 @@ static errno_t areas_dump(void)
 
 	printf("Address space areas:\n");
 	for (i = 0; i < n_areas; i++) {
-		printf(" [%zu] flags: %c%c%c%c base: %p size: %zu\n", 1 + i,
+		printf(" [%zu] flags: %c%c%c%c%c base: %p size: %zu"
+		    " large: %zu\n", 1 + i,
 		    (ainfo_buf[i].flags & AS_AREA_READ) ? 'R' : '-',
 		    (ainfo_buf[i].flags & AS_AREA_WRITE) ? 'W' : '-',
 		    (ainfo_buf[i].flags & AS_AREA_EXEC) ? 'X' : '-',
 		    (ainfo_buf[i].flags & AS_AREA_CACHEABLE) ? 'C' : '-',
-		    (void *) ainfo_buf[i].start_addr, ainfo_buf[i].size);
+		    (ainfo_buf[i].flags & AS_AREA_LARGE_PAGES) ? 'L' : '-',
+		    (void *) ainfo_buf[i].start_addr, ainfo_buf[i].size,
+		    ainfo_buf[i].large_size);
 	}
 
 	putchar('\n');
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup tester
+ * @{
+ */
+/**
+ * @file
+ * @brief Common code of the IPC benchmarks.
+ *
+ * The benchmarks talk to the ipc-test server. Each sample is the average
+ * cost of one operation within a batch of operations, since the uptime clock
+ * only has microsecond resolution. The results are printed as single lines
+ * starting with "@ipc_bench" followed by key=value pairs, so that they can
+ * be extracted from the console log and compared between runs.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <ipc/ipc_test.h>
+#include <ipc/services.h>
+#include <loc.h>
+#include <macros.h>
+#include <qsort.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "bench.h"
+
+/** Connect to the IPC test server
+ *
+ * @return Session to the server or NULL if the server is not running.
+ *
+ */
+async_sess_t *ipc_bench_connect(void)
+{
+	service_id_t sid;
+	
+	errno_t rc = loc_service_get_id(SERVICE_NAME_IPC_TEST, &sid, 0);
+	if (rc != EOK)
+		return NULL;
+	
+	return loc_service_connect(sid, INTERFACE_IPC_TEST, 0);
+}
+
+/** Get the number of CPUs in the system
+ *
+ * @return Number of CPUs (at least one).
+ *
+ */
+size_t ipc_bench_cpus(void)
+{
+	size_t count;
+	stats_cpu_t *cpus = stats_get_cpus(&count);
+	if (cpus == NULL)
+		return 1;
+	
+	free(cpus);
+	return max(count, 1);
+}
+
+/** Time batches of operations
+ *
+ * One untimed batch is run first to warm up the caches and to populate the
+ * server side state.
+ *
+ * @param sess    Session to the IPC test server.
+ * @param op      Benchmarked operation.
+ * @param arg     Argument of the operation.
+ * @param batch   Number of operations in one sample.
+ * @param count   Number of samples.
+ * @param samples Array of @a count elements to store the average cost of
+ *                one operation in each batch (in nanoseconds).
+ *
+ * @return EOK on success or the error code of the first failed operation.
+ *
+ */
+errno_t ipc_bench_collect(async_sess_t *sess, ipc_bench_op_t op, void *arg,
+    size_t batch, size_t count, uint64_t *samples)
+{
+	errno_t rc;
+	
+	for (size_t i = 0; i < batch; i++) {
+		rc = op(sess, arg);
+		if (rc != EOK)
+			return rc;
+	}
+	
+	for (size_t s = 0; s < count; s++) {
+		struct timeval start;
+		struct timeval end;
+		
+		getuptime(&start);
+		
+		for (size_t i = 0; i < batch; i++) {
+			rc = op(sess, arg);
+			if (rc != EOK)
+				return rc;
+		}
+		
+		getuptime(&end);
+		samples[s] = (uint64_t) tv_sub_diff(&end, &start) * 1000 / batch;
+	}
+	
+	return EOK;
+}
+
+static int ipc_bench_cmp(const void *a, const void *b)
+{
+	uint64_t sa = *((const uint64_t *) a);
+	uint64_t sb = *((const uint64_t *) b);
+	
+	if (sa < sb)
+		return -1;
+	
+	if (sa > sb)
+		return 1;
+	
+	return 0;
+}
+
+/** Compute the distribution of samples
+ *
+ * @param samples Samples (sorted in place).
+ * @param count   Number of samples (at least one).
+ * @param summary Place to store the distribution.
+ *
+ */
+void ipc_bench_summarize(uint64_t *samples, size_t count,
+    ipc_bench_summary_t *summary)
+{
+	qsort(samples, count, sizeof(uint64_t), ipc_bench_cmp);
+	
+	summary->count = count;
+	summary->min = samples[0];
+	summary->p50 = samples[(count - 1) * 50 / 100];
+	summary->p90 = samples[(count - 1) * 90 / 100];
+	summary->p99 = samples[(count - 1) * 99 / 100];
+	summary->max = samples[count - 1];
+}
+
+/** Time an operation and compute the distribution of its cost
+ *
+ * @param sess    Session to the IPC test server.
+ * @param op      Benchmarked operation.
+ * @param arg     Argument of the operation.
+ * @param batch   Number of operations in one sample.
+ * @param count   Number of samples.
+ * @param summary Place to store the distribution.
+ *
+ * @return EOK on success or an error code.
+ *
+ */
+errno_t ipc_bench_run(async_sess_t *sess, ipc_bench_op_t op, void *arg,
+    size_t batch, size_t count, ipc_bench_summary_t *summary)
+{
+	uint64_t *samples = calloc(count, sizeof(uint64_t));
+	if (samples == NULL)
+		return ENOMEM;
+	
+	errno_t rc = ipc_bench_collect(sess, op, arg, batch, count, samples);
+	if (rc == EOK)
+		ipc_bench_summarize(samples, count, summary);
+	
+	free(samples);
+	return rc;
+}
+
+/** Print the result of one benchmark case
+ *
+ * @param test    Name of the benchmark.
+ * @param name    Name of the case.
+ * @param summary Distribution of the cost of one operation.
+ * @param bytes   Number of bytes moved by one operation or zero.
+ *                The throughput is computed from the median.
+ *
+ */
+void ipc_bench_report(const char *test, const char *name,
+    ipc_bench_summary_t *summary, size_t bytes)
+{
+	printf("@ipc_bench test=%s case=%s samples=%zu unit=ns min=%" PRIu64
+	    " p50=%" PRIu64 " p90=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64,
+	    test, name, summary->count, summary->min, summary->p50,
+	    summary->p90, summary->p99, summary->max);
+	
+	if (bytes > 0) {
+		uint64_t rate = (uint64_t) bytes * 1000000000 /
+		    max(summary->p50, 1) / 1024;
+		printf(" kib_s=%" PRIu64, rate);
+	}
+	
+	printf("\n");
+}
+
+/** @}
+ */
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup tester
+ * @{
+ */
+/** @file
+ */
+
+#ifndef IPC_BENCH_H_
+#define IPC_BENCH_H_
+
+#include <async.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Default number of operations timed together as one sample */
+#define IPC_BENCH_BATCH  64
+
+/** Default number of samples collected for each benchmark case */
+#define IPC_BENCH_SAMPLES  256
+
+/** Benchmarked operation
+ *
+ * @param sess Session to the IPC test server.
+ * @param arg  Operation specific argument.
+ *
+ * @return EOK on success or an error code.
+ *
+ */
+typedef errno_t (*ipc_bench_op_t)(async_sess_t *, void *);
+
+/** Distribution of the cost of one operation in nanoseconds */
+typedef struct {
+	size_t count;
+	uint64_t min;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t max;
+} ipc_bench_summary_t;
+
+extern async_sess_t *ipc_bench_connect(void);
+extern size_t ipc_bench_cpus(void);
+extern errno_t ipc_bench_collect(async_sess_t *, ipc_bench_op_t, void *,
+    size_t, size_t, uint64_t *);
+extern void ipc_bench_summarize(uint64_t *, size_t, ipc_bench_summary_t *);
+extern errno_t ipc_bench_run(async_sess_t *, ipc_bench_op_t, void *, size_t,
+    size_t, ipc_bench_summary_t *);
+extern void ipc_bench_report(const char *, const char *,
+    ipc_bench_summary_t *, size_t);
+
+#endif
+
+/** @}
+ */
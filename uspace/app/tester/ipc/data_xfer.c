@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <as.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <io/chardev.h>
+#include <ipc/services.h>
+#include <loc.h>
+#include <macros.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "../tester.h"
+
+/** Amount of data moved for each transfer size and direction */
+#define TOTAL_BYTES  (16 * 1024 * 1024)
+
+/** Run one direction of the benchmark
+ *
+ * @param chardev Character device to transfer the data to or from.
+ * @param buffer  Page-aligned buffer of at least @a size bytes.
+ * @param size    Size of each transfer.
+ * @param write   Write to the device instead of reading from it.
+ * @param rate    Place to store the throughput in KiB/s.
+ *
+ * @return EOK on success or an error code.
+ *
+ */
+static errno_t data_xfer_run(chardev_t *chardev, void *buffer, size_t size,
+    bool write, uint64_t *rate)
+{
+	struct timeval start;
+	struct timeval end;
+	uint64_t total = 0;
+	size_t nbytes;
+	errno_t rc;
+
+	gettimeofday(&start, NULL);
+
+	while (total < TOTAL_BYTES) {
+		if (write)
+			rc = chardev_write(chardev, buffer, size, &nbytes);
+		else
+			rc = chardev_read(chardev, buffer, size, &nbytes);
+
+		if (rc != EOK)
+			return rc;
+
+		if (nbytes != size)
+			return EIO;
+
+		total += nbytes;
+	}
+
+	gettimeofday(&end, NULL);
+
+	suseconds_t usecs = max(tv_sub_diff(&end, &start), 1);
+	*rate = (total * 1000000 / usecs) / 1024;
+	return EOK;
+}
+
+const char *test_data_xfer(void)
+{
+	chardev_t *chardev;
+	service_id_t sid;
+	async_sess_t *sess;
+	errno_t rc;
+
+	rc = loc_service_get_id(SERVICE_NAME_CHARDEV_TEST_LARGEX, &sid, 0);
+	if (rc != EOK) {
+		return "Failed resolving test device "
+		    SERVICE_NAME_CHARDEV_TEST_LARGEX;
+	}
+
+	sess = loc_service_connect(sid, INTERFACE_DDF, 0);
+	if (sess == NULL)
+		return "Failed connecting test device";
+
+	rc = chardev_open(sess, &chardev);
+	if (rc != EOK) {
+		async_hangup(sess);
+		return "Failed opening test device";
+	}
+
+	void *buffer = memalign(PAGE_SIZE, DATA_XFER_LIMIT);
+	if (buffer == NULL) {
+		chardev_close(chardev);
+		async_hangup(sess);
+		return "Failed allocating buffer";
+	}
+
+	const char *err = NULL;
+
+	TPRINTF("%10s %16s %16s\n", "Size", "Write [KiB/s]", "Read [KiB/s]");
+
+	for (size_t size = 64; size <= DATA_XFER_LIMIT; size *= 4) {
+		uint64_t wrate;
+		uint64_t rrate;
+
+		rc = data_xfer_run(chardev, buffer, size, true, &wrate);
+		if (rc != EOK) {
+			err = "Failed sending data";
+			break;
+		}
+
+		rc = data_xfer_run(chardev, buffer, size, false, &rrate);
+		if (rc != EOK) {
+			err = "Failed receiving data";
+			break;
+		}
+
+		TPRINTF("%10zu %16" PRIu64 " %16" PRIu64 "\n", size, wrate,
+		    rrate);
+	}
+
+	free(buffer);
+	chardev_close(chardev);
+	async_hangup(sess);
+	return err;
+}
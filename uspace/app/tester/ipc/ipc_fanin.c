@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <async.h>
+#include <atomic.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <ipc/ipc_test.h>
+#include <ipc/services.h>
+#include <macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <thread.h>
+#include "../tester.h"
+#include "bench.h"
+
+/** Largest number of client threads */
+#define FANIN_MAX_CLIENTS  32
+
+/** Number of samples collected by each client */
+#define FANIN_SAMPLES  64
+
+/** Client thread parameters */
+typedef struct {
+	/** Place to store the samples of this client */
+	uint64_t *samples;
+	/** Result of the client */
+	errno_t rc;
+} fanin_client_t;
+
+static atomic_t fanin_running;
+
+static errno_t ping_fast(async_sess_t *sess, void *arg)
+{
+	async_exch_t *exch = async_exchange_begin(sess);
+	errno_t rc = async_req_0_0(exch, IPC_TEST_PING);
+	async_exchange_end(exch);
+	
+	return rc;
+}
+
+/** Client thread
+ *
+ * Each client uses its own connection to the server.
+ *
+ */
+static void fanin_client(void *arg)
+{
+	fanin_client_t *client = (fanin_client_t *) arg;
+	
+	async_sess_t *sess = ipc_bench_connect();
+	if (sess == NULL) {
+		client->rc = ENOENT;
+	} else {
+		client->rc = ipc_bench_collect(sess, ping_fast, NULL,
+		    IPC_BENCH_BATCH, FANIN_SAMPLES, client->samples);
+		async_hangup(sess);
+	}
+	
+	atomic_dec(&fanin_running);
+}
+
+/** Run the given number of clients at the same time
+ *
+ * @param count   Number of clients.
+ * @param clients Array of at least @a count client descriptors.
+ * @param usecs   Place to store the wall clock time of the run.
+ *
+ * @return EOK on success or an error code.
+ *
+ */
+static errno_t fanin_run(size_t count, fanin_client_t *clients,
+    suseconds_t *usecs)
+{
+	struct timeval start;
+	struct timeval end;
+	errno_t rc = EOK;
+	
+	atomic_set(&fanin_running, count);
+	getuptime(&start);
+	
+	for (size_t i = 0; i < count; i++) {
+		clients[i].rc = EOK;
+		
+		errno_t trc = thread_create(fanin_client, &clients[i],
+		    "ipc_fanin", NULL);
+		if (trc != EOK) {
+			rc = trc;
+			atomic_dec(&fanin_running);
+		}
+	}
+	
+	while (atomic_get(&fanin_running) > 0)
+		thread_usleep(1000);
+	
+	getuptime(&end);
+	*usecs = max(tv_sub_diff(&end, &start), 1);
+	
+	for (size_t i = 0; i < count; i++) {
+		if (clients[i].rc != EOK)
+			rc = clients[i].rc;
+	}
+	
+	return rc;
+}
+
+const char *test_ipc_fanin(void)
+{
+	fanin_client_t clients[FANIN_MAX_CLIENTS];
+	ipc_bench_summary_t summary;
+	char name[32];
+	
+	size_t cpus = ipc_bench_cpus();
+	size_t max_clients = min(2 * cpus, FANIN_MAX_CLIENTS);
+	
+	uint64_t *samples = calloc(max_clients * FANIN_SAMPLES,
+	    sizeof(uint64_t));
+	if (samples == NULL)
+		return "Failed allocating samples";
+	
+	for (size_t i = 0; i < max_clients; i++)
+		clients[i].samples = samples + i * FANIN_SAMPLES;
+	
+	TPRINTF("Running up to %zu clients on %zu CPUs...\n", max_clients,
+	    cpus);
+	
+	const char *err = NULL;
+	
+	for (size_t count = 1; count <= max_clients; count *= 2) {
+		suseconds_t usecs;
+		
+		TPRINTF("Measuring %zu concurrent clients...\n", count);
+		if (fanin_run(count, clients, &usecs) != EOK) {
+			err = "Failed running clients";
+			break;
+		}
+		
+		ipc_bench_summarize(samples, count * FANIN_SAMPLES, &summary);
+		
+		/*
+		 * The warm-up batch of each client is not timed, but it is
+		 * included in the wall clock time.
+		 */
+		uint64_t ops = (uint64_t) count * (FANIN_SAMPLES + 1) *
+		    IPC_BENCH_BATCH;
+		
+		snprintf(name, sizeof(name), "clients-%zu", count);
+		ipc_bench_report("ipc_fanin", name, &summary, 0);
+		printf("@ipc_bench test=ipc_fanin case=%s cpus=%zu ops_s=%"
+		    PRIu64 "\n", name, cpus, ops * 1000000 / usecs);
+	}
+	
+	free(samples);
+	return err;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <async.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <ipc/ipc_test.h>
+#include <ipc/services.h>
+#include <stdio.h>
+#include "../tester.h"
+#include "bench.h"
+
+/** Longest forward chain */
+#define FORWARD_MAX_HOPS  16
+
+static errno_t forward(async_sess_t *sess, void *arg)
+{
+	sysarg_t hops = *((sysarg_t *) arg);
+	
+	async_exch_t *exch = async_exchange_begin(sess);
+	errno_t rc = async_req_1_0(exch, IPC_TEST_FORWARD, hops);
+	async_exchange_end(exch);
+	
+	return rc;
+}
+
+const char *test_ipc_forward(void)
+{
+	ipc_bench_summary_t summary;
+	char name[32];
+	
+	async_sess_t *sess = ipc_bench_connect();
+	if (sess == NULL)
+		return "Failed connecting to " SERVICE_NAME_IPC_TEST;
+	
+	const char *err = NULL;
+	sysarg_t hops = 0;
+	
+	while (hops <= FORWARD_MAX_HOPS) {
+		TPRINTF("Measuring chains of %" PRIun " forwards...\n", hops);
+		
+		errno_t rc = ipc_bench_run(sess, forward, &hops, IPC_BENCH_BATCH,
+		    IPC_BENCH_SAMPLES, &summary);
+		if (rc != EOK) {
+			err = "Failed forwarding call";
+			break;
+		}
+		
+		snprintf(name, sizeof(name), "hops-%" PRIun, hops);
+		ipc_bench_report("ipc_forward", name, &summary, 0);
+		
+		hops = (hops == 0) ? 1 : hops * 2;
+	}
+	
+	async_hangup(sess);
+	return err;
+}
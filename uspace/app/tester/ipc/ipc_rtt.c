@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <async.h>
+#include <errno.h>
+#include <mem.h>
+#include <ipc/ipc_test.h>
+#include <ipc/services.h>
+#include "../tester.h"
+#include "bench.h"
+
+/** Number of calls submitted together by async_send_batch() */
+#define RTT_BATCH_CALLS  16
+
+static errno_t ping_fast(async_sess_t *sess, void *arg)
+{
+	async_exch_t *exch = async_exchange_begin(sess);
+	errno_t rc = async_req_0_0(exch, IPC_TEST_PING);
+	async_exchange_end(exch);
+	
+	return rc;
+}
+
+static errno_t ping_slow(async_sess_t *sess, void *arg)
+{
+	sysarg_t sum;
+	
+	async_exch_t *exch = async_exchange_begin(sess);
+	errno_t rc = async_req_5_1(exch, IPC_TEST_PING_SLOW, 1, 2, 3, 4, 5,
+	    &sum);
+	async_exchange_end(exch);
+	
+	if ((rc == EOK) && (sum != 15))
+		rc = EIO;
+	
+	return rc;
+}
+
+static errno_t ping_batch(async_sess_t *sess, void *arg)
+{
+	ipc_call_t requests[RTT_BATCH_CALLS];
+	aid_t aids[RTT_BATCH_CALLS];
+	
+	for (size_t i = 0; i < RTT_BATCH_CALLS; i++) {
+		memset(&requests[i], 0, sizeof(requests[i]));
+		IPC_SET_IMETHOD(requests[i], IPC_TEST_PING);
+	}
+	
+	async_exch_t *exch = async_exchange_begin(sess);
+	errno_t rc = async_send_batch(exch, RTT_BATCH_CALLS, requests, NULL,
+	    aids);
+	async_exchange_end(exch);
+	
+	if (rc != EOK)
+		return rc;
+	
+	/* Every call has to be waited for, even after a failure */
+	for (size_t i = 0; i < RTT_BATCH_CALLS; i++) {
+		errno_t retval;
+		async_wait_for(aids[i], &retval);
+		if (retval != EOK)
+			rc = retval;
+	}
+	
+	return rc;
+}
+
+const char *test_ipc_rtt(void)
+{
+	ipc_bench_summary_t summary;
+	
+	async_sess_t *sess = ipc_bench_connect();
+	if (sess == NULL)
+		return "Failed connecting to " SERVICE_NAME_IPC_TEST;
+	
+	TPRINTF("Measuring fast call round trips...\n");
+	errno_t rc = ipc_bench_run(sess, ping_fast, NULL, IPC_BENCH_BATCH,
+	    IPC_BENCH_SAMPLES, &summary);
+	if (rc != EOK) {
+		async_hangup(sess);
+		return "Failed sending fast call";
+	}
+	
+	ipc_bench_report("ipc_rtt", "fast", &summary, 0);
+	
+	TPRINTF("Measuring slow call round trips...\n");
+	rc = ipc_bench_run(sess, ping_slow, NULL, IPC_BENCH_BATCH,
+	    IPC_BENCH_SAMPLES, &summary);
+	if (rc != EOK) {
+		async_hangup(sess);
+		return "Failed sending slow call";
+	}
+	
+	ipc_bench_report("ipc_rtt", "slow", &summary, 0);
+	
+	TPRINTF("Measuring round trips of %d calls sent in a batch...\n",
+	    RTT_BATCH_CALLS);
+	rc = ipc_bench_run(sess, ping_batch, NULL, IPC_BENCH_BATCH,
+	    IPC_BENCH_SAMPLES, &summary);
+	if (rc != EOK) {
+		async_hangup(sess);
+		return "Failed sending batched calls";
+	}
+	
+	ipc_bench_report("ipc_rtt", "batch", &summary, 0);
+	
+	async_hangup(sess);
+	return NULL;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <async.h>
+#include <atomic.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <ipc/ipc_test.h>
+#include <macros.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <thread.h>
+#include "../tester.h"
+#include "bench.h"
+
+/** Largest number of client threads */
+#define SCALE_MAX_CLIENTS  32
+
+/** Number of calls made by each client */
+#define SCALE_CALLS  4096
+
+/** Client thread parameters */
+typedef struct {
+	/** Result of the client */
+	errno_t rc;
+} scale_client_t;
+
+static atomic_t scale_running;
+
+/** Client thread
+ *
+ * Each client uses its own connection to the server.
+ *
+ */
+static void scale_client(void *arg)
+{
+	scale_client_t *client = (scale_client_t *) arg;
+	
+	async_sess_t *sess = ipc_bench_connect();
+	if (sess == NULL) {
+		client->rc = ENOENT;
+	} else {
+		async_exch_t *exch = async_exchange_begin(sess);
+		
+		for (size_t i = 0; i < SCALE_CALLS; i++) {
+			client->rc = async_req_0_0(exch, IPC_TEST_PING);
+			if (client->rc != EOK)
+				break;
+		}
+		
+		async_exchange_end(exch);
+		async_hangup(sess);
+	}
+	
+	atomic_dec(&scale_running);
+}
+
+/** Run the given number of clients at the same time
+ *
+ * @param count   Number of clients.
+ * @param clients Array of at least @a count client descriptors.
+ * @param usecs   Place to store the wall clock time of the run.
+ *
+ * @return EOK on success or an error code.
+ *
+ */
+static errno_t scale_run(size_t count, scale_client_t *clients,
+    suseconds_t *usecs)
+{
+	struct timeval start;
+	struct timeval end;
+	errno_t rc = EOK;
+	
+	atomic_set(&scale_running, count);
+	getuptime(&start);
+	
+	for (size_t i = 0; i < count; i++) {
+		clients[i].rc = EOK;
+		
+		errno_t trc = thread_create(scale_client, &clients[i],
+		    "ipc_scale", NULL);
+		if (trc != EOK) {
+			rc = trc;
+			atomic_dec(&scale_running);
+		}
+	}
+	
+	while (atomic_get(&scale_running) > 0)
+		thread_usleep(1000);
+	
+	getuptime(&end);
+	*usecs = max(tv_sub_diff(&end, &start), 1);
+	
+	for (size_t i = 0; i < count; i++) {
+		if (clients[i].rc != EOK)
+			rc = clients[i].rc;
+	}
+	
+	return rc;
+}
+
+/** Next number of server threads to measure
+ *
+ * The numbers double up to the largest one, which is always measured
+ * even if it is not a power of two.
+ *
+ * @return Next number of server threads or zero when done.
+ *
+ */
+static size_t scale_next_threads(size_t threads, size_t max_threads)
+{
+	if (threads >= max_threads)
+		return 0;
+	
+	return min(2 * threads, max_threads);
+}
+
+const char *test_ipc_scale(void)
+{
+	scale_client_t clients[SCALE_MAX_CLIENTS];
+	char name[32];
+	
+	size_t cpus = ipc_bench_cpus();
+	size_t max_threads = min(cpus, IPC_TEST_MAX_THREADS);
+	size_t count = min(2 * cpus, SCALE_MAX_CLIENTS);
+	
+	async_sess_t *sess = ipc_bench_connect();
+	if (sess == NULL)
+		return "Failed connecting to the IPC test server";
+	
+	TPRINTF("Running %zu clients against up to %zu server threads...\n",
+	    count, max_threads);
+	
+	const char *err = NULL;
+	
+	for (size_t threads = 1; threads != 0;
+	    threads = scale_next_threads(threads, max_threads)) {
+		sysarg_t running;
+		suseconds_t usecs;
+		
+		async_exch_t *exch = async_exchange_begin(sess);
+		errno_t rc = async_req_1_1(exch, IPC_TEST_SET_THREADS, threads,
+		    &running);
+		async_exchange_end(exch);
+		
+		if ((rc != EOK) || (running < threads)) {
+			err = "Failed starting server threads";
+			break;
+		}
+		
+		TPRINTF("Measuring %zu server threads...\n", threads);
+		if (scale_run(count, clients, &usecs) != EOK) {
+			err = "Failed running clients";
+			break;
+		}
+		
+		uint64_t ops = (uint64_t) count * SCALE_CALLS;
+		
+		snprintf(name, sizeof(name), "threads-%zu", threads);
+		printf("@ipc_bench test=ipc_scale case=%s cpus=%zu clients=%zu"
+		    " ops_s=%" PRIu64 "\n", name, cpus, count,
+		    ops * 1000000 / usecs);
+	}
+	
+	async_hangup(sess);
+	return err;
+}
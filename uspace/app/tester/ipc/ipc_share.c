@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <as.h>
+#include <async.h>
+#include <errno.h>
+#include <ipc/ipc_test.h>
+#include <ipc/services.h>
+#include <mem.h>
+#include <stdio.h>
+#include "../tester.h"
+#include "bench.h"
+
+/** Number of operations in one sample */
+#define SHARE_BATCH  8
+
+/** Number of samples for each case */
+#define SHARE_SAMPLES  64
+
+/** Largest area shared out */
+#define SHARE_OUT_MAX  (1024 * 1024)
+
+static errno_t share_in(async_sess_t *sess, void *arg)
+{
+	void *dst;
+	
+	async_exch_t *exch = async_exchange_begin(sess);
+	aid_t req = async_send_0(exch, IPC_TEST_SHARE_IN, NULL);
+	errno_t rc = async_share_in_start_0_0(exch, IPC_TEST_BUF_SIZE, &dst);
+	async_exchange_end(exch);
+	
+	if (rc != EOK) {
+		async_forget(req);
+		return rc;
+	}
+	
+	async_wait_for(req, &rc);
+	
+	/* Touch the first page so that the mapping is actually used. */
+	if ((rc == EOK) && (*((volatile uint8_t *) dst) != 0))
+		rc = EIO;
+	
+	(void) as_area_destroy(dst);
+	return rc;
+}
+
+static errno_t share_out(async_sess_t *sess, void *arg)
+{
+	async_exch_t *exch = async_exchange_begin(sess);
+	aid_t req = async_send_0(exch, IPC_TEST_SHARE_OUT, NULL);
+	errno_t rc = async_share_out_start(exch, arg,
+	    AS_AREA_READ | AS_AREA_CACHEABLE);
+	async_exchange_end(exch);
+	
+	if (rc != EOK) {
+		async_forget(req);
+		return rc;
+	}
+	
+	async_wait_for(req, &rc);
+	return rc;
+}
+
+const char *test_ipc_share(void)
+{
+	ipc_bench_summary_t summary;
+	char name[32];
+	
+	async_sess_t *sess = ipc_bench_connect();
+	if (sess == NULL)
+		return "Failed connecting to " SERVICE_NAME_IPC_TEST;
+	
+	TPRINTF("Measuring share in of %zu bytes...\n",
+	    (size_t) IPC_TEST_BUF_SIZE);
+	errno_t rc = ipc_bench_run(sess, share_in, NULL, SHARE_BATCH,
+	    SHARE_SAMPLES, &summary);
+	if (rc != EOK) {
+		async_hangup(sess);
+		return "Failed sharing in";
+	}
+	
+	snprintf(name, sizeof(name), "in-%zu", (size_t) IPC_TEST_BUF_SIZE);
+	ipc_bench_report("ipc_share", name, &summary, 0);
+	
+	const char *err = NULL;
+	
+	for (size_t size = PAGE_SIZE; size <= SHARE_OUT_MAX; size *= 4) {
+		void *area = as_area_create(AS_AREA_ANY, size,
+		    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE,
+		    AS_AREA_UNPAGED);
+		if (area == AS_MAP_FAILED) {
+			err = "Failed creating area";
+			break;
+		}
+		
+		/* Populate the area so that all its pages are shared. */
+		memset(area, 0, size);
+		
+		TPRINTF("Measuring share out of %zu bytes...\n", size);
+		rc = ipc_bench_run(sess, share_out, area, SHARE_BATCH,
+		    SHARE_SAMPLES, &summary);
+		(void) as_area_destroy(area);
+		
+		if (rc != EOK) {
+			err = "Failed sharing out";
+			break;
+		}
+		
+		snprintf(name, sizeof(name), "out-%zu", size);
+		ipc_bench_report("ipc_share", name, &summary, 0);
+	}
+	
+	async_hangup(sess);
+	return err;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <as.h>
+#include <async.h>
+#include <errno.h>
+#include <ipc/ipc_test.h>
+#include <ipc/services.h>
+#include <malloc.h>
+#include <mem.h>
+#include <stdio.h>
+#include "../tester.h"
+#include "bench.h"
+
+/** Number of operations in one sample */
+#define XFER_BATCH  16
+
+/** Number of samples for each size */
+#define XFER_SAMPLES  64
+
+typedef struct {
+	void *buffer;
+	size_t size;
+} xfer_arg_t;
+
+static errno_t data_write(async_sess_t *sess, void *arg)
+{
+	xfer_arg_t *xfer = (xfer_arg_t *) arg;
+	
+	async_exch_t *exch = async_exchange_begin(sess);
+	aid_t req = async_send_0(exch, IPC_TEST_DATA_WRITE, NULL);
+	errno_t rc = async_data_write_start(exch, xfer->buffer, xfer->size);
+	async_exchange_end(exch);
+	
+	if (rc != EOK) {
+		async_forget(req);
+		return rc;
+	}
+	
+	async_wait_for(req, &rc);
+	return rc;
+}
+
+static errno_t data_read(async_sess_t *sess, void *arg)
+{
+	xfer_arg_t *xfer = (xfer_arg_t *) arg;
+	
+	async_exch_t *exch = async_exchange_begin(sess);
+	aid_t req = async_send_0(exch, IPC_TEST_DATA_READ, NULL);
+	errno_t rc = async_data_read_start(exch, xfer->buffer, xfer->size);
+	async_exchange_end(exch);
+	
+	if (rc != EOK) {
+		async_forget(req);
+		return rc;
+	}
+	
+	async_wait_for(req, &rc);
+	return rc;
+}
+
+const char *test_ipc_xfer(void)
+{
+	ipc_bench_summary_t summary;
+	xfer_arg_t xfer;
+	char name[32];
+	
+	async_sess_t *sess = ipc_bench_connect();
+	if (sess == NULL)
+		return "Failed connecting to " SERVICE_NAME_IPC_TEST;
+	
+	xfer.buffer = memalign(PAGE_SIZE, IPC_TEST_BUF_SIZE);
+	if (xfer.buffer == NULL) {
+		async_hangup(sess);
+		return "Failed allocating buffer";
+	}
+	
+	memset(xfer.buffer, 0, IPC_TEST_BUF_SIZE);
+	
+	const char *err = NULL;
+	
+	for (xfer.size = 16; xfer.size <= IPC_TEST_BUF_SIZE; xfer.size *= 4) {
+		TPRINTF("Measuring transfers of %zu bytes...\n", xfer.size);
+		
+		errno_t rc = ipc_bench_run(sess, data_write, &xfer, XFER_BATCH,
+		    XFER_SAMPLES, &summary);
+		if (rc != EOK) {
+			err = "Failed writing data";
+			break;
+		}
+		
+		snprintf(name, sizeof(name), "write-%zu", xfer.size);
+		ipc_bench_report("ipc_xfer", name, &summary, xfer.size);
+		
+		rc = ipc_bench_run(sess, data_read, &xfer, XFER_BATCH,
+		    XFER_SAMPLES, &summary);
+		if (rc != EOK) {
+			err = "Failed reading data";
+			break;
+		}
+		
+		snprintf(name, sizeof(name), "read-%zu", xfer.size);
+		ipc_bench_report("ipc_xfer", name, &summary, xfer.size);
+	}
+	
+	free(xfer.buffer);
+	async_hangup(sess);
+	return err;
+}
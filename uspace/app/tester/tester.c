@@ -48,6 +48,7 @@ char **test_argv;
 test_t tests[] = {
 #include "thread/thread1.def"
 #include "thread/setjmp1.def"
+#include "thread/timeout1.def"
 #include "print/print1.def"
 #include "print/print2.def"
 #include "print/print3.def"
@@ -68,6 +69,13 @@ test_t tests[] = {
 #include "vfs/vfs1.def"
 #include "ipc/ping_pong.def"
 #include "ipc/starve.def"
+#include "ipc/data_xfer.def"
+#include "ipc/ipc_rtt.def"
+#include "ipc/ipc_xfer.def"
+#include "ipc/ipc_share.def"
+#include "ipc/ipc_forward.def"
+#include "ipc/ipc_fanin.def"
+#include "ipc/ipc_scale.def"
 #include "loop/loop1.def"
 #include "mm/malloc1.def"
 #include "mm/malloc2.def"
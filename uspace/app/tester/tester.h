@@ -80,6 +80,7 @@ typedef struct {
 
 extern const char *test_thread1(void);
 extern const char *test_setjmp1(void);
+extern const char *test_timeout1(void);
 extern const char *test_print1(void);
 extern const char *test_print2(void);
 extern const char *test_print3(void);
@@ -100,6 +101,13 @@ extern const char *test_softfloat1(void);
 extern const char *test_vfs1(void);
 extern const char *test_ping_pong(void);
 extern const char *test_starve_ipc(void);
+extern const char *test_data_xfer(void);
+extern const char *test_ipc_rtt(void);
+extern const char *test_ipc_xfer(void);
+extern const char *test_ipc_share(void);
+extern const char *test_ipc_forward(void);
+extern const char *test_ipc_fanin(void);
+extern const char *test_ipc_scale(void);
 extern const char *test_loop1(void);
 extern const char *test_malloc1(void);
 extern const char *test_malloc2(void);
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <async.h>
+#include <atomic.h>
+#include <errno.h>
+#include <fibril.h>
+#include <fibril_synch.h>
+#include <inttypes.h>
+#include <libarch/config.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include "../tester.h"
+
+/** Number of fibrils with a pending timeout at the same time */
+#define TIMEOUT_FIBRILS  100000
+
+/** Shortest sleep in microseconds, long enough to start all fibrils */
+#define TIMEOUT_BASE  (30 * 1000 * 1000)
+
+/** Range of the sleep lengths in microseconds */
+#define TIMEOUT_SPREAD  (1000 * 1000)
+
+/** Timeout of the waits which are cancelled, never expires in the test */
+#define TIMEOUT_CANCEL  (600 * 1000 * 1000)
+
+static FIBRIL_MUTEX_INITIALIZE(cancel_lock);
+static FIBRIL_CONDVAR_INITIALIZE(cancel_cv);
+
+static atomic_t started;
+static atomic_t finished;
+static atomic_t failed;
+
+/** Timeout fibril
+ *
+ * Even fibrils sleep until their timeout expires. Odd fibrils wait for
+ * a condition variable with a long timeout, which is cancelled by the
+ * broadcast.
+ *
+ */
+static errno_t timeout_fibril(void *arg)
+{
+	uintptr_t idx = (uintptr_t) arg;
+	struct timeval start;
+	struct timeval end;
+	
+	if ((idx % 2) == 0) {
+		/* Spread the expiration times over the range */
+		suseconds_t delay = TIMEOUT_BASE + (idx * 7919) % TIMEOUT_SPREAD;
+		
+		getuptime(&start);
+		atomic_inc(&started);
+		async_usleep(delay);
+		getuptime(&end);
+		
+		/* The timeout must never fire early */
+		if (tv_sub_diff(&end, &start) < delay)
+			atomic_inc(&failed);
+	} else {
+		fibril_mutex_lock(&cancel_lock);
+		atomic_inc(&started);
+		
+		errno_t rc = fibril_condvar_wait_timeout(&cancel_cv, &cancel_lock,
+		    TIMEOUT_CANCEL);
+		fibril_mutex_unlock(&cancel_lock);
+		
+		if (rc != EOK)
+			atomic_inc(&failed);
+	}
+	
+	atomic_inc(&finished);
+	return EOK;
+}
+
+const char *test_timeout1(void)
+{
+	struct timeval start;
+	struct timeval queued;
+	struct timeval cancelled;
+	struct timeval end;
+	
+	atomic_set(&started, 0);
+	atomic_set(&finished, 0);
+	atomic_set(&failed, 0);
+	
+	TPRINTF("Starting %u fibrils...\n", TIMEOUT_FIBRILS);
+	getuptime(&start);
+	
+	uintptr_t count;
+	for (count = 0; count < TIMEOUT_FIBRILS; count++) {
+		fid_t fid = fibril_create_generic(timeout_fibril, (void *) count,
+		    PAGE_SIZE);
+		if (fid == 0)
+			break;
+		
+		fibril_add_ready(fid);
+	}
+	
+	if (count < TIMEOUT_FIBRILS)
+		TPRINTF("Only %" PRIuPTR " fibrils started\n", count);
+	
+	/* Let all fibrils queue their timeouts */
+	while (atomic_get(&started) < count)
+		async_usleep(1000);
+	
+	getuptime(&queued);
+	TPRINTF("%" PRIuPTR " timeouts queued in %ld us\n", count,
+	    (long) tv_sub_diff(&queued, &start));
+	
+	if (atomic_get(&finished) > 0)
+		TPRINTF("Some timeouts expired before all were queued\n");
+	
+	/* Cancel the timeouts of the odd fibrils */
+	fibril_mutex_lock(&cancel_lock);
+	fibril_condvar_broadcast(&cancel_cv);
+	fibril_mutex_unlock(&cancel_lock);
+	
+	while (atomic_get(&finished) < count / 2)
+		async_usleep(1000);
+	
+	getuptime(&cancelled);
+	TPRINTF("%" PRIuPTR " timeouts cancelled in %ld us\n", count / 2,
+	    (long) tv_sub_diff(&cancelled, &queued));
+	
+	/* Wait for the remaining timeouts to expire */
+	while (atomic_get(&finished) < count)
+		async_usleep(100000);
+	
+	getuptime(&end);
+	TPRINTF("All timeouts fired %ld us after they were queued\n",
+	    (long) tv_sub_diff(&end, &queued));
+	
+	if (count < TIMEOUT_FIBRILS)
+		return "Failed creating fibrils";
+	
+	if (atomic_get(&failed) > 0)
+		return "Timeout fired early or did not fire";
+	
+	return NULL;
+}
@@ -89,7 +89,8 @@ static errno_t kfb_claim(visualizer_t *vs)
 {
 	return physmem_map(kfb.paddr + kfb.offset,
 	    ALIGN_UP(kfb.size, PAGE_SIZE) >> PAGE_WIDTH,
-	    AS_AREA_READ | AS_AREA_WRITE, (void *) &kfb.addr);
+	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_LARGE_PAGES,
+	    (void *) &kfb.addr);
 }
 
 static errno_t kfb_yield(visualizer_t *vs)
@@ -54,16 +54,37 @@
 #include <str_error.h>
 #include <offset.h>
 #include <inttypes.h>
+#include <qsort.h>
 #include "block.h"
 
 #define MAX_WRITE_RETRIES 10
 
+/** Number of concurrently tracked sequential access streams. */
+#define RA_STREAMS	4
+/** Initial readahead window in blocks. */
+#define RA_MIN_WINDOW	2
+/** Maximal readahead window in blocks. */
+#define RA_MAX_WINDOW	8
+
+/** Maximal number of blocks written back in one pass. */
+#define WB_BATCH	64
+/** Number of released dirty blocks which triggers write-back. */
+#define WB_THRESHOLD	8
+/** Write-back period in microseconds. */
+#define WB_PERIOD	500000
+
 /** Lock protecting the device connection list */
 static FIBRIL_MUTEX_INITIALIZE(dcl_lock);
 /** Device connection list head. */
 static LIST_INITIALIZE(dcl);
 
 
+/** Sequential access stream. */
+typedef struct {
+	aoff64_t next;            /**< Next block expected in the stream. */
+	unsigned window;          /**< Current readahead window. */
+} ra_stream_t;
+
 typedef struct {
 	fibril_mutex_t lock;
 	size_t lblock_size;       /**< Logical block size. */
@@ -73,6 +94,13 @@ typedef struct {
 	hash_table_t block_hash;
 	list_t free_list;
 	enum cache_mode mode;
+	ra_stream_t ra_streams[RA_STREAMS];  /**< Sequential access streams. */
+	unsigned ra_victim;       /**< Next stream to be replaced. */
+	fibril_condvar_t wb_cv;   /**< Signals the write-back fibril. */
+	unsigned wb_pending;      /**< Dirty blocks released since last pass. */
+	bool wb_running;          /**< Write-back fibril is running. */
+	bool wb_stop;             /**< Write-back fibril should terminate. */
+	block_cache_stats_t stats;
 } cache_t;
 
 typedef struct {
@@ -90,6 +118,7 @@ typedef struct {
 static errno_t read_blocks(devcon_t *, aoff64_t, size_t, void *, size_t);
 static errno_t write_blocks(devcon_t *, aoff64_t, size_t, void *, size_t);
 static aoff64_t ba_ltop(devcon_t *, aoff64_t);
+static errno_t writeback_fibril(void *);
 
 static devcon_t *devcon_search(service_id_t service_id)
 {
@@ -288,6 +317,17 @@ errno_t block_cache_init(service_id_t service_id, size_t size, unsigned blocks,
 	cache->block_count = blocks;
 	cache->blocks_cached = 0;
 	cache->mode = mode;
+	cache->ra_victim = 0;
+	fibril_condvar_initialize(&cache->wb_cv);
+	cache->wb_pending = 0;
+	cache->wb_running = false;
+	cache->wb_stop = false;
+	memset(&cache->stats, 0, sizeof(cache->stats));
+	
+	for (unsigned i = 0; i < RA_STREAMS; i++) {
+		cache->ra_streams[i].next = 0;
+		cache->ra_streams[i].window = 0;
+	}
 
 	/* Allow 1:1 or small-to-large block size translation */
 	if (cache->lblock_size % devcon->pblock_size != 0) {
@@ -303,6 +343,19 @@ errno_t block_cache_init(service_id_t service_id, size_t size, unsigned blocks,
 	}
 
 	devcon->cache = cache;
+	
+	if (mode == CACHE_MODE_WB) {
+		/*
+		 * Dirty blocks are written back in the background
+		 * so that adjacent blocks can be coalesced.
+		 */
+		fid_t fid = fibril_create(writeback_fibril, devcon);
+		if (fid != 0) {
+			cache->wb_running = true;
+			fibril_add_ready(fid);
+		}
+	}
+	
 	return EOK;
 }
 
@@ -318,6 +371,14 @@ errno_t block_cache_fini(service_id_t service_id)
 		return EOK;
 	cache = devcon->cache;
 	
+	/* Terminate the write-back fibril. */
+	fibril_mutex_lock(&cache->lock);
+	cache->wb_stop = true;
+	fibril_condvar_broadcast(&cache->wb_cv);
+	while (cache->wb_running)
+		fibril_condvar_wait(&cache->wb_cv, &cache->lock);
+	fibril_mutex_unlock(&cache->lock);
+	
 	/*
 	 * We are expecting to find all blocks for this device handle on the
 	 * free list, i.e. the block reference count should be zero. Do not
@@ -348,6 +409,62 @@ errno_t block_cache_fini(service_id_t service_id)
 	return EOK;
 }
 
+/** Get block cache statistics.
+ *
+ * @param service_id	Service ID of the block device.
+ * @param stats		Place to store the statistics.
+ *
+ * @return		EOK on success or an error code.
+ */
+errno_t block_cache_get_stats(service_id_t service_id,
+    block_cache_stats_t *stats)
+{
+	devcon_t *devcon = devcon_search(service_id);
+	if (!devcon)
+		return ENOENT;
+	if (!devcon->cache)
+		return ENOENT;
+	
+	fibril_mutex_lock(&devcon->cache->lock);
+	*stats = devcon->cache->stats;
+	fibril_mutex_unlock(&devcon->cache->lock);
+	
+	return EOK;
+}
+
+/** Check whether any block of a range is present in the cache.
+ *
+ * Callers which transfer data with block_read_direct() or
+ * block_write_direct() use this to avoid bypassing a cached copy, which
+ * might be dirty or would become stale.
+ *
+ * @param service_id	Service ID of the block device.
+ * @param ba		Address of the first logical block.
+ * @param cnt		Number of logical blocks.
+ *
+ * @return		True if at least one of the blocks is cached.
+ */
+bool block_cache_contains(service_id_t service_id, aoff64_t ba, size_t cnt)
+{
+	devcon_t *devcon = devcon_search(service_id);
+	bool found = false;
+
+	assert(devcon);
+	assert(devcon->cache);
+
+	fibril_mutex_lock(&devcon->cache->lock);
+	for (size_t i = 0; i < cnt; i++) {
+		aoff64_t lba = ba + i;
+		if (hash_table_find(&devcon->cache->block_hash, &lba) != NULL) {
+			found = true;
+			break;
+		}
+	}
+	fibril_mutex_unlock(&devcon->cache->lock);
+
+	return found;
+}
+
 #define CACHE_LO_WATERMARK	10	
 #define CACHE_HI_WATERMARK	20	
 static bool cache_can_grow(cache_t *cache)
@@ -366,10 +483,213 @@ static void block_initialize(block_t *b)
 	b->write_failures = 0;
 	b->dirty = false;
 	b->toxic = false;
+	b->readahead = false;
 	fibril_rwlock_initialize(&b->contents_lock);
 	link_initialize(&b->free_link);
 }
 
+/** Note a cache hit in the sequential access streams.
+ *
+ * Must be called with the cache lock held.
+ *
+ * @param cache		Block cache.
+ * @param ba		Block address (logical).
+ */
+static void ra_hit(cache_t *cache, aoff64_t ba)
+{
+	for (unsigned i = 0; i < RA_STREAMS; i++) {
+		if (cache->ra_streams[i].next == ba) {
+			cache->ra_streams[i].next = ba + 1;
+			return;
+		}
+	}
+}
+
+/** Note a cache miss in the sequential access streams.
+ *
+ * A miss which continues a stream doubles its readahead window,
+ * a miss which does not continue any stream starts a new stream.
+ * Must be called with the cache lock held.
+ *
+ * @param cache		Block cache.
+ * @param ba		Block address (logical).
+ *
+ * @return		Number of blocks to read starting with @a ba.
+ */
+static unsigned ra_miss(cache_t *cache, aoff64_t ba)
+{
+	for (unsigned i = 0; i < RA_STREAMS; i++) {
+		ra_stream_t *stream = &cache->ra_streams[i];
+		
+		if (stream->next == ba) {
+			if (stream->window == 0)
+				stream->window = RA_MIN_WINDOW;
+			else
+				stream->window = min(stream->window * 2,
+				    RA_MAX_WINDOW);
+			
+			stream->next = ba + 1;
+			return stream->window;
+		}
+	}
+	
+	ra_stream_t *stream = &cache->ra_streams[cache->ra_victim];
+	cache->ra_victim = (cache->ra_victim + 1) % RA_STREAMS;
+	
+	stream->next = ba + 1;
+	stream->window = 0;
+	return 1;
+}
+
+/** Get a block structure for readahead.
+ *
+ * Allocate a new block as long as the cache is not too big, otherwise
+ * recycle the least recently used block provided it is clean. Must be
+ * called with the cache lock held.
+ *
+ * @param cache		Block cache.
+ *
+ * @return		Block structure or NULL if none is available.
+ */
+static block_t *ra_block_get(cache_t *cache)
+{
+	block_t *b;
+	
+	if (cache->blocks_cached < CACHE_HI_WATERMARK) {
+		b = malloc(sizeof(block_t));
+		if (!b)
+			return NULL;
+		b->data = malloc(cache->lblock_size);
+		if (!b->data) {
+			free(b);
+			return NULL;
+		}
+		cache->blocks_cached++;
+		return b;
+	}
+	
+	link_t *link = list_first(&cache->free_list);
+	if (!link)
+		return NULL;
+	
+	b = list_get_instance(link, block_t, free_link);
+	if (!fibril_mutex_trylock(&b->lock))
+		return NULL;
+	
+	if (b->dirty) {
+		fibril_mutex_unlock(&b->lock);
+		return NULL;
+	}
+	
+	fibril_mutex_unlock(&b->lock);
+	list_remove(&b->free_link);
+	hash_table_remove_item(&cache->block_hash, &b->hash_link);
+	return b;
+}
+
+/** Instantiate blocks following a block read from the device.
+ *
+ * The blocks are placed on the free list and remain locked until
+ * their contents is read by ra_read(). Must be called with the
+ * cache lock held.
+ *
+ * @param devcon	Device connection.
+ * @param ba		Block address (logical) of the block being read.
+ * @param window	Number of blocks to read starting with @a ba.
+ * @param ra		Array for storing the instantiated blocks.
+ *
+ * @return		Number of instantiated blocks.
+ */
+static size_t ra_prepare(devcon_t *devcon, aoff64_t ba, unsigned window,
+    block_t **ra)
+{
+	cache_t *cache = devcon->cache;
+	size_t count = 0;
+	
+	for (unsigned i = 1; i < window; i++) {
+		aoff64_t lba = ba + i;
+		
+		/* The whole block must lie within the device. */
+		if (ba_ltop(devcon, lba) + cache->blocks_cluster >
+		    devcon->pblocks)
+			break;
+		
+		if (hash_table_find(&cache->block_hash, &lba))
+			break;
+		
+		block_t *b = ra_block_get(cache);
+		if (!b)
+			break;
+		
+		block_initialize(b);
+		b->refcnt = 0;
+		b->readahead = true;
+		b->service_id = devcon->service_id;
+		b->size = cache->lblock_size;
+		b->lba = lba;
+		b->pba = ba_ltop(devcon, lba);
+		hash_table_insert(&cache->block_hash, &b->hash_link);
+		list_append(&b->free_link, &cache->free_list);
+		
+		fibril_mutex_lock(&b->lock);
+		ra[count++] = b;
+	}
+	
+	cache->stats.ra_blocks += count;
+	return count;
+}
+
+/** Read a block together with the blocks following it.
+ *
+ * All blocks are read using a single request if possible. The
+ * readahead blocks are unlocked when their contents is valid.
+ *
+ * @param devcon	Device connection.
+ * @param b		Block being read (locked).
+ * @param ra		Blocks instantiated by ra_prepare().
+ * @param count		Number of blocks in @a ra.
+ *
+ * @return		EOK on success or an error code.
+ */
+static errno_t ra_read(devcon_t *devcon, block_t *b, block_t **ra,
+    size_t count)
+{
+	cache_t *cache = devcon->cache;
+	
+	if (count > 0) {
+		size_t size = (count + 1) * cache->lblock_size;
+		void *buf = malloc(size);
+		
+		if (buf && read_blocks(devcon, b->pba,
+		    (count + 1) * cache->blocks_cluster, buf, size) == EOK) {
+			memcpy(b->data, buf, cache->lblock_size);
+			for (size_t i = 0; i < count; i++) {
+				memcpy(ra[i]->data,
+				    buf + (i + 1) * cache->lblock_size,
+				    cache->lblock_size);
+				fibril_mutex_unlock(&ra[i]->lock);
+			}
+			
+			free(buf);
+			return EOK;
+		}
+		
+		free(buf);
+		
+		/* Fall back to reading the blocks one by one. */
+		for (size_t i = 0; i < count; i++) {
+			if (read_blocks(devcon, ra[i]->pba,
+			    cache->blocks_cluster, ra[i]->data,
+			    cache->lblock_size) != EOK)
+				ra[i]->toxic = true;
+			fibril_mutex_unlock(&ra[i]->lock);
+		}
+	}
+	
+	return read_blocks(devcon, b->pba, cache->blocks_cluster, b->data,
+	    cache->lblock_size);
+}
+
 /** Instantiate a block in memory and get a reference to it.
  *
  * @param block			Pointer to where the function will store the
@@ -387,6 +707,8 @@ errno_t block_get(block_t **block, service_id_t service_id, aoff64_t ba, int fla
 	devcon_t *devcon;
 	cache_t *cache;
 	block_t *b;
+	block_t *ra[RA_MAX_WINDOW];
+	size_t ra_count;
 	link_t *link;
 	aoff64_t p_ba;
 	errno_t rc;
@@ -426,6 +748,12 @@ found:
 			list_remove(&b->free_link);
 		if (b->toxic)
 			rc = EIO;
+		cache->stats.hits++;
+		if (b->readahead) {
+			cache->stats.ra_hits++;
+			b->readahead = false;
+		}
+		ra_hit(cache, ba);
 		fibril_mutex_unlock(&b->lock);
 		fibril_mutex_unlock(&cache->lock);
 	} else {
@@ -538,6 +866,7 @@ recycle:
 		b->lba = ba;
 		b->pba = ba_ltop(devcon, b->lba);
 		hash_table_insert(&cache->block_hash, &b->hash_link);
+		cache->stats.misses++;
 
 		/*
 		 * Lock the block before releasing the cache lock. Thus we don't
@@ -545,6 +874,16 @@ recycle:
 		 * the block.
 		 */
 		fibril_mutex_lock(&b->lock);
+
+		/*
+		 * If the block continues a sequential access stream,
+		 * instantiate the following blocks as well so that they
+		 * can be read in one request.
+		 */
+		ra_count = 0;
+		if (!(flags & BLOCK_FLAGS_NOREAD))
+			ra_count = ra_prepare(devcon, ba, ra_miss(cache, ba), ra);
+
 		fibril_mutex_unlock(&cache->lock);
 
 		if (!(flags & BLOCK_FLAGS_NOREAD)) {
@@ -552,8 +891,7 @@ recycle:
 			 * The block contains old or no data. We need to read
 			 * the new contents from the device.
 			 */
-			rc = read_blocks(devcon, b->pba, cache->blocks_cluster,
-			    b->data, cache->lblock_size);
+			rc = ra_read(devcon, b, ra, ra_count);
 			if (rc != EOK) 
 				b->toxic = true;
 		} else
@@ -678,6 +1016,8 @@ retry:
 			goto retry;
 		}
 		list_append(&block->free_link, &cache->free_list);
+		if (block->dirty && ++cache->wb_pending >= WB_THRESHOLD)
+			fibril_condvar_signal(&cache->wb_cv);
 	}
 	fibril_mutex_unlock(&block->lock);
 	fibril_mutex_unlock(&cache->lock);
@@ -685,6 +1025,159 @@ retry:
 	return rc;
 }
 
+static int writeback_cmp(const void *a, const void *b)
+{
+	block_t *ba = *(block_t **) a;
+	block_t *bb = *(block_t **) b;
+	
+	if (ba->pba < bb->pba)
+		return -1;
+	if (ba->pba > bb->pba)
+		return 1;
+	return 0;
+}
+
+/** Write back dirty blocks on the free list.
+ *
+ * The blocks are sorted by address and adjacent blocks are written
+ * using a single request. Must be called with the cache lock held,
+ * the lock is dropped while writing.
+ *
+ * @param devcon	Device connection.
+ */
+static void writeback_pass(devcon_t *devcon)
+{
+	cache_t *cache = devcon->cache;
+	block_t *blocks[WB_BATCH];
+	size_t count = 0;
+	
+	/*
+	 * Take a reference to the dirty blocks so that they
+	 * cannot be recycled while being written.
+	 */
+	link_t *link = list_first(&cache->free_list);
+	while (link && (count < WB_BATCH)) {
+		block_t *b = list_get_instance(link, block_t, free_link);
+		link = list_next(link, &cache->free_list);
+		
+		if (!fibril_mutex_trylock(&b->lock))
+			continue;
+		
+		if (b->dirty && !b->toxic) {
+			b->refcnt++;
+			list_remove(&b->free_link);
+			blocks[count++] = b;
+		}
+		
+		fibril_mutex_unlock(&b->lock);
+	}
+	
+	if (count == 0)
+		return;
+	
+	fibril_mutex_unlock(&cache->lock);
+	
+	qsort(blocks, count, sizeof(block_t *), writeback_cmp);
+	
+	/*
+	 * Make a snapshot of the blocks. The blocks are marked clean
+	 * before writing, so that modifications made in the meantime
+	 * will not be lost.
+	 */
+	void *buf = malloc(count * cache->lblock_size);
+	uint64_t writes = 0;
+	uint64_t written = 0;
+	
+	for (size_t i = 0; buf && (i < count); i++) {
+		fibril_rwlock_read_lock(&blocks[i]->contents_lock);
+		fibril_mutex_lock(&blocks[i]->lock);
+		memcpy(buf + i * cache->lblock_size, blocks[i]->data,
+		    cache->lblock_size);
+		blocks[i]->dirty = false;
+		fibril_mutex_unlock(&blocks[i]->lock);
+		fibril_rwlock_read_unlock(&blocks[i]->contents_lock);
+	}
+	
+	size_t first = 0;
+	while (buf && (first < count)) {
+		size_t last = first;
+		while ((last + 1 < count) && (blocks[last + 1]->pba ==
+		    blocks[last]->pba + cache->blocks_cluster))
+			last++;
+		
+		size_t run = last - first + 1;
+		errno_t rc = write_blocks(devcon, blocks[first]->pba,
+		    run * cache->blocks_cluster,
+		    buf + first * cache->lblock_size,
+		    run * cache->lblock_size);
+		
+		for (size_t i = first; i <= last; i++) {
+			fibril_mutex_lock(&blocks[i]->lock);
+			if (rc == EOK) {
+				blocks[i]->write_failures = 0;
+			} else {
+				blocks[i]->write_failures++;
+				blocks[i]->dirty = true;
+			}
+			fibril_mutex_unlock(&blocks[i]->lock);
+		}
+		
+		writes++;
+		written += run;
+		first = last + 1;
+	}
+	
+	free(buf);
+	
+	/*
+	 * Release the references the same way as any other user of the
+	 * blocks, so that blocks which failed to be written are retried
+	 * and the cache shrinks when it is over the watermark.
+	 */
+	for (size_t i = 0; i < count; i++)
+		(void) block_put(blocks[i]);
+	
+	fibril_mutex_lock(&cache->lock);
+	
+	cache->stats.wb_writes += writes;
+	cache->stats.wb_blocks += written;
+}
+
+/** Write-back fibril.
+ *
+ * Periodically writes back dirty blocks which are not referenced.
+ *
+ * @param arg		Device connection.
+ *
+ * @return		EOK.
+ */
+static errno_t writeback_fibril(void *arg)
+{
+	devcon_t *devcon = (devcon_t *) arg;
+	cache_t *cache = devcon->cache;
+	
+	fibril_mutex_lock(&cache->lock);
+	
+	while (!cache->wb_stop) {
+		if (cache->wb_pending < WB_THRESHOLD) {
+			(void) fibril_condvar_wait_timeout(&cache->wb_cv,
+			    &cache->lock, WB_PERIOD);
+		}
+		
+		if (cache->wb_stop)
+			break;
+		
+		cache->wb_pending = 0;
+		writeback_pass(devcon);
+	}
+	
+	cache->wb_running = false;
+	fibril_condvar_broadcast(&cache->wb_cv);
+	fibril_mutex_unlock(&cache->lock);
+	
+	return EOK;
+}
+
 /** Read sequential data from a block device.
  *
  * @param service_id	Service ID of the block device.
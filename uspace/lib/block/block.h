@@ -70,6 +70,8 @@ typedef struct block {
 	bool dirty;
 	/** If true, the blcok does not contain valid data. */
 	bool toxic;
+	/** If true, the block was read ahead and has not been used yet. */
+	bool readahead;
 	/** Readers / Writer lock protecting the contents of the block. */
 	fibril_rwlock_t contents_lock;
 	/** Service ID of service providing the block device. */
@@ -98,6 +100,22 @@ enum cache_mode {
 	CACHE_MODE_WB
 };
 
+/** Block cache statistics */
+typedef struct {
+	/** Number of block_get() calls satisfied from the cache. */
+	uint64_t hits;
+	/** Number of block_get() calls which had to instantiate the block. */
+	uint64_t misses;
+	/** Number of blocks read ahead. */
+	uint64_t ra_blocks;
+	/** Number of blocks read ahead which were used later. */
+	uint64_t ra_hits;
+	/** Number of write requests issued by the write-back fibril. */
+	uint64_t wb_writes;
+	/** Number of blocks written by the write-back fibril. */
+	uint64_t wb_blocks;
+} block_cache_stats_t;
+
 extern errno_t block_init(service_id_t, size_t);
 extern void block_fini(service_id_t);
 
@@ -106,6 +124,8 @@ extern void *block_bb_get(service_id_t);
 
 extern errno_t block_cache_init(service_id_t, size_t, unsigned, enum cache_mode);
 extern errno_t block_cache_fini(service_id_t);
+extern errno_t block_cache_get_stats(service_id_t, block_cache_stats_t *);
+extern bool block_cache_contains(service_id_t, aoff64_t, size_t);
 
 extern errno_t block_get(block_t **, service_id_t, aoff64_t, int);
 extern errno_t block_put(block_t *);
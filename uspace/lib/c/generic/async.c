@@ -107,6 +107,7 @@
 #include <adt/hash_table.h>
 #include <adt/hash.h>
 #include <adt/list.h>
+#include <adt/odict.h>
 #include <assert.h>
 #include <errno.h>
 #include <sys/time.h>
@@ -305,7 +306,7 @@ static void to_event_initialize(to_event_t *to)
 	
 	to->inlist = false;
 	to->occurred = false;
-	link_initialize(&to->link);
+	odlink_initialize(&to->link);
 	to->expires = tv;
 }
 
@@ -391,6 +392,9 @@ static async_port_handler_t fallback_port_handler =
     default_fallback_port_handler;
 static void *fallback_port_data = NULL;
 
+/** Stack size of the fibrils handling new connections */
+static size_t connection_stack_size = FIBRIL_DFLT_STK_SIZE;
+
 static hash_table_t interface_hash_table;
 
 static size_t interface_key_hash(void *key)
@@ -552,10 +556,37 @@ void async_set_fallback_port_handler(async_port_handler_t handler, void *data)
 	fallback_port_data = data;
 }
 
+/** Set the stack size of the fibrils handling new connections.
+ *
+ * Servers with short-lived connections and shallow call chains can use
+ * FIBRIL_SMALL_STK_SIZE. The small stacks are recycled in a larger pool.
+ *
+ * @param size Stack size in bytes or FIBRIL_DFLT_STK_SIZE.
+ *
+ */
+void async_set_connection_stack_size(size_t size)
+{
+	connection_stack_size = size;
+}
+
+/** Futex protecting client_hash_table */
+static futex_t client_futex = FUTEX_INITIALIZER;
+
+/**
+ * Futex protecting conn_hash_table. Must be acquired before async_futex.
+ * A connection cannot be freed while it is held.
+ */
+static futex_t conn_futex = FUTEX_INITIALIZER;
+
+/** Futex protecting notification_hash_table and notification_avail */
+static futex_t notification_futex = FUTEX_INITIALIZER;
+
 static hash_table_t client_hash_table;
 static hash_table_t conn_hash_table;
 static hash_table_t notification_hash_table;
-static LIST_INITIALIZE(timeout_list);
+
+/** Pending timeouts ordered by their expiration time */
+static odict_t timeout_queue;
 
 static sysarg_t notification_avail = 0;
 
@@ -645,7 +676,7 @@ static client_t *async_client_get(task_id_t client_id, bool create)
 {
 	client_t *client = NULL;
 	
-	futex_down(&async_futex);
+	futex_down(&client_futex);
 	ht_link_t *link = hash_table_find(&client_hash_table, &client_id);
 	if (link) {
 		client = hash_table_get_inst(link, client_t, link);
@@ -661,7 +692,7 @@ static client_t *async_client_get(task_id_t client_id, bool create)
 		}
 	}
 	
-	futex_up(&async_futex);
+	futex_up(&client_futex);
 	return client;
 }
 
@@ -669,7 +700,7 @@ static void async_client_put(client_t *client)
 {
 	bool destroy;
 	
-	futex_down(&async_futex);
+	futex_down(&client_futex);
 	
 	if (atomic_predec(&client->refcnt) == 0) {
 		hash_table_remove(&client_hash_table, &client->in_task_id);
@@ -677,7 +708,7 @@ static void async_client_put(client_t *client)
 	} else
 		destroy = false;
 	
-	futex_up(&async_futex);
+	futex_up(&client_futex);
 	
 	if (destroy) {
 		if (client->data)
@@ -732,14 +763,15 @@ static errno_t connection_fibril(void *arg)
 	async_client_put(client);
 	
 	/*
-	 * Remove myself from the connection hash table.
+	 * Remove myself from the connection hash table. No new messages
+	 * can be routed to this connection afterwards.
 	 */
-	futex_down(&async_futex);
+	futex_down(&conn_futex);
 	hash_table_remove(&conn_hash_table, &(conn_key_t){
 		.task_id = fibril_connection->in_task_id,
 		.phone_hash = fibril_connection->in_phone_hash
 	});
-	futex_up(&async_futex);
+	futex_up(&conn_futex);
 	
 	/*
 	 * Answer all remaining messages with EHANGUP.
@@ -809,7 +841,8 @@ static fid_t async_new_connection(task_id_t in_task_id, sysarg_t in_phone_hash,
 	
 	/* We will activate the fibril ASAP */
 	conn->wdata.active = true;
-	conn->wdata.fid = fibril_create(connection_fibril, conn);
+	conn->wdata.fid = fibril_create_generic(connection_fibril, conn,
+	    connection_stack_size);
 	
 	if (conn->wdata.fid == 0) {
 		free(conn);
@@ -822,9 +855,9 @@ static fid_t async_new_connection(task_id_t in_task_id, sysarg_t in_phone_hash,
 	
 	/* Add connection to the connection hash table */
 	
-	futex_down(&async_futex);
+	futex_down(&conn_futex);
 	hash_table_insert(&conn_hash_table, &conn->link);
-	futex_up(&async_futex);
+	futex_up(&conn_futex);
 	
 	fibril_add_ready(conn->wdata.fid);
 	
@@ -928,7 +961,46 @@ static hash_table_ops_t notification_hash_table_ops = {
 	.remove_callback = NULL
 };
 
+/** Get the key of a timeout queue entry.
+ *
+ * @param link Timeout queue link.
+ *
+ * @return Pointer to the expiration time.
+ *
+ */
+static void *timeout_queue_getkey(odlink_t *link)
+{
+	awaiter_t *wd = odict_get_instance(link, awaiter_t, to_event.link);
+	return &wd->to_event.expires;
+}
+
+/** Compare the expiration times of two timeout queue entries.
+ *
+ * @param a Pointer to the first expiration time.
+ * @param b Pointer to the second expiration time.
+ *
+ * @return <0, =0, >0 if a is earlier, the same or later than b.
+ *
+ */
+static int timeout_queue_cmp(void *a, void *b)
+{
+	struct timeval *tva = (struct timeval *) a;
+	struct timeval *tvb = (struct timeval *) b;
+	
+	if (tv_gt(tva, tvb))
+		return 1;
+	
+	if (tv_gt(tvb, tva))
+		return -1;
+	
+	return 0;
+}
+
 /** Sort in current fibril's timeout request.
+ *
+ * The timeout queue is an ordered dictionary, so both inserting and
+ * removing a timeout take logarithmic time in the number of pending
+ * timeouts. Must be called with async_futex held.
  *
  * @param wd Wait data of the current fibril.
  *
@@ -940,18 +1012,23 @@ void async_insert_timeout(awaiter_t *wd)
 	wd->to_event.occurred = false;
 	wd->to_event.inlist = true;
 	
-	link_t *tmp = timeout_list.head.next;
-	while (tmp != &timeout_list.head) {
-		awaiter_t *cur
-		    = list_get_instance(tmp, awaiter_t, to_event.link);
-		
-		if (tv_gteq(&cur->to_event.expires, &wd->to_event.expires))
-			break;
-		
-		tmp = tmp->next;
-	}
+	odict_insert(&wd->to_event.link, &timeout_queue, NULL);
+}
+
+/** Remove a timeout request which has not expired.
+ *
+ * Must be called with async_futex held.
+ *
+ * @param wd Wait data with a pending timeout.
+ *
+ */
+void async_remove_timeout(awaiter_t *wd)
+{
+	assert(wd);
+	assert(wd->to_event.inlist);
 	
-	list_insert_before(&wd->to_event.link, tmp);
+	wd->to_event.inlist = false;
+	odict_remove(&wd->to_event.link);
 }
 
 /** Try to route a call to an appropriate connection fibril.
@@ -960,6 +1037,10 @@ void async_insert_timeout(awaiter_t *wd)
  * its message queue. If the fibril was not active, it is activated and all
  * timeouts are unregistered.
  *
+ * The connection is looked up under conn_futex only. The async_futex is
+ * taken just to queue the message and wake up the fibril, so calls which
+ * do not belong to any connection never touch it.
+ *
  * @param chandle  Handle of the incoming call.
  * @param call     Data of the incoming call.
  *
@@ -971,14 +1052,14 @@ static bool route_call(cap_handle_t chandle, ipc_call_t *call)
 {
 	assert(call);
 	
-	futex_down(&async_futex);
+	futex_down(&conn_futex);
 	
 	ht_link_t *link = hash_table_find(&conn_hash_table, &(conn_key_t){
 		.task_id = call->in_task_id,
 		.phone_hash = call->in_phone_hash
 	});
 	if (!link) {
-		futex_up(&async_futex);
+		futex_up(&conn_futex);
 		return false;
 	}
 	
@@ -986,12 +1067,15 @@ static bool route_call(cap_handle_t chandle, ipc_call_t *call)
 	
 	msg_t *msg = malloc(sizeof(*msg));
 	if (!msg) {
-		futex_up(&async_futex);
+		futex_up(&conn_futex);
 		return false;
 	}
 	
 	msg->chandle = chandle;
 	msg->call = *call;
+	
+	futex_down(&async_futex);
+	
 	list_append(&msg->link, &conn->msg_queue);
 	
 	if (IPC_GET_IMETHOD(*call) == IPC_M_PHONE_HUNGUP)
@@ -1000,17 +1084,16 @@ static bool route_call(cap_handle_t chandle, ipc_call_t *call)
 	/* If the connection fibril is waiting for an event, activate it */
 	if (!conn->wdata.active) {
 		
-		/* If in timeout list, remove it */
-		if (conn->wdata.to_event.inlist) {
-			conn->wdata.to_event.inlist = false;
-			list_remove(&conn->wdata.to_event.link);
-		}
+		/* If in timeout queue, remove it */
+		if (conn->wdata.to_event.inlist)
+			async_remove_timeout(&conn->wdata);
 		
 		conn->wdata.active = true;
 		fibril_add_ready(conn->wdata.fid);
 	}
 	
 	futex_up(&async_futex);
+	futex_up(&conn_futex);
 	return true;
 }
 
@@ -1026,7 +1109,7 @@ static void process_notification(ipc_call_t *call)
 
 	assert(call);
 	
-	futex_down(&async_futex);
+	futex_down(&notification_futex);
 	
 	ht_link_t *link = hash_table_find(&notification_hash_table,
 	    &IPC_GET_IMETHOD(*call));
@@ -1037,7 +1120,7 @@ static void process_notification(ipc_call_t *call)
 		data = notification->data;
 	}
 	
-	futex_up(&async_futex);
+	futex_up(&notification_futex);
 	
 	if (handler)
 		handler(call, data);
@@ -1063,7 +1146,7 @@ errno_t async_irq_subscribe(int inr, async_notification_handler_t handler,
 	if (!notification)
 		return ENOMEM;
 	
-	futex_down(&async_futex);
+	futex_down(&notification_futex);
 	
 	sysarg_t imethod = notification_avail;
 	notification_avail++;
@@ -1074,7 +1157,7 @@ errno_t async_irq_subscribe(int inr, async_notification_handler_t handler,
 	
 	hash_table_insert(&notification_hash_table, &notification->link);
 	
-	futex_up(&async_futex);
+	futex_up(&notification_futex);
 	
 	cap_handle_t cap;
 	errno_t rc = ipc_irq_subscribe(inr, imethod, ucode, &cap);
@@ -1116,7 +1199,7 @@ errno_t async_event_subscribe(event_type_t evno,
 	if (!notification)
 		return ENOMEM;
 	
-	futex_down(&async_futex);
+	futex_down(&notification_futex);
 	
 	sysarg_t imethod = notification_avail;
 	notification_avail++;
@@ -1127,7 +1210,7 @@ errno_t async_event_subscribe(event_type_t evno,
 	
 	hash_table_insert(&notification_hash_table, &notification->link);
 	
-	futex_up(&async_futex);
+	futex_up(&notification_futex);
 	
 	return ipc_event_subscribe(evno, imethod);
 }
@@ -1149,7 +1232,7 @@ errno_t async_event_task_subscribe(event_task_type_t evno,
 	if (!notification)
 		return ENOMEM;
 	
-	futex_down(&async_futex);
+	futex_down(&notification_futex);
 	
 	sysarg_t imethod = notification_avail;
 	notification_avail++;
@@ -1160,7 +1243,7 @@ errno_t async_event_task_subscribe(event_task_type_t evno,
 	
 	hash_table_insert(&notification_hash_table, &notification->link);
 	
-	futex_up(&async_futex);
+	futex_up(&notification_futex);
 	
 	return ipc_event_task_subscribe(evno, imethod);
 }
@@ -1404,16 +1487,15 @@ static void handle_expired_timeouts(void)
 	
 	futex_down(&async_futex);
 	
-	link_t *cur = list_first(&timeout_list);
+	odlink_t *cur = odict_first(&timeout_queue);
 	while (cur != NULL) {
 		awaiter_t *waiter =
-		    list_get_instance(cur, awaiter_t, to_event.link);
+		    odict_get_instance(cur, awaiter_t, to_event.link);
 		
 		if (tv_gt(&waiter->to_event.expires, &tv))
 			break;
 		
-		list_remove(&waiter->to_event.link);
-		waiter->to_event.inlist = false;
+		async_remove_timeout(waiter);
 		waiter->to_event.occurred = true;
 		
 		/*
@@ -1425,7 +1507,7 @@ static void handle_expired_timeouts(void)
 			fibril_add_ready(waiter->fid);
 		}
 		
-		cur = list_first(&timeout_list);
+		cur = odict_first(&timeout_queue);
 	}
 	
 	futex_up(&async_futex);
@@ -1438,6 +1520,19 @@ static void handle_expired_timeouts(void)
  */
 static errno_t async_manager_worker(void)
 {
+	/*
+	 * Manager fibrils run on a single page of stack, so the batch of
+	 * reaped calls is kept on the heap, one buffer per manager. Without
+	 * memory the calls are reaped one by one.
+	 */
+	ipc_call_t single;
+	size_t batch = IPC_BATCH_MAX;
+	ipc_call_t *calls = malloc(batch * sizeof(ipc_call_t));
+	if (calls == NULL) {
+		calls = &single;
+		batch = 1;
+	}
+	
 	while (true) {
 		if (fibril_switch(FIBRIL_FROM_MANAGER)) {
 			futex_up(&async_futex);
@@ -1452,9 +1547,10 @@ static errno_t async_manager_worker(void)
 		
 		suseconds_t timeout;
 		unsigned int flags = SYNCH_FLAGS_NONE;
-		if (!list_empty(&timeout_list)) {
-			awaiter_t *waiter = list_get_instance(
-			    list_first(&timeout_list), awaiter_t, to_event.link);
+		odlink_t *first = odict_first(&timeout_queue);
+		if (first != NULL) {
+			awaiter_t *waiter = odict_get_instance(first, awaiter_t,
+			    to_event.link);
 			
 			struct timeval tv;
 			getuptime(&tv);
@@ -1487,26 +1583,30 @@ static errno_t async_manager_worker(void)
 		
 		atomic_inc(&threads_in_ipc_wait);
 		
-		ipc_call_t call;
-		errno_t rc = ipc_wait_cycle(&call, timeout, flags);
+		/*
+		 * Reap all calls and answers which are already pending
+		 * in one kernel entry.
+		 */
+		size_t received;
+		errno_t rc = ipc_wait_cycle_batch(calls, batch, timeout, flags,
+		    &received);
 		
 		atomic_dec(&threads_in_ipc_wait);
 		
 		assert(rc == EOK);
 
-		if (call.cap_handle == CAP_NIL) {
-			if ((call.flags &
-			    (IPC_CALL_NOTIF | IPC_CALL_ANSWERED)) == 0) {
-				/* Neither a notification nor an answer. */
-				handle_expired_timeouts();
-				continue;
-			}
+		if (received == 0) {
+			/* Neither a call, a notification nor an answer. */
+			handle_expired_timeouts();
+			continue;
 		}
 
-		if (call.flags & IPC_CALL_ANSWERED)
-			continue;
+		for (size_t i = 0; i < received; i++) {
+			if (calls[i].flags & IPC_CALL_ANSWERED)
+				continue;
 
-		handle_call(call.cap_handle, &call);
+			handle_call(calls[i].cap_handle, &calls[i]);
+		}
 	}
 
 	return 0;
@@ -1565,6 +1665,9 @@ void __async_init(void)
 	    &notification_hash_table_ops))
 		abort();
 	
+	odict_initialize(&timeout_queue, timeout_queue_getkey,
+	    timeout_queue_cmp);
+	
 	session_ns = (async_sess_t *) malloc(sizeof(async_sess_t));
 	if (session_ns == NULL)
 		abort();
@@ -1611,9 +1714,9 @@ void reply_received(void *arg, errno_t retval, ipc_call_t *data)
 	
 	write_barrier();
 	
-	/* Remove message from timeout list */
+	/* Remove message from timeout queue */
 	if (msg->wdata.to_event.inlist)
-		list_remove(&msg->wdata.to_event.link);
+		async_remove_timeout(&msg->wdata);
 	
 	msg->done = true;
 	
@@ -1701,6 +1804,51 @@ aid_t async_send_slow(async_exch_t *exch, sysarg_t imethod, sysarg_t arg1,
 	return (aid_t) msg;
 }
 
+/** Send a batch of messages and return ids of the sent messages.
+ *
+ * The messages are passed to the kernel in batches, which saves a kernel
+ * entry for each message compared to async_send_slow(). Each of the
+ * returned ids has to be waited for by async_wait_for() or forgotten by
+ * async_forget().
+ *
+ * @param exch     Exchange for sending the messages.
+ * @param count    Number of messages.
+ * @param requests Service-defined interfaces, methods and payload arguments.
+ * @param answers  If non-NULL, array of storage where the reply data will
+ *                 be stored.
+ * @param aids     Array where the ids of the sent messages are stored.
+ *
+ * @return EOK on success.
+ * @return EINVAL if the exchange is not valid.
+ * @return ENOMEM if out of memory, in which case no message is sent.
+ *
+ */
+errno_t async_send_batch(async_exch_t *exch, size_t count,
+    const ipc_call_t *requests, ipc_call_t *answers, aid_t *aids)
+{
+	if (exch == NULL)
+		return EINVAL;
+	
+	for (size_t i = 0; i < count; i++) {
+		amsg_t *msg = amsg_create();
+		if (msg == NULL) {
+			while (i > 0)
+				amsg_destroy((amsg_t *) aids[--i]);
+			
+			return ENOMEM;
+		}
+		
+		msg->dataptr = (answers != NULL) ? &answers[i] : NULL;
+		msg->wdata.active = true;
+		aids[i] = (aid_t) msg;
+	}
+	
+	ipc_call_async_batch(exch->phone, count, requests, (void **) aids,
+	    reply_received);
+	
+	return EOK;
+}
+
 /** Wait for a message sent by the async framework.
  *
  * @param amsgid Hash of the message to wait for.
@@ -45,6 +45,8 @@
 #include <libarch/barrier.h>
 #include <libarch/faddr.h>
 #include <futex.h>
+#include <atomic.h>
+#include <macros.h>
 #include <assert.h>
 #include <async.h>
 
@@ -52,15 +54,358 @@
 #include <rcu.h>
 #endif
 
+/** Run queue of a thread.
+ *
+ * Each thread runs the fibrils from its own run queue. A thread with an empty
+ * ready list steals fibrils from the run queues of the other threads. Manager
+ * fibrils are never stolen, each thread has its own IPC manager. Run queues
+ * are never freed, the run queue of a finished thread is reused by the next
+ * new thread.
+ *
+ */
+typedef struct fibril_rq {
+	/** Link to rq_list */
+	link_t link;
+	
+	/** This futex serializes access to ready_list and manager_list. */
+	futex_t futex;
+	
+	/** Fibrils ready to run */
+	list_t ready_list;
+	
+	/** Idle manager fibrils of the thread */
+	list_t manager_list;
+	
+	/** True if the run queue is used by a thread */
+	bool used;
+} fibril_rq_t;
+
 /**
- * This futex serializes access to ready_list,
- * manager_list and fibril_list.
+ * This futex serializes access to fibril_list and rq_list.
  */
 static futex_t fibril_futex = FUTEX_INITIALIZER;
 
-static LIST_INITIALIZE(ready_list);
-static LIST_INITIALIZE(manager_list);
 static LIST_INITIALIZE(fibril_list);
+static LIST_INITIALIZE(rq_list);
+
+/** Number of ready fibrils in all run queues */
+static atomic_t ready_count = { 0 };
+
+/** Largest number of stacks kept in one pool */
+#define FIBRIL_STACK_POOL_MAX  256
+
+/** Pool of recycled fibril stacks of one size.
+ *
+ * Mapping a new stack and unmapping it again costs two syscalls, page faults
+ * on the first touch and a TLB shootdown. Servers creating a fibril for every
+ * connection would pay this for every short connection.
+ *
+ */
+typedef struct {
+	/** This futex serializes access to the pool. */
+	futex_t futex;
+	
+	/** Maximum number of stacks kept in the pool */
+	size_t limit;
+	
+	/** Number of stacks in the pool */
+	size_t count;
+	
+	/** Stacks in the pool */
+	void *stacks[FIBRIL_STACK_POOL_MAX];
+	
+	/** Counters reported by fibril_stack_pool_get_stats() */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t recycled;
+	uint64_t unmapped;
+} fibril_stack_pool_t;
+
+static fibril_stack_pool_t stack_pools[FIBRIL_STACK_CLASSES] = {
+	[FIBRIL_STACK_DEFAULT] = {
+		.futex = FUTEX_INITIALIZER,
+		.limit = 16
+	},
+	[FIBRIL_STACK_SMALL] = {
+		.futex = FUTEX_INITIALIZER,
+		.limit = 64
+	}
+};
+
+/** Find the pool for stacks of the given size.
+ *
+ * @param size Stack size in bytes.
+ *
+ * @return Stack pool or NULL if stacks of this size are not recycled.
+ *
+ */
+static fibril_stack_pool_t *fibril_stack_pool(size_t size)
+{
+	if (size == stack_size_get())
+		return &stack_pools[FIBRIL_STACK_DEFAULT];
+	
+	if (size == FIBRIL_SMALL_STK_SIZE)
+		return &stack_pools[FIBRIL_STACK_SMALL];
+	
+	return NULL;
+}
+
+/** Get a fibril stack from the pool or map a new one.
+ *
+ * @param size Stack size in bytes.
+ *
+ * @return Stack or NULL if out of memory.
+ *
+ */
+static void *fibril_stack_alloc(size_t size)
+{
+	fibril_stack_pool_t *pool = fibril_stack_pool(size);
+	if (pool != NULL) {
+		void *stack = NULL;
+		
+		futex_lock(&pool->futex);
+		if (pool->count > 0) {
+			stack = pool->stacks[--pool->count];
+			pool->hits++;
+		} else
+			pool->misses++;
+		futex_unlock(&pool->futex);
+		
+		if (stack != NULL)
+			return stack;
+	}
+	
+	void *stack = as_area_create(AS_AREA_ANY, size,
+	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE | AS_AREA_GUARD |
+	    AS_AREA_LATE_RESERVE, AS_AREA_UNPAGED);
+	if (stack == AS_MAP_FAILED)
+		return NULL;
+	
+	return stack;
+}
+
+/** Return a fibril stack to the pool or unmap it.
+ *
+ * @param stack Stack.
+ * @param size  Stack size in bytes.
+ *
+ */
+static void fibril_stack_free(void *stack, size_t size)
+{
+	fibril_stack_pool_t *pool = fibril_stack_pool(size);
+	if (pool != NULL) {
+		futex_lock(&pool->futex);
+		
+		if (pool->count < pool->limit) {
+			pool->stacks[pool->count++] = stack;
+			pool->recycled++;
+			futex_unlock(&pool->futex);
+			return;
+		}
+		
+		pool->unmapped++;
+		futex_unlock(&pool->futex);
+	}
+	
+	as_area_destroy(stack);
+}
+
+/** Set the maximum number of recycled stacks of a class.
+ *
+ * Stacks above the new limit are unmapped.
+ *
+ * @param cls   Stack class.
+ * @param limit Maximum number of stacks kept in the pool. Zero disables
+ *              recycling, values above FIBRIL_STACK_POOL_MAX are clamped.
+ *
+ */
+void fibril_stack_pool_set_limit(fibril_stack_class_t cls, size_t limit)
+{
+	assert(cls < FIBRIL_STACK_CLASSES);
+	fibril_stack_pool_t *pool = &stack_pools[cls];
+	
+	futex_lock(&pool->futex);
+	
+	pool->limit = min(limit, FIBRIL_STACK_POOL_MAX);
+	while (pool->count > pool->limit)
+		as_area_destroy(pool->stacks[--pool->count]);
+	
+	futex_unlock(&pool->futex);
+}
+
+/** Get the statistics of the pool of recycled stacks of a class.
+ *
+ * @param cls   Stack class.
+ * @param stats Place to store the statistics.
+ *
+ */
+void fibril_stack_pool_get_stats(fibril_stack_class_t cls,
+    fibril_stack_stats_t *stats)
+{
+	assert(cls < FIBRIL_STACK_CLASSES);
+	fibril_stack_pool_t *pool = &stack_pools[cls];
+	
+	futex_lock(&pool->futex);
+	
+	stats->limit = pool->limit;
+	stats->count = pool->count;
+	stats->hits = pool->hits;
+	stats->misses = pool->misses;
+	stats->recycled = pool->recycled;
+	stats->unmapped = pool->unmapped;
+	
+	futex_unlock(&pool->futex);
+}
+
+/** Append a fibril to a run queue.
+ *
+ * @param rq      Run queue.
+ * @param fibril  Fibril to be appended.
+ * @param manager Append to the manager list instead of the ready list.
+ *
+ */
+static void fibril_rq_put(fibril_rq_t *rq, fibril_t *fibril, bool manager)
+{
+	futex_lock(&rq->futex);
+	
+	if (manager) {
+		list_append(&fibril->link, &rq->manager_list);
+	} else {
+		list_append(&fibril->link, &rq->ready_list);
+		atomic_inc(&ready_count);
+	}
+	
+	futex_unlock(&rq->futex);
+}
+
+/** Remove the first fibril from a run queue.
+ *
+ * @param rq      Run queue.
+ * @param manager Remove a manager fibril instead of a ready fibril.
+ *
+ * @return Removed fibril or NULL if the list is empty.
+ *
+ */
+static fibril_t *fibril_rq_pop(fibril_rq_t *rq, bool manager)
+{
+	list_t *list = manager ? &rq->manager_list : &rq->ready_list;
+	fibril_t *fibril = NULL;
+	
+	futex_lock(&rq->futex);
+	
+	link_t *link = list_first(list);
+	if (link != NULL) {
+		list_remove(link);
+		if (!manager)
+			atomic_dec(&ready_count);
+		
+		fibril = list_get_instance(link, fibril_t, link);
+	}
+	
+	futex_unlock(&rq->futex);
+	return fibril;
+}
+
+/** Take a ready fibril from a run queue or steal it from another one.
+ *
+ * The run queues of the other threads are searched only if some of them
+ * contains a ready fibril, so a thread with a non-empty run queue does not
+ * touch any global lock.
+ *
+ * @param rq Run queue of the current thread.
+ *
+ * @return Removed fibril or NULL if there is no ready fibril.
+ *
+ */
+static fibril_t *fibril_rq_take(fibril_rq_t *rq)
+{
+	fibril_t *fibril = fibril_rq_pop(rq, false);
+	if (fibril != NULL)
+		return fibril;
+	
+	if (atomic_get(&ready_count) == 0)
+		return NULL;
+	
+	futex_lock(&fibril_futex);
+	
+	/* Start with the run queue after ours to spread the stealing */
+	unsigned long count = list_count(&rq_list);
+	link_t *link = list_next(&rq->link, &rq_list);
+	for (unsigned long i = 0; i < count; i++) {
+		if (link == NULL)
+			link = list_first(&rq_list);
+		
+		fibril_rq_t *victim = list_get_instance(link, fibril_rq_t,
+		    link);
+		if (victim != rq) {
+			fibril = fibril_rq_pop(victim, false);
+			if (fibril != NULL)
+				break;
+		}
+		
+		link = list_next(link, &rq_list);
+	}
+	
+	futex_unlock(&fibril_futex);
+	return fibril;
+}
+
+/** Give the current thread a run queue.
+ *
+ * Must be called by the first fibril of each thread.
+ *
+ * @param fibril First fibril of the thread.
+ *
+ * @return True on success, false if out of memory.
+ *
+ */
+bool fibril_rq_join(fibril_t *fibril)
+{
+	fibril_rq_t *rq = NULL;
+	
+	futex_down(&fibril_futex);
+	
+	list_foreach(rq_list, link, fibril_rq_t, cur) {
+		if (!cur->used) {
+			rq = cur;
+			break;
+		}
+	}
+	
+	if (rq == NULL) {
+		rq = malloc(sizeof(fibril_rq_t));
+		if (rq == NULL) {
+			futex_up(&fibril_futex);
+			return false;
+		}
+		
+		futex_initialize(&rq->futex, 1);
+		list_initialize(&rq->ready_list);
+		list_initialize(&rq->manager_list);
+		list_append(&rq->link, &rq_list);
+	}
+	
+	rq->used = true;
+	futex_up(&fibril_futex);
+	
+	fibril->rq = rq;
+	return true;
+}
+
+/** Give up the run queue of the current thread.
+ *
+ * The fibrils left in the run queue are eventually stolen by the
+ * other threads.
+ *
+ */
+void fibril_rq_leave(void)
+{
+	fibril_t *fibril = __tcb_get()->fibril_data;
+	
+	futex_lock(&fibril_futex);
+	fibril->rq->used = false;
+	futex_unlock(&fibril_futex);
+}
 
 /** Function that spans the whole life-cycle of a fibril.
  *
@@ -106,11 +451,14 @@ fibril_t *fibril_setup(void)
 	fibril->func = NULL;
 	fibril->arg = NULL;
 	fibril->stack = NULL;
+	fibril->stack_size = 0;
 	fibril->clean_after_me = NULL;
 	fibril->retval = 0;
 	fibril->flags = 0;
 	
 	fibril->waits_for = NULL;
+	fibril->running = false;
+	fibril->rq = NULL;
 
 	fibril->switches = 0;
 
@@ -126,18 +474,19 @@ fibril_t *fibril_setup(void)
 	return fibril;
 }
 
-void fibril_teardown(fibril_t *fibril, bool locked)
-{	
-	if (!locked)
-		futex_lock(&fibril_futex);
+void fibril_teardown(fibril_t *fibril)
+{
+	futex_lock(&fibril_futex);
 	list_remove(&fibril->all_link);
-	if (!locked)
-		futex_unlock(&fibril_futex);
+	futex_unlock(&fibril_futex);
 	tls_free(fibril->tcb);
 	free(fibril);
 }
 
 /** Switch from the current fibril.
+ *
+ * The next fibril is taken from the run queue of the current thread. If it
+ * is empty, a fibril is stolen from the run queue of another thread.
  *
  * If stype is FIBRIL_TO_MANAGER or FIBRIL_FROM_DEAD, the async_futex must
  * be held.
@@ -152,31 +501,34 @@ void fibril_teardown(fibril_t *fibril, bool locked)
  */
 int fibril_switch(fibril_switch_type_t stype)
 {
-	futex_lock(&fibril_futex);
-
+	fibril_t *srcf = __tcb_get()->fibril_data;
+	fibril_rq_t *rq = srcf->rq;
+	fibril_t *dstf;
+	
+	/* Choose a new fibril to run */
 	switch (stype) {
 	case FIBRIL_PREEMPT:
 	case FIBRIL_FROM_MANAGER:
-		if (list_empty(&ready_list)) {
-			futex_unlock(&fibril_futex);
+		dstf = fibril_rq_take(rq);
+		if (dstf == NULL)
 			return 0;
-		}
 		break;
-	case FIBRIL_TO_MANAGER:
-	case FIBRIL_FROM_DEAD:
+	default:
+		assert((stype == FIBRIL_TO_MANAGER) ||
+		    (stype == FIBRIL_FROM_DEAD));
+		
 		/* Make sure the async_futex is held. */
 		assert((atomic_signed_t) async_futex.val.count <= 0);
-
+		
 		/* If we are going to manager and none exists, create it */
-		while (list_empty(&manager_list)) {
-			futex_unlock(&fibril_futex);
+		while ((dstf = fibril_rq_pop(rq, true)) == NULL)
 			async_create_manager();
-			futex_lock(&fibril_futex);
-		}
+		
+		if (stype == FIBRIL_FROM_DEAD)
+			dstf->clean_after_me = srcf;
 		break;
 	}
 	
-	fibril_t *srcf = __tcb_get()->fibril_data;
 	if (stype != FIBRIL_FROM_DEAD) {
 		
 		/* Save current state */
@@ -196,57 +548,44 @@ int fibril_switch(fibril_switch_type_t stype)
 					 * case, its fibril will not have the
 					 * stack member filled.
 					 */
-					as_area_destroy(stack);
+					fibril_stack_free(stack,
+					    srcf->clean_after_me->stack_size);
 				}
-				fibril_teardown(srcf->clean_after_me, true);
+				fibril_teardown(srcf->clean_after_me);
 				srcf->clean_after_me = NULL;
 			}
 			
-			return 1;	/* futex_unlock already done here */
-		}
-		
-		/* Put the current fibril into the correct run list */
-		switch (stype) {
-		case FIBRIL_PREEMPT:
-			list_append(&srcf->link, &ready_list);
-			break;
-		case FIBRIL_FROM_MANAGER:
-			list_append(&srcf->link, &manager_list);
-			break;
-		default:
-			assert(stype == FIBRIL_TO_MANAGER);
-
-			srcf->switches++;
-
-			/*
-			 * Don't put the current fibril into any list, it should
-			 * already be somewhere, or it will be lost.
-			 */
-			break;
+			return 1;
 		}
 	}
 	
-	fibril_t *dstf;
-
-	/* Choose a new fibril to run */
+	/* Read without fibril_futex by fibril_mutex_spin(). */
+	__atomic_store_n(&srcf->running, false, __ATOMIC_RELAXED);
+	__atomic_store_n(&dstf->running, true, __ATOMIC_RELAXED);
+	dstf->rq = rq;
+	
+	/*
+	 * Put the current fibril into the correct run list. This must be the
+	 * last access to it, since another thread can resume it right away.
+	 */
 	switch (stype) {
+	case FIBRIL_PREEMPT:
+		fibril_rq_put(rq, srcf, false);
+		break;
+	case FIBRIL_FROM_MANAGER:
+		fibril_rq_put(rq, srcf, true);
+		break;
 	case FIBRIL_TO_MANAGER:
-	case FIBRIL_FROM_DEAD:
-		dstf = list_get_instance(list_first(&manager_list), fibril_t,
-		    link);
+		srcf->switches++;
 		
-		if (stype == FIBRIL_FROM_DEAD) 
-			dstf->clean_after_me = srcf;
+		/*
+		 * Don't put the current fibril into any list, it should
+		 * already be somewhere, or it will be lost.
+		 */
 		break;
 	default:
-		dstf = list_get_instance(list_first(&ready_list), fibril_t,
-		    link);
 		break;
 	}
-
-	list_remove(&dstf->link);
-	
-	futex_unlock(&fibril_futex);
 	
 #ifdef FUTEX_UPGRADABLE
 	if (stype == FIBRIL_FROM_DEAD) {
@@ -262,7 +601,8 @@ int fibril_switch(fibril_switch_type_t stype)
  *
  * @param func Implementing function of the new fibril.
  * @param arg Argument to pass to func.
- * @param stksz Stack size in bytes.
+ * @param stksz Stack size in bytes. Stacks of the default size and of
+ *              FIBRIL_SMALL_STK_SIZE bytes are recycled.
  *
  * @return 0 on failure or TLS of the new fibril.
  *
@@ -277,14 +617,14 @@ fid_t fibril_create_generic(errno_t (*func)(void *), void *arg, size_t stksz)
 	
 	size_t stack_size = (stksz == FIBRIL_DFLT_STK_SIZE) ?
 	    stack_size_get() : stksz;
-	fibril->stack = as_area_create(AS_AREA_ANY, stack_size,
-	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE | AS_AREA_GUARD |
-	    AS_AREA_LATE_RESERVE, AS_AREA_UNPAGED);
-	if (fibril->stack == (void *) -1) {
-		fibril_teardown(fibril, false);
+	fibril->stack = fibril_stack_alloc(stack_size);
+	if (fibril->stack == NULL) {
+		fibril_teardown(fibril);
 		return 0;
 	}
 	
+	fibril->stack_size = stack_size;
+	
 	fibril->func = func;
 	fibril->arg = arg;
 
@@ -307,11 +647,11 @@ void fibril_destroy(fid_t fid)
 {
 	fibril_t *fibril = (fibril_t *) fid;
 	
-	as_area_destroy(fibril->stack);
-	fibril_teardown(fibril, false);
+	fibril_stack_free(fibril->stack, fibril->stack_size);
+	fibril_teardown(fibril);
 }
 
-/** Add a fibril to the ready list.
+/** Add a fibril to the ready list of the current thread.
  *
  * @param fid Pointer to the fibril structure of the fibril to be
  *            added.
@@ -321,12 +661,11 @@ void fibril_add_ready(fid_t fid)
 {
 	fibril_t *fibril = (fibril_t *) fid;
 	
-	futex_lock(&fibril_futex);
-	list_append(&fibril->link, &ready_list);
-	futex_unlock(&fibril_futex);
+	fibril_rq_put(((fibril_t *) __tcb_get()->fibril_data)->rq, fibril,
+	    false);
 }
 
-/** Add a fibril to the manager list.
+/** Add a fibril to the manager list of the current thread.
  *
  * @param fid Pointer to the fibril structure of the fibril to be
  *            added.
@@ -336,18 +675,15 @@ void fibril_add_manager(fid_t fid)
 {
 	fibril_t *fibril = (fibril_t *) fid;
 	
-	futex_lock(&fibril_futex);
-	list_append(&fibril->link, &manager_list);
-	futex_unlock(&fibril_futex);
+	fibril_rq_put(((fibril_t *) __tcb_get()->fibril_data)->rq, fibril,
+	    true);
 }
 
-/** Remove one manager from the manager list. */
+/** Remove one manager from the manager list of the current thread. */
 void fibril_remove_manager(void)
 {
-	futex_lock(&fibril_futex);
-	if (!list_empty(&manager_list))
-		list_remove(list_first(&manager_list));
-	futex_unlock(&fibril_futex);
+	(void) fibril_rq_pop(((fibril_t *) __tcb_get()->fibril_data)->rq,
+	    true);
 }
 
 /** Return fibril id of the currently running fibril.
@@ -44,6 +44,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "private/async.h"
+#include "private/futex.h"
 
 static void optimize_execution_power(void)
 {
@@ -100,11 +101,59 @@ void fibril_mutex_initialize(fibril_mutex_t *fm)
 	list_initialize(&fm->waiters);
 }
 
+/** Wait for a contended mutex while its owner is running.
+ *
+ * An owner running on another thread is likely to unlock the mutex
+ * soon, so watch the mutex for a while with async_futex released
+ * instead of going to sleep right away. Nothing is done if the owner
+ * is not running or if other fibrils already wait for the mutex,
+ * since these would get it first anyway.
+ *
+ * Must be called with async_futex held and returns with it held.
+ *
+ * @param fm Fibril mutex.
+ *
+ */
+static void fibril_mutex_spin(fibril_mutex_t *fm)
+{
+	fibril_t *owner = fm->oi.owned_by;
+	unsigned int limit = futex_spin_limit();
+	
+	/*
+	 * The owner's running flag is updated by its thread under
+	 * fibril_futex, not async_futex.
+	 */
+	if ((limit == 0) || (owner == NULL) ||
+	    (!__atomic_load_n(&owner->running, __ATOMIC_RELAXED)) ||
+	    (!list_empty(&fm->waiters)))
+		return;
+	
+	futex_up(&async_futex);
+	
+	/*
+	 * The owner cannot be dereferenced without async_futex,
+	 * watch only the mutex itself.
+	 */
+	for (unsigned int i = 0; i < limit; i++) {
+		if ((__atomic_load_n(&fm->counter, __ATOMIC_RELAXED) > 0) ||
+		    (__atomic_load_n(&fm->oi.owned_by, __ATOMIC_RELAXED) !=
+		    owner))
+			break;
+		
+		futex_spin_hint();
+	}
+	
+	futex_down(&async_futex);
+}
+
 void fibril_mutex_lock(fibril_mutex_t *fm)
 {
 	fibril_t *f = (fibril_t *) fibril_get_id();
 
 	futex_down(&async_futex);
+	if (fm->counter <= 0)
+		fibril_mutex_spin(fm);
+	
 	if (fm->counter-- <= 0) {
 		awaiter_t wdata;
 
@@ -381,7 +430,7 @@ fibril_condvar_wait_timeout(fibril_condvar_t *fcv, fibril_mutex_t *fm,
 	/* async_futex not held after fibril_switch() */
 	futex_down(&async_futex);
 	if (wdata.to_event.inlist)
-		list_remove(&wdata.to_event.link);
+		async_remove_timeout(&wdata);
 	if (wdata.wu_event.inlist)
 		list_remove(&wdata.wu_event.link);
 	futex_up(&async_futex);
@@ -34,6 +34,21 @@
 
 #include <futex.h>
 #include <atomic.h>
+#include <stats.h>
+#include <stdlib.h>
+#include "private/futex.h"
+
+/** Default number of iterations to spin on a contended futex */
+#define FUTEX_SPIN_DEFAULT  1024
+
+/** Number of iterations to spin on a contended futex before sleeping
+ *
+ * Zero disables spinning. The value is set by __futex_init() depending
+ * on the number of active CPUs and can be changed by the application
+ * at any time. Values above FUTEX_SPIN_MAX are treated as FUTEX_SPIN_MAX.
+ *
+ */
+unsigned int futex_spin_budget = 0;
 
 /** Initialize futex counter.
  *
@@ -46,6 +61,66 @@ void futex_initialize(futex_t *futex, int val)
 	atomic_set(&futex->val, val);
 }
 
+/** Try to down the futex by spinning.
+ *
+ * Spinning stops as soon as the futex is acquired, after
+ * futex_spin_limit() iterations or when some threads are found
+ * sleeping on the futex. The sleepers mean that the holder has
+ * already been waited for long enough to give up the CPU (or is
+ * not running at all) and the futex is going to be handed over
+ * to the sleepers anyway.
+ *
+ * @param futex Futex.
+ *
+ * @return True if the futex was acquired.
+ * @return False if the caller should sleep on the futex.
+ *
+ */
+bool futex_spin(futex_t *futex)
+{
+	unsigned int limit = futex_spin_limit();
+	
+	for (unsigned int i = 0; i < limit; i++) {
+		atomic_count_t val = atomic_get(&futex->val);
+		
+		if ((atomic_signed_t) val < 0)
+			return false;
+		
+		if (((atomic_signed_t) val > 0) &&
+		    (cas(&futex->val, val, val - 1)))
+			return true;
+		
+		futex_spin_hint();
+	}
+	
+	return false;
+}
+
+/** Set up futex spinning
+ *
+ * Spinning makes sense only if the holder of a futex can run
+ * in parallel with the waiter.
+ *
+ */
+void __futex_init(void)
+{
+	size_t count;
+	stats_cpu_t *cpus = stats_get_cpus(&count);
+	if (cpus == NULL)
+		return;
+	
+	size_t active = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (cpus[i].active)
+			active++;
+	}
+	
+	free(cpus);
+	
+	if (active > 1)
+		futex_spin_budget = FUTEX_SPIN_DEFAULT;
+}
+
 
 #ifdef FUTEX_UPGRADABLE
 
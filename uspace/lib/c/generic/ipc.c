@@ -48,6 +48,7 @@
 #include <futex.h>
 #include <fibril.h>
 #include <macros.h>
+#include <mem.h>
 
 /**
  * Structures of this type are used for keeping track of sent asynchronous calls.
@@ -180,6 +181,53 @@ void ipc_call_async_slow(int phandle, sysarg_t imethod, sysarg_t arg1,
 	ipc_finish_async(rc, call);
 }
 
+/** Batch of asynchronous calls over one phone.
+ *
+ * The calls are submitted to the kernel in chunks of up to IPC_BATCH_MAX
+ * calls per syscall. Otherwise, each call behaves as if it was made by
+ * ipc_call_async_slow().
+ *
+ * @param phandle   Phone handle for the calls.
+ * @param count     Number of calls.
+ * @param requests  Requested interfaces, methods and payload arguments.
+ * @param privates  Arguments to be passed to the answer/error callback,
+ *                  one for each call.
+ * @param callback  Answer or error callback.
+ */
+void ipc_call_async_batch(cap_handle_t phandle, size_t count,
+    const ipc_call_t *requests, void **privates, ipc_async_callback_t callback)
+{
+	ipc_batch_call_t batch[IPC_BATCH_MAX];
+	async_call_t *calls[IPC_BATCH_MAX];
+	size_t pos = 0;
+	
+	while (pos < count) {
+		size_t prepared = 0;
+		
+		while ((pos < count) && (prepared < IPC_BATCH_MAX)) {
+			async_call_t *call = ipc_prepare_async(privates[pos],
+			    callback);
+			if (call != NULL) {
+				batch[prepared].phone = phandle;
+				batch[prepared].label = (sysarg_t) call;
+				memcpy(batch[prepared].args, requests[pos].args,
+				    sizeof(batch[prepared].args));
+				calls[prepared] = call;
+				prepared++;
+			}
+			
+			pos++;
+		}
+		
+		size_t submitted = 0;
+		errno_t rc = (errno_t) __SYSCALL3(SYS_IPC_CALL_ASYNC_BATCH,
+		    (sysarg_t) batch, prepared, (sysarg_t) &submitted);
+		
+		for (size_t i = submitted; i < prepared; i++)
+			ipc_finish_async(rc, calls[i]);
+	}
+}
+
 /** Answer received call (fast version).
  *
  * The fast answer makes use of passing retval and first four arguments in
@@ -270,6 +318,38 @@ errno_t ipc_wait_cycle(ipc_call_t *call, sysarg_t usec, unsigned int flags)
 	return rc;
 }
 
+/** Wait for a batch of IPC calls.
+ *
+ * Only the wait for the first call may block. Answers are passed to their
+ * callbacks, but they are still included in the batch.
+ *
+ * @param calls         Incoming calls storage.
+ * @param count         Number of elements in @a calls.
+ * @param usec          Timeout in microseconds
+ * @param flags         Flags passed to SYS_IPC_WAIT_BATCH (blocking,
+ *                      nonblocking).
+ * @param[out] received Number of received calls.
+ *
+ * @return  Error code.
+ */
+errno_t ipc_wait_cycle_batch(ipc_call_t *calls, size_t count, sysarg_t usec,
+    unsigned int flags, size_t *received)
+{
+	*received = 0;
+	
+	errno_t rc = (errno_t) __SYSCALL5(SYS_IPC_WAIT_BATCH, (sysarg_t) calls,
+	    count, usec, flags, (sysarg_t) received);
+	
+	/* Handle received answers */
+	for (size_t i = 0; i < *received; i++) {
+		if ((calls[i].cap_handle == CAP_NIL) &&
+		    (calls[i].flags & IPC_CALL_ANSWERED))
+			handle_answer(&calls[i]);
+	}
+	
+	return rc;
+}
+
 /** Interrupt one thread of this task from waiting for IPC.
  *
  */
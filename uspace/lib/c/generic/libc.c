@@ -52,6 +52,7 @@
 #include "private/libc.h"
 #include "private/async.h"
 #include "private/malloc.h"
+#include "private/futex.h"
 #include "private/io.h"
 
 #ifdef FUTEX_UPGRADABLE
@@ -87,12 +88,17 @@ void __main(void *pcb_ptr)
 		abort();
 	
 	__tcb_set(fibril->tcb);
+	fibril->running = true;
 	
+	if (!fibril_rq_join(fibril))
+		abort();
 	
 #ifdef FUTEX_UPGRADABLE
 	rcu_register_fibril();
 #endif
 	
+	__futex_init();
+	
 	__async_init();
 	
 	/* The basic run-time environment is setup */
@@ -131,7 +137,7 @@ void exit(int status)
 	if (env_setup) {
 		__stdio_done();
 		task_retval(status);
-		fibril_teardown(__tcb_get()->fibril_data, false);
+		fibril_teardown(__tcb_get()->fibril_data);
 	}
 	
 	__SYSCALL1(SYS_TASK_EXIT, false);
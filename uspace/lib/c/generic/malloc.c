@@ -46,6 +46,7 @@
 #include <futex.h>
 #include <stdlib.h>
 #include <adt/gcdlcm.h>
+#include <adt/list.h>
 #include "private/malloc.h"
 
 /** Magic used in heap headers. */
@@ -57,6 +58,15 @@
 /** Magic used in heap descriptor. */
 #define HEAP_AREA_MAGIC  UINT32_C(0xBEEFCAFE)
 
+/** Magic used in headers of small objects. */
+#define HEAP_OBJECT_MAGIC  UINT32_C(0xBEEF0303)
+
+/** Magic used in headers of large blocks. */
+#define HEAP_LARGE_MAGIC  UINT32_C(0xBEEF0404)
+
+/** Magic used in span descriptors. */
+#define HEAP_SPAN_MAGIC  UINT32_C(0xBEEFC0DE)
+
 /** Allocation alignment.
  *
  * This also covers the alignment of fields
@@ -75,6 +85,47 @@
  */
 #define SHRINK_GRANULARITY  (64 * PAGE_SIZE)
 
+/** Number of small object size classes. */
+#define HEAP_CLASS_COUNT  20
+
+/** Largest net size of a small object. */
+#define HEAP_SMALL_MAX  1024
+
+/** Smallest net size of a large block
+ *
+ * Large blocks are not allocated from the heap areas,
+ * but they get an address space area of their own.
+ * Blocks of this size would cause the heap to shrink
+ * on release anyway.
+ *
+ */
+#define HEAP_LARGE_MIN  SHRINK_GRANULARITY
+
+/** Size of a span of small objects (power of two). */
+#define HEAP_SPAN_SIZE  (16 * PAGE_SIZE)
+
+/** Number of empty spans kept for reuse. */
+#define HEAP_SPAN_EMPTY_MAX  4
+
+/** Number of object caches
+ *
+ * The object caches are selected by the address of the stack
+ * of the current fibril, so that allocations from different
+ * threads are likely to use different object caches.
+ *
+ */
+#define HEAP_CACHE_COUNT  16
+
+/** Binary order of the default stack size used to select object caches. */
+#define HEAP_CACHE_SHIFT  20
+
+/** Preferred number of bytes in one class of an object cache. */
+#define HEAP_CACHE_BYTES  4096
+
+/** Minimal and maximal number of objects in one class of an object cache. */
+#define HEAP_CACHE_MIN  4
+#define HEAP_CACHE_MAX  64
+
 /** Overhead of each heap block. */
 #define STRUCT_OVERHEAD \
 	(sizeof(heap_block_head_t) + sizeof(heap_block_foot_t))
@@ -126,6 +177,54 @@
 	((heap_block_foot_t *) \
 	    (((uintptr_t) (head)) + (head)->size - sizeof(heap_block_foot_t)))
 
+/** Get gross size of a small object of the given size class.
+ *
+ * Small objects have only a header, no footer.
+ *
+ */
+#define OBJECT_GROSS_SIZE(class) \
+	(heap_class_size[(class)] + sizeof(heap_block_head_t))
+
+/** Get span of a small object.
+ *
+ */
+#define OBJECT_SPAN(head) \
+	((heap_span_t *) ALIGN_DOWN((uintptr_t) (head), HEAP_SPAN_SIZE))
+
+/** Get next free small object.
+ *
+ * Free small objects are linked through their payload.
+ *
+ */
+#define OBJECT_NEXT(head) \
+	(*((heap_block_head_t **) \
+	    (((uintptr_t) (head)) + sizeof(heap_block_head_t))))
+
+/** Get first small object in a span.
+ *
+ */
+#define SPAN_FIRST_OBJECT(span) \
+	((uintptr_t) ALIGN_UP(((uintptr_t) (span)) + sizeof(heap_span_t), \
+	    BASE_ALIGN))
+
+/** Get end of a span.
+ *
+ */
+#define SPAN_END(span) \
+	(((uintptr_t) (span)) + HEAP_SPAN_SIZE)
+
+/** Offset of the header of a large block in its address space area.
+ *
+ */
+#define LARGE_HEAD_OFFSET \
+	((size_t) ALIGN_UP(sizeof(link_t), BASE_ALIGN))
+
+/** Get link of a large block.
+ *
+ */
+#define LARGE_LINK(head) \
+	((link_t *) (((uintptr_t) (head)) - LARGE_HEAD_OFFSET))
+
 /** Heap area.
  *
  * The memory managed by the heap allocator is divided into
@@ -156,6 +255,9 @@ typedef struct heap_area {
 } heap_area_t;
 
 /** Header of a heap block
+ *
+ * The same header also precedes small objects and large
+ * blocks, which are distinguished by the magic value.
  *
  */
 typedef struct {
@@ -183,6 +285,66 @@ typedef struct {
 	uint32_t magic;
 } heap_block_foot_t;
 
+/** Span of small objects
+ *
+ * Small objects of a single size class are allocated from
+ * spans, which are naturally aligned blocks allocated from
+ * the heap. This structure is at the very beginning of
+ * the span.
+ *
+ */
+typedef struct {
+	/** Link to the list of spans */
+	link_t link;
+	
+	/** Size class of the objects */
+	unsigned int class;
+	
+	/** Number of objects in use (including cached objects) */
+	size_t used;
+	
+	/** Free objects */
+	heap_block_head_t *free;
+	
+	/** Start of the space not yet divided into objects */
+	uintptr_t unused;
+	
+	/** A magic value */
+	uint32_t magic;
+} heap_span_t;
+
+/** Objects of a single size class cached in an object cache
+ *
+ */
+typedef struct {
+	/** Cached objects */
+	heap_block_head_t *objects;
+	
+	/** Number of cached objects */
+	size_t count;
+} heap_cache_class_t;
+
+/** Object cache
+ *
+ * Object caches hold free small objects which can be allocated
+ * without accessing the spans.
+ *
+ */
+typedef struct {
+	/** Futex for thread-safe object cache manipulation */
+	futex_t futex;
+	
+	/** Cached objects of each size class */
+	heap_cache_class_t classes[HEAP_CLASS_COUNT];
+} heap_cache_t;
+
+/** Net sizes of small objects in each size class */
+static const size_t heap_class_size[HEAP_CLASS_COUNT] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 896, 1024
+};
+
 /** First heap area */
 static heap_area_t *first_heap_area = NULL;
 
@@ -195,6 +357,27 @@ static heap_block_head_t *next_fit = NULL;
 /** Futex for thread-safe heap manipulation */
 static futex_t malloc_futex = FUTEX_INITIALIZER;
 
+/** Spans with free objects of each size class */
+static list_t span_partial[HEAP_CLASS_COUNT];
+
+/** Spans without free objects of each size class */
+static list_t span_full[HEAP_CLASS_COUNT];
+
+/** Empty spans kept for reuse */
+static list_t span_empty;
+
+/** Number of empty spans kept for reuse */
+static size_t span_empty_count = 0;
+
+/** Futex for thread-safe span manipulation */
+static futex_t span_futex = FUTEX_INITIALIZER;
+
+/** Object caches */
+static heap_cache_t heap_caches[HEAP_CACHE_COUNT];
+
+/** Large blocks (protected by the heap futex) */
+static list_t large_blocks;
+
 #define malloc_assert(expr) safe_assert(expr)
 
 #ifdef FUTEX_UPGRADABLE
@@ -208,10 +391,10 @@ void malloc_enable_multithreaded(void)
 }
 
 /** Serializes access to the heap from multiple threads. */
-static inline void heap_lock(void)
+static inline void malloc_lock(futex_t *futex)
 {
 	if (multithreaded) {
-		futex_down(&malloc_futex);
+		futex_down(futex);
 	} else {
 		/*
 		 * Malloc never switches fibrils while the heap is locked.
@@ -224,10 +407,10 @@ static inline void heap_lock(void)
 }
 
 /** Serializes access to the heap from multiple threads. */
-static inline void heap_unlock(void)
+static inline void malloc_unlock(futex_t *futex)
 {
 	if (multithreaded) {
-		futex_up(&malloc_futex);
+		futex_up(futex);
 	} else {
 		/*
 		 * Malloc never switches fibrils while the heap is locked.
@@ -248,18 +431,42 @@ void malloc_enable_multithreaded(void)
 }
 
 /** Serializes access to the heap from multiple threads. */
-static inline void heap_lock(void)
+static inline void malloc_lock(futex_t *futex)
 {
-	futex_down(&malloc_futex);
+	futex_down(futex);
 }
 
 /** Serializes access to the heap from multiple threads. */
-static inline void heap_unlock(void)
+static inline void malloc_unlock(futex_t *futex)
 {
-	futex_up(&malloc_futex);
+	futex_up(futex);
 }
 #endif
 
+/** Serializes access to the heap areas from multiple threads. */
+static inline void heap_lock(void)
+{
+	malloc_lock(&malloc_futex);
+}
+
+/** Serializes access to the heap areas from multiple threads. */
+static inline void heap_unlock(void)
+{
+	malloc_unlock(&malloc_futex);
+}
+
+/** Serializes access to the spans from multiple threads. */
+static inline void span_lock(void)
+{
+	malloc_lock(&span_futex);
+}
+
+/** Serializes access to the spans from multiple threads. */
+static inline void span_unlock(void)
+{
+	malloc_unlock(&span_futex);
+}
+
 
 /** Initialize a heap block
  *
@@ -536,6 +743,17 @@ void __malloc_init(void)
 {
 	if (!area_create(PAGE_SIZE))
 		abort();
+	
+	for (unsigned int class = 0; class < HEAP_CLASS_COUNT; class++) {
+		list_initialize(&span_partial[class]);
+		list_initialize(&span_full[class]);
+	}
+	
+	list_initialize(&span_empty);
+	list_initialize(&large_blocks);
+	
+	for (size_t i = 0; i < HEAP_CACHE_COUNT; i++)
+		futex_initialize(&heap_caches[i].futex, 1);
 }
 
 /** Split heap block and mark it as used.
@@ -806,6 +1024,501 @@ static void *malloc_internal(const size_t size, const size_t align)
 	return heap_grow_and_alloc(gross_size, falign);
 }
 
+/** Free a heap block
+ *
+ * Should be called only inside the critical section.
+ *
+ * @param addr The address of the block.
+ *
+ */
+static void heap_free(void * const addr)
+{
+	/* Calculate the position of the header. */
+	heap_block_head_t *head
+	    = (heap_block_head_t *) (addr - sizeof(heap_block_head_t));
+	
+	block_check(head);
+	malloc_assert(!head->free);
+	
+	heap_area_t *area = head->area;
+	
+	area_check(area);
+	malloc_assert((void *) head >= (void *) AREA_FIRST_BLOCK_HEAD(area));
+	malloc_assert((void *) head < area->end);
+	
+	/* Mark the block itself as free. */
+	head->free = true;
+	
+	/* Look at the next block. If it is free, merge the two. */
+	heap_block_head_t *next_head
+	    = (heap_block_head_t *) (((void *) head) + head->size);
+	
+	if ((void *) next_head < area->end) {
+		block_check(next_head);
+		if (next_head->free)
+			block_init(head, head->size + next_head->size, true, area);
+	}
+	
+	/* Look at the previous block. If it is free, merge the two. */
+	if ((void *) head > (void *) AREA_FIRST_BLOCK_HEAD(area)) {
+		heap_block_foot_t *prev_foot =
+		    (heap_block_foot_t *) (((void *) head) - sizeof(heap_block_foot_t));
+		
+		heap_block_head_t *prev_head =
+		    (heap_block_head_t *) (((void *) head) - prev_foot->size);
+		
+		block_check(prev_head);
+		
+		if (prev_head->free)
+			block_init(prev_head, prev_head->size + head->size, true,
+			    area);
+	}
+	
+	heap_shrink(area);
+}
+
+/** Get size class of a small object
+ *
+ * @param size Net size of the object.
+ *
+ * @return Smallest size class the object fits in.
+ *
+ */
+static unsigned int heap_class(size_t size)
+{
+	malloc_assert(size <= HEAP_SMALL_MAX);
+	
+	if (size <= 128)
+		return (size == 0) ? 0 : (size - 1) / 16;
+	
+	/* Four size classes for each power of two above 128 bytes */
+	size_t last = size - 1;
+	unsigned int order = fnzb(last);
+	
+	return 8 + (order - 7) * 4 + ((last >> (order - 2)) & 3);
+}
+
+/** Initialize a small object
+ *
+ * Should be called only inside the span critical section.
+ *
+ * @param head  Address of the object.
+ * @param class Size class of the object.
+ *
+ */
+static void object_init(heap_block_head_t *head, unsigned int class)
+{
+	head->size = OBJECT_GROSS_SIZE(class);
+	head->free = true;
+	head->area = NULL;
+	head->magic = HEAP_OBJECT_MAGIC;
+}
+
+/** Check a span descriptor
+ *
+ * @param span Span to check.
+ *
+ */
+static void span_check(heap_span_t *span)
+{
+	malloc_assert(span->magic == HEAP_SPAN_MAGIC);
+	malloc_assert(span->class < HEAP_CLASS_COUNT);
+	malloc_assert(span->unused <= SPAN_END(span));
+}
+
+/** Check a small object
+ *
+ * @param head Header of the object.
+ *
+ */
+static void object_check(heap_block_head_t *head)
+{
+	malloc_assert(head->magic == HEAP_OBJECT_MAGIC);
+	
+	heap_span_t *span = OBJECT_SPAN(head);
+	
+	span_check(span);
+	malloc_assert(head->size == OBJECT_GROSS_SIZE(span->class));
+	malloc_assert((uintptr_t) head >= SPAN_FIRST_OBJECT(span));
+	malloc_assert((uintptr_t) head < span->unused);
+}
+
+/** Check whether all objects of a span are in use
+ *
+ * Should be called only inside the span critical section.
+ *
+ * @param span Span to check.
+ *
+ */
+static bool span_is_full(heap_span_t *span)
+{
+	return ((span->free == NULL) &&
+	    (span->unused + OBJECT_GROSS_SIZE(span->class) > SPAN_END(span)));
+}
+
+/** Get a span with free objects
+ *
+ * If there is no such span, an empty span is reused or
+ * a new span is allocated from the heap.
+ * Should be called only inside the span critical section.
+ *
+ * @param class Size class of the objects.
+ *
+ * @return Span with free objects or NULL on not enough memory.
+ *
+ */
+static heap_span_t *span_get(unsigned int class)
+{
+	link_t *link = list_first(&span_partial[class]);
+	if (link != NULL)
+		return list_get_instance(link, heap_span_t, link);
+	
+	heap_span_t *span;
+	
+	link = list_first(&span_empty);
+	if (link != NULL) {
+		span = list_get_instance(link, heap_span_t, link);
+		list_remove(&span->link);
+		span_empty_count--;
+	} else {
+		heap_lock();
+		span = malloc_internal(HEAP_SPAN_SIZE, HEAP_SPAN_SIZE);
+		heap_unlock();
+		
+		if (span == NULL)
+			return NULL;
+		
+		link_initialize(&span->link);
+		span->magic = HEAP_SPAN_MAGIC;
+	}
+	
+	span->class = class;
+	span->used = 0;
+	span->free = NULL;
+	span->unused = SPAN_FIRST_OBJECT(span);
+	
+	list_append(&span->link, &span_partial[class]);
+	return span;
+}
+
+/** Take a free object from a span
+ *
+ * The object stays marked as free.
+ * Should be called only inside the span critical section.
+ *
+ * @param span Span with free objects.
+ *
+ * @return Header of the object.
+ *
+ */
+static heap_block_head_t *span_alloc(heap_span_t *span)
+{
+	span_check(span);
+	
+	heap_block_head_t *head;
+	
+	if (span->free != NULL) {
+		head = span->free;
+		object_check(head);
+		malloc_assert(head->free);
+		
+		span->free = OBJECT_NEXT(head);
+	} else {
+		head = (heap_block_head_t *) span->unused;
+		span->unused += OBJECT_GROSS_SIZE(span->class);
+		
+		object_init(head, span->class);
+	}
+	
+	span->used++;
+	
+	if (span_is_full(span)) {
+		list_remove(&span->link);
+		list_append(&span->link, &span_full[span->class]);
+	}
+	
+	return head;
+}
+
+/** Return a free object to its span
+ *
+ * An empty span is either kept for reuse
+ * or it is returned to the heap.
+ * Should be called only inside the span critical section.
+ *
+ * @param head Header of the free object.
+ *
+ */
+static void span_free(heap_block_head_t *head)
+{
+	object_check(head);
+	malloc_assert(head->free);
+	
+	heap_span_t *span = OBJECT_SPAN(head);
+	bool full = span_is_full(span);
+	
+	malloc_assert(span->used > 0);
+	
+	OBJECT_NEXT(head) = span->free;
+	span->free = head;
+	span->used--;
+	
+	if (span->used == 0) {
+		list_remove(&span->link);
+		
+		if (span_empty_count < HEAP_SPAN_EMPTY_MAX) {
+			list_append(&span->link, &span_empty);
+			span_empty_count++;
+		} else {
+			span->magic = 0;
+			
+			heap_lock();
+			heap_free(span);
+			heap_unlock();
+		}
+	} else if (full) {
+		list_remove(&span->link);
+		list_append(&span->link, &span_partial[span->class]);
+	}
+}
+
+/** Get object cache of the current fibril
+ *
+ * The fibril-local storage cannot be used, because the allocator
+ * is called before the thread-local storage of a new thread is set
+ * up. Each fibril runs on its own stack though.
+ *
+ */
+static inline heap_cache_t *cache_get(void)
+{
+	uintptr_t sp = (uintptr_t) __builtin_frame_address(0);
+	
+	return &heap_caches[(sp >> HEAP_CACHE_SHIFT) % HEAP_CACHE_COUNT];
+}
+
+/** Get maximal number of objects of a size class in an object cache
+ *
+ * @param class Size class.
+ *
+ */
+static inline size_t cache_limit(unsigned int class)
+{
+	size_t limit = HEAP_CACHE_BYTES / OBJECT_GROSS_SIZE(class);
+	
+	return min(max(limit, HEAP_CACHE_MIN), HEAP_CACHE_MAX);
+}
+
+/** Refill object cache with free objects from the spans
+ *
+ * Should be called only inside the object cache critical section.
+ *
+ * @param cc    Objects of the size class in the object cache.
+ * @param class Size class.
+ *
+ */
+static void cache_refill(heap_cache_class_t *cc, unsigned int class)
+{
+	size_t batch = cache_limit(class) / 2;
+	
+	span_lock();
+	
+	while (cc->count < batch) {
+		heap_span_t *span = span_get(class);
+		if (span == NULL)
+			break;
+		
+		heap_block_head_t *head = span_alloc(span);
+		
+		OBJECT_NEXT(head) = cc->objects;
+		cc->objects = head;
+		cc->count++;
+	}
+	
+	span_unlock();
+}
+
+/** Return free objects from object cache to the spans
+ *
+ * Should be called only inside the object cache critical section.
+ *
+ * @param cc    Objects of the size class in the object cache.
+ * @param count Number of objects to return.
+ *
+ */
+static void cache_flush(heap_cache_class_t *cc, size_t count)
+{
+	malloc_assert(count <= cc->count);
+	
+	span_lock();
+	
+	while (count > 0) {
+		heap_block_head_t *head = cc->objects;
+		
+		cc->objects = OBJECT_NEXT(head);
+		cc->count--;
+		count--;
+		
+		span_free(head);
+	}
+	
+	span_unlock();
+}
+
+/** Allocate a small object
+ *
+ * @param size Number of bytes to allocate.
+ *
+ * @return Allocated memory or NULL.
+ *
+ */
+static void *malloc_small(const size_t size)
+{
+	unsigned int class = heap_class(size);
+	heap_cache_t *cache = cache_get();
+	heap_cache_class_t *cc = &cache->classes[class];
+	
+	malloc_lock(&cache->futex);
+	
+	if (cc->count == 0)
+		cache_refill(cc, class);
+	
+	heap_block_head_t *head = cc->objects;
+	if (head != NULL) {
+		cc->objects = OBJECT_NEXT(head);
+		cc->count--;
+	}
+	
+	malloc_unlock(&cache->futex);
+	
+	if (head == NULL)
+		return NULL;
+	
+	object_check(head);
+	malloc_assert(head->free);
+	
+	head->free = false;
+	return ((void *) head) + sizeof(heap_block_head_t);
+}
+
+/** Free a small object
+ *
+ * @param head Header of the object.
+ *
+ */
+static void free_small(heap_block_head_t *head)
+{
+	object_check(head);
+	malloc_assert(!head->free);
+	
+	head->free = true;
+	
+	unsigned int class = OBJECT_SPAN(head)->class;
+	size_t limit = cache_limit(class);
+	heap_cache_t *cache = cache_get();
+	heap_cache_class_t *cc = &cache->classes[class];
+	
+	malloc_lock(&cache->futex);
+	
+	if (cc->count >= limit)
+		cache_flush(cc, limit / 2);
+	
+	OBJECT_NEXT(head) = cc->objects;
+	cc->objects = head;
+	cc->count++;
+	
+	malloc_unlock(&cache->futex);
+}
+
+/** Allocate a large block
+ *
+ * @param size Number of bytes to allocate.
+ *
+ * @return Allocated memory or NULL.
+ *
+ */
+static void *malloc_large(const size_t size)
+{
+	size_t gross_size = size + LARGE_HEAD_OFFSET + sizeof(heap_block_head_t);
+	
+	/* Check for integer overflow. */
+	if (gross_size < size)
+		return NULL;
+	
+	size_t asize = ALIGN_UP(gross_size, PAGE_SIZE);
+	if (asize < gross_size)
+		return NULL;
+	
+	void *astart = as_area_create(AS_AREA_ANY, asize,
+	    AS_AREA_WRITE | AS_AREA_READ | AS_AREA_CACHEABLE, AS_AREA_UNPAGED);
+	if (astart == AS_MAP_FAILED)
+		return NULL;
+	
+	heap_block_head_t *head =
+	    (heap_block_head_t *) (astart + LARGE_HEAD_OFFSET);
+	
+	head->size = asize - LARGE_HEAD_OFFSET;
+	head->free = false;
+	head->area = NULL;
+	head->magic = HEAP_LARGE_MAGIC;
+	
+	link_t *link = LARGE_LINK(head);
+	link_initialize(link);
+	
+	heap_lock();
+	list_append(link, &large_blocks);
+	heap_unlock();
+	
+	return ((void *) head) + sizeof(heap_block_head_t);
+}
+
+/** Check a large block
+ *
+ * @param head Header of the block.
+ *
+ */
+static void large_check(heap_block_head_t *head)
+{
+	malloc_assert(head->magic == HEAP_LARGE_MAGIC);
+	malloc_assert(head->area == NULL);
+	malloc_assert(((uintptr_t) LARGE_LINK(head) % PAGE_SIZE) == 0);
+	malloc_assert(((head->size + LARGE_HEAD_OFFSET) % PAGE_SIZE) == 0);
+}
+
+/** Free a large block
+ *
+ * @param head Header of the block.
+ *
+ */
+static void free_large(heap_block_head_t *head)
+{
+	large_check(head);
+	malloc_assert(!head->free);
+	
+	link_t *link = LARGE_LINK(head);
+	
+	heap_lock();
+	list_remove(link);
+	heap_unlock();
+	
+	as_area_destroy((void *) link);
+}
+
+/** Get net size of a small object or a large block
+ *
+ * @param head Header of the object or block.
+ *
+ */
+static size_t object_net_size(heap_block_head_t *head)
+{
+	if (head->magic == HEAP_OBJECT_MAGIC)
+		object_check(head);
+	else
+		large_check(head);
+	
+	malloc_assert(!head->free);
+	return head->size - sizeof(heap_block_head_t);
+}
+
 /** Allocate memory by number of elements
  *
  * @param nmemb Number of members to allocate.
@@ -835,6 +1548,12 @@ void *calloc(const size_t nmemb, const size_t size)
  */
 void *malloc(const size_t size)
 {
+	if (size <= HEAP_SMALL_MAX)
+		return malloc_small(size);
+	
+	if (size >= HEAP_LARGE_MIN)
+		return malloc_large(size);
+	
 	heap_lock();
 	void *block = malloc_internal(size, BASE_ALIGN);
 	heap_unlock();
@@ -857,6 +1576,13 @@ void *memalign(const size_t align, const size_t size)
 	
 	size_t palign =
 	    1 << (fnzb(max(sizeof(void *), align) - 1) + 1);
+	
+	/*
+	 * Small objects and large blocks provide only the base
+	 * alignment, stricter alignment is handled by the heap.
+	 */
+	if (palign <= BASE_ALIGN)
+		return malloc(size);
 
 	heap_lock();
 	void *block = malloc_internal(size, palign);
@@ -883,12 +1609,31 @@ void *realloc(void * const addr, const size_t size)
 	if (addr == NULL)
 		return malloc(size);
 	
-	heap_lock();
-	
 	/* Calculate the position of the header. */
 	heap_block_head_t *head =
 	    (heap_block_head_t *) (addr - sizeof(heap_block_head_t));
 	
+	if (head->magic != HEAP_BLOCK_HEAD_MAGIC) {
+		/*
+		 * Small objects and large blocks cannot be resized
+		 * in place, unless the new size still fits.
+		 */
+		size_t net_size = object_net_size(head);
+		
+		if ((size <= net_size) && (size > net_size / 2))
+			return addr;
+		
+		void *ptr = malloc(size);
+		if (ptr != NULL) {
+			memcpy(ptr, addr, min(net_size, size));
+			free(addr);
+		}
+		
+		return ptr;
+	}
+	
+	heap_lock();
+	
 	block_check(head);
 	malloc_assert(!head->free);
 	
@@ -992,63 +1737,33 @@ void free(void * const addr)
 	if (addr == NULL)
 		return;
 	
-	heap_lock();
-	
 	/* Calculate the position of the header. */
 	heap_block_head_t *head
 	    = (heap_block_head_t *) (addr - sizeof(heap_block_head_t));
 	
-	block_check(head);
-	malloc_assert(!head->free);
-	
-	heap_area_t *area = head->area;
-	
-	area_check(area);
-	malloc_assert((void *) head >= (void *) AREA_FIRST_BLOCK_HEAD(area));
-	malloc_assert((void *) head < area->end);
-	
-	/* Mark the block itself as free. */
-	head->free = true;
-	
-	/* Look at the next block. If it is free, merge the two. */
-	heap_block_head_t *next_head
-	    = (heap_block_head_t *) (((void *) head) + head->size);
-	
-	if ((void *) next_head < area->end) {
-		block_check(next_head);
-		if (next_head->free)
-			block_init(head, head->size + next_head->size, true, area);
-	}
-	
-	/* Look at the previous block. If it is free, merge the two. */
-	if ((void *) head > (void *) AREA_FIRST_BLOCK_HEAD(area)) {
-		heap_block_foot_t *prev_foot =
-		    (heap_block_foot_t *) (((void *) head) - sizeof(heap_block_foot_t));
-		
-		heap_block_head_t *prev_head =
-		    (heap_block_head_t *) (((void *) head) - prev_foot->size);
-		
-		block_check(prev_head);
-		
-		if (prev_head->free)
-			block_init(prev_head, prev_head->size + head->size, true,
-			    area);
+	switch (head->magic) {
+	case HEAP_OBJECT_MAGIC:
+		free_small(head);
+		break;
+	case HEAP_LARGE_MAGIC:
+		free_large(head);
+		break;
+	default:
+		heap_lock();
+		heap_free(addr);
+		heap_unlock();
 	}
-	
-	heap_shrink(area);
-	
-	heap_unlock();
 }
 
-void *heap_check(void)
+/** Check heap areas and blocks
+ *
+ * Should be called only inside the critical section.
+ *
+ * @return Address of the first inconsistent structure or NULL.
+ *
+ */
+static void *heap_check_areas(void)
 {
-	heap_lock();
-	
-	if (first_heap_area == NULL) {
-		heap_unlock();
-		return (void *) -1;
-	}
-	
 	/* Walk all heap areas */
 	for (heap_area_t *area = first_heap_area; area != NULL;
 	    area = area->next) {
@@ -1058,10 +1773,8 @@ void *heap_check(void)
 		    ((void *) area != area->start) ||
 		    (area->start >= area->end) ||
 		    (((uintptr_t) area->start % PAGE_SIZE) != 0) ||
-		    (((uintptr_t) area->end % PAGE_SIZE) != 0)) {
-			heap_unlock();
+		    (((uintptr_t) area->end % PAGE_SIZE) != 0))
 			return (void *) area;
-		}
 		
 		/* Walk all heap blocks */
 		for (heap_block_head_t *head = (heap_block_head_t *)
@@ -1069,25 +1782,122 @@ void *heap_check(void)
 		    head = (heap_block_head_t *) (((void *) head) + head->size)) {
 			
 			/* Check heap block consistency */
-			if (head->magic != HEAP_BLOCK_HEAD_MAGIC) {
-				heap_unlock();
+			if (head->magic != HEAP_BLOCK_HEAD_MAGIC)
 				return (void *) head;
-			}
 			
 			heap_block_foot_t *foot = BLOCK_FOOT(head);
 			
 			if ((foot->magic != HEAP_BLOCK_FOOT_MAGIC) ||
-			    (head->size != foot->size)) {
-				heap_unlock();
+			    (head->size != foot->size))
 				return (void *) foot;
-			}
 		}
 	}
 	
-	heap_unlock();
+	return NULL;
+}
+
+/** Check a list of spans and their small objects
+ *
+ * Should be called only inside the span critical section.
+ *
+ * @param list List of spans.
+ *
+ * @return Address of the first inconsistent structure or NULL.
+ *
+ */
+static void *heap_check_spans(list_t *list)
+{
+	list_foreach(*list, link, heap_span_t, span) {
+		/* Check span consistency */
+		if ((span->magic != HEAP_SPAN_MAGIC) ||
+		    (((uintptr_t) span % HEAP_SPAN_SIZE) != 0) ||
+		    (span->class >= HEAP_CLASS_COUNT) ||
+		    (span->unused > SPAN_END(span)))
+			return (void *) span;
+		
+		size_t gross_size = OBJECT_GROSS_SIZE(span->class);
+		
+		/* Walk all objects */
+		for (uintptr_t obj = SPAN_FIRST_OBJECT(span); obj < span->unused;
+		    obj += gross_size) {
+			heap_block_head_t *head = (heap_block_head_t *) obj;
+			
+			/* Check object consistency */
+			if ((head->magic != HEAP_OBJECT_MAGIC) ||
+			    (head->size != gross_size))
+				return (void *) head;
+		}
+	}
 	
 	return NULL;
 }
 
+/** Check large blocks
+ *
+ * Should be called only inside the critical section.
+ *
+ * @return Address of the first inconsistent structure or NULL.
+ *
+ */
+static void *heap_check_large(void)
+{
+	for (link_t *link = list_first(&large_blocks); link != NULL;
+	    link = list_next(link, &large_blocks)) {
+		heap_block_head_t *head =
+		    (heap_block_head_t *) (((void *) link) + LARGE_HEAD_OFFSET);
+		
+		/* Check large block consistency */
+		if ((((uintptr_t) link % PAGE_SIZE) != 0) ||
+		    (head->magic != HEAP_LARGE_MAGIC) ||
+		    (head->free))
+			return (void *) head;
+	}
+	
+	return NULL;
+}
+
+/** Check the consistency of the heap
+ *
+ * Walk all heap areas, spans and large blocks and verify
+ * the magic values and sizes of all structures.
+ *
+ * @return NULL if the heap is consistent.
+ * @return Address of the first inconsistent structure otherwise.
+ * @return (void *) -1 if the heap has not been initialized.
+ *
+ */
+void *heap_check(void)
+{
+	span_lock();
+	heap_lock();
+	
+	void *res;
+	
+	if (first_heap_area == NULL) {
+		res = (void *) -1;
+	} else {
+		res = heap_check_areas();
+		
+		for (unsigned int class = 0;
+		    (res == NULL) && (class < HEAP_CLASS_COUNT); class++) {
+			res = heap_check_spans(&span_partial[class]);
+			
+			if (res == NULL)
+				res = heap_check_spans(&span_full[class]);
+		}
+		
+		if (res == NULL)
+			res = heap_check_spans(&span_empty);
+		
+		if (res == NULL)
+			res = heap_check_large();
+	}
+	
+	heap_unlock();
+	span_unlock();
+	
+	return res;
+}
+
 /** @}
  */
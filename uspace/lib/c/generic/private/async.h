@@ -37,6 +37,7 @@
 
 #include <async.h>
 #include <adt/list.h>
+#include <adt/odict.h>
 #include <fibril.h>
 #include <fibril_synch.h>
 #include <sys/time.h>
@@ -44,11 +45,11 @@
 
 /** Structures of this type are used to track the timeout events. */
 typedef struct {
-	/** If true, this struct is in the timeout list. */
+	/** If true, this struct is in the timeout queue. */
 	bool inlist;
 	
-	/** Timeout list link. */
-	link_t link;
+	/** Timeout queue link. */
+	odlink_t link;
 	
 	/** If true, we have timed out. */
 	bool occurred;
@@ -84,6 +85,7 @@ extern void awaiter_initialize(awaiter_t *);
 
 extern void __async_init(void);
 extern void async_insert_timeout(awaiter_t *);
+extern void async_remove_timeout(awaiter_t *);
 extern void reply_received(void *, errno_t, ipc_call_t *);
 
 #endif
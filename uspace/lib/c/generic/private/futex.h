@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup libc
+ * @{
+ */
+/** @file
+ */
+
+#ifndef LIBC_PRIVATE_FUTEX_H_
+#define LIBC_PRIVATE_FUTEX_H_
+
+#include <futex.h>
+
+/** Upper bound on the number of iterations of a single spin */
+#define FUTEX_SPIN_MAX  16384
+
+extern void __futex_init(void);
+
+/** Get the number of iterations to spin on a contended lock
+ *
+ * @return futex_spin_budget capped at FUTEX_SPIN_MAX.
+ *
+ */
+static inline unsigned int futex_spin_limit(void)
+{
+	unsigned int budget = futex_spin_budget;
+	
+	return (budget < FUTEX_SPIN_MAX) ? budget : FUTEX_SPIN_MAX;
+}
+
+/** Tell the CPU that the caller is busy waiting
+ *
+ * On x86 this lets a sibling hyperthread run and avoids the memory order
+ * violation penalty when the spin ends. Elsewhere it is just a compiler
+ * barrier, so that the spinning loop re-reads the watched variables.
+ *
+ */
+static inline void futex_spin_hint(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	asm volatile ("pause" ::: "memory");
+#else
+	asm volatile ("" ::: "memory");
+#endif
+}
+
+#endif
+
+/** @}
+ */
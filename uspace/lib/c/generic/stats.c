@@ -263,6 +263,32 @@ stats_exc_t *stats_get_exception(unsigned int excn)
 	return stats_exception;
 }
 
+/** Get futex contention statistics
+ *
+ * @param count Number of records returned.
+ *
+ * @return Array of stats_futex_t structures.
+ *         If non-NULL then it should be eventually freed
+ *         by free().
+ *
+ */
+stats_futex_t *stats_get_futexes(size_t *count)
+{
+	size_t size = 0;
+	stats_futex_t *stats_futexes =
+	    (stats_futex_t *) sysinfo_get_data("system.futexes", &size);
+	
+	if ((size % sizeof(stats_futex_t)) != 0) {
+		if (stats_futexes != NULL)
+			free(stats_futexes);
+		*count = 0;
+		return NULL;
+	}
+	
+	*count = size / sizeof(stats_futex_t);
+	return stats_futexes;
+}
+
 /** Get system load
  *
  * @param count Number of load records returned.
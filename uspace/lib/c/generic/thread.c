@@ -66,6 +66,12 @@ void __thread_main(uspace_arg_t *uarg)
 		thread_exit(0);
 	
 	__tcb_set(fibril->tcb);
+	fibril->running = true;
+	
+	if (!fibril_rq_join(fibril)) {
+		fibril_teardown(fibril);
+		thread_exit(0);
+	}
 	
 #ifdef FUTEX_UPGRADABLE
 	rcu_register_fibril();
@@ -87,7 +93,8 @@ void __thread_main(uspace_arg_t *uarg)
 	rcu_deregister_fibril();
 #endif
 	
-	fibril_teardown(fibril, false);
+	fibril_rq_leave();
+	fibril_teardown(fibril);
 	
 	thread_exit(0);
 }
@@ -144,6 +144,8 @@ extern aid_t async_send_fast(async_exch_t *, sysarg_t, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t, ipc_call_t *);
 extern aid_t async_send_slow(async_exch_t *, sysarg_t, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t, sysarg_t, ipc_call_t *);
+extern errno_t async_send_batch(async_exch_t *, size_t, const ipc_call_t *,
+    ipc_call_t *, aid_t *);
 
 extern void async_wait_for(aid_t, errno_t *);
 extern errno_t async_wait_timeout(aid_t, errno_t *, suseconds_t);
@@ -164,6 +166,7 @@ extern void async_put_client_data_by_id(task_id_t);
 extern errno_t async_create_port(iface_t, async_port_handler_t, void *,
     port_id_t *);
 extern void async_set_fallback_port_handler(async_port_handler_t, void *);
+extern void async_set_connection_stack_size(size_t);
 extern errno_t async_create_callback_port(async_exch_t *, iface_t, sysarg_t,
     sysarg_t, async_port_handler_t, void *, port_id_t *);
 
@@ -37,6 +37,7 @@
 
 #include <libarch/fibril.h>
 #include <types/common.h>
+#include <stdint.h>
 #include <adt/list.h>
 #include <libarch/tls.h>
 
@@ -50,6 +51,7 @@
 #define FIBRIL_WRITER	1 
 
 struct fibril;
+struct fibril_rq;
 
 typedef struct {
 	struct fibril *owned_by;
@@ -69,6 +71,7 @@ typedef struct fibril {
 	link_t all_link;
 	context_t ctx;
 	void *stack;
+	size_t stack_size;
 	void *arg;
 	errno_t (*func)(void *);
 	tcb_t *tcb;
@@ -78,6 +81,10 @@ typedef struct fibril {
 	int flags;
 	
 	fibril_owner_info_t *waits_for;
+	bool running;
+	
+	/** Run queue of the thread which runs the fibril */
+	struct fibril_rq *rq;
 
 	unsigned int switches;
 } fibril_t;
@@ -90,12 +97,45 @@ extern void context_restore(context_t *ctx) __attribute__((noreturn));
 
 #define FIBRIL_DFLT_STK_SIZE	0
 
+/** Stack size for short-lived fibrils with shallow call chains */
+#define FIBRIL_SMALL_STK_SIZE	(64 * 1024)
+
+/** Classes of recycled fibril stacks */
+typedef enum {
+	/** Stacks of the default size */
+	FIBRIL_STACK_DEFAULT,
+	/** Stacks of FIBRIL_SMALL_STK_SIZE bytes */
+	FIBRIL_STACK_SMALL,
+	FIBRIL_STACK_CLASSES
+} fibril_stack_class_t;
+
+/** Statistics of a pool of recycled fibril stacks */
+typedef struct {
+	/** Maximum number of stacks kept in the pool */
+	size_t limit;
+	/** Number of stacks in the pool */
+	size_t count;
+	/** Number of stacks taken from the pool */
+	uint64_t hits;
+	/** Number of stacks which had to be mapped */
+	uint64_t misses;
+	/** Number of stacks returned to the pool */
+	uint64_t recycled;
+	/** Number of stacks unmapped because the pool was full */
+	uint64_t unmapped;
+} fibril_stack_stats_t;
+
 #define fibril_create(func, arg) \
 	fibril_create_generic((func), (arg), FIBRIL_DFLT_STK_SIZE)
 extern fid_t fibril_create_generic(errno_t (*func)(void *), void *arg, size_t);
 extern void fibril_destroy(fid_t fid);
+extern void fibril_stack_pool_set_limit(fibril_stack_class_t, size_t);
+extern void fibril_stack_pool_get_stats(fibril_stack_class_t,
+    fibril_stack_stats_t *);
 extern fibril_t *fibril_setup(void);
-extern void fibril_teardown(fibril_t *f, bool locked);
+extern void fibril_teardown(fibril_t *f);
+extern bool fibril_rq_join(fibril_t *f);
+extern void fibril_rq_leave(void);
 extern int fibril_switch(fibril_switch_type_t stype);
 extern void fibril_add_ready(fid_t fid);
 extern void fibril_add_manager(fid_t fid);
@@ -38,6 +38,7 @@
 #include <atomic.h>
 #include <errno.h>
 #include <libc.h>
+#include <stdbool.h>
 
 typedef struct futex {
 	atomic_t val;
@@ -47,7 +48,10 @@ typedef struct futex {
 } futex_t;
 
 
+extern unsigned int futex_spin_budget;
+
 extern void futex_initialize(futex_t *futex, int value);
+extern bool futex_spin(futex_t *futex);
 
 #ifdef FUTEX_UPGRADABLE
 #include <rcu.h>
@@ -117,6 +121,9 @@ static inline bool futex_trydown(futex_t *futex)
 }
 
 /** Down the futex.
+ *
+ * If the futex is not available right away and the system has more
+ * than one CPU, spin for a while before going to sleep in the kernel.
  *
  * @param futex Futex.
  *
@@ -127,6 +134,9 @@ static inline bool futex_trydown(futex_t *futex)
  */
 static inline errno_t futex_down(futex_t *futex)
 {
+	if ((futex_spin_budget > 0) && (futex_spin(futex)))
+		return EOK;
+	
 	if ((atomic_signed_t) atomic_predec(&futex->val) < 0)
 		return (errno_t) __SYSCALL1(SYS_FUTEX_SLEEP, (sysarg_t) &futex->val.count);
 	
@@ -48,6 +48,8 @@
 typedef void (*ipc_async_callback_t)(void *, errno_t, ipc_call_t *);
 
 extern errno_t ipc_wait_cycle(ipc_call_t *, sysarg_t, unsigned int);
+extern errno_t ipc_wait_cycle_batch(ipc_call_t *, size_t, sysarg_t,
+    unsigned int, size_t *);
 extern void ipc_poke(void);
 
 #define ipc_wait_for_call(data) \
@@ -114,6 +116,9 @@ extern void ipc_call_async_fast(cap_handle_t, sysarg_t, sysarg_t, sysarg_t,
 extern void ipc_call_async_slow(cap_handle_t, sysarg_t, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t, sysarg_t, void *, ipc_async_callback_t);
 
+extern void ipc_call_async_batch(cap_handle_t, size_t, const ipc_call_t *,
+    void **, ipc_async_callback_t);
+
 extern errno_t ipc_hangup(cap_handle_t);
 
 extern errno_t ipc_forward_fast(cap_handle_t, cap_handle_t, sysarg_t, sysarg_t,
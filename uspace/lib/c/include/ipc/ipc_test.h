@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup libcipc
+ * @{
+ */
+/** @file
+ */
+
+#ifndef LIBC_IPC_IPC_TEST_H_
+#define LIBC_IPC_IPC_TEST_H_
+
+#include <ipc/common.h>
+
+/** Size of the buffer the IPC test server transfers or shares */
+#define IPC_TEST_BUF_SIZE  DATA_XFER_LIMIT
+
+/** Largest number of threads the IPC test server runs */
+#define IPC_TEST_MAX_THREADS  32
+
+typedef enum {
+	/** Answer immediately (no arguments, fast path) */
+	IPC_TEST_PING = IPC_FIRST_USER_METHOD,
+	/** Answer with the sum of the five arguments (slow path) */
+	IPC_TEST_PING_SLOW,
+	/** Accept IPC_M_DATA_WRITE of at most IPC_TEST_BUF_SIZE bytes */
+	IPC_TEST_DATA_WRITE,
+	/** Answer IPC_M_DATA_READ of at most IPC_TEST_BUF_SIZE bytes */
+	IPC_TEST_DATA_READ,
+	/** Share the server buffer in with IPC_M_SHARE_IN */
+	IPC_TEST_SHARE_IN,
+	/** Map and unmap an area shared out with IPC_M_SHARE_OUT */
+	IPC_TEST_SHARE_OUT,
+	/** Forward the call back to the server ARG1 more times */
+	IPC_TEST_FORWARD,
+	/** Run at least ARG1 threads with an IPC manager, answer the count */
+	IPC_TEST_SET_THREADS
+} ipc_test_request_t;
+
+#endif
+
+/** @}
+ */
@@ -57,6 +57,8 @@ extern stats_thread_t *stats_get_thread(thread_id_t);
 extern stats_exc_t *stats_get_exceptions(size_t *);
 extern stats_exc_t *stats_get_exception(unsigned int);
 
+extern stats_futex_t *stats_get_futexes(size_t *);
+
 extern void stats_print_load_fragment(load_t, unsigned int);
 extern const char *thread_get_state(state_t);
 
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fibril.h>
+#include <pcut/pcut.h>
+
+PCUT_INIT
+
+PCUT_TEST_SUITE(fibril_stack_pool);
+
+static errno_t dummy_fibril(void *arg)
+{
+	return EOK;
+}
+
+PCUT_TEST(recycle)
+{
+	fibril_stack_stats_t before;
+	fibril_stack_stats_t after;
+
+	fibril_stack_pool_get_stats(FIBRIL_STACK_SMALL, &before);
+	PCUT_ASSERT_TRUE(before.limit > 0);
+
+	fid_t fid = fibril_create_generic(dummy_fibril, NULL,
+	    FIBRIL_SMALL_STK_SIZE);
+	PCUT_ASSERT_TRUE(fid != 0);
+	fibril_destroy(fid);
+
+	/* The second fibril gets the stack of the first one */
+	fid = fibril_create_generic(dummy_fibril, NULL, FIBRIL_SMALL_STK_SIZE);
+	PCUT_ASSERT_TRUE(fid != 0);
+	fibril_destroy(fid);
+
+	fibril_stack_pool_get_stats(FIBRIL_STACK_SMALL, &after);
+	PCUT_ASSERT_TRUE(after.hits > before.hits);
+	PCUT_ASSERT_INT_EQUALS(before.recycled + 2, after.recycled);
+}
+
+PCUT_TEST(limit)
+{
+	fibril_stack_stats_t stats;
+	fibril_stack_stats_t saved;
+
+	fibril_stack_pool_get_stats(FIBRIL_STACK_SMALL, &saved);
+
+	fibril_stack_pool_set_limit(FIBRIL_STACK_SMALL, 0);
+	fibril_stack_pool_get_stats(FIBRIL_STACK_SMALL, &stats);
+	PCUT_ASSERT_INT_EQUALS(0, stats.limit);
+	PCUT_ASSERT_INT_EQUALS(0, stats.count);
+
+	fid_t fid = fibril_create_generic(dummy_fibril, NULL,
+	    FIBRIL_SMALL_STK_SIZE);
+	PCUT_ASSERT_TRUE(fid != 0);
+	fibril_destroy(fid);
+
+	fibril_stack_pool_get_stats(FIBRIL_STACK_SMALL, &stats);
+	PCUT_ASSERT_INT_EQUALS(0, stats.count);
+	PCUT_ASSERT_INT_EQUALS(saved.unmapped + 1, stats.unmapped);
+
+	fibril_stack_pool_set_limit(FIBRIL_STACK_SMALL, saved.limit);
+}
+
+PCUT_EXPORT(fibril_stack_pool);
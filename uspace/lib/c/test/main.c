@@ -32,7 +32,9 @@
 PCUT_INIT
 
 PCUT_IMPORT(circ_buf);
+PCUT_IMPORT(fibril_stack_pool);
 PCUT_IMPORT(fibril_timer);
+PCUT_IMPORT(malloc);
 PCUT_IMPORT(odict);
 PCUT_IMPORT(qsort);
 PCUT_IMPORT(sprintf);
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <macros.h>
+#include <malloc.h>
+#include <mem.h>
+#include <pcut/pcut.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <thread.h>
+
+PCUT_INIT
+
+PCUT_TEST_SUITE(malloc);
+
+enum {
+	/** Number of allocations live at the same time in each thread */
+	bench_slots = 64,
+	/** Number of allocations done by each thread */
+	bench_iterations = 20000,
+	/** Alignment forcing allocations from the general heap */
+	bench_heap_align = 32
+};
+
+/** Benchmark thread parameters */
+typedef struct {
+	/** Use memalign() instead of malloc() */
+	bool heap;
+	/** Seed of the size sequence */
+	unsigned int seed;
+} bench_arg_t;
+
+static atomic_t bench_running;
+static atomic_t bench_failed;
+
+/** Fill memory block with a test pattern. */
+static void fill(uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		data[i] = (uint8_t) (i * 7);
+}
+
+/** Verify test pattern written by fill(). */
+static bool verify(uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		if (data[i] != (uint8_t) (i * 7))
+			return false;
+	}
+
+	return true;
+}
+
+PCUT_TEST(small_sizes)
+{
+	void *blocks[1100];
+
+	for (size_t size = 0; size < 1100; size++) {
+		blocks[size] = malloc(size);
+		PCUT_ASSERT_NOT_NULL(blocks[size]);
+		PCUT_ASSERT_INT_EQUALS(0, ((uintptr_t) blocks[size]) % 16);
+		fill(blocks[size], size);
+	}
+
+	PCUT_ASSERT_NULL(heap_check());
+
+	for (size_t size = 0; size < 1100; size++) {
+		PCUT_ASSERT_TRUE(verify(blocks[size], size));
+		free(blocks[size]);
+	}
+
+	PCUT_ASSERT_NULL(heap_check());
+}
+
+PCUT_TEST(large_block)
+{
+	size_t size = 1024 * 1024;
+	uint8_t *data = malloc(size);
+	PCUT_ASSERT_NOT_NULL(data);
+
+	fill(data, size);
+	PCUT_ASSERT_NULL(heap_check());
+
+	uint8_t *ndata = realloc(data, 2 * size);
+	PCUT_ASSERT_NOT_NULL(ndata);
+	PCUT_ASSERT_TRUE(verify(ndata, size));
+
+	free(ndata);
+	PCUT_ASSERT_NULL(heap_check());
+}
+
+PCUT_TEST(realloc_grow_shrink)
+{
+	const size_t sizes[] = { 10, 100, 3000, 500000, 700, 20 };
+	uint8_t *data = NULL;
+	size_t prev = 0;
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		data = realloc(data, sizes[i]);
+		PCUT_ASSERT_NOT_NULL(data);
+		PCUT_ASSERT_TRUE(verify(data, min(prev, sizes[i])));
+
+		fill(data, sizes[i]);
+		prev = sizes[i];
+	}
+
+	free(data);
+	PCUT_ASSERT_NULL(heap_check());
+}
+
+PCUT_TEST(memalign_alignment)
+{
+	for (size_t align = 1; align <= 4096; align *= 2) {
+		void *data = memalign(align, 100);
+		PCUT_ASSERT_NOT_NULL(data);
+		PCUT_ASSERT_INT_EQUALS(0, ((uintptr_t) data) % align);
+		free(data);
+	}
+
+	PCUT_ASSERT_NULL(heap_check());
+}
+
+/** Benchmark thread
+ *
+ * Allocate and free blocks of small sizes, keeping a fixed
+ * number of them allocated at any time.
+ *
+ */
+static void bench_thread(void *data)
+{
+	bench_arg_t *arg = (bench_arg_t *) data;
+	void *slots[bench_slots];
+	unsigned int seed = arg->seed;
+
+	thread_detach(thread_get_id());
+
+	for (size_t i = 0; i < bench_slots; i++)
+		slots[i] = NULL;
+
+	for (size_t i = 0; i < bench_iterations; i++) {
+		seed = seed * 1103515245 + 12345;
+		size_t slot = (seed >> 16) % bench_slots;
+		size_t size = 16 + ((seed >> 8) % 496);
+
+		free(slots[slot]);
+
+		if (arg->heap)
+			slots[slot] = memalign(bench_heap_align, size);
+		else
+			slots[slot] = malloc(size);
+
+		if (slots[slot] == NULL) {
+			atomic_inc(&bench_failed);
+			break;
+		}
+
+		*((uint8_t *) slots[slot]) = (uint8_t) i;
+	}
+
+	for (size_t i = 0; i < bench_slots; i++)
+		free(slots[i]);
+
+	atomic_dec(&bench_running);
+}
+
+/** Run the benchmark with the given number of threads
+ *
+ * @param threads Number of threads.
+ * @param heap    Use the general heap instead of the size classes.
+ *
+ * @return Duration of the benchmark in microseconds.
+ *
+ */
+static suseconds_t bench_run(unsigned int threads, bool heap)
+{
+	bench_arg_t args[32];
+	struct timeval start;
+	struct timeval end;
+
+	atomic_set(&bench_running, threads);
+	getuptime(&start);
+
+	for (unsigned int i = 0; i < threads; i++) {
+		args[i].heap = heap;
+		args[i].seed = i;
+
+		if (thread_create(bench_thread, &args[i], "malloc_bench",
+		    NULL) != EOK) {
+			atomic_inc(&bench_failed);
+			atomic_dec(&bench_running);
+		}
+	}
+
+	while (atomic_get(&bench_running) > 0)
+		thread_usleep(1000);
+
+	getuptime(&end);
+	return max(tv_sub_diff(&end, &start), 1);
+}
+
+PCUT_TEST(benchmark)
+{
+	atomic_set(&bench_failed, 0);
+
+	for (unsigned int threads = 1; threads <= 32; threads *= 2) {
+		suseconds_t classes = bench_run(threads, false);
+		suseconds_t heap = bench_run(threads, true);
+		uint64_t ops = (uint64_t) threads * bench_iterations;
+
+		printf("malloc: %2u threads: size classes %" PRIu64
+		    " ops/s, heap %" PRIu64 " ops/s\n", threads,
+		    ops * 1000000 / classes, ops * 1000000 / heap);
+	}
+
+	PCUT_ASSERT_INT_EQUALS(0, atomic_get(&bench_failed));
+	PCUT_ASSERT_NULL(heap_check());
+}
+
+PCUT_EXPORT(malloc);
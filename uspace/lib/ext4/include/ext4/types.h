@@ -224,11 +224,25 @@ typedef struct ext4_superblock {
 	EXT4_FEATURE_RO_COMPAT_GDT_CSUM | \
 	EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE)
 
+/* Number of length orders in the free space summary of a block group */
+#define EXT4_BALLOC_ORDERS  16
+
+/*
+ * In-memory summary of free space in a block group
+ */
+typedef struct ext4_balloc_group_info {
+	bool valid;                                 /* Summary matches bitmap */
+	uint32_t free_extents[EXT4_BALLOC_ORDERS];  /* Free runs by length order */
+} ext4_balloc_group_info_t;
+
 typedef struct ext4_filesystem {
 	service_id_t device;
 	ext4_superblock_t *superblock;
 	aoff64_t inode_block_limits[4];
 	aoff64_t inode_blocks_per_level[4];
+	ext4_balloc_group_info_t *bg_info;  /* Free space summaries of groups */
+	list_t prealloc;                    /* Preallocation windows of i-nodes */
+	unsigned int prealloc_count;        /* Number of preallocation windows */
 } ext4_filesystem_t;
 
 
@@ -35,7 +35,10 @@
  */
 
 #include <errno.h>
+#include <macros.h>
+#include <mem.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include "ext4/balloc.h"
 #include "ext4/bitmap.h"
 #include "ext4/block_group.h"
@@ -44,6 +47,280 @@
 #include "ext4/superblock.h"
 #include "ext4/types.h"
 
+/** Length of the preallocation window of regular files in blocks */
+#define EXT4_BALLOC_PREALLOC_BLOCKS  64
+
+/** Maximal number of preallocation windows kept at the same time */
+#define EXT4_BALLOC_PREALLOC_MAX  64
+
+/** Preallocation window of an i-node.
+ *
+ * The blocks following the last allocation of an i-node are reserved so that
+ * its next allocation continues the same run. The reservation lives in
+ * memory only, it never reaches the bitmaps and can be dropped at any time.
+ * Windows outlive the in-memory i-nodes, as a file is usually written by a
+ * series of requests, each of which gets and puts the i-node.
+ *
+ */
+typedef struct {
+	link_t link;
+	uint32_t inode;  /* I-node owning the window */
+	uint32_t start;  /* First reserved block */
+	uint32_t count;  /* Number of reserved blocks */
+} ext4_balloc_window_t;
+
+/** Drop preallocation window.
+ *
+ * @param fs  Filesystem
+ * @param win Window to drop
+ *
+ */
+static void ext4_balloc_window_drop(ext4_filesystem_t *fs,
+    ext4_balloc_window_t *win)
+{
+	list_remove(&win->link);
+	fs->prealloc_count--;
+	free(win);
+}
+
+/** Find preallocation window of an i-node.
+ *
+ * @param fs    Filesystem
+ * @param inode I-node number
+ *
+ * @return Window or NULL if the i-node has none
+ *
+ */
+static ext4_balloc_window_t *ext4_balloc_window_find(ext4_filesystem_t *fs,
+    uint32_t inode)
+{
+	list_foreach(fs->prealloc, link, ext4_balloc_window_t, win) {
+		if (win->inode == inode)
+			return win;
+	}
+	
+	return NULL;
+}
+
+/** Create preallocation window of an i-node.
+ *
+ * The reservation is only a hint, so it is silently skipped when there
+ * is no memory for it.
+ *
+ * @param fs    Filesystem
+ * @param inode I-node number
+ * @param start First block to reserve
+ * @param count Number of blocks to reserve
+ *
+ */
+static void ext4_balloc_window_create(ext4_filesystem_t *fs, uint32_t inode,
+    uint32_t start, uint32_t count)
+{
+	/*
+	 * Windows are replaced on every allocation, so the list is kept in
+	 * the order of last use. Make room by dropping the least recently
+	 * used window.
+	 */
+	if (fs->prealloc_count >= EXT4_BALLOC_PREALLOC_MAX) {
+		ext4_balloc_window_drop(fs, list_get_instance(
+		    list_first(&fs->prealloc), ext4_balloc_window_t, link));
+	}
+	
+	ext4_balloc_window_t *win = malloc(sizeof(ext4_balloc_window_t));
+	if (win == NULL)
+		return;
+	
+	link_initialize(&win->link);
+	win->inode = inode;
+	win->start = start;
+	win->count = count;
+	
+	list_append(&win->link, &fs->prealloc);
+	fs->prealloc_count++;
+}
+
+/** Check whether block is reserved for another i-node.
+ *
+ * @param fs    Filesystem
+ * @param inode I-node which is allocating
+ * @param block Absolute block address
+ *
+ * @return True if the block must not be allocated
+ *
+ */
+static bool ext4_balloc_reserved(ext4_filesystem_t *fs, uint32_t inode,
+    uint32_t block)
+{
+	list_foreach(fs->prealloc, link, ext4_balloc_window_t, win) {
+		if ((win->inode != inode) && (block >= win->start) &&
+		    (block - win->start < win->count))
+			return true;
+	}
+	
+	return false;
+}
+
+/** Drop all preallocation windows.
+ *
+ * @param fs Filesystem
+ *
+ */
+static void ext4_balloc_discard_all(ext4_filesystem_t *fs)
+{
+	while (!list_empty(&fs->prealloc)) {
+		ext4_balloc_window_drop(fs, list_get_instance(
+		    list_first(&fs->prealloc), ext4_balloc_window_t, link));
+	}
+}
+
+/** Initialize in-memory state of the block allocator.
+ *
+ * @param fs Filesystem
+ *
+ * @return Error code
+ *
+ */
+errno_t ext4_balloc_init(ext4_filesystem_t *fs)
+{
+	uint32_t count = ext4_superblock_get_block_group_count(fs->superblock);
+	
+	/* Summaries are built lazily when the groups are searched */
+	fs->bg_info = calloc(count, sizeof(ext4_balloc_group_info_t));
+	if (fs->bg_info == NULL)
+		return ENOMEM;
+	
+	list_initialize(&fs->prealloc);
+	fs->prealloc_count = 0;
+	
+	return EOK;
+}
+
+/** Release in-memory state of the block allocator.
+ *
+ * @param fs Filesystem
+ *
+ */
+void ext4_balloc_fini(ext4_filesystem_t *fs)
+{
+	ext4_balloc_discard_all(fs);
+	
+	free(fs->bg_info);
+	fs->bg_info = NULL;
+}
+
+/** Drop preallocation window of an i-node.
+ *
+ * Should be called when the i-node is freed or truncated.
+ *
+ * @param inode_ref I-node
+ *
+ */
+void ext4_balloc_discard_prealloc(ext4_inode_ref_t *inode_ref)
+{
+	ext4_balloc_window_t *win =
+	    ext4_balloc_window_find(inode_ref->fs, inode_ref->index);
+	if (win != NULL)
+		ext4_balloc_window_drop(inode_ref->fs, win);
+}
+
+/** Compute length order of a run of free blocks.
+ *
+ * @param len Length of the run
+ *
+ * @return Binary logarithm of the length, limited by the summary size
+ *
+ */
+static unsigned int ext4_balloc_order(uint32_t len)
+{
+	unsigned int order = 0;
+	
+	while ((order < EXT4_BALLOC_ORDERS - 1) && ((len >> (order + 1)) != 0))
+		order++;
+	
+	return order;
+}
+
+/** Rebuild free space summary of a block group.
+ *
+ * Runs of free blocks are counted by the order of their length, like the
+ * free lists of a buddy allocator.
+ *
+ * @param fs     Filesystem
+ * @param bgid   Block group index
+ * @param bitmap Block bitmap of the group
+ * @param first  Index of the first data block in the group
+ * @param end    Number of blocks in the group
+ *
+ */
+static void ext4_balloc_summarize(ext4_filesystem_t *fs, uint32_t bgid,
+    uint8_t *bitmap, uint32_t first, uint32_t end)
+{
+	ext4_balloc_group_info_t *info = &fs->bg_info[bgid];
+	
+	memset(info->free_extents, 0, sizeof(info->free_extents));
+	
+	uint32_t idx = first;
+	while (idx < end) {
+		/* Skip fully used bytes at once */
+		if (((idx % 8) == 0) && (bitmap[idx / 8] == 0xff)) {
+			idx += 8;
+			continue;
+		}
+		
+		if (!ext4_bitmap_is_free_bit(bitmap, idx)) {
+			idx++;
+			continue;
+		}
+		
+		uint32_t len = 1;
+		while ((idx + len < end) &&
+		    (ext4_bitmap_is_free_bit(bitmap, idx + len)))
+			len++;
+		
+		info->free_extents[ext4_balloc_order(len)]++;
+		idx += len;
+	}
+	
+	info->valid = true;
+}
+
+/** Check whether block group can contain a run of free blocks.
+ *
+ * @param fs   Filesystem
+ * @param bgid Block group index
+ * @param len  Length of the run
+ *
+ * @return False if the summary proves that there is no such run
+ *
+ */
+static bool ext4_balloc_group_may_fit(ext4_filesystem_t *fs, uint32_t bgid,
+    uint32_t len)
+{
+	ext4_balloc_group_info_t *info = &fs->bg_info[bgid];
+	
+	if (!info->valid)
+		return true;
+	
+	for (unsigned int order = ext4_balloc_order(len);
+	    order < EXT4_BALLOC_ORDERS; order++) {
+		if (info->free_extents[order] > 0)
+			return true;
+	}
+	
+	return false;
+}
+
+/** Note that the bitmap of a block group was changed.
+ *
+ * @param fs   Filesystem
+ * @param bgid Block group index
+ *
+ */
+static void ext4_balloc_group_changed(ext4_filesystem_t *fs, uint32_t bgid)
+{
+	fs->bg_info[bgid].valid = false;
+}
+
 /** Free block.
  *
  * @param inode_ref  Inode, where the block is allocated
@@ -81,6 +358,7 @@ errno_t ext4_balloc_free_block(ext4_inode_ref_t *inode_ref, uint32_t block_addr)
 	/* Modify bitmap */
 	ext4_bitmap_free_bit(bitmap_block->data, index_in_group);
 	bitmap_block->dirty = true;
+	ext4_balloc_group_changed(fs, block_group);
 	
 	/* Release block with bitmap */
 	rc = block_put(bitmap_block);
@@ -154,6 +432,7 @@ static errno_t ext4_balloc_free_blocks_internal(ext4_inode_ref_t *inode_ref,
 	/* Modify bitmap */
 	ext4_bitmap_free_bits(bitmap_block->data, index_in_group_first, count);
 	bitmap_block->dirty = true;
+	ext4_balloc_group_changed(fs, block_group_first);
 
 	/* Release block with bitmap */
 	rc = block_put(bitmap_block);
@@ -311,7 +590,7 @@ static errno_t ext4_balloc_find_goal(ext4_inode_ref_t *inode_ref, uint32_t *goal
 		if (rc != EOK)
 			return rc;
 
-		if (goal != 0) {
+		if (*goal != 0) {
 			(*goal)++;
 			return EOK;
 		}
@@ -334,287 +613,406 @@ static errno_t ext4_balloc_find_goal(ext4_inode_ref_t *inode_ref, uint32_t *goal
 	return ext4_filesystem_put_block_group_ref(bg_ref);
 }
 
-/** Data block allocation algorithm.
+/** Compute length of a run of blocks usable for an allocation.
  *
- * @param inode_ref Inode to allocate block for
- * @param fblock    Allocated block address
+ * Usable blocks are free in the bitmap and not reserved for another i-node.
  *
- * @return Error code
+ * @param inode_ref I-node to allocate blocks for
+ * @param bgid      Block group index
+ * @param bitmap    Block bitmap of the group
+ * @param idx       Index of the first block of the run in the group
+ * @param end       Number of blocks in the group
+ * @param max       Maximal length of the run
+ *
+ * @return Length of the run
  *
  */
-errno_t ext4_balloc_alloc_block(ext4_inode_ref_t *inode_ref, uint32_t *fblock)
+static uint32_t ext4_balloc_usable_length(ext4_inode_ref_t *inode_ref,
+    uint32_t bgid, uint8_t *bitmap, uint32_t idx, uint32_t end, uint32_t max)
 {
-	uint32_t allocated_block = 0;
+	ext4_filesystem_t *fs = inode_ref->fs;
+	uint32_t len = 0;
 	
-	uint32_t bitmap_block_addr;
-	block_t *bitmap_block;
-	uint32_t rel_block_idx = 0;
-	uint32_t free_blocks;
-	uint32_t goal;
+	while ((len < max) && (idx + len < end) &&
+	    (ext4_bitmap_is_free_bit(bitmap, idx + len))) {
+		uint32_t block = ext4_filesystem_index_in_group2blockaddr(
+		    fs->superblock, idx + len, bgid);
+		if (ext4_balloc_reserved(fs, inode_ref->index, block))
+			break;
+		
+		len++;
+	}
 	
-	/* Find GOAL */
-	errno_t rc = ext4_balloc_find_goal(inode_ref, &goal);
-	if (rc != EOK)
-		return rc;
+	return len;
+}
 
-	ext4_superblock_t *sb = inode_ref->fs->superblock;
+/** Find first run of usable blocks in block group.
+ *
+ * @param inode_ref I-node to allocate blocks for
+ * @param bgid      Block group index
+ * @param bitmap    Block bitmap of the group
+ * @param from      Index to start searching from
+ * @param end       Number of blocks in the group
+ * @param needed    Minimal length of the run
+ * @param max       Maximal length of the run
+ * @param start     Output value - index of the first block of the run
+ * @param len       Output value - length of the run
+ *
+ * @return True if a run was found
+ *
+ */
+static bool ext4_balloc_find_run(ext4_inode_ref_t *inode_ref, uint32_t bgid,
+    uint8_t *bitmap, uint32_t from, uint32_t end, uint32_t needed,
+    uint32_t max, uint32_t *start, uint32_t *len)
+{
+	uint32_t idx = from;
+	
+	while (idx < end) {
+		/* Skip fully used bytes at once */
+		if (((idx % 8) == 0) && (bitmap[idx / 8] == 0xff)) {
+			idx += 8;
+			continue;
+		}
+		
+		uint32_t n = ext4_balloc_usable_length(inode_ref, bgid, bitmap,
+		    idx, end, max);
+		if ((n > 0) && (n >= needed)) {
+			*start = idx;
+			*len = n;
+			return true;
+		}
+		
+		idx += n + 1;
+	}
+	
+	return false;
+}
+
+/** Allocate blocks from a run of usable blocks.
+ *
+ * The first blocks of the run are marked as used and the rest of the run
+ * becomes the preallocation window of the i-node.
+ *
+ * @param inode_ref    I-node to allocate blocks for
+ * @param bg_ref       Block group containing the run
+ * @param bitmap_block Block bitmap of the group
+ * @param idx          Index of the first block of the run in the group
+ * @param len          Length of the run
+ * @param count        Number of blocks to allocate
+ * @param fblock       Output value - address of the first allocated block
+ * @param allocated    Output value - number of allocated blocks
+ *
+ */
+static void ext4_balloc_take_run(ext4_inode_ref_t *inode_ref,
+    ext4_block_group_ref_t *bg_ref, block_t *bitmap_block, uint32_t idx,
+    uint32_t len, uint32_t count, uint32_t *fblock, uint32_t *allocated)
+{
+	ext4_filesystem_t *fs = inode_ref->fs;
+	ext4_superblock_t *sb = fs->superblock;
+	uint32_t taken = min(len, count);
+	
+	/* Modify bitmap */
+	for (uint32_t i = 0; i < taken; i++)
+		ext4_bitmap_set_bit(bitmap_block->data, idx + i);
+	
+	bitmap_block->dirty = true;
+	ext4_balloc_group_changed(fs, bg_ref->index);
+	
+	uint32_t block_size = ext4_superblock_get_block_size(sb);
+	
+	/* Update superblock free blocks count */
+	uint64_t sb_free_blocks = ext4_superblock_get_free_blocks_count(sb);
+	sb_free_blocks -= taken;
+	ext4_superblock_set_free_blocks_count(sb, sb_free_blocks);
+	
+	/* Update inode blocks (different block size!) count */
+	uint64_t ino_blocks =
+	    ext4_inode_get_blocks_count(sb, inode_ref->inode);
+	ino_blocks += (uint64_t) taken * (block_size / EXT4_INODE_BLOCK_SIZE);
+	ext4_inode_set_blocks_count(sb, inode_ref->inode, ino_blocks);
+	inode_ref->dirty = true;
+	
+	/* Update block group free blocks count */
+	uint32_t bg_free_blocks =
+	    ext4_block_group_get_free_blocks_count(bg_ref->block_group, sb);
+	bg_free_blocks -= taken;
+	ext4_block_group_set_free_blocks_count(bg_ref->block_group, sb,
+	    bg_free_blocks);
+	bg_ref->dirty = true;
+	
+	*fblock = ext4_filesystem_index_in_group2blockaddr(sb, idx,
+	    bg_ref->index);
+	*allocated = taken;
+	
+	/* Reserve the rest of the run for the next allocation */
+	if (len > taken)
+		ext4_balloc_window_create(fs, inode_ref->index, *fblock + taken,
+		    len - taken);
+}
+
+/** Allocate blocks exactly at the goal.
+ *
+ * @param inode_ref I-node to allocate blocks for
+ * @param goal      Address of the first block to allocate
+ * @param count     Number of blocks to allocate
+ * @param want      Number of blocks to allocate and reserve
+ * @param fblock    Output value - address of the first allocated block
+ * @param allocated Output value - number of allocated blocks, zero if
+ *                  the goal is not free
+ *
+ * @return Error code
+ *
+ */
+static errno_t ext4_balloc_alloc_at(ext4_inode_ref_t *inode_ref, uint32_t goal,
+    uint32_t count, uint32_t want, uint32_t *fblock, uint32_t *allocated)
+{
+	ext4_filesystem_t *fs = inode_ref->fs;
+	ext4_superblock_t *sb = fs->superblock;
+	
+	*allocated = 0;
+	if (goal >= ext4_superblock_get_blocks_count(sb))
+		return EOK;
 	
 	/* Load block group number for goal and relative index */
-	uint32_t block_group = ext4_filesystem_blockaddr2group(sb, goal);
-	uint32_t index_in_group =
-	    ext4_filesystem_blockaddr2_index_in_group(sb, goal);
+	uint32_t bgid = ext4_filesystem_blockaddr2group(sb, goal);
+	uint32_t idx = ext4_filesystem_blockaddr2_index_in_group(sb, goal);
 	
-	/* Load block group reference */
 	ext4_block_group_ref_t *bg_ref;
-	rc = ext4_filesystem_get_block_group_ref(inode_ref->fs,
-	    block_group, &bg_ref);
+	errno_t rc = ext4_filesystem_get_block_group_ref(fs, bgid, &bg_ref);
 	if (rc != EOK)
 		return rc;
-
-	free_blocks =
-	    ext4_block_group_get_free_blocks_count(bg_ref->block_group, sb);
-	if (free_blocks == 0) {
-		/* This group has no free blocks */
-		goto goal_failed;
-	}
 	
-	/* Compute indexes */
-	uint32_t first_in_group =
-	    ext4_balloc_get_first_data_block_in_group(sb, bg_ref);
+	uint32_t first = ext4_filesystem_blockaddr2_index_in_group(sb,
+	    ext4_balloc_get_first_data_block_in_group(sb, bg_ref));
 	
-	uint32_t first_in_group_index =
-	    ext4_filesystem_blockaddr2_index_in_group(sb, first_in_group);
-	
-	if (index_in_group < first_in_group_index)
-		index_in_group = first_in_group_index;
+	if ((ext4_block_group_get_free_blocks_count(bg_ref->block_group,
+	    sb) == 0) || (idx < first))
+		return ext4_filesystem_put_block_group_ref(bg_ref);
 	
 	/* Load block with bitmap */
-	bitmap_block_addr =
+	uint32_t bitmap_block_addr =
 	    ext4_block_group_get_block_bitmap(bg_ref->block_group, sb);
-	
-	rc = block_get(&bitmap_block, inode_ref->fs->device,
-	    bitmap_block_addr, BLOCK_FLAGS_NONE);
+	block_t *bitmap_block;
+	rc = block_get(&bitmap_block, fs->device, bitmap_block_addr,
+	    BLOCK_FLAGS_NONE);
 	if (rc != EOK) {
 		ext4_filesystem_put_block_group_ref(bg_ref);
 		return rc;
 	}
 	
-	/* Check if goal is free */
-	if (ext4_bitmap_is_free_bit(bitmap_block->data, index_in_group)) {
-		ext4_bitmap_set_bit(bitmap_block->data, index_in_group);
-		bitmap_block->dirty = true;
-		rc = block_put(bitmap_block);
-		if (rc != EOK) {
-			ext4_filesystem_put_block_group_ref(bg_ref);
-			return rc;
-		}
-		
-		allocated_block =
-		    ext4_filesystem_index_in_group2blockaddr(sb, index_in_group,
-		    block_group);
-		
-		goto success;
+	uint32_t len = ext4_balloc_usable_length(inode_ref, bgid,
+	    bitmap_block->data, idx, ext4_superblock_get_blocks_in_group(sb, bgid),
+	    want);
+	if (len > 0) {
+		ext4_balloc_take_run(inode_ref, bg_ref, bitmap_block, idx, len,
+		    count, fblock, allocated);
 	}
 	
-	uint32_t blocks_in_group =
-	    ext4_superblock_get_blocks_in_group(sb, block_group);
-	
-	uint32_t end_idx = (index_in_group + 63) & ~63;
-	if (end_idx > blocks_in_group)
-		end_idx = blocks_in_group;
-	
-	/* Try to find free block near to goal */
-	for (uint32_t tmp_idx = index_in_group + 1; tmp_idx < end_idx;
-	    ++tmp_idx) {
-		if (ext4_bitmap_is_free_bit(bitmap_block->data, tmp_idx)) {
-			ext4_bitmap_set_bit(bitmap_block->data, tmp_idx);
-			bitmap_block->dirty = true;
-			rc = block_put(bitmap_block);
-			if (rc != EOK)
-				return rc;
-			
-			allocated_block =
-			    ext4_filesystem_index_in_group2blockaddr(sb, tmp_idx,
-			    block_group);
-			
-			goto success;
-		}
-	}
-	
-	/* Find free BYTE in bitmap */
-	rc = ext4_bitmap_find_free_byte_and_set_bit(bitmap_block->data,
-	    index_in_group, &rel_block_idx, blocks_in_group);
-	if (rc == EOK) {
-		bitmap_block->dirty = true;
-		rc = block_put(bitmap_block);
-		if (rc != EOK)
-			return rc;
-		
-		allocated_block =
-		    ext4_filesystem_index_in_group2blockaddr(sb, rel_block_idx,
-		    block_group);
-		
-		goto success;
-	}
-	
-	/* Find free bit in bitmap */
-	rc = ext4_bitmap_find_free_bit_and_set(bitmap_block->data,
-	    index_in_group, &rel_block_idx, blocks_in_group);
-	if (rc == EOK) {
-		bitmap_block->dirty = true;
-		rc = block_put(bitmap_block);
-		if (rc != EOK)
-			return rc;
-		
-		allocated_block =
-		    ext4_filesystem_index_in_group2blockaddr(sb, rel_block_idx,
-		    block_group);
-		
-		goto success;
-	}
-	
-	/* No free block found yet */
 	rc = block_put(bitmap_block);
 	if (rc != EOK) {
 		ext4_filesystem_put_block_group_ref(bg_ref);
 		return rc;
 	}
-
-goal_failed:
-
-	rc = ext4_filesystem_put_block_group_ref(bg_ref);
-	if (rc != EOK)
-		return rc;
 	
-	/* Try other block groups */
+	return ext4_filesystem_put_block_group_ref(bg_ref);
+}
+
+/** Search block groups for a run of free blocks.
+ *
+ * The groups are searched starting with the group of the goal, first for
+ * a run long enough for the preallocation window, then for the requested
+ * number of blocks and finally for any free block. Groups whose summary
+ * shows that they cannot satisfy the current criterion are skipped without
+ * reading their bitmaps.
+ *
+ * @param inode_ref I-node to allocate blocks for
+ * @param goal      Preferred address of the first block
+ * @param count     Number of blocks to allocate
+ * @param want      Number of blocks to allocate and reserve
+ * @param fblock    Output value - address of the first allocated block
+ * @param allocated Output value - number of allocated blocks
+ *
+ * @return Error code
+ *
+ */
+static errno_t ext4_balloc_alloc_search(ext4_inode_ref_t *inode_ref,
+    uint32_t goal, uint32_t count, uint32_t want, uint32_t *fblock,
+    uint32_t *allocated)
+{
+	ext4_filesystem_t *fs = inode_ref->fs;
+	ext4_superblock_t *sb = fs->superblock;
 	uint32_t block_group_count = ext4_superblock_get_block_group_count(sb);
 	
-	uint32_t bgid = (block_group + 1) % block_group_count;
-	uint32_t count = block_group_count;
+	uint32_t goal_group = 0;
+	uint32_t goal_idx = 0;
+	if (goal < ext4_superblock_get_blocks_count(sb)) {
+		goal_group = ext4_filesystem_blockaddr2group(sb, goal);
+		goal_idx = ext4_filesystem_blockaddr2_index_in_group(sb, goal);
+	}
 	
-	while (count > 0) {
-		rc = ext4_filesystem_get_block_group_ref(inode_ref->fs, bgid,
-		    &bg_ref);
-		if (rc != EOK)
-			return rc;
-
-		free_blocks =
-		     ext4_block_group_get_free_blocks_count(bg_ref->block_group, sb);
-		if (free_blocks == 0) {
-			/* This group has no free blocks */
-			goto next_group;
-		}
-
-		/* Load block with bitmap */
-		bitmap_block_addr =
-		    ext4_block_group_get_block_bitmap(bg_ref->block_group, sb);
-		
-		rc = block_get(&bitmap_block, inode_ref->fs->device,
-		    bitmap_block_addr, 0);
-		if (rc != EOK) {
-			ext4_filesystem_put_block_group_ref(bg_ref);
-			return rc;
-		}
-		
-		/* Compute indexes */
-		first_in_group =
-		    ext4_balloc_get_first_data_block_in_group(sb, bg_ref);
-		index_in_group =
-		    ext4_filesystem_blockaddr2_index_in_group(sb, first_in_group);
-		blocks_in_group = ext4_superblock_get_blocks_in_group(sb, bgid);
-		
-		first_in_group_index =
-		    ext4_filesystem_blockaddr2_index_in_group(sb, first_in_group);
-		
-		if (index_in_group < first_in_group_index)
-			index_in_group = first_in_group_index;
+	uint32_t needed[] = { want, count, 1 };
+	
+	for (unsigned int cr = 0; cr < sizeof(needed) / sizeof(needed[0]); cr++) {
+		if ((cr > 0) && (needed[cr] == needed[cr - 1]))
+			continue;
 		
-		/* Try to find free byte in bitmap */
-		rc = ext4_bitmap_find_free_byte_and_set_bit(bitmap_block->data,
-		    index_in_group, &rel_block_idx, blocks_in_group);
-		if (rc == EOK) {
-			bitmap_block->dirty = true;
-			rc = block_put(bitmap_block);
+		for (uint32_t i = 0; i < block_group_count; i++) {
+			uint32_t bgid = (goal_group + i) % block_group_count;
+			
+			if (!ext4_balloc_group_may_fit(fs, bgid, needed[cr]))
+				continue;
+			
+			ext4_block_group_ref_t *bg_ref;
+			errno_t rc = ext4_filesystem_get_block_group_ref(fs, bgid,
+			    &bg_ref);
+			if (rc != EOK)
+				return rc;
+			
+			uint32_t free_blocks = ext4_block_group_get_free_blocks_count(
+			    bg_ref->block_group, sb);
+			if (free_blocks < needed[cr]) {
+				rc = ext4_filesystem_put_block_group_ref(bg_ref);
+				if (rc != EOK)
+					return rc;
+				
+				continue;
+			}
+			
+			/* Load block with bitmap */
+			uint32_t bitmap_block_addr =
+			    ext4_block_group_get_block_bitmap(bg_ref->block_group, sb);
+			block_t *bitmap_block;
+			rc = block_get(&bitmap_block, fs->device, bitmap_block_addr,
+			    BLOCK_FLAGS_NONE);
 			if (rc != EOK) {
 				ext4_filesystem_put_block_group_ref(bg_ref);
 				return rc;
 			}
 			
-			allocated_block =
-			    ext4_filesystem_index_in_group2blockaddr(sb, rel_block_idx,
-			    bgid);
+			uint32_t first = ext4_filesystem_blockaddr2_index_in_group(sb,
+			    ext4_balloc_get_first_data_block_in_group(sb, bg_ref));
+			uint32_t end = ext4_superblock_get_blocks_in_group(sb, bgid);
+			
+			/* In the group of the goal prefer blocks after the goal */
+			uint32_t start;
+			uint32_t len;
+			bool found = false;
+			if ((bgid == goal_group) && (goal_idx > first)) {
+				found = ext4_balloc_find_run(inode_ref, bgid,
+				    bitmap_block->data, goal_idx, end, needed[cr],
+				    want, &start, &len);
+			}
+			
+			if (!found) {
+				found = ext4_balloc_find_run(inode_ref, bgid,
+				    bitmap_block->data, first, end, needed[cr],
+				    want, &start, &len);
+			}
+			
+			if (found) {
+				ext4_balloc_take_run(inode_ref, bg_ref, bitmap_block,
+				    start, len, count, fblock, allocated);
+			} else {
+				/* The whole group was scanned, remember the result */
+				ext4_balloc_summarize(fs, bgid, bitmap_block->data,
+				    first, end);
+			}
 			
-			goto success;
-		}
-		
-		/* Try to find free bit in bitmap */
-		rc = ext4_bitmap_find_free_bit_and_set(bitmap_block->data,
-		    index_in_group, &rel_block_idx, blocks_in_group);
-		if (rc == EOK) {
-			bitmap_block->dirty = true;
 			rc = block_put(bitmap_block);
 			if (rc != EOK) {
 				ext4_filesystem_put_block_group_ref(bg_ref);
 				return rc;
 			}
 			
-			allocated_block =
-			    ext4_filesystem_index_in_group2blockaddr(sb, rel_block_idx,
-			    bgid);
-			
-			goto success;
-		}
-		
-		rc = block_put(bitmap_block);
-		if (rc != EOK) {
-			ext4_filesystem_put_block_group_ref(bg_ref);
-			return rc;
+			rc = ext4_filesystem_put_block_group_ref(bg_ref);
+			if ((rc != EOK) || (found))
+				return rc;
 		}
-
-next_group:
-		rc = ext4_filesystem_put_block_group_ref(bg_ref);
-		if (rc != EOK)
-			return rc;
-		
-		/* Goto next group */
-		bgid = (bgid + 1) % block_group_count;
-		count--;
 	}
 	
 	return ENOSPC;
+}
+
+/** Multi-block data allocation algorithm.
+ *
+ * Allocates a run of up to count physically contiguous blocks, at least
+ * one block is allocated on success. Blocks following the goal are
+ * preferred, so that the run continues the previous allocation. Regular
+ * files get the blocks following the run reserved in a preallocation
+ * window, from which their next allocation is satisfied.
+ *
+ * @param inode_ref I-node to allocate blocks for
+ * @param goal      Preferred address of the first block, zero to compute
+ *                  it from the last block of the i-node
+ * @param count     Maximal number of blocks to allocate
+ * @param fblock    Output value - address of the first allocated block
+ * @param allocated Output value - number of allocated blocks
+ *
+ * @return Error code
+ *
+ */
+errno_t ext4_balloc_alloc_blocks(ext4_inode_ref_t *inode_ref, uint32_t goal,
+    uint32_t count, uint32_t *fblock, uint32_t *allocated)
+{
+	ext4_filesystem_t *fs = inode_ref->fs;
+	errno_t rc;
 	
-success:
-	/* Empty command - because of syntax */
-	;
+	assert(count > 0);
 	
-	uint32_t block_size = ext4_superblock_get_block_size(sb);
+	/* Find GOAL */
+	if (goal == 0) {
+		rc = ext4_balloc_find_goal(inode_ref, &goal);
+		if (rc != EOK)
+			return rc;
+	}
 	
-	/* Update superblock free blocks count */
-	uint32_t sb_free_blocks = ext4_superblock_get_free_blocks_count(sb);
-	sb_free_blocks--;
-	ext4_superblock_set_free_blocks_count(sb, sb_free_blocks);
+	/* Only file data are worth reserving space ahead */
+	uint32_t want = count;
+	if (ext4_inode_is_type(fs->superblock, inode_ref->inode,
+	    EXT4_INODE_MODE_FILE))
+		want = max(count, EXT4_BALLOC_PREALLOC_BLOCKS);
 	
-	/* Update inode blocks (different block size!) count */
-	uint64_t ino_blocks =
-	    ext4_inode_get_blocks_count(sb, inode_ref->inode);
-	ino_blocks += block_size / EXT4_INODE_BLOCK_SIZE;
-	ext4_inode_set_blocks_count(sb, inode_ref->inode, ino_blocks);
-	inode_ref->dirty = true;
+	/*
+	 * The window of the i-node is reserved for this allocation only if it
+	 * starts at the goal. Either way, it is replaced by the window created
+	 * by this allocation.
+	 */
+	ext4_balloc_window_t *win = ext4_balloc_window_find(fs,
+	    inode_ref->index);
+	if (win != NULL)
+		ext4_balloc_window_drop(fs, win);
 	
-	/* Update block group free blocks count */
-	uint32_t bg_free_blocks =
-	    ext4_block_group_get_free_blocks_count(bg_ref->block_group, sb);
-	bg_free_blocks--;
-	ext4_block_group_set_free_blocks_count(bg_ref->block_group, sb,
-	    bg_free_blocks);
-	bg_ref->dirty = true;
+	rc = ext4_balloc_alloc_at(inode_ref, goal, count, want, fblock,
+	    allocated);
+	if ((rc != EOK) || (*allocated > 0))
+		return rc;
 	
-	rc = ext4_filesystem_put_block_group_ref(bg_ref);
+	rc = ext4_balloc_alloc_search(inode_ref, goal, count, want, fblock,
+	    allocated);
+	if ((rc == ENOSPC) && (!list_empty(&fs->prealloc))) {
+		/* The last free blocks might be reserved for other i-nodes */
+		ext4_balloc_discard_all(fs);
+		rc = ext4_balloc_alloc_search(inode_ref, goal, count, want,
+		    fblock, allocated);
+	}
 	
-	*fblock = allocated_block;
 	return rc;
 }
 
+/** Data block allocation algorithm.
+ *
+ * @param inode_ref Inode to allocate block for
+ * @param fblock    Allocated block address
+ *
+ * @return Error code
+ *
+ */
+errno_t ext4_balloc_alloc_block(ext4_inode_ref_t *inode_ref, uint32_t *fblock)
+{
+	uint32_t allocated;
+	return ext4_balloc_alloc_blocks(inode_ref, 0, 1, fblock, &allocated);
+}
+
 /** Try to allocate concrete block.
  *
  * @param inode_ref Inode to allocate block for
@@ -653,13 +1051,24 @@ errno_t ext4_balloc_try_alloc_block(ext4_inode_ref_t *inode_ref, uint32_t fblock
 		return rc;
 	}
 	
-	/* Check if block is free */
-	*free = ext4_bitmap_is_free_bit(bitmap_block->data, index_in_group);
+	/* Check if block is free and not reserved for another i-node */
+	*free = ext4_bitmap_is_free_bit(bitmap_block->data, index_in_group) &&
+	    !ext4_balloc_reserved(fs, inode_ref->index, fblock);
 	
 	/* Allocate block if possible */
 	if (*free) {
 		ext4_bitmap_set_bit(bitmap_block->data, index_in_group);
 		bitmap_block->dirty = true;
+		ext4_balloc_group_changed(fs, block_group);
+		
+		/* Keep the window of the i-node in front of its last block */
+		ext4_balloc_window_t *win =
+		    ext4_balloc_window_find(fs, inode_ref->index);
+		if ((win != NULL) && (win->start == fblock) && (win->count > 1)) {
+			win->start++;
+			win->count--;
+		} else if (win != NULL)
+			ext4_balloc_window_drop(fs, win);
 	}
 	
 	/* Release block with bitmap */
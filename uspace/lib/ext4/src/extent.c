@@ -36,6 +36,7 @@
 
 #include <byteorder.h>
 #include <errno.h>
+#include <macros.h>
 #include <mem.h>
 #include <stdlib.h>
 #include "ext4/balloc.h"
@@ -441,6 +442,109 @@ errno_t ext4_extent_find_block(ext4_inode_ref_t *inode_ref, uint32_t iblock,
 	return rc;
 }
 
+/** Find physical blocks of a run of logical blocks in the extent tree.
+ *
+ * Besides the physical address of the first block, the number of following
+ * logical blocks which are mapped to consecutive physical blocks (or which
+ * are all unallocated) is returned, so that the whole run can be transferred
+ * in one operation. Nothing is mapped past the end of the i-node, so a run
+ * starting there is a hole of the maximal length and an append can allocate
+ * all of its blocks at once.
+ *
+ * @param inode_ref I-node to load blocks from
+ * @param iblock    First logical block of the run
+ * @param max       Maximal number of blocks in the run
+ * @param fblock    Output value for physical block number of iblock,
+ *                  zero if iblock is not allocated
+ * @param count     Output value for number of blocks in the run
+ *
+ * @return Error code
+ *
+ */
+errno_t ext4_extent_find_range(ext4_inode_ref_t *inode_ref, uint32_t iblock,
+    uint32_t max, uint32_t *fblock, uint32_t *count)
+{
+	errno_t rc = EOK;
+	/* Compute bound defined by i-node size */
+	uint64_t inode_size =
+	    ext4_inode_get_size(inode_ref->fs->superblock, inode_ref->inode);
+	
+	uint32_t block_size =
+	    ext4_superblock_get_block_size(inode_ref->fs->superblock);
+	
+	uint32_t last_idx = (inode_size - 1) / block_size;
+	
+	/* The whole tail past the end of the i-node is one hole */
+	if ((inode_size == 0) || (iblock > last_idx)) {
+		*fblock = 0;
+		*count = max;
+		return EOK;
+	}
+	
+	block_t *block = NULL;
+	
+	/* Walk through extent tree */
+	ext4_extent_header_t *header =
+	    ext4_inode_get_extent_header(inode_ref->inode);
+	
+	while (ext4_extent_header_get_depth(header) != 0) {
+		/* Search index in node */
+		ext4_extent_index_t *index;
+		ext4_extent_binsearch_idx(header, &index, iblock);
+		
+		/* Load child node and set values for the next iteration */
+		uint64_t child = ext4_extent_index_get_leaf(index);
+		
+		if (block != NULL) {
+			rc = block_put(block);
+			if (rc != EOK)
+				return rc;
+		}
+		
+		rc = block_get(&block, inode_ref->fs->device, child,
+		    BLOCK_FLAGS_NONE);
+		if (rc != EOK)
+			return rc;
+		
+		header = (ext4_extent_header_t *)block->data;
+	}
+	
+	/* Search extent in the leaf block */
+	ext4_extent_t *extent = NULL;
+	ext4_extent_binsearch(header, &extent, iblock);
+	
+	*fblock = 0;
+	*count = 1;
+	
+	if (extent != NULL) {
+		uint32_t first = ext4_extent_get_first_block(extent);
+		uint32_t length = ext4_extent_get_block_count(extent);
+		ext4_extent_t *last = EXT4_EXTENT_FIRST(header) +
+		    ext4_extent_header_get_entries_count(header) - 1;
+		
+		if (iblock < first) {
+			/* Hole before the first extent of the leaf */
+			*count = first - iblock;
+		} else if (iblock - first < length) {
+			/* Block is mapped by the extent */
+			*fblock = ext4_extent_get_start(extent) + iblock - first;
+			*count = length - (iblock - first);
+		} else if (extent < last) {
+			/* Hole between two extents of the leaf */
+			*count = ext4_extent_get_first_block(extent + 1) - iblock;
+		}
+	}
+	
+	/* Do not report blocks beyond the end of the i-node or the limit */
+	*count = min(min(*count, last_idx - iblock + 1), max);
+	
+	/* Cleanup */
+	if (block != NULL)
+		rc = block_put(block);
+	
+	return rc;
+}
+
 /** Find extent for specified iblock.
  *
  * This function is used for finding block in the extent tree with
@@ -950,26 +1054,33 @@ static errno_t ext4_extent_append_extent(ext4_inode_ref_t *inode_ref,
 	return EOK;
 }
 
-/** Append data block to the i-node.
+/** Append a run of data blocks to the i-node.
+ *
+ * The blocks are requested from the multi-block allocator with the end of
+ * the last extent as the goal, so that they extend the last extent whenever
+ * possible. Otherwise a new extent is appended to the tree (including
+ * possible splitting). Fewer blocks than requested are appended if the
+ * allocator cannot find a long enough run of free blocks.
  *
- * This function allocates data block, tries to append it
- * to some existing extent or creates new extents.
- * It includes possible extent tree modifications (splitting).
- *<
- * @param inode_ref I-node to append block to
- * @param iblock    Output logical number of newly allocated block
- * @param fblock    Output physical block address of newly allocated block
+ * @param inode_ref   I-node to append blocks to
+ * @param count       Number of blocks to append
+ * @param iblock      Output logical number of the first new block
+ * @param fblock      Output physical address of the first new block
+ * @param appended    Output number of appended blocks
+ * @param update_size Extend the i-node size over the new blocks
  *
  * @return Error code
  *
  */
-errno_t ext4_extent_append_block(ext4_inode_ref_t *inode_ref, uint32_t *iblock,
-    uint32_t *fblock, bool update_size)
+errno_t ext4_extent_append_blocks(ext4_inode_ref_t *inode_ref, uint32_t count,
+    uint32_t *iblock, uint32_t *fblock, uint32_t *appended, bool update_size)
 {
 	ext4_superblock_t *sb = inode_ref->fs->superblock;
 	uint64_t inode_size = ext4_inode_get_size(sb, inode_ref->inode);
 	uint32_t block_size = ext4_superblock_get_block_size(sb);
 	
+	assert(count > 0);
+	
 	/* Calculate number of new logical block */
 	uint32_t new_block_idx = 0;
 	if (inode_size > 0) {
@@ -990,81 +1101,70 @@ errno_t ext4_extent_append_block(ext4_inode_ref_t *inode_ref, uint32_t *iblock,
 	while (path_ptr->depth != 0)
 		path_ptr++;
 	
+	uint32_t block_limit = (1 << 15);
+	uint32_t phys_block = 0;
+	uint32_t allocated = 0;
+	
 	/* Add new extent to the node if not present */
 	if (path_ptr->extent == NULL)
 		goto append_extent;
 	
-	uint16_t block_count = ext4_extent_get_block_count(path_ptr->extent);
-	uint16_t block_limit = (1 << 15);
+	uint32_t block_count = ext4_extent_get_block_count(path_ptr->extent);
 	
-	uint32_t phys_block = 0;
 	if (block_count < block_limit) {
-		/* There is space for new block in the extent */
+		/* There is space for new blocks in the extent */
 		if (block_count == 0) {
 			/* Existing extent is empty */
-			rc = ext4_balloc_alloc_block(inode_ref, &phys_block);
+			rc = ext4_balloc_alloc_blocks(inode_ref, 0,
+			    min(count, block_limit), &phys_block, &allocated);
 			if (rc != EOK)
 				goto finish;
 			
 			/* Initialize extent */
 			ext4_extent_set_first_block(path_ptr->extent, new_block_idx);
 			ext4_extent_set_start(path_ptr->extent, phys_block);
-			ext4_extent_set_block_count(path_ptr->extent, 1);
-			
-			/* Update i-node */
-			if (update_size) {
-				ext4_inode_set_size(inode_ref->inode, inode_size + block_size);
-				inode_ref->dirty = true;
-			}
+			ext4_extent_set_block_count(path_ptr->extent, allocated);
 			
 			path_ptr->block->dirty = true;
-			
+			goto update;
+		}
+		
+		/* Existing extent contains some blocks, try to continue it */
+		uint32_t goal = ext4_extent_get_start(path_ptr->extent) +
+		    block_count;
+		
+		rc = ext4_balloc_alloc_blocks(inode_ref, goal,
+		    min(count, block_limit - block_count), &phys_block,
+		    &allocated);
+		if (rc != EOK)
 			goto finish;
-		} else {
-			/* Existing extent contains some blocks */
-			phys_block = ext4_extent_get_start(path_ptr->extent);
-			phys_block += ext4_extent_get_block_count(path_ptr->extent);
-			
-			/* Check if the following block is free for allocation */
-			bool free;
-			rc = ext4_balloc_try_alloc_block(inode_ref, phys_block, &free);
-			if (rc != EOK)
-				goto finish;
-			
-			if (!free) {
-				/* Target is not free, new block must be appended to new extent */
-				goto append_extent;
-			}
-			
+		
+		if (phys_block == goal) {
 			/* Update extent */
-			ext4_extent_set_block_count(path_ptr->extent, block_count + 1);
-			
-			/* Update i-node */
-			if (update_size) {
-				ext4_inode_set_size(inode_ref->inode, inode_size + block_size);
-				inode_ref->dirty = true;
-			}
+			ext4_extent_set_block_count(path_ptr->extent,
+			    block_count + allocated);
 			
 			path_ptr->block->dirty = true;
-			
-			goto finish;
+			goto update;
 		}
+		
+		/* Blocks are elsewhere, they must be appended to new extent */
 	}
 	
-	
 append_extent:
-	/* Append new extent to the tree */
-	phys_block = 0;
-	
-	/* Allocate new data block */
-	rc = ext4_balloc_alloc_block(inode_ref, &phys_block);
-	if (rc != EOK)
-		goto finish;
+	/* Allocate new data blocks unless already done */
+	if (allocated == 0) {
+		rc = ext4_balloc_alloc_blocks(inode_ref, 0, min(count, block_limit),
+		    &phys_block, &allocated);
+		if (rc != EOK)
+			goto finish;
+	}
 	
-	/* Append extent for new block (includes tree splitting if needed) */
+	/* Append extent for new blocks (includes tree splitting if needed) */
 	rc = ext4_extent_append_extent(inode_ref, path, new_block_idx);
 	if (rc != EOK) {
-		ext4_balloc_free_block(inode_ref, phys_block);
+		ext4_balloc_free_blocks(inode_ref, phys_block, allocated);
+		allocated = 0;
 		goto finish;
 	}
 	
@@ -1072,18 +1172,20 @@ append_extent:
 	path_ptr = path + tree_depth;
 	
 	/* Initialize newly created extent */
-	ext4_extent_set_block_count(path_ptr->extent, 1);
+	ext4_extent_set_block_count(path_ptr->extent, allocated);
 	ext4_extent_set_first_block(path_ptr->extent, new_block_idx);
 	ext4_extent_set_start(path_ptr->extent, phys_block);
 	
+	path_ptr->block->dirty = true;
+	
+update:
 	/* Update i-node */
 	if (update_size) {
-		ext4_inode_set_size(inode_ref->inode, inode_size + block_size);
+		ext4_inode_set_size(inode_ref->inode,
+		    inode_size + (uint64_t) allocated * block_size);
 		inode_ref->dirty = true;
 	}
 	
-	path_ptr->block->dirty = true;
-	
 finish:
 	;
 
@@ -1092,6 +1194,7 @@ finish:
 	/* Set return values */
 	*iblock = new_block_idx;
 	*fblock = phys_block;
+	*appended = allocated;
 	
 	/*
 	 * Put loaded blocks
@@ -1111,6 +1214,24 @@ finish:
 	return rc;
 }
 
+/** Append data block to the i-node.
+ *
+ * @param inode_ref   I-node to append block to
+ * @param iblock      Output logical number of newly allocated block
+ * @param fblock      Output physical block address of newly allocated block
+ * @param update_size Extend the i-node size over the new block
+ *
+ * @return Error code
+ *
+ */
+errno_t ext4_extent_append_block(ext4_inode_ref_t *inode_ref, uint32_t *iblock,
+    uint32_t *fblock, bool update_size)
+{
+	uint32_t appended;
+	return ext4_extent_append_blocks(inode_ref, 1, iblock, fblock, &appended,
+	    update_size);
+}
+
 /**
  * @}
  */
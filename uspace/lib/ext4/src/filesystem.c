@@ -37,6 +37,7 @@
 
 #include <byteorder.h>
 #include <errno.h>
+#include <macros.h>
 #include <mem.h>
 #include <align.h>
 #include <crypto.h>
@@ -130,6 +131,11 @@ static errno_t ext4_filesystem_init(ext4_filesystem_t *fs, service_id_t service_
 	if (rc != EOK)
 		goto err_2;
 
+	/* Set up in-memory state of the block allocator */
+	rc = ext4_balloc_init(fs);
+	if (rc != EOK)
+		goto err_2;
+
 	return EOK;
 err_2:
 	block_cache_fini(fs->device);
@@ -148,6 +154,8 @@ err:
  */
 static void ext4_filesystem_fini(ext4_filesystem_t *fs)
 {
+	ext4_balloc_fini(fs);
+
 	/* Release memory space for superblock */
 	free(fs->superblock);
 
@@ -1028,6 +1036,8 @@ errno_t ext4_filesystem_free_inode(ext4_inode_ref_t *inode_ref)
 {
 	ext4_filesystem_t *fs = inode_ref->fs;
 	
+	ext4_balloc_discard_prealloc(inode_ref);
+	
 	/* For extents must be data block destroyed by other way */
 	if ((ext4_superblock_has_feature_incompatible(fs->superblock,
 	    EXT4_FEATURE_INCOMPAT_EXTENTS)) &&
@@ -1196,6 +1206,9 @@ errno_t ext4_filesystem_truncate_inode(ext4_inode_ref_t *inode_ref,
 	if (old_size < new_size)
 		return EINVAL;
 	
+	/* Blocks reserved past the old end are not needed any more */
+	ext4_balloc_discard_prealloc(inode_ref);
+	
 	/* Compute how many blocks will be released */
 	aoff64_t size_diff = old_size - new_size;
 	uint32_t block_size  = ext4_superblock_get_block_size(sb);
@@ -1347,6 +1360,68 @@ errno_t ext4_filesystem_get_inode_data_block_index(ext4_inode_ref_t *inode_ref,
 	return EOK;
 }
 
+/** Get physical block addresses of a run of logical blocks.
+ *
+ * The run starts with the given logical block and contains the following
+ * blocks as long as they are stored in consecutive physical blocks, or as
+ * long as they are all unallocated.
+ *
+ * @param inode_ref I-node to read block addresses from
+ * @param iblock    Logical index of the first block
+ * @param max       Maximal number of blocks in the run
+ * @param fblock    Output pointer for physical address of the first block,
+ *                  zero if the block is not allocated
+ * @param count     Output pointer for number of blocks in the run
+ *
+ * @return Error code
+ *
+ */
+errno_t ext4_filesystem_get_inode_data_block_range(ext4_inode_ref_t *inode_ref,
+    aoff64_t iblock, uint32_t max, uint32_t *fblock, uint32_t *count)
+{
+	ext4_filesystem_t *fs = inode_ref->fs;
+	
+	assert(max > 0);
+	
+	/* For empty file is situation simple */
+	if (ext4_inode_get_size(fs->superblock, inode_ref->inode) == 0) {
+		*fblock = 0;
+		*count = max;
+		return EOK;
+	}
+	
+	/* Handle i-node using extents */
+	if ((ext4_superblock_has_feature_incompatible(fs->superblock,
+	    EXT4_FEATURE_INCOMPAT_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		return ext4_extent_find_range(inode_ref, iblock, max, fblock,
+		    count);
+	}
+	
+	/* Block maps have to be looked up block after block */
+	uint32_t first;
+	errno_t rc = ext4_filesystem_get_inode_data_block_index(inode_ref,
+	    iblock, &first);
+	if (rc != EOK)
+		return rc;
+	
+	uint32_t n;
+	for (n = 1; n < max; n++) {
+		uint32_t next;
+		rc = ext4_filesystem_get_inode_data_block_index(inode_ref,
+		    iblock + n, &next);
+		if (rc != EOK)
+			return rc;
+		
+		if ((first == 0) ? (next != 0) : (next != first + n))
+			break;
+	}
+	
+	*fblock = first;
+	*count = n;
+	return EOK;
+}
+
 /** Set physical block address for the block logical address into the i-node.
  *
  * @param inode_ref I-node to set block address to
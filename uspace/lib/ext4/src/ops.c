@@ -55,6 +55,9 @@
 #include "ext4/fstypes.h"
 #include "ext4/superblock.h"
 
+/** Minimal size of a run of blocks transferred past the block cache */
+#define EXT4_DIRECT_MIN_SIZE  (32 * 1024)
+
 /* Forward declarations of auxiliary functions */
 
 static errno_t ext4_read_directory(ipc_callid_t, aoff64_t, size_t,
@@ -1173,7 +1176,105 @@ skip:
 	}
 }
 
+/** Check whether a run of whole blocks should bypass the block cache.
+ *
+ * Only runs of at least EXT4_DIRECT_MIN_SIZE bytes are transferred directly.
+ * None of the blocks may be cached, as the cached copy could be dirty or
+ * would become stale.
+ *
+ * @param fs     Filesystem
+ * @param fblock First physical block of the run
+ * @param count  Number of blocks in the run
+ *
+ * @return True if the run can be transferred directly
+ *
+ */
+static bool ext4_direct_possible(ext4_filesystem_t *fs, uint32_t fblock,
+    uint32_t count)
+{
+	uint32_t block_size = ext4_superblock_get_block_size(fs->superblock);
+	
+	if ((uint64_t) count * block_size < EXT4_DIRECT_MIN_SIZE)
+		return false;
+	
+	return !block_cache_contains(fs->device, fblock, count);
+}
+
+/** Transfer a run of whole blocks between a buffer and the device.
+ *
+ * @param fs     Filesystem
+ * @param fblock First physical block of the run
+ * @param count  Number of blocks in the run
+ * @param buf    Buffer to read to or write from
+ * @param write  Write the buffer to the device instead of reading it
+ *
+ * @return Error code
+ *
+ */
+static errno_t ext4_direct_transfer(ext4_filesystem_t *fs, uint32_t fblock,
+    uint32_t count, void *buf, bool write)
+{
+	size_t phys_size;
+	errno_t rc = block_get_bsize(fs->device, &phys_size);
+	if (rc != EOK)
+		return rc;
+	
+	/* Direct transfers are addressed in device blocks */
+	uint32_t block_size = ext4_superblock_get_block_size(fs->superblock);
+	aoff64_t ratio = block_size / phys_size;
+	
+	if (write)
+		return block_write_direct(fs->device, fblock * ratio,
+		    count * ratio, buf);
+	
+	return block_read_direct(fs->device, fblock * ratio, count * ratio, buf);
+}
+
+/** Update cached copies of blocks written past the cache.
+ *
+ * Read-ahead may bring some of the blocks into the cache while they are
+ * being written directly to the device. Such copies hold the old data, so
+ * they are overwritten with the data which were written.
+ *
+ * @param fs     Filesystem
+ * @param fblock First physical block of the run
+ * @param count  Number of blocks in the run
+ * @param buf    Data written to the run
+ *
+ * @return Error code
+ *
+ */
+static errno_t ext4_direct_update_cache(ext4_filesystem_t *fs,
+    uint32_t fblock, uint32_t count, const uint8_t *buf)
+{
+	uint32_t block_size = ext4_superblock_get_block_size(fs->superblock);
+	
+	for (uint32_t i = 0; i < count; i++) {
+		if (!block_cache_contains(fs->device, fblock + i, 1))
+			continue;
+		
+		block_t *block;
+		errno_t rc = block_get(&block, fs->device, fblock + i,
+		    BLOCK_FLAGS_NOREAD);
+		if (rc != EOK)
+			return rc;
+		
+		memcpy(block->data, buf + (size_t) i * block_size, block_size);
+		block->dirty = true;
+		
+		rc = block_put(block);
+		if (rc != EOK)
+			return rc;
+	}
+	
+	return EOK;
+}
+
 /** Read data from file.
+ *
+ * The data are mapped run by run, where a run is a range of logical blocks
+ * stored in consecutive physical blocks, so that the whole request is served
+ * in one IPC transfer.
  *
  * @param callid    IPC id of call (for communication)
  * @param pos       Position to start reading from
@@ -1188,7 +1289,8 @@ skip:
 errno_t ext4_read_file(ipc_callid_t callid, aoff64_t pos, size_t size,
     ext4_instance_t *inst, ext4_inode_ref_t *inode_ref, size_t *rbytes)
 {
-	ext4_superblock_t *sb = inst->filesystem->superblock;
+	ext4_filesystem_t *fs = inst->filesystem;
+	ext4_superblock_t *sb = fs->superblock;
 	uint64_t file_size = ext4_inode_get_size(sb, inode_ref->inode);
 	
 	if (pos >= file_size) {
@@ -1198,72 +1300,244 @@ errno_t ext4_read_file(ipc_callid_t callid, aoff64_t pos, size_t size,
 		return EOK;
 	}
 	
-	/* For now, we only read data from one block at a time */
-	uint32_t block_size = ext4_superblock_get_block_size(sb);
-	aoff64_t file_block = pos / block_size;
-	uint32_t offset_in_block = pos % block_size;
-	uint32_t bytes = min(block_size - offset_in_block, size);
-	
 	/* Handle end of file */
-	if (pos + bytes > file_size)
-		bytes = file_size - pos;
+	uint32_t block_size = ext4_superblock_get_block_size(sb);
+	size_t bytes = min(size, file_size - pos);
 	
-	/* Get the real block number */
-	uint32_t fs_block;
-	errno_t rc = ext4_filesystem_get_inode_data_block_index(inode_ref,
-	    file_block, &fs_block);
-	if (rc != EOK) {
-		async_answer_0(callid, rc);
-		return rc;
+	uint8_t *buffer = malloc(bytes);
+	if (buffer == NULL) {
+		async_answer_0(callid, ENOMEM);
+		return ENOMEM;
 	}
 	
-	/*
-	 * Check for sparse file.
-	 * If ext4_filesystem_get_inode_data_block_index returned
-	 * fs_block == 0, it means that the given block is not allocated for the
-	 * file and we need to return a buffer of zeros
-	 */
-	uint8_t *buffer;
-	if (fs_block == 0) {
-		buffer = malloc(bytes);
-		if (buffer == NULL) {
-			async_answer_0(callid, ENOMEM);
-			return ENOMEM;
+	errno_t rc = EOK;
+	size_t done = 0;
+	while (done < bytes) {
+		aoff64_t iblock = (pos + done) / block_size;
+		uint32_t offset = (pos + done) % block_size;
+		uint32_t blocks = (offset + bytes - done + block_size - 1) /
+		    block_size;
+		
+		/* Map as many of the remaining blocks as possible */
+		uint32_t fblock;
+		uint32_t count;
+		rc = ext4_filesystem_get_inode_data_block_range(inode_ref, iblock,
+		    blocks, &fblock, &count);
+		if (rc != EOK)
+			break;
+		
+		size_t run = min((size_t) count * block_size - offset,
+		    bytes - done);
+		
+		/*
+		 * Check for sparse file.
+		 * Blocks which are not allocated for the file are read as
+		 * zeros.
+		 */
+		if (fblock == 0) {
+			memset(buffer + done, 0, run);
+			done += run;
+			continue;
 		}
 		
-		memset(buffer, 0, bytes);
+		/* Large runs of whole blocks are read past the cache */
+		uint32_t whole = (offset == 0) ? run / block_size : 0;
+		if ((whole > 0) && (ext4_direct_possible(fs, fblock, whole))) {
+			rc = ext4_direct_transfer(fs, fblock, whole, buffer + done,
+			    false);
+			if (rc != EOK)
+				break;
+			
+			done += (size_t) whole * block_size;
+			continue;
+		}
 		
-		rc = async_data_read_finalize(callid, buffer, bytes);
-		*rbytes = bytes;
+		/* Usual case - read the run block by block from the cache */
+		size_t end = done + run;
+		while (done < end) {
+			block_t *block;
+			rc = block_get(&block, inst->service_id, fblock,
+			    BLOCK_FLAGS_NONE);
+			if (rc != EOK)
+				break;
+			
+			size_t chunk = min(block_size - offset, end - done);
+			memcpy(buffer + done, block->data + offset, chunk);
+			
+			rc = block_put(block);
+			if (rc != EOK)
+				break;
+			
+			done += chunk;
+			offset = 0;
+			fblock++;
+		}
 		
-		free(buffer);
-		return rc;
+		if (rc != EOK)
+			break;
 	}
 	
-	/* Usual case - we need to read a block from device */
-	block_t *block;
-	rc = block_get(&block, inst->service_id, fs_block, BLOCK_FLAGS_NONE);
 	if (rc != EOK) {
+		free(buffer);
 		async_answer_0(callid, rc);
 		return rc;
 	}
 	
-	assert(offset_in_block + bytes <= block_size);
-	rc = async_data_read_finalize(callid, block->data + offset_in_block, bytes);
-	if (rc != EOK) {
-		block_put(block);
+	rc = async_data_read_finalize(callid, buffer, bytes);
+	free(buffer);
+	if (rc != EOK)
 		return rc;
+	
+	*rbytes = bytes;
+	return EOK;
+}
+
+/** Append data blocks to a file using extents.
+ *
+ * Extent trees can only grow at the end of the file. Blocks skipped by the
+ * write are allocated together with the run and zeroed, so that the whole
+ * request needs a single allocation as long as the allocator finds a long
+ * enough free run. Every appended block extends the i-node size, which is
+ * set to its final value once the data are written.
+ *
+ * @param inode_ref I-node of the file
+ * @param iblock    Logical number of the first block of the run
+ * @param max       Maximal number of blocks to allocate
+ * @param fblock    Output value for physical number of the first block
+ * @param count     Output value for number of blocks in the run
+ *
+ * @return Error code
+ *
+ */
+static errno_t ext4_write_alloc_extent(ext4_inode_ref_t *inode_ref,
+    uint32_t iblock, uint32_t max, uint32_t *fblock, uint32_t *count)
+{
+	ext4_filesystem_t *fs = inode_ref->fs;
+	uint32_t block_size = ext4_superblock_get_block_size(fs->superblock);
+	
+	while (true) {
+		uint64_t size = ext4_inode_get_size(fs->superblock,
+		    inode_ref->inode);
+		uint32_t next = (size + block_size - 1) / block_size;
+		
+		/* Holes inside of the extent tree cannot be filled */
+		if (next > iblock)
+			return ENOTSUP;
+		
+		uint32_t gap = min(iblock - next, UINT32_MAX - max);
+		
+		uint32_t first;
+		uint32_t appended;
+		errno_t rc = ext4_extent_append_blocks(inode_ref, gap + max,
+		    &first, fblock, &appended, true);
+		if (rc != EOK)
+			return rc;
+		
+		/* Zero the blocks skipped by the write */
+		uint32_t skipped = min(appended, iblock - first);
+		
+		for (uint32_t i = 0; i < skipped; i++) {
+			block_t *block;
+			rc = block_get(&block, fs->device, *fblock + i,
+			    BLOCK_FLAGS_NOREAD);
+			if (rc != EOK)
+				return rc;
+			
+			memset(block->data, 0, block->size);
+			block->dirty = true;
+			
+			rc = block_put(block);
+			if (rc != EOK)
+				return rc;
+		}
+		
+		if (appended > skipped) {
+			*fblock += skipped;
+			*count = appended - skipped;
+			return EOK;
+		}
+	}
+}
+
+/** Allocate a run of data blocks for a write.
+ *
+ * The multi-block allocator is asked for all the blocks at once, so that
+ * the run is physically contiguous and can be written in one operation.
+ * The run never extends past the hole starting at @a iblock, blocks which
+ * are already mapped are left alone.
+ *
+ * @param inode_ref I-node of the file
+ * @param iblock    Logical number of the first block of the run
+ * @param max       Maximal number of blocks to allocate, at most the length
+ *                  of the hole starting at @a iblock
+ * @param fblock    Output value for physical number of the first block
+ * @param count     Output value for number of blocks in the run
+ *
+ * @return Error code
+ *
+ */
+static errno_t ext4_write_alloc_run(ext4_inode_ref_t *inode_ref,
+    uint32_t iblock, uint32_t max, uint32_t *fblock, uint32_t *count)
+{
+	ext4_filesystem_t *fs = inode_ref->fs;
+	
+	if ((ext4_superblock_has_feature_incompatible(fs->superblock,
+	    EXT4_FEATURE_INCOMPAT_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS)))
+		return ext4_write_alloc_extent(inode_ref, iblock, max, fblock,
+		    count);
+	
+	/* Continue right after the previously mapped block if possible */
+	uint32_t goal = 0;
+	if (iblock > 0) {
+		errno_t rc = ext4_filesystem_get_inode_data_block_index(inode_ref,
+		    iblock - 1, &goal);
+		if (rc != EOK)
+			return rc;
+		
+		if (goal != 0)
+			goal++;
 	}
 	
-	rc = block_put(block);
+	errno_t rc = ext4_balloc_alloc_blocks(inode_ref, goal, max, fblock,
+	    count);
 	if (rc != EOK)
 		return rc;
 	
-	*rbytes = bytes;
+	for (uint32_t i = 0; i < *count; i++) {
+		uint32_t mapped;
+		rc = ext4_filesystem_get_inode_data_block_index(inode_ref,
+		    iblock + i, &mapped);
+		
+		/* Do not remap blocks past the hole */
+		if ((rc == EOK) && (mapped != 0))
+			rc = EEXIST;
+		
+		if (rc == EOK) {
+			rc = ext4_filesystem_set_inode_data_block_index(
+			    inode_ref, iblock + i, *fblock + i);
+		}
+		
+		if (rc != EOK) {
+			/* Keep the blocks which were mapped successfully */
+			ext4_balloc_free_blocks(inode_ref, *fblock + i,
+			    *count - i);
+			*count = i;
+			if (i == 0)
+				return rc;
+			
+			break;
+		}
+	}
+	
+	inode_ref->dirty = true;
 	return EOK;
 }
 
 /** Write bytes to file
+ *
+ * The data are received in one IPC transfer and written run by run,
+ * allocating the missing blocks on the way.
  *
  * @param service_id Device identifier
  * @param index      I-node number of file
@@ -1292,110 +1566,135 @@ static errno_t ext4_write(service_id_t service_id, fs_index_t index, aoff64_t po
 	
 	ext4_node_t *enode = EXT4_NODE(fn);
 	ext4_filesystem_t *fs = enode->instance->filesystem;
+	ext4_inode_ref_t *inode_ref = enode->inode_ref;
 	
 	uint32_t block_size = ext4_superblock_get_block_size(fs->superblock);
 	
-	/* Prevent writing to more than one block */
-	uint32_t bytes = min(len, block_size - (pos % block_size));
-	
-	int flags = BLOCK_FLAGS_NONE;
-	if (bytes == block_size)
-		flags = BLOCK_FLAGS_NOREAD;
-	
-	uint32_t iblock =  pos / block_size;
-	uint32_t fblock;
+	uint8_t *buffer = malloc(len);
+	if (buffer == NULL) {
+		rc = ENOMEM;
+		async_answer_0(callid, rc);
+		goto exit;
+	}
 	
-	/* Load inode */
-	ext4_inode_ref_t *inode_ref = enode->inode_ref;
-	rc = ext4_filesystem_get_inode_data_block_index(inode_ref, iblock,
-	    &fblock);
+	rc = async_data_write_finalize(callid, buffer, len);
 	if (rc != EOK) {
-		async_answer_0(callid, rc);
+		free(buffer);
 		goto exit;
 	}
 	
-	/* Check for sparse file */
-	if (fblock == 0) {
-		if ((ext4_superblock_has_feature_incompatible(fs->superblock,
-		    EXT4_FEATURE_INCOMPAT_EXTENTS)) &&
-		    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
-			uint32_t last_iblock =
-			    ext4_inode_get_size(fs->superblock, inode_ref->inode) /
-			    block_size;
+	/*
+	 * Newly allocated blocks and blocks past the old end of file are not
+	 * read from the device, the parts which are not written are zeroed
+	 * instead.
+	 */
+	uint64_t old_size = ext4_inode_get_size(fs->superblock,
+	    inode_ref->inode);
+	aoff64_t fresh_iblock = (old_size + block_size - 1) / block_size;
+	
+	/* Blocks allocated by the last allocation */
+	aoff64_t alloc_first = 0;
+	aoff64_t alloc_end = 0;
+	
+	size_t done = 0;
+	while (done < len) {
+		aoff64_t iblock = (pos + done) / block_size;
+		uint32_t offset = (pos + done) % block_size;
+		uint32_t blocks = (offset + len - done + block_size - 1) /
+		    block_size;
+		
+		uint32_t fblock;
+		uint32_t count;
+		rc = ext4_filesystem_get_inode_data_block_range(inode_ref, iblock,
+		    blocks, &fblock, &count);
+		if (rc != EOK)
+			break;
+		
+		/* Check for sparse file, fill only the hole */
+		if (fblock == 0) {
+			rc = ext4_write_alloc_run(inode_ref, iblock, count,
+			    &fblock, &count);
+			if (rc != EOK)
+				break;
 			
-			while (last_iblock < iblock) {
-				rc = ext4_extent_append_block(inode_ref, &last_iblock,
-				    &fblock, true);
-				if (rc != EOK) {
-					async_answer_0(callid, rc);
-					goto exit;
-				}
+			alloc_first = iblock;
+			alloc_end = iblock + count;
+		}
+		
+		size_t run = min((size_t) count * block_size - offset,
+		    len - done);
+		
+		/* Large runs of whole blocks are written past the cache */
+		uint32_t whole = (offset == 0) ? run / block_size : 0;
+		if ((whole > 0) && (ext4_direct_possible(fs, fblock, whole))) {
+			rc = ext4_direct_transfer(fs, fblock, whole, buffer + done,
+			    true);
+			if (rc == EOK) {
+				rc = ext4_direct_update_cache(fs, fblock, whole,
+				    buffer + done);
 			}
+			if (rc != EOK)
+				break;
 			
-			rc = ext4_extent_append_block(inode_ref, &last_iblock,
-			    &fblock, false);
-			if (rc != EOK) {
-				async_answer_0(callid, rc);
-				goto exit;
-			}
-		} else {
-			rc = ext4_balloc_alloc_block(inode_ref, &fblock);
-			if (rc != EOK) {
-				async_answer_0(callid, rc);
-				goto exit;
-			}
+			done += (size_t) whole * block_size;
+			continue;
+		}
+		
+		/* Write the run block by block through the cache */
+		size_t end = done + run;
+		while (done < end) {
+			size_t chunk = min(block_size - offset, end - done);
+			bool fresh = (iblock >= fresh_iblock) ||
+			    ((iblock >= alloc_first) && (iblock < alloc_end));
 			
-			rc = ext4_filesystem_set_inode_data_block_index(inode_ref,
-			    iblock, fblock);
-			if (rc != EOK) {
-				ext4_balloc_free_block(inode_ref, fblock);
-				async_answer_0(callid, rc);
-				goto exit;
-			}
+			int flags = BLOCK_FLAGS_NONE;
+			if ((chunk == block_size) || (fresh))
+				flags = BLOCK_FLAGS_NOREAD;
+			
+			block_t *block;
+			rc = block_get(&block, service_id, fblock, flags);
+			if (rc != EOK)
+				break;
+			
+			if ((chunk != block_size) && (fresh))
+				memset(block->data, 0, block_size);
+			
+			memcpy(block->data + offset, buffer + done, chunk);
+			block->dirty = true;
+			
+			rc = block_put(block);
+			if (rc != EOK)
+				break;
+			
+			done += chunk;
+			offset = 0;
+			iblock++;
+			fblock++;
 		}
 		
-		flags = BLOCK_FLAGS_NOREAD;
-		inode_ref->dirty = true;
+		if (rc != EOK)
+			break;
 	}
 	
-	/* Load target block */
-	block_t *write_block;
-	rc = block_get(&write_block, service_id, fblock, flags);
-	if (rc != EOK) {
-		async_answer_0(callid, rc);
-		goto exit;
-	}
+	free(buffer);
 	
-	if (flags == BLOCK_FLAGS_NOREAD)
-		memset(write_block->data, 0, block_size);
-
-	rc = async_data_write_finalize(callid, write_block->data +
-	    (pos % block_size), bytes);
-	if (rc != EOK) {
-		block_put(write_block);
-		goto exit;
-	}
-
-	write_block->dirty = true;
-
-	rc = block_put(write_block);
-	if (rc != EOK)
-		goto exit;
-
 	/* Do some counting */
-	uint32_t old_inode_size = ext4_inode_get_size(fs->superblock,
-	    inode_ref->inode);
-	if (pos + bytes > old_inode_size) {
-		ext4_inode_set_size(inode_ref->inode, pos + bytes);
+	uint64_t new_size = max(old_size, pos + done);
+	if (ext4_inode_get_size(fs->superblock, inode_ref->inode) != new_size) {
+		ext4_inode_set_size(inode_ref->inode, new_size);
 		inode_ref->dirty = true;
 	}
-
-	*nsize = ext4_inode_get_size(fs->superblock, inode_ref->inode);
-	*wbytes = bytes;
-
+	
+	/* Report the data written before an error as a short write */
+	if (done > 0)
+		rc = EOK;
+	
+	*nsize = new_size;
+	*wbytes = done;
+	
 exit:
 	;
-
+	
 	errno_t const rc2 = ext4_node_put(fn);
 	return rc == EOK ? rc2 : rc;
 }
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <mem.h>
+#include <pcut/pcut.h>
+#include "ext4/extent.h"
+#include "ext4/filesystem.h"
+#include "ext4/inode.h"
+#include "ext4/superblock.h"
+#include "ext4/types.h"
+
+PCUT_INIT
+
+PCUT_TEST_SUITE(filesystem);
+
+enum {
+	/** Block size of the test file system (1 KiB) */
+	test_block_size = 1024,
+	/** Physical block of the first block of the test file */
+	test_start = 1000,
+	/** Number of blocks of a write request */
+	test_request = 64
+};
+
+/** Pretended file system with one i-node using an in-inode extent tree */
+typedef struct {
+	ext4_superblock_t sb;
+	ext4_filesystem_t fs;
+	ext4_inode_t inode;
+	ext4_inode_ref_t inode_ref;
+} test_fs_t;
+
+/** Set up a file of the given size mapped by a single extent.
+ *
+ * @param tfs  Pretended file system
+ * @param size Size of the file in bytes
+ */
+static void test_fs_init(test_fs_t *tfs, uint64_t size)
+{
+	memset(tfs, 0, sizeof(*tfs));
+	
+	ext4_superblock_set_log_block_size(&tfs->sb, 0);
+	ext4_superblock_set_features_incompatible(&tfs->sb,
+	    EXT4_FEATURE_INCOMPAT_EXTENTS);
+	
+	tfs->fs.superblock = &tfs->sb;
+	tfs->inode_ref.fs = &tfs->fs;
+	tfs->inode_ref.inode = &tfs->inode;
+	
+	ext4_inode_set_flag(&tfs->inode, EXT4_INODE_FLAG_EXTENTS);
+	ext4_inode_set_size(&tfs->inode, size);
+	
+	ext4_extent_header_t *header = ext4_inode_get_extent_header(&tfs->inode);
+	ext4_extent_header_set_magic(header, EXT4_EXTENT_MAGIC);
+	ext4_extent_header_set_max_entries_count(header, 4);
+	ext4_extent_header_set_depth(header, 0);
+	
+	uint32_t blocks = (size + test_block_size - 1) / test_block_size;
+	if (blocks == 0)
+		return;
+	
+	ext4_extent_header_set_entries_count(header, 1);
+	
+	ext4_extent_t *extent = EXT4_EXTENT_FIRST(header);
+	ext4_extent_set_first_block(extent, 0);
+	ext4_extent_set_block_count(extent, blocks);
+	ext4_extent_set_start(extent, test_start);
+}
+
+/** Blocks inside of the file are reported as one mapped run */
+PCUT_TEST(range_mapped)
+{
+	test_fs_t tfs;
+	uint32_t fblock;
+	uint32_t count;
+	
+	test_fs_init(&tfs, 8 * test_block_size);
+	
+	errno_t rc = ext4_filesystem_get_inode_data_block_range(&tfs.inode_ref,
+	    2, test_request, &fblock, &count);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(test_start + 2, fblock);
+	PCUT_ASSERT_INT_EQUALS(6, count);
+}
+
+/** The run is limited by the number of requested blocks */
+PCUT_TEST(range_limited)
+{
+	test_fs_t tfs;
+	uint32_t fblock;
+	uint32_t count;
+	
+	test_fs_init(&tfs, 8 * test_block_size);
+	
+	errno_t rc = ext4_filesystem_get_inode_data_block_range(&tfs.inode_ref,
+	    1, 3, &fblock, &count);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(test_start + 1, fblock);
+	PCUT_ASSERT_INT_EQUALS(3, count);
+}
+
+/** An append to a non-empty file is one hole covering the whole request
+ *
+ * The write path allocates each hole it is given in one go, so the append
+ * needs a single allocation instead of one per block.
+ */
+PCUT_TEST(range_append)
+{
+	test_fs_t tfs;
+	uint32_t fblock;
+	uint32_t count;
+	
+	test_fs_init(&tfs, 8 * test_block_size);
+	
+	errno_t rc = ext4_filesystem_get_inode_data_block_range(&tfs.inode_ref,
+	    8, test_request, &fblock, &count);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(0, fblock);
+	PCUT_ASSERT_INT_EQUALS(test_request, count);
+}
+
+/** An append to a file ending inside of a block continues past its end */
+PCUT_TEST(range_append_unaligned)
+{
+	test_fs_t tfs;
+	uint32_t fblock;
+	uint32_t count;
+	
+	test_fs_init(&tfs, 8 * test_block_size - 100);
+	
+	/* The last block is mapped and written in place */
+	errno_t rc = ext4_filesystem_get_inode_data_block_range(&tfs.inode_ref,
+	    7, test_request, &fblock, &count);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(test_start + 7, fblock);
+	PCUT_ASSERT_INT_EQUALS(1, count);
+	
+	/* The rest of the request is one hole */
+	rc = ext4_filesystem_get_inode_data_block_range(&tfs.inode_ref,
+	    8, test_request - 1, &fblock, &count);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(0, fblock);
+	PCUT_ASSERT_INT_EQUALS(test_request - 1, count);
+}
+
+/** A write past the end of a file is one hole */
+PCUT_TEST(range_past_end)
+{
+	test_fs_t tfs;
+	uint32_t fblock;
+	uint32_t count;
+	
+	test_fs_init(&tfs, 8 * test_block_size);
+	
+	errno_t rc = ext4_filesystem_get_inode_data_block_range(&tfs.inode_ref,
+	    100, test_request, &fblock, &count);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(0, fblock);
+	PCUT_ASSERT_INT_EQUALS(test_request, count);
+}
+
+/** A write to an empty file is one hole */
+PCUT_TEST(range_empty)
+{
+	test_fs_t tfs;
+	uint32_t fblock;
+	uint32_t count;
+	
+	test_fs_init(&tfs, 0);
+	
+	errno_t rc = ext4_filesystem_get_inode_data_block_range(&tfs.inode_ref,
+	    0, test_request, &fblock, &count);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(0, fblock);
+	PCUT_ASSERT_INT_EQUALS(test_request, count);
+}
+
+PCUT_EXPORT(filesystem);
@@ -42,6 +42,9 @@
 #define TMPFS_NODE(node)	((node) ? (tmpfs_node_t *)(node)->data : NULL)
 #define FS_NODE(node)		((node) ? (node)->bp : NULL)
 
+/** Size of a file content page. */
+#define TMPFS_PAGE_SIZE		4096
+
 typedef enum {
 	TMPFS_NONE,
 	TMPFS_FILE,
@@ -65,7 +68,12 @@ typedef struct tmpfs_node {
 	tmpfs_dentry_type_t type;
 	unsigned lnkcnt;	/**< Link count. */
 	size_t size;		/**< File size if type is TMPFS_FILE. */
-	void *data;		/**< File content's if type is TMPFS_FILE. */
+	/**
+	 * File content's pages if type is TMPFS_FILE. Holes in the file
+	 * are represented by NULL pages.
+	 */
+	void **pages;
+	size_t pages_count;	/**< Number of slots in pages. */
 	list_t cs_list;		/**< Child's siblings list. */
 } tmpfs_node_t;
 
@@ -73,6 +81,7 @@ extern vfs_out_ops_t tmpfs_ops;
 extern libfs_ops_t tmpfs_libfs_ops;
 
 extern bool tmpfs_init(void);
+extern void *tmpfs_page_get(tmpfs_node_t *, aoff64_t, bool);
 extern bool tmpfs_restore(service_id_t);
 
 #endif
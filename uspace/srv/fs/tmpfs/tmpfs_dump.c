@@ -39,6 +39,7 @@
 #include "tmpfs.h"
 #include "../../vfs/vfs.h"
 #include <errno.h>
+#include <macros.h>
 #include <stdlib.h>
 #include <str.h>
 #include <stddef.h>
@@ -113,14 +114,17 @@ tmpfs_restore_recursion(service_id_t dsid, size_t *bufpos, size_t *buflen,
 			size = uint32_t_le2host(size);
 			
 			nodep = TMPFS_NODE(fn);
-			nodep->data = malloc(size);
-			if (nodep->data == NULL)
-				return false;
-			
 			nodep->size = size;
-			if (block_seqread(dsid, tmpfs_buf, bufpos, buflen, pos, nodep->data,
-			    size) != EOK)
-				return false;
+			
+			for (size_t off = 0; off < size; off += TMPFS_PAGE_SIZE) {
+				void *page = tmpfs_page_get(nodep, off, true);
+				if (page == NULL)
+					return false;
+				
+				if (block_seqread(dsid, tmpfs_buf, bufpos, buflen,
+				    pos, page, min(size - off, TMPFS_PAGE_SIZE)) != EOK)
+					return false;
+			}
 			
 			break;
 		case TMPFS_DIRECTORY:
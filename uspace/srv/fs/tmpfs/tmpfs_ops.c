@@ -53,6 +53,9 @@
 #include <as.h>
 #include <libfs.h>
 
+/** Page of zeroes used for reading file holes. */
+static const uint8_t tmpfs_zero_page[TMPFS_PAGE_SIZE];
+
 /** All root nodes have index 0. */
 #define TMPFS_SOME_ROOT		0
 /** Global counter for assigning node indices. Shared by all instances. */
@@ -166,6 +169,86 @@ static bool nodes_key_equal(void *key_arg, const ht_link_t *item)
 	return key->service_id == node->service_id && key->index == node->index;
 }
 
+/** Get the content page of a file.
+ *
+ * @param nodep TMPFS file node.
+ * @param pos   Position within the file.
+ * @param alloc Allocate a zeroed page if the position falls into a hole.
+ *
+ * @return Page containing the position or NULL if the position falls into
+ *         a hole and @a alloc is false or if there is not enough memory.
+ *
+ */
+void *tmpfs_page_get(tmpfs_node_t *nodep, aoff64_t pos, bool alloc)
+{
+	aoff64_t idx = pos / TMPFS_PAGE_SIZE;
+	
+	if (idx < nodep->pages_count && nodep->pages[idx] != NULL)
+		return nodep->pages[idx];
+	
+	if (!alloc)
+		return NULL;
+	
+	if (idx >= SIZE_MAX / sizeof(void *))
+		return NULL;
+	
+	if (idx >= nodep->pages_count) {
+		/* Grow the page array geometrically. */
+		size_t count = max(nodep->pages_count * 2, 16);
+		if (count <= idx)
+			count = idx + 1;
+		
+		void **pages = realloc(nodep->pages, count * sizeof(void *));
+		if (pages == NULL)
+			return NULL;
+		
+		for (size_t i = nodep->pages_count; i < count; i++)
+			pages[i] = NULL;
+		
+		nodep->pages = pages;
+		nodep->pages_count = count;
+	}
+	
+	void *page = calloc(1, TMPFS_PAGE_SIZE);
+	if (page == NULL)
+		return NULL;
+	
+	nodep->pages[idx] = page;
+	return page;
+}
+
+/** Release file content beyond the given size.
+ *
+ * Pages past the new end of file are freed and the tail of the last page
+ * is cleared, so that the content beyond the end of file always reads as
+ * zeroes if the file grows again.
+ *
+ * @param nodep TMPFS file node.
+ * @param size  New size of the file.
+ *
+ */
+static void tmpfs_pages_truncate(tmpfs_node_t *nodep, aoff64_t size)
+{
+	aoff64_t first = (size + TMPFS_PAGE_SIZE - 1) / TMPFS_PAGE_SIZE;
+	
+	for (aoff64_t idx = first; idx < nodep->pages_count; idx++) {
+		free(nodep->pages[idx]);
+		nodep->pages[idx] = NULL;
+	}
+	
+	if (first == 0) {
+		free(nodep->pages);
+		nodep->pages = NULL;
+		nodep->pages_count = 0;
+		return;
+	}
+	
+	size_t offset = size % TMPFS_PAGE_SIZE;
+	void *page = tmpfs_page_get(nodep, size, false);
+	if (offset != 0 && page != NULL)
+		memset(page + offset, 0, TMPFS_PAGE_SIZE - offset);
+}
+
 static void nodes_remove_callback(ht_link_t *item)
 {
 	tmpfs_node_t *nodep = hash_table_get_inst(item, tmpfs_node_t, nh_link);
@@ -179,9 +262,9 @@ static void nodes_remove_callback(ht_link_t *item)
 		free(dentryp);
 	}
 
-	if (nodep->data) {
+	if (nodep->pages) {
 		assert(nodep->type == TMPFS_FILE);
-		free(nodep->data);
+		tmpfs_pages_truncate(nodep, 0);
 	}
 	free(nodep->bp);
 	free(nodep);
@@ -204,7 +287,8 @@ static void tmpfs_node_initialize(tmpfs_node_t *nodep)
 	nodep->type = TMPFS_NONE;
 	nodep->lnkcnt = 0;
 	nodep->size = 0;
-	nodep->data = NULL;
+	nodep->pages = NULL;
+	nodep->pages_count = 0;
 	list_initialize(&nodep->cs_list);
 }
 
@@ -492,9 +576,48 @@ static errno_t tmpfs_read(service_id_t service_id, fs_index_t index, aoff64_t po
 
 	size_t bytes;
 	if (nodep->type == TMPFS_FILE) {
-		bytes = min(nodep->size - pos, size);
-		(void) async_data_read_finalize(callid, nodep->data + pos,
-		    bytes);
+		bytes = 0;
+		if (pos < nodep->size)
+			bytes = min(nodep->size - pos, size);
+		
+		size_t offset = pos % TMPFS_PAGE_SIZE;
+		uint8_t *buf = NULL;
+		if (offset + bytes > TMPFS_PAGE_SIZE)
+			buf = malloc(bytes);
+		
+		if (buf == NULL) {
+			/*
+			 * Serve the request straight from the page containing
+			 * the position. Without memory for gathering the
+			 * pages, the client retries for the rest of the data.
+			 */
+			bytes = min(bytes, TMPFS_PAGE_SIZE - offset);
+			
+			const void *page = tmpfs_page_get(nodep, pos, false);
+			if (page == NULL)
+				page = tmpfs_zero_page;
+			
+			(void) async_data_read_finalize(callid, page + offset,
+			    bytes);
+		} else {
+			/* Gather the pages so that one transfer suffices. */
+			for (size_t done = 0; done < bytes; ) {
+				offset = (pos + done) % TMPFS_PAGE_SIZE;
+				size_t chunk = min(bytes - done,
+				    TMPFS_PAGE_SIZE - offset);
+				
+				const void *page = tmpfs_page_get(nodep,
+				    pos + done, false);
+				if (page == NULL)
+					page = tmpfs_zero_page;
+				
+				memcpy(buf + done, page + offset, chunk);
+				done += chunk;
+			}
+			
+			(void) async_data_read_finalize(callid, buf, bytes);
+			free(buf);
+		}
 	} else {
 		tmpfs_dentry_t *dentryp;
 		link_t *lnk;
@@ -553,34 +676,61 @@ tmpfs_write(service_id_t service_id, fs_index_t index, aoff64_t pos,
 		return EINVAL;
 	}
 
-	/*
-	 * Check whether the file needs to grow.
-	 */
-	if (pos + size <= nodep->size) {
-		/* The file size is not changing. */
-		(void) async_data_write_finalize(callid, nodep->data + pos,
-		    size);
-		goto out;
+	size_t offset = pos % TMPFS_PAGE_SIZE;
+	uint8_t *buf = NULL;
+	if (offset + size > TMPFS_PAGE_SIZE)
+		buf = malloc(size);
+	
+	if (buf == NULL) {
+		/*
+		 * Write straight into the page containing the position,
+		 * allocating it if needed. Without memory for receiving the
+		 * whole request, the client retries for the rest of the data.
+		 */
+		size = min(size, TMPFS_PAGE_SIZE - offset);
+		
+		void *page = tmpfs_page_get(nodep, pos, true);
+		if (page == NULL) {
+			async_answer_0(callid, ENOMEM);
+			size = 0;
+			goto out;
+		}
+		
+		(void) async_data_write_finalize(callid, page + offset, size);
+	} else {
+		/* Receive the whole request and scatter it into the pages. */
+		if (async_data_write_finalize(callid, buf, size) != EOK) {
+			free(buf);
+			size = 0;
+			goto out;
+		}
+		
+		size_t done = 0;
+		while (done < size) {
+			offset = (pos + done) % TMPFS_PAGE_SIZE;
+			size_t chunk = min(size - done, TMPFS_PAGE_SIZE - offset);
+			
+			void *page = tmpfs_page_get(nodep, pos + done, true);
+			if (page == NULL)
+				break;
+			
+			memcpy(page + offset, buf + done, chunk);
+			done += chunk;
+		}
+		
+		free(buf);
+		if (done == 0)
+			return ENOMEM;
+		
+		size = done;
 	}
-	size_t delta = (pos + size) - nodep->size;
+	
 	/*
-	 * At this point, we are deliberately extremely straightforward and
-	 * simply realloc the contents of the file on every write that grows the
-	 * file. In the end, the situation might not be as bad as it may look:
-	 * our heap allocator can save us and just grow the block whenever
-	 * possible.
+	 * Any gap between the current end of file and the position is left
+	 * as a hole.
 	 */
-	void *newdata = realloc(nodep->data, nodep->size + delta);
-	if (!newdata) {
-		async_answer_0(callid, ENOMEM);
-		size = 0;
-		goto out;
-	}
-	/* Clear any newly allocated memory in order to emulate gaps. */
-	memset(newdata + nodep->size, 0, delta);
-	nodep->size += delta;
-	nodep->data = newdata;
-	(void) async_data_write_finalize(callid, nodep->data + pos, size);
+	if (pos + size > nodep->size)
+		nodep->size = pos + size;
 
 out:
 	*wbytes = size;
@@ -611,17 +761,11 @@ static errno_t tmpfs_truncate(service_id_t service_id, fs_index_t index,
 	if (size > SIZE_MAX)
 		return ENOMEM;
 	
-	void *newdata = realloc(nodep->data, size);
-	if (!newdata)
-		return ENOMEM;
-	
-	if (size > nodep->size) {
-		size_t delta = size - nodep->size;
-		memset(newdata + nodep->size, 0, delta);
-	}
+	/* Growing the file just creates a hole at its end. */
+	if (size < nodep->size)
+		tmpfs_pages_truncate(nodep, size);
 	
 	nodep->size = size;
-	nodep->data = newdata;
 	return EOK;
 }
 
@@ -1543,6 +1543,7 @@ int main(int argc, char *argv[])
 	
 	/* Set a handler of incomming connections */
 	async_set_fallback_port_handler(loc_forward, NULL);
+	async_set_connection_stack_size(FIBRIL_SMALL_STK_SIZE);
 	
 	/* Register location service at naming service */
 	rc = service_register(SERVICE_LOC);
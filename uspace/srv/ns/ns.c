@@ -144,6 +144,9 @@ int main(int argc, char **argv)
 	
 	async_set_fallback_port_handler(ns_connection, NULL);
 	
+	/* Naming requests are short and need only a small stack. */
+	async_set_connection_stack_size(FIBRIL_SMALL_STK_SIZE);
+	
 	printf("%s: Accepting connections\n", NAME);
 	async_manager();
 	
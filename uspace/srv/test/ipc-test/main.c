@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2018 HelenOS developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup ipc-test
+ * @{
+ */
+/**
+ * @file
+ * @brief IPC benchmark server.
+ *
+ * The server answers the requests of the tester IPC benchmarks. It does as
+ * little work as possible per request so that the measured cost is dominated
+ * by the IPC mechanism itself. On request, the server starts more threads
+ * with their own IPC managers to show how the throughput scales.
+ */
+
+#include <as.h>
+#include <async.h>
+#include <errno.h>
+#include <fibril_synch.h>
+#include <ipc/ipc_test.h>
+#include <ipc/services.h>
+#include <loc.h>
+#include <macros.h>
+#include <mem.h>
+#include <stdio.h>
+#include <str_error.h>
+#include <task.h>
+#include <thread.h>
+
+#define NAME  "ipc-test"
+
+static service_id_t svc_id;
+
+/** Buffer used for data transfers and shared in to the clients */
+static void *buffer;
+
+/** Session to ourselves used for forwarding */
+static async_sess_t *self_sess;
+static FIBRIL_MUTEX_INITIALIZE(self_sess_lock);
+
+/** Number of threads running an IPC manager */
+static sysarg_t threads = 1;
+static FIBRIL_MUTEX_INITIALIZE(threads_lock);
+
+static void ipc_test_ping_slow(cap_handle_t chandle, ipc_call_t *call)
+{
+	sysarg_t sum = IPC_GET_ARG1(*call) + IPC_GET_ARG2(*call) +
+	    IPC_GET_ARG3(*call) + IPC_GET_ARG4(*call) + IPC_GET_ARG5(*call);
+	
+	async_answer_1(chandle, EOK, sum);
+}
+
+static void ipc_test_data_write(cap_handle_t chandle, ipc_call_t *call)
+{
+	cap_handle_t wchandle;
+	size_t size;
+	
+	if (!async_data_write_receive(&wchandle, &size)) {
+		async_answer_0(wchandle, EREFUSED);
+		async_answer_0(chandle, EREFUSED);
+		return;
+	}
+	
+	if (size > IPC_TEST_BUF_SIZE) {
+		async_answer_0(wchandle, ELIMIT);
+		async_answer_0(chandle, ELIMIT);
+		return;
+	}
+	
+	errno_t rc = async_data_write_finalize(wchandle, buffer, size);
+	async_answer_0(chandle, rc);
+}
+
+static void ipc_test_data_read(cap_handle_t chandle, ipc_call_t *call)
+{
+	cap_handle_t rchandle;
+	size_t size;
+	
+	if (!async_data_read_receive(&rchandle, &size)) {
+		async_answer_0(rchandle, EREFUSED);
+		async_answer_0(chandle, EREFUSED);
+		return;
+	}
+	
+	if (size > IPC_TEST_BUF_SIZE) {
+		async_answer_0(rchandle, ELIMIT);
+		async_answer_0(chandle, ELIMIT);
+		return;
+	}
+	
+	errno_t rc = async_data_read_finalize(rchandle, buffer, size);
+	async_answer_0(chandle, rc);
+}
+
+static void ipc_test_share_in(cap_handle_t chandle, ipc_call_t *call)
+{
+	cap_handle_t schandle;
+	size_t size;
+	
+	if (!async_share_in_receive(&schandle, &size)) {
+		async_answer_0(schandle, EREFUSED);
+		async_answer_0(chandle, EREFUSED);
+		return;
+	}
+	
+	/* The whole area must be shared. */
+	if (size != IPC_TEST_BUF_SIZE) {
+		async_answer_0(schandle, ELIMIT);
+		async_answer_0(chandle, ELIMIT);
+		return;
+	}
+	
+	errno_t rc = async_share_in_finalize(schandle, buffer,
+	    AS_AREA_READ | AS_AREA_CACHEABLE);
+	async_answer_0(chandle, rc);
+}
+
+static void ipc_test_share_out(cap_handle_t chandle, ipc_call_t *call)
+{
+	cap_handle_t schandle;
+	size_t size;
+	unsigned int flags;
+	void *dst;
+	
+	if (!async_share_out_receive(&schandle, &size, &flags)) {
+		async_answer_0(schandle, EREFUSED);
+		async_answer_0(chandle, EREFUSED);
+		return;
+	}
+	
+	errno_t rc = async_share_out_finalize(schandle, &dst);
+	if (rc == EOK)
+		(void) as_area_destroy(dst);
+	
+	async_answer_0(chandle, rc);
+}
+
+static void ipc_test_forward(cap_handle_t chandle, ipc_call_t *call)
+{
+	sysarg_t hops = IPC_GET_ARG1(*call);
+	
+	if (hops == 0) {
+		async_answer_0(chandle, EOK);
+		return;
+	}
+	
+	fibril_mutex_lock(&self_sess_lock);
+	if (self_sess == NULL)
+		self_sess = loc_service_connect(svc_id, INTERFACE_IPC_TEST, 0);
+	fibril_mutex_unlock(&self_sess_lock);
+	
+	if (self_sess == NULL) {
+		async_answer_0(chandle, ENOMEM);
+		return;
+	}
+	
+	async_exch_t *exch = async_exchange_begin(self_sess);
+	errno_t rc = async_forward_fast(chandle, exch, IPC_TEST_FORWARD,
+	    hops - 1, 0, IPC_FF_NONE);
+	async_exchange_end(exch);
+	
+	if (rc != EOK)
+		async_answer_0(chandle, rc);
+}
+
+/** Thread which only serves the incoming calls */
+static void ipc_test_manager_thread(void *arg)
+{
+	async_manager();
+}
+
+static void ipc_test_set_threads(cap_handle_t chandle, ipc_call_t *call)
+{
+	sysarg_t count = min(IPC_GET_ARG1(*call), IPC_TEST_MAX_THREADS);
+	errno_t rc = EOK;
+	
+	fibril_mutex_lock(&threads_lock);
+	
+	while (threads < count) {
+		rc = thread_create(ipc_test_manager_thread, NULL,
+		    "ipc-test-manager", NULL);
+		if (rc != EOK)
+			break;
+		
+		threads++;
+	}
+	
+	sysarg_t running = threads;
+	fibril_mutex_unlock(&threads_lock);
+	
+	async_answer_1(chandle, rc, running);
+}
+
+static void ipc_test_connection(cap_handle_t iid, ipc_call_t *icall, void *arg)
+{
+	/* Accept connection */
+	async_answer_0(iid, EOK);
+	
+	while (true) {
+		ipc_call_t call;
+		cap_handle_t chandle = async_get_call(&call);
+		
+		if (!IPC_GET_IMETHOD(call)) {
+			async_answer_0(chandle, EOK);
+			break;
+		}
+		
+		switch (IPC_GET_IMETHOD(call)) {
+		case IPC_TEST_PING:
+			async_answer_0(chandle, EOK);
+			break;
+		case IPC_TEST_PING_SLOW:
+			ipc_test_ping_slow(chandle, &call);
+			break;
+		case IPC_TEST_DATA_WRITE:
+			ipc_test_data_write(chandle, &call);
+			break;
+		case IPC_TEST_DATA_READ:
+			ipc_test_data_read(chandle, &call);
+			break;
+		case IPC_TEST_SHARE_IN:
+			ipc_test_share_in(chandle, &call);
+			break;
+		case IPC_TEST_SHARE_OUT:
+			ipc_test_share_out(chandle, &call);
+			break;
+		case IPC_TEST_FORWARD:
+			ipc_test_forward(chandle, &call);
+			break;
+		case IPC_TEST_SET_THREADS:
+			ipc_test_set_threads(chandle, &call);
+			break;
+		default:
+			async_answer_0(chandle, ENOTSUP);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	errno_t rc;
+	
+	printf("%s: IPC benchmark service\n", NAME);
+	
+	buffer = as_area_create(AS_AREA_ANY, IPC_TEST_BUF_SIZE,
+	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE, AS_AREA_UNPAGED);
+	if (buffer == AS_MAP_FAILED) {
+		printf("%s: Failed allocating buffer.\n", NAME);
+		return ENOMEM;
+	}
+	
+	memset(buffer, 0, IPC_TEST_BUF_SIZE);
+	async_set_fallback_port_handler(ipc_test_connection, NULL);
+	
+	rc = loc_server_register(NAME);
+	if (rc != EOK) {
+		printf("%s: Failed registering server: %s\n", NAME, str_error(rc));
+		return rc;
+	}
+	
+	rc = loc_service_register(SERVICE_NAME_IPC_TEST, &svc_id);
+	if (rc != EOK) {
+		printf("%s: Failed registering service: %s\n", NAME, str_error(rc));
+		return rc;
+	}
+	
+	printf("%s: Accepting connections\n", NAME);
+	task_retval(0);
+	async_manager();
+	
+	/* Never reached */
+	return 0;
+}
+
+/** @}
+ */
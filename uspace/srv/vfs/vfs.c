@@ -100,6 +100,14 @@ int main(int argc, char **argv)
 		return ENOMEM;
 	}
 	
+	/*
+	 * Initialize the pager page cache.
+	 */
+	if (!vfs_page_cache_init()) {
+		printf("%s: Failed to initialize page cache\n", NAME);
+		return ENOMEM;
+	}
+	
 	/*
 	 * Allocate and initialize the Path Lookup Buffer.
 	 */
@@ -132,6 +140,12 @@ int main(int argc, char **argv)
 	 */
 	async_set_fallback_port_handler(vfs_connection, NULL);
 
+	/*
+	 * Client requests have shallow call chains, so the connection
+	 * fibrils can use the small recycled stacks.
+	 */
+	async_set_connection_stack_size(FIBRIL_SMALL_STK_SIZE);
+
 	/*
 	 * Subscribe to notifications.
 	 */
@@ -79,6 +79,8 @@ static size_t shared_path(char *a, char *b)
 /* This call destroys the file if and only if there are no hard links left. */
 static void out_destroy(vfs_triplet_t *file)
 {
+	vfs_page_cache_invalidate(file, 0, UINT64_MAX);
+	
 	async_exch_t *exch = vfs_exchange_grab(file->fs_handle);
 	async_msg_2(exch, VFS_OUT_DESTROY, (sysarg_t) file->service_id,
 	    (sysarg_t) file->index);
@@ -481,6 +483,18 @@ static errno_t vfs_rdwr(int fd, aoff64_t pos, bool read, rdwr_ipc_cb_t ipc_cb,
 	if (file->node->type == VFS_NODE_DIRECTORY)
 		fibril_rwlock_read_unlock(&namespace_rwlock);
 	
+	/* Drop pager pages made stale by the write. */
+	if (!read && rc == EOK) {
+		vfs_triplet_t triplet = {
+			.fs_handle = file->node->fs_handle,
+			.service_id = file->node->service_id,
+			.index = file->node->index
+		};
+		
+		vfs_page_cache_invalidate(&triplet, pos,
+		    pos + IPC_GET_ARG1(answer));
+	}
+	
 	/* Unlock the VFS node. */
 	if (rlock) {
 		fibril_rwlock_read_unlock(&file->node->contents_rwlock);
@@ -598,10 +612,13 @@ errno_t vfs_op_rename(int basefd, char *old, char *new)
 	/* If the node is not held by anyone, try to destroy it. */
 	if (orig_unlinked) {
 		vfs_node_t *node = vfs_node_peek(&new_lr_orig);
-		if (!node)
+		if (!node) {
 			out_destroy(&new_lr_orig.triplet);
-		else
+		} else {
+			vfs_page_cache_invalidate(&new_lr_orig.triplet, 0,
+			    UINT64_MAX);
 			vfs_node_put(node);
+		}
 	}
 	
 	vfs_node_put(base);
@@ -619,8 +636,17 @@ errno_t vfs_op_resize(int fd, int64_t size)
 	
 	errno_t rc = vfs_truncate_internal(file->node->fs_handle,
 	    file->node->service_id, file->node->index, size);
-	if (rc == EOK)
+	if (rc == EOK) {
+		vfs_triplet_t triplet = {
+			.fs_handle = file->node->fs_handle,
+			.service_id = file->node->service_id,
+			.index = file->node->index
+		};
+		
+		/* The page containing the new end of file changes as well. */
+		vfs_page_cache_invalidate(&triplet, size, UINT64_MAX);
 		file->node->size = size;
+	}
 	
 	fibril_rwlock_write_unlock(&file->node->contents_rwlock);
 	vfs_file_put(file);
@@ -759,12 +785,18 @@ errno_t vfs_op_unlink(int parentfd, int expectfd, char *path)
 	if (rc != EOK)
 		goto exit;
 
-	/* If the node is not held by anyone, try to destroy it. */
+	/*
+	 * If the node is not held by anyone, try to destroy it. Otherwise
+	 * just drop its cached pages, the file system may reuse the index
+	 * once the node is released.
+	 */
 	vfs_node_t *node = vfs_node_peek(&lr);
-	if (!node)
+	if (!node) {
 		out_destroy(&lr.triplet);
-	else
+	} else {
+		vfs_page_cache_invalidate(&lr.triplet, 0, UINT64_MAX);
 		vfs_node_put(node);
+	}
 
 exit:
 	if (path)
@@ -815,6 +847,8 @@ errno_t vfs_op_unmount(int mpfd)
 		return rc;
 	}
 	
+	vfs_page_cache_invalidate_fs(mp->node->mount->fs_handle,
+	    mp->node->mount->service_id);
 	vfs_node_forget(mp->node->mount);
 	vfs_node_put(mp->node);
 	mp->node->mount = NULL;
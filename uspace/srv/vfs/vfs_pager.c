@@ -40,29 +40,264 @@
 #include <fibril_synch.h>
 #include <errno.h>
 #include <as.h>
+#include <assert.h>
+#include <macros.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <adt/hash.h>
+#include <adt/hash_table.h>
+#include <adt/list.h>
 
-void vfs_page_in(ipc_callid_t rid, ipc_call_t *request)
-{
-	aoff64_t offset = IPC_GET_ARG1(*request);
-	size_t page_size = IPC_GET_ARG2(*request);
-	int fd = IPC_GET_ARG3(*request);
+/** Maximum number of pages kept in the page cache. */
+#define PAGE_CACHE_MAX_PAGES	256
+
+/** Page cache key. */
+typedef struct {
+	VFS_TRIPLET;
+	aoff64_t offset;
+	size_t size;
+} page_key_t;
+
+/** Page cache entry.
+ *
+ * The page is kept alive in the VFS address space. The kernel maps the very
+ * same frame into all clients that fault on it, so repeated faults on the
+ * same file page are served without touching the file system.
+ *
+ */
+typedef struct {
+	/** Link in the page cache hash table. */
+	ht_link_t link;
+	/** Link in the LRU list. */
+	link_t lru_link;
+	
+	page_key_t key;
 	void *page;
-	errno_t rc;
+} cached_page_t;
 
-	page = as_area_create(AS_AREA_ANY, page_size,
-	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE,
-	    AS_AREA_UNPAGED);
+/** Mutex protecting the page cache. */
+static FIBRIL_MUTEX_INITIALIZE(page_cache_lock);
 
-	if (page == AS_MAP_FAILED) {
-		async_answer_0(rid, ENOMEM);
-		return;
+/** Page cache hash table. */
+static hash_table_t page_cache;
+
+/** Cached pages, least recently used first. */
+static LIST_INITIALIZE(page_cache_lru);
+
+/** Number of cached pages. */
+static size_t page_cache_count = 0;
+
+/** Page cache generation.
+ *
+ * Incremented by every invalidation. A page filled while an invalidation
+ * took place might contain stale data and must not be cached.
+ *
+ */
+static uint64_t page_cache_gen = 0;
+
+static size_t page_key_hash(void *key)
+{
+	page_key_t *pkey = key;
+	size_t hash = hash_combine(pkey->fs_handle, pkey->service_id);
+	hash = hash_combine(hash, pkey->index);
+	hash = hash_combine(hash, LOWER32(pkey->offset));
+	return hash_combine(hash, UPPER32(pkey->offset));
+}
+
+static size_t page_hash(const ht_link_t *item)
+{
+	cached_page_t *cpage = hash_table_get_inst(item, cached_page_t, link);
+	return page_key_hash(&cpage->key);
+}
+
+static bool page_key_equal(void *key, const ht_link_t *item)
+{
+	page_key_t *pkey = key;
+	cached_page_t *cpage = hash_table_get_inst(item, cached_page_t, link);
+	
+	return (cpage->key.fs_handle == pkey->fs_handle) &&
+	    (cpage->key.service_id == pkey->service_id) &&
+	    (cpage->key.index == pkey->index) &&
+	    (cpage->key.offset == pkey->offset) &&
+	    (cpage->key.size == pkey->size);
+}
+
+/** Page cache hash table operations. */
+static hash_table_ops_t page_cache_ops = {
+	.hash = page_hash,
+	.key_hash = page_key_hash,
+	.key_equal = page_key_equal,
+	.equal = NULL,
+	.remove_callback = NULL
+};
+
+/** Initialize the page cache.
+ *
+ * @return True on success, false on failure.
+ *
+ */
+bool vfs_page_cache_init(void)
+{
+	return hash_table_create(&page_cache, 0, 0, &page_cache_ops);
+}
+
+/** Remove a page from the page cache and release it.
+ *
+ * The page cache lock must be held.
+ *
+ */
+static void page_cache_remove(cached_page_t *cpage)
+{
+	assert(fibril_mutex_is_locked(&page_cache_lock));
+	
+	hash_table_remove_item(&page_cache, &cpage->link);
+	list_remove(&cpage->lru_link);
+	page_cache_count--;
+	
+	as_area_destroy(cpage->page);
+	free(cpage);
+}
+
+/** Insert a freshly filled page into the page cache.
+ *
+ * The least recently used pages are evicted if the cache is full. Clients
+ * which already have the evicted frames mapped keep them.
+ *
+ * The page cache lock must be held.
+ *
+ * @return True if the page has been cached, false otherwise.
+ *
+ */
+static bool page_cache_insert(page_key_t *key, void *page)
+{
+	assert(fibril_mutex_is_locked(&page_cache_lock));
+	
+	cached_page_t *cpage = malloc(sizeof(cached_page_t));
+	if (cpage == NULL)
+		return false;
+	
+	while (page_cache_count >= PAGE_CACHE_MAX_PAGES) {
+		cached_page_t *victim = list_get_instance(
+		    list_first(&page_cache_lru), cached_page_t, lru_link);
+		page_cache_remove(victim);
 	}
+	
+	cpage->key = *key;
+	cpage->page = page;
+	link_initialize(&cpage->lru_link);
+	
+	hash_table_insert(&page_cache, &cpage->link);
+	list_append(&cpage->lru_link, &page_cache_lru);
+	page_cache_count++;
+	
+	return true;
+}
+
+/** Invalidate cached pages of a file.
+ *
+ * All cached pages of the file which overlap the given range are dropped.
+ *
+ * @param triplet File whose pages are to be invalidated.
+ * @param start   Start of the range.
+ * @param end     End of the range (exclusive).
+ *
+ */
+void vfs_page_cache_invalidate(vfs_triplet_t *triplet, aoff64_t start,
+    aoff64_t end)
+{
+	fibril_mutex_lock(&page_cache_lock);
+	
+	page_cache_gen++;
+	
+	list_foreach_safe(page_cache_lru, cur, next) {
+		cached_page_t *cpage = list_get_instance(cur, cached_page_t,
+		    lru_link);
+		
+		if ((cpage->key.fs_handle == triplet->fs_handle) &&
+		    (cpage->key.service_id == triplet->service_id) &&
+		    (cpage->key.index == triplet->index) &&
+		    (cpage->key.offset < end) &&
+		    (cpage->key.offset + cpage->key.size > start))
+			page_cache_remove(cpage);
+	}
+	
+	fibril_mutex_unlock(&page_cache_lock);
+}
+
+/** Invalidate all cached pages of a file system instance.
+ *
+ * @param fs_handle  File system handle.
+ * @param service_id File system instance service ID.
+ *
+ */
+void vfs_page_cache_invalidate_fs(fs_handle_t fs_handle,
+    service_id_t service_id)
+{
+	fibril_mutex_lock(&page_cache_lock);
+	
+	page_cache_gen++;
+	
+	list_foreach_safe(page_cache_lru, cur, next) {
+		cached_page_t *cpage = list_get_instance(cur, cached_page_t,
+		    lru_link);
+		
+		if ((cpage->key.fs_handle == fs_handle) &&
+		    (cpage->key.service_id == service_id))
+			page_cache_remove(cpage);
+	}
+	
+	fibril_mutex_unlock(&page_cache_lock);
+}
 
+/** Get the page cache key for a page of an open file.
+ *
+ * @param fd     File descriptor.
+ * @param offset Offset of the page within the file.
+ * @param size   Size of the page.
+ * @param key    Place to store the key.
+ *
+ * @return EOK if the page can be cached, EBADF if the file descriptor
+ *         is invalid, EINVAL if the file is not open for reading and
+ *         ENOTSUP if the node is not a regular file.
+ *
+ */
+static errno_t page_key_get(int fd, aoff64_t offset, size_t size,
+    page_key_t *key)
+{
+	vfs_file_t *file = vfs_file_get(fd);
+	if (file == NULL)
+		return EBADF;
+	
+	errno_t rc = EOK;
+	if (!file->open_read) {
+		rc = EINVAL;
+	} else if (file->node->type != VFS_NODE_FILE) {
+		rc = ENOTSUP;
+	} else {
+		key->fs_handle = file->node->fs_handle;
+		key->service_id = file->node->service_id;
+		key->index = file->node->index;
+		key->offset = offset;
+		key->size = size;
+	}
+	
+	vfs_file_put(file);
+	return rc;
+}
+
+/** Fill a page with file data.
+ *
+ * The part of the page beyond the end of the file is left zeroed.
+ *
+ */
+static errno_t page_fill(int fd, aoff64_t offset, void *page, size_t page_size)
+{
 	rdwr_io_chunk_t chunk = {
 		.buffer = page,
 		.size = page_size
 	};
-
+	
+	errno_t rc;
 	size_t total = 0;
 	aoff64_t pos = offset;
 	do {
@@ -76,15 +311,85 @@ void vfs_page_in(ipc_callid_t rid, ipc_call_t *request)
 		chunk.buffer += chunk.size;
 		chunk.size = page_size - total;
 	} while (total < page_size);
+	
+	return rc;
+}
 
+void vfs_page_in(ipc_callid_t rid, ipc_call_t *request)
+{
+	aoff64_t offset = IPC_GET_ARG1(*request);
+	size_t page_size = IPC_GET_ARG2(*request);
+	int fd = IPC_GET_ARG3(*request);
+	page_key_t key;
+	void *page;
+	errno_t rc;
+	
+	rc = page_key_get(fd, offset, page_size, &key);
+	if ((rc != EOK) && (rc != ENOTSUP)) {
+		async_answer_0(rid, rc);
+		return;
+	}
+	
+	bool cacheable = (rc == EOK);
+	uint64_t gen = 0;
+	
+	if (cacheable) {
+		fibril_mutex_lock(&page_cache_lock);
+		
+		ht_link_t *link = hash_table_find(&page_cache, &key);
+		if (link != NULL) {
+			cached_page_t *cpage = hash_table_get_inst(link,
+			    cached_page_t, link);
+			list_remove(&cpage->lru_link);
+			list_append(&cpage->lru_link, &page_cache_lru);
+			
+			/*
+			 * The kernel takes its own reference to the frame
+			 * while processing the answer, so the page may be
+			 * evicted any time after this.
+			 */
+			async_answer_1(rid, EOK, (sysarg_t) cpage->page);
+			fibril_mutex_unlock(&page_cache_lock);
+			return;
+		}
+		
+		gen = page_cache_gen;
+		fibril_mutex_unlock(&page_cache_lock);
+	}
+	
+	page = as_area_create(AS_AREA_ANY, page_size,
+	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE,
+	    AS_AREA_UNPAGED);
+	
+	if (page == AS_MAP_FAILED) {
+		async_answer_0(rid, ENOMEM);
+		return;
+	}
+	
+	rc = page_fill(fd, offset, page, page_size);
+	
+	if ((rc == EOK) && (cacheable)) {
+		fibril_mutex_lock(&page_cache_lock);
+		
+		/*
+		 * Another fibril might have filled the same page in the
+		 * meantime or the file might have been modified.
+		 */
+		bool cached = false;
+		if ((gen == page_cache_gen) &&
+		    (hash_table_find(&page_cache, &key) == NULL))
+			cached = page_cache_insert(&key, page);
+		
+		async_answer_1(rid, rc, (sysarg_t) page);
+		fibril_mutex_unlock(&page_cache_lock);
+		
+		if (!cached)
+			as_area_destroy(page);
+		
+		return;
+	}
+	
 	async_answer_1(rid, rc, (sysarg_t) page);
-
-	/*
-	 * FIXME: 
-	 * This is just for now until we implement proper page cache
-	 * management.  Not keeping the pages around in a cache results in
-	 * inherently non-coherent private mappings.
-	 */
 	as_area_destroy(page);
 }
 